@@ -0,0 +1,47 @@
+/****************************************************************************************
+ * Copyright (C) 2021 aistream <aistream@yeah.net>
+ *
+ * Licensed under the BSD 3-Clause License (the "License"); you may not use this
+ * file except in compliance with the License. You may obtain a copy of the License at
+ *
+ * https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Unless required by applicable law or agreed to in writing, software distributed
+ * under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+ * CONDITIONS OF ANY KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations under the License.
+ *
+ ***************************************************************************************/
+
+#ifndef __AISTREAM_BUFPOOL_H__
+#define __AISTREAM_BUFPOOL_H__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <memory>
+
+// process-wide pool of buffers, grouped by size class, frames of the same
+// resolution and format always fall into the same class.
+// implemented in aistream, plugins use it by symbols exported with -rdynamic
+
+typedef struct {
+  uint64_t hits;
+  uint64_t misses;
+  // bytes of free buffers kept by pool
+  uint64_t bytes_held;
+  // bytes of buffers in use
+  uint64_t bytes_used;
+  uint64_t bytes_max;
+} BufferPoolStat;
+
+void BufferPoolInit(size_t max_bytes);
+char* BufferGet(size_t size);
+void BufferPut(char* buf);
+// the buffer returns to pool when the last user is gone
+std::shared_ptr<char> BufferAlloc(size_t size);
+void BufferPoolStats(BufferPoolStat* stat);
+
+#endif
+
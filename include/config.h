@@ -54,6 +54,12 @@ class ConfigParams {
   int GetTaskTimeout(void) {
     return task_timeout_sec;
   }
+  int GetExecutorThreads(void) {
+    return executor_threads;
+  }
+  int GetGopCacheMb(void) {
+    return gop_cache_mb;
+  }
   void SetOutput(char *str);
   auto GetOutput(void) {
     return out_params;
@@ -69,6 +75,9 @@ class ConfigParams {
   int slave_rest_port;
   int obj_max;
   int task_timeout_sec;
+  int executor_threads;
+  // per object, 0 means disabled
+  int gop_cache_mb;
   std::shared_ptr<char> out_params;
 };
 
@@ -0,0 +1,78 @@
+/****************************************************************************************
+ * Copyright (C) 2021 aistream <aistream@yeah.net>
+ *
+ * Licensed under the BSD 3-Clause License (the "License"); you may not use this
+ * file except in compliance with the License. You may obtain a copy of the License at
+ *
+ * https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Unless required by applicable law or agreed to in writing, software distributed
+ * under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+ * CONDITIONS OF ANY KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations under the License.
+ *
+ ***************************************************************************************/
+
+#ifndef __AISTREAM_EXECUTOR_H__
+#define __AISTREAM_EXECUTOR_H__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <memory>
+#include <vector>
+#include <deque>
+#include <map>
+#include <chrono>
+#include <functional>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include "tensor.h"
+
+class MediaServer;
+
+// something can be run by executor, such as element thread of task,
+// one unit is never run by two workers at the same time
+class ExecUnit {
+ public:
+  virtual ~ExecUnit(void) {}
+  virtual void Run(void) = 0;
+};
+
+// fixed number of workers, each worker has its own queue of ready units,
+// the idle worker steals units from others
+class Executor {
+ public:
+  Executor(MediaServer* _media);
+  ~Executor(void);
+  void Start(int num);
+  void Submit(std::shared_ptr<ExecUnit> unit);
+  // run cb in the timer thread after delay, it should only wake a unit up
+  void After(std::chrono::steady_clock::duration delay, std::function<void()> cb);
+  size_t GetThreadNum(void) {
+    return workers.size();
+  }
+  MediaServer* media;
+ private:
+  struct alignas(CACHE_LINE_SIZE) Worker {
+    std::mutex mtx;
+    std::deque<std::shared_ptr<ExecUnit>> _queue;
+  };
+  void WorkerFunc(int idx);
+  void TimerFunc(void);
+  std::shared_ptr<ExecUnit> GetUnit(int idx);
+  std::vector<std::unique_ptr<Worker>> workers;
+  std::atomic<size_t> next;
+  std::atomic<int> pending;
+  std::atomic<int> idle;
+  std::mutex mtx;
+  std::condition_variable condition;
+  std::mutex timer_mtx;
+  std::condition_variable timer_cond;
+  std::multimap<std::chrono::steady_clock::time_point, std::function<void()>> timers;
+};
+
+#endif
+
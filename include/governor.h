@@ -0,0 +1,60 @@
+/****************************************************************************************
+ * Copyright (C) 2021 aistream <aistream@yeah.net>
+ *
+ * Licensed under the BSD 3-Clause License (the "License"); you may not use this
+ * file except in compliance with the License. You may obtain a copy of the License at
+ *
+ * https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Unless required by applicable law or agreed to in writing, software distributed
+ * under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+ * CONDITIONS OF ANY KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations under the License.
+ *
+ ***************************************************************************************/
+
+#ifndef __AISTREAM_GOVERNOR_H__
+#define __AISTREAM_GOVERNOR_H__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+
+class MediaServer;
+
+typedef struct {
+  bool enable;
+  int interval_ms;
+  // bounds of streams which do not set their own
+  int min_fps;
+  int max_fps;
+  // overloaded if queue fill or cpu busy is above high_water,
+  // underloaded if both are below low_water
+  double high_water;
+  double low_water;
+} GovernorConfig;
+
+// analysis rate of one stream, fps is changed by the governor between
+// min_fps and max_fps, higher priority is slowed down less and sped up more
+typedef struct {
+  int id;
+  int min_fps;
+  int max_fps;
+  int priority;
+  std::atomic<int> fps;
+} StreamRate;
+
+void GovernorInit(GovernorConfig* config);
+void GovernorStart(MediaServer* media);
+// called by plugins, returns nullptr if the governor is disabled,
+// max_fps and priority <= 0 mean the default
+StreamRate* GovernorRegister(int id, int max_fps, int priority);
+void GovernorUnregister(StreamRate* rate);
+// new max_fps of the stream, for example, config reloaded
+void GovernorSetMax(StreamRate* rate, int max_fps);
+// rates registered by stream id
+void GovernorTraverse(int id, void* arg, int (*cb)(StreamRate* rate, void* arg));
+
+#endif
+
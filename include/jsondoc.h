@@ -0,0 +1,70 @@
+/****************************************************************************************
+ * Copyright (C) 2021 aistream <aistream@yeah.net>
+ *
+ * Licensed under the BSD 3-Clause License (the "License"); you may not use this
+ * file except in compliance with the License. You may obtain a copy of the License at
+ *
+ * https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Unless required by applicable law or agreed to in writing, software distributed
+ * under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+ * CONDITIONS OF ANY KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations under the License.
+ *
+ ***************************************************************************************/
+
+#ifndef __AISTREAM_JSONDOC_H__
+#define __AISTREAM_JSONDOC_H__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <memory>
+
+struct cJSON;
+
+// items are looked up by at most 3 names, the same as GetIntValFromJson,
+// missing int or double is -1, missing string is nullptr
+cJSON* JsonItem(const cJSON* node, const char* name1,
+                const char* name2 = NULL, const char* name3 = NULL);
+int JsonInt(const cJSON* node, const char* name1,
+            const char* name2 = NULL, const char* name3 = NULL);
+double JsonDouble(const cJSON* node, const char* name1,
+                  const char* name2 = NULL, const char* name3 = NULL);
+const char* JsonStr(const cJSON* node, const char* name1,
+                    const char* name2 = NULL, const char* name3 = NULL);
+
+// A json document parsed once and shared read only, never modify the nodes.
+// config files and element params are cached, so they are not parsed again
+class JsonDoc {
+ public:
+  ~JsonDoc(void);
+  // cached by text if cache is set, nullptr if it is not json.
+  // texts of requests are parsed with cache unset, a cached document of the
+  // same text is still used, but the text is not kept after the caller
+  static std::shared_ptr<JsonDoc> Parse(const char* buf, bool cache = true);
+  // cached by path, parsed again when mtime or size of the file changes
+  static std::shared_ptr<JsonDoc> Load(const char* filename);
+  cJSON* Root(void) const {
+    return root;
+  }
+  cJSON* Get(const char* name1, const char* name2 = NULL, const char* name3 = NULL) const {
+    return JsonItem(root, name1, name2, name3);
+  }
+  int GetInt(const char* name1, const char* name2 = NULL, const char* name3 = NULL) const {
+    return JsonInt(root, name1, name2, name3);
+  }
+  double GetDouble(const char* name1, const char* name2 = NULL, const char* name3 = NULL) const {
+    return JsonDouble(root, name1, name2, name3);
+  }
+  // valid as long as the document
+  const char* GetStr(const char* name1, const char* name2 = NULL, const char* name3 = NULL) const {
+    return JsonStr(root, name1, name2, name3);
+  }
+ private:
+  JsonDoc(cJSON* _root);
+  cJSON* root;
+};
+
+#endif
+
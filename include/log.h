@@ -24,6 +24,7 @@
 #include <sys/types.h>
 #include <sys/time.h>
 #include <pthread.h>
+#include <atomic>
 
 #define SERVER_NAME                     "aistream"
 #define DEBUG_STOP                      "aistream.stop"
@@ -37,74 +38,38 @@
 #define APREFIX_GREEN  "\033[0;32m"
 #define APREFIX_YELLOW "\033[1;33m"
 
-#define AppDebug(format, args...) \
-    do { \
-        struct timeval tv; \
-        struct tm _time; \
-        printf(APREFIX_GREEN"debug, %s:%d, %s, "  format APREFIX_NONE"\n", \
-                __filename(__FILE__), __LINE__, __func__, ## args); \
-        gettimeofday(&tv, NULL); \
-        localtime_r(&tv.tv_sec, &_time); \
-        FILE *fp = fopen(DEBUG_LOG_FILE, "a+"); \
-        if(fp != NULL) { \
-            fprintf(fp, "%d-%02d-%02d %02d:%02d:%02d.%03d, debug, %s:%d,%s, " format "\n", \
-                    _time.tm_year + 1900, _time.tm_mon + 1, _time.tm_mday, _time.tm_hour, _time.tm_min, \
-                    _time.tm_sec,(int)tv.tv_usec/1000, __filename(__FILE__), __LINE__, __func__, ##args); \
-            fclose(fp); \
-        } \
-        struct stat f_stat; \
-        if(stat(DEBUG_LOG_FILE, &f_stat) == 0) { \
-            if(f_stat.st_size > LOG_SIZE_MAX) { \
-				rename(DEBUG_LOG_FILE, DEBUG_LOG_BAK_FILE);\
-            } \
-        } \
-    } while(0)
+#define LOG_LEVEL_DEBUG                 0
+#define LOG_LEVEL_WARN                  1
+#define LOG_LEVEL_ERROR                 2
+// at most LOG_SITE_BURST logs of one call site in LOG_SITE_WINDOW_MS,
+// the rest are counted and reported with the next log of the site
+#define LOG_SITE_BURST                  20
+#define LOG_SITE_WINDOW_MS              1000
 
-#define AppWarn(format, args...) \
-    do { \
-        struct timeval tv; \
-        struct tm _time; \
-        printf(APREFIX_YELLOW"warning, %s:%d, %s, "  format APREFIX_NONE"\n", \
-                __filename(__FILE__), __LINE__, __func__, ## args); \
-        gettimeofday(&tv, NULL); \
-        localtime_r(&tv.tv_sec, &_time); \
-        FILE *fp = fopen(DEBUG_LOG_FILE, "a+"); \
-        if(fp != NULL) { \
-            fprintf(fp, "%d-%02d-%02d %02d:%02d:%02d.%03d, warning, pid:%d %s:%d,%s, " format "\n", \
-                    _time.tm_year + 1900, _time.tm_mon + 1, _time.tm_mday, _time.tm_hour, _time.tm_min, \
-                    _time.tm_sec,(int)tv.tv_usec/1000,getpid(), __filename(__FILE__), __LINE__, __func__, ##args); \
-            fclose(fp); \
-        } \
-        struct stat f_stat; \
-        if(stat(DEBUG_LOG_FILE, &f_stat) == 0) { \
-            if(f_stat.st_size > LOG_SIZE_MAX) { \
-				rename(DEBUG_LOG_FILE, DEBUG_LOG_BAK_FILE);\
-            } \
-        } \
-    } while(0)
+// rate limit state of one call site
+typedef struct {
+  std::atomic<int64_t> window;
+  std::atomic<int> count;
+  std::atomic<int> suppressed;
+} LogSite;
+
+// Logs are put to a ring buffer and written by one background thread,
+// the caller never touches the file
+void LogWrite(LogSite* site, int level, const char* file, int line,
+              const char* func, const char* format, ...)
+              __attribute__((format(printf, 6, 7)));
+// write all logs in the ring buffer now
+void LogFlush(void);
 
-#define AppError(format, args...) \
+#define AppLog(level, format, args...) \
     do { \
-        struct timeval tv; \
-        struct tm _time; \
-        printf(APREFIX_RED"error, %s:%d, %s, "  format APREFIX_NONE"\n", \
-                __filename(__FILE__), __LINE__, __func__, ## args); \
-        gettimeofday(&tv, NULL); \
-        localtime_r(&tv.tv_sec, &_time); \
-        FILE *fp = fopen(DEBUG_LOG_FILE, "a+"); \
-        if(fp != NULL) { \
-            fprintf(fp, "%d-%02d-%02d %02d:%02d:%02d.%03d, error, pid:%d %s:%d,%s, " format "\n", \
-                    _time.tm_year + 1900, _time.tm_mon + 1, _time.tm_mday, _time.tm_hour, _time.tm_min, \
-                    _time.tm_sec,(int)tv.tv_usec/1000,getpid(), __filename(__FILE__), __LINE__, __func__, ##args); \
-            fclose(fp); \
-        } \
-        struct stat f_stat; \
-        if(stat(DEBUG_LOG_FILE, &f_stat) == 0) { \
-            if(f_stat.st_size > LOG_SIZE_MAX) { \
-				rename(DEBUG_LOG_FILE, DEBUG_LOG_BAK_FILE);\
-            } \
-        } \
+        static LogSite _log_site; \
+        LogWrite(&_log_site, level, __filename(__FILE__), __LINE__, __func__, format, ## args); \
     } while(0)
 
+#define AppDebug(format, args...) AppLog(LOG_LEVEL_DEBUG, format, ## args)
+#define AppWarn(format, args...) AppLog(LOG_LEVEL_WARN, format, ## args)
+#define AppError(format, args...) AppLog(LOG_LEVEL_ERROR, format, ## args)
+
 #endif
 
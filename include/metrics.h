@@ -0,0 +1,96 @@
+/****************************************************************************************
+ * Copyright (C) 2021 aistream <aistream@yeah.net>
+ *
+ * Licensed under the BSD 3-Clause License (the "License"); you may not use this
+ * file except in compliance with the License. You may obtain a copy of the License at
+ *
+ * https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Unless required by applicable law or agreed to in writing, software distributed
+ * under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+ * CONDITIONS OF ANY KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations under the License.
+ *
+ ***************************************************************************************/
+
+#ifndef __AISTREAM_METRICS_H__
+#define __AISTREAM_METRICS_H__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <atomic>
+#include <map>
+#include <string>
+
+// always on metrics, updates are relaxed atomics and never lock,
+// text in prometheus format is built when /metrics is requested
+
+enum {
+  METRIC_COUNTER = 0,
+  METRIC_GAUGE,
+  METRIC_HISTOGRAM,
+};
+
+// histogram buckets in usec, the last one is +Inf
+#define METRIC_BUCKETS    16
+extern const uint64_t metric_bounds[METRIC_BUCKETS - 1];
+
+class Metric {
+ public:
+  Metric(int _type = METRIC_COUNTER);
+  void Add(int64_t v = 1) {
+    val.fetch_add(v, std::memory_order_relaxed);
+  }
+  void Set(int64_t v) {
+    val.store(v, std::memory_order_relaxed);
+  }
+  void Observe(uint64_t usec) {
+    int i = 0;
+    while (i < METRIC_BUCKETS - 1 && usec > metric_bounds[i]) i ++;
+    bucket[i].fetch_add(1, std::memory_order_relaxed);
+    sum.fetch_add(usec, std::memory_order_relaxed);
+  }
+  // counter or gauge value, histogram counts by buckets
+  int64_t Value(void) {
+    return val.load(std::memory_order_relaxed);
+  }
+  // usec observed by histogram
+  uint64_t Sum(void) {
+    return sum.load(std::memory_order_relaxed);
+  }
+  uint64_t Count(void);
+  // upper bound of the bucket where the quantile q falls in usec,
+  // the last bound if it is above all
+  uint64_t Quantile(double q);
+  int type;
+  std::atomic<int64_t> val;
+  std::atomic<uint64_t> sum;
+  std::atomic<uint64_t> bucket[METRIC_BUCKETS];
+};
+
+// samples are grouped by name, labels are like: obj="99",element="decode"
+class MetricsWriter {
+ public:
+  void Write(const char* name, const char* help, const std::string& labels, Metric* metric);
+  void Write(const char* name, const char* help, int type, const std::string& labels, double val);
+  std::string Text(void);
+ private:
+  typedef struct {
+    std::string help;
+    int type;
+    std::string samples;
+  } Family;
+  Family& GetFamily(const char* name, const char* help, int type);
+  std::map<std::string, Family> families;
+};
+
+// registered metrics are never freed, only for bounded label sets
+Metric* MetricsGet(const char* name, const char* help, int type, const std::string& labels = "");
+// collectors write metrics of live objects when /metrics is requested
+void MetricsAddCollector(void* arg, void (*cb)(MetricsWriter* writer, void* arg));
+std::string MetricsText(void);
+
+#endif
+
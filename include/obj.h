@@ -21,6 +21,8 @@
 #include <string.h>
 #include <memory>
 #include <vector>
+#include <map>
+#include <string>
 #include <mutex>
 #include "task.h"
 
@@ -43,15 +45,28 @@ class Object : public std::enable_shared_from_this<Object> {
   std::shared_ptr<TaskParams> GetTask(char *name);
   bool DelFromTaskQue(const char *name);
   void TraverseTaskQue(void);
+  void TraverseTaskQue(void* arg, int (*cb)(std::shared_ptr<TaskParams> task, void* arg));
   void SetParams(char *str);
   auto GetParams(void) {
     return params;
   }
+  // the stage running the shared elements of alg, started by the first task
+  std::shared_ptr<TaskParams> AcquireShared(std::shared_ptr<AlgTask> alg,
+                                            std::shared_ptr<TaskParams> task);
+  // stopped when no task uses it
+  void ReleaseShared(std::shared_ptr<TaskParams> stage, bool sync);
+  // packets of the source since its last key frame, nullptr if disabled
+  std::shared_ptr<GopCache> GetGopCache(void);
   MediaServer* media;
  private:
   int id;
   std::mutex task_mtx;
   std::vector<std::shared_ptr<TaskParams>> task_vec;
+  // shared stages by the key of their elements, and the tasks using them
+  std::mutex shared_mtx;
+  std::map<std::string, std::pair<std::shared_ptr<TaskParams>, int>> shared_map;
+  std::once_flag gop_once;
+  std::shared_ptr<GopCache> gop_cache;
   std::shared_ptr<char> params;
   void CheckWorkDir(void);
 };
@@ -21,6 +21,8 @@
 #include <string.h>
 #include <memory>
 #include <vector>
+#include <map>
+#include <string>
 #include <mutex>
 #include <thread>
 #include "tensor.h"
@@ -31,8 +33,34 @@ class TaskParams;
 typedef struct {
   char key[256];
   char val[256];
+  // input_map only, QUEUE_* policy of the edge when the queue is full
+  int policy;
+  int timeout_ms;
+  // input_map only, pass one of every decimate packets, 0 or 1 passes all
+  int decimate;
 } KeyValue;
 
+// what a multi-input element does when input[0] has no partner
+enum {
+  // discard the frame of input[0]
+  JOIN_DROP = 0,
+  // process it, the missing inputs are null
+  JOIN_PASS,
+  // no timeout, drop only when the partner can not come any more
+  JOIN_WAIT,
+};
+#define JOIN_WAIT_MS    100
+#define MAX_REPLICAS    16
+
+// difference of a reloaded pipeline from the running one
+enum {
+  ALG_SAME = 0,
+  // only queue lengths differ, changed in place
+  ALG_TUNE,
+  // tasks using it have to restart
+  ALG_CHANGED,
+};
+
 class Element {
  public:
   Element(void);
@@ -66,16 +94,59 @@ class Element {
   bool GetAsync(void) {
     return async;
   }
+  void SetJoin(int policy, int wait_ms) {
+    join_policy = policy;
+    join_wait_ms = wait_ms;
+  }
+  int GetJoinPolicy(void) {
+    return join_policy;
+  }
+  int GetJoinWaitMs(void) {
+    return join_wait_ms;
+  }
   void SetParams(char *str);
   auto GetParams(void) {
     return params;
   }
+  // overrides queue_len set by the plugin, -1 means not set
+  void SetQueueLen(int len) {
+    queue_len = len;
+  }
+  int GetQueueLen(void) {
+    return queue_len;
+  }
+  // instances of a stateless element pulling from the same input,
+  // ordered restores the input order of their outputs
+  void SetReplicas(int num, bool _ordered) {
+    replicas = num;
+    ordered = _ordered;
+  }
+  int GetReplicas(void) {
+    return replicas;
+  }
+  bool GetOrdered(void) {
+    return ordered;
+  }
+  // run once per object and fanned out to all tasks of the object using it
+  void SetShared(bool val) {
+    shared = val;
+  }
+  bool GetShared(void) {
+    return shared;
+  }
+  int Compare(Element* c);
   bool attach_to_thread;
  private:
   char name[256];
   char path[256];
   char framework[256];
   bool async;
+  int join_policy;
+  int join_wait_ms;
+  int queue_len;
+  int replicas;
+  bool ordered;
+  bool shared;
   std::shared_ptr<char> params;
   std::vector<std::shared_ptr<KeyValue>> input_map;
   std::vector<std::shared_ptr<KeyValue>> output_map;
@@ -94,34 +165,69 @@ class AlgTask {
   void SetConfig(const char* cfg) {
     strncpy(config, cfg, sizeof(config));
   }
+  char* GetConfig(void) {
+    return config;
+  }
+  // the parsed file, reused as long as it is not changed
+  void SetDoc(std::shared_ptr<JsonDoc> _doc) {
+    doc = _doc;
+  }
+  auto GetDoc(void) {
+    return doc;
+  }
   bool Put2ElementQue(auto ele);
-  bool AssignToThreads(std::shared_ptr<TaskParams> task);
+  // shared elements of the pipeline or the others
+  bool AssignToThreads(std::shared_ptr<TaskParams> task, bool shared = false);
+  std::shared_ptr<Element> GetElement(const char* ele_name);
+  int Compare(AlgTask* c);
+  // shared elements must only take entry or the output of shared elements
+  bool CheckShared(void);
+  // the same key for the same shared elements, empty if none
+  std::string GetSharedKey(void) {
+    return shared_key;
+  }
   MediaServer* media;
  private:
   char name[128];
   char config[256];
+  std::shared_ptr<JsonDoc> doc;
   std::mutex ele_mtx;
   std::vector<std::shared_ptr<Element>> ele_vec;
+  std::string shared_key;
   auto SearchEntry(void);
   auto GetNextEle(auto ele);
-  void AttachToThread(auto ele, auto task);
+  void AttachToThread(auto ele, auto task, bool shared);
   void ResetEleAttachFlag(void);
 };
 
+// cfg/config.json, cfg/task.json and the pipelines of the tasks, read together
+// and never changed after published, a reload publishes a new one
+class PipelineSnapshot {
+ public:
+  std::shared_ptr<JsonDoc> config;
+  std::shared_ptr<JsonDoc> tasks;
+  std::map<std::string, std::shared_ptr<AlgTask>> algs;
+};
+
 class Pipeline {
  public:
   Pipeline(MediaServer* _media);
   ~Pipeline(void);
   MediaServer* media;
   void Start(void);
-  bool Put2AlgQue(auto alg);
+  // read the files again, unchanged pipelines keep their AlgTask
+  void Reload(void);
+  std::shared_ptr<const PipelineSnapshot> GetSnapshot(void) {
+    return std::atomic_load(&snapshot);
+  }
   std::shared_ptr<AlgTask> GetAlgTask(const char* name);
-  void CheckIfDelAlg(auto config_map);
-  size_t GetAlgNum(void);
  private:
-  std::mutex alg_mtx;
-  std::vector<std::shared_ptr<AlgTask>> alg_vec;
+  std::shared_ptr<const PipelineSnapshot> snapshot;
 };
 
+// changed each time a new cfg/config.json is published,
+// cheap enough for plugins to check it per frame
+uint64_t ConfigGeneration(void);
+
 #endif
 
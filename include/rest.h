@@ -45,7 +45,7 @@ do {                                                \
     }                                               \
     if(req != (struct evhttp_request *)(-1)) {      \
         UrlMap *p = (UrlMap *)arg;                  \
-        request_cb(req, p->cb, p->arg);             \
+        request_cb(req, p->cb, p->arg, p->url);     \
         return ;                                    \
     }                                               \
 } while(0)
@@ -100,9 +100,13 @@ class SlaveRestful : public Restful {
 
 int HttpPost(const char* url, char* data, HttpAck* ack, int timeout_sec = 3);
 int HttpGet(const char* url, HttpAck* ack, int timeout_sec = 3);
-int request_cb(struct evhttp_request* req, void (*http_task)(struct evhttp_request *, void *), void* arg);
+// path is the url registered in the url map, the label of metrics
+int request_cb(struct evhttp_request* req, void (*http_task)(struct evhttp_request *, void *),
+               void* arg, const char* path);
 void CheckErrMsg(const char* err_msg, char** ppbody);
 void SetAckMsg(const char* msg, char** ppbody);
+// metrics in prometheus format, on both master and slave
+void request_metrics(struct evhttp_request* req, void* arg);
 
 #endif
 
@@ -21,6 +21,7 @@
 #include <string.h>
 #include <condition_variable>
 #include "config.h"
+#include "jsondoc.h"
 
 typedef struct {
   void *arga;
@@ -48,6 +49,9 @@ int ReadFile(const char *filename, void *buf, int size);
 int ReadFile2(const char *filename, void *buf, int max);
 int WriteFile(const char *filename, void *buf, int size, const char *mode);
 int GetFileSize(const char *filename);
+// the same camera gives the same key, scheme and host are lower case,
+// default port and trailing '/' are removed, returns -1 if key is too short
+int NormalizeUrl(const char* url, int default_port, char* key, int size);
 ShareParams GlobalConfig(ShareParams* params = NULL);
 int GetHttpFilePort(char* name, const char* config_file);
 void LibevntInit(void);
@@ -20,6 +20,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include "pipeline.h"
+#include "executor.h"
 
 class MediaServer;
 class SlaveParams {
@@ -29,6 +30,9 @@ class SlaveParams {
   Pipeline* GetPipe(void) {
     return pipe;
   }
+  Executor* GetExecutor(void) {
+    return executor;
+  }
   void Start(void);
   MediaServer* media;
   char _ip[128];
@@ -36,6 +40,7 @@ class SlaveParams {
  private:
   void SlaveManager(void);
   Pipeline* pipe;
+  Executor* executor;
 };
 
 #endif
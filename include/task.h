@@ -20,27 +20,137 @@
 #include <stdlib.h>
 #include <string.h>
 #include <memory>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <functional>
 #include "pipeline.h"
 #include "framework.h"
+#include "executor.h"
+#include "metrics.h"
+#include "trace.h"
 
 class Object;
 
+// Aligns the inputs of a multi-input element by frame_id, input[0] leads.
+// Every other input keeps the first packet not older than the lead in a
+// slot, older packets can never match and are dropped.
+class JoinBuffer {
+ public:
+  JoinBuffer(size_t input_num, int _policy, int _wait_ms);
+  ~JoinBuffer(void) {}
+  // 0: tensor is filled, 1: not ready, -1: stopped
+  int Get(TensorData& tensor, ElementData& data, bool block);
+  // when the lead waiting for partners is released, false if there is no
+  // such lead or it has been returned for the lead already
+  bool TakeDeadline(std::chrono::steady_clock::time_point* end);
+  int policy;
+  int wait_ms;
+  // lead frames processed with all, with some and without partners
+  std::atomic<uint64_t> matched;
+  std::atomic<uint64_t> passed;
+  std::atomic<uint64_t> dropped;
+  // frames of other inputs dropped without a lead
+  std::atomic<uint64_t> stale;
+ private:
+  // 2 means the lead is dropped
+  int Match(TensorData& tensor, ElementData& data, bool block);
+  std::shared_ptr<Packet> lead;
+  std::chrono::steady_clock::time_point lead_time;
+  bool lead_armed;
+  std::vector<std::shared_ptr<Packet>> slots;
+};
+
+// Replicas of an element run in their own threads and pull from the same
+// input, the first one started connects it to the previous element.
+// pushes wake the replicas in turn, ordered replicas number the packets
+// when popping and send the outputs in that order.
+class ReplicaGroup : public QueueListener,
+                     public std::enable_shared_from_this<ReplicaGroup> {
+ public:
+  ReplicaGroup(bool _ordered);
+  ~ReplicaGroup(void) {}
+  // returns true for the first one, others get its input instead of their own
+  bool ShareInput(ElementData& data, int* running, std::shared_ptr<QueueListener> listener);
+  void OnPush(void);
+  // output of seq, nullptr if none, send it and the following ready ones
+  void Reorder(uint64_t seq, std::shared_ptr<Packet> pkt,
+               std::function<void(std::shared_ptr<Packet>& pkt)> send);
+  const bool ordered;
+  // taken by ordered replicas when popping, so pop_seq follows the input
+  std::mutex pop_mtx;
+  uint64_t pop_seq;
+  // taken by unordered replicas when sending, queues have one producer
+  std::mutex send_mtx;
+ private:
+  std::mutex mtx;
+  std::vector<std::shared_ptr<PacketQueue>> input;
+  std::vector<std::weak_ptr<QueueListener>> listeners;
+  size_t next;
+  std::mutex out_mtx;
+  uint64_t out_seq;
+  std::map<uint64_t, std::shared_ptr<Packet>> pending;
+};
+
 class TaskElement : public Element {
  public:
   TaskElement(std::shared_ptr<TaskParams> _task);
   ~TaskElement(void);
-  bool Start(bool sync_in);
+  bool Start(bool sync_in, std::shared_ptr<QueueListener> listener = nullptr);
   bool Stop(void);
   std::unique_ptr<Framework> framework;
   ElementData data;
+  // taken at every access to data.output, tasks subscribe to and leave
+  // the shared element while it is running
   std::mutex data_mtx;
-  int exception_cnt;
+  std::atomic<int> exception_cnt;
+  Metric frames_in;
+  Metric frames_out;
+  // output frames of last second
+  Metric fps;
+  // duration of framework->Process, the sum is read by the governor
+  Metric process_usec;
+  // from ingest to the end of Process
+  Metric latency_usec;
+  // element name interned for spans
+  int trace_name;
+  // only for elements with more than one input
+  std::unique_ptr<JoinBuffer> join;
+  // only for elements with replicas
+  std::shared_ptr<ReplicaGroup> replica;
+  int replica_id;
+  // only for the entry element, the gop cache of object
+  std::shared_ptr<GopCache> gop_cache;
+  // given to Process, set if the element is run by executor
+  std::function<void()> wake;
+  // outputs finished by the plugin and not taken yet
+  std::atomic<int> async_ready;
+  // only called by the thread running the element
+  void UpdateFps(std::chrono::steady_clock::time_point now, bool output);
+  // carry ingest time to the output and record the latency
+  void UpdateLatency(TensorData& tensor, int64_t now_usec);
+  // queue_len of the pipeline if set, or the one set by Init of the plugin,
+  // return false if it is cut to the capacity of the output queues
+  bool ApplyQueueLen(void);
+  // push the gop cache to the queue of a new consumer
+  void PrimeOutput(std::shared_ptr<PacketQueue> queue);
+  size_t OutputNum(void);
+  // an output of QUEUE_BLOCK is full, unit is parked on it until the
+  // consumer pops or the timeout of the edge, then the packet is dropped
+  bool Parked(std::shared_ptr<QueueListener> unit, Executor* executor);
  private:
   void ConnectElement(void);
   std::shared_ptr<TaskParams> task;
+  std::chrono::steady_clock::time_point fps_start;
+  int64_t fps_frames;
+  int init_queue_len;
+  // zero if not parked, see ParkOutputs
+  std::chrono::steady_clock::time_point park_start;
+  std::chrono::steady_clock::time_point park_wake;
 };
 
-class TaskThread : public std::enable_shared_from_this<TaskThread> {
+class TaskThread : public ExecUnit, public QueueListener,
+                   public std::enable_shared_from_this<TaskThread> {
  public:
   TaskThread(void);
   ~TaskThread(void);
@@ -49,10 +159,24 @@ class TaskThread : public std::enable_shared_from_this<TaskThread> {
   std::vector<std::shared_ptr<TaskElement>> t_ele_vec;
   void Start(std::shared_ptr<TaskParams> _task);
   void Stop(bool sync = false);
+  // run by executor when input is ready
+  void Run(void);
+  void OnPush(void);
  private:
   std::thread* t;
   void ThreadFunc(void);
+  // block is false when run by executor, it never waits for input or output
+  int ProcessOnce(std::shared_ptr<Object> obj, bool block);
+  void ThreadExit(std::shared_ptr<Object> obj);
+  bool ExecEnable(void);
   std::shared_ptr<TaskParams> task;
+  // after elements started, the thread exits and the executor runs them,
+  // except the entry element, which gets data by itself
+  Executor* executor;
+  std::atomic<int> sched_state;
+  std::mutex exit_mtx;
+  std::condition_variable exit_cond;
+  bool exited;
 };
 
 class TaskParams : public std::enable_shared_from_this<TaskParams> {
@@ -70,14 +194,28 @@ class TaskParams : public std::enable_shared_from_this<TaskParams> {
     return params;
   }
   int Start(void);
+  // run the shared elements of alg for the tasks of the object
+  int StartShared(std::shared_ptr<AlgTask> _alg);
   int Stop(bool sync = false);
   bool KeepAlive(void);
+  // follow the reloaded pipeline, returns false if the task has to restart
+  bool SyncAlg(void);
   void BeatAlive(MediaServer* media);
   void ThreadSync(const char* name);
   std::shared_ptr<Object> GetTaskObj(void);
   std::vector<std::shared_ptr<TaskThread>> thread_vec;
   int running;
+  // from ingest to the end of elements without output
+  Metric latency_usec;
+  // the stage running shared elements, nullptr if none
+  std::shared_ptr<TaskParams> GetShared(void) {
+    return shared;
+  }
+  // input connected to an element of the shared stage
+  void Subscribe(std::shared_ptr<TaskElement> ele, std::shared_ptr<PacketQueue> queue);
  private:
+  int StartThreads(bool _shared);
+  void Unsubscribe(void);
   char name[256];
   // obj thread should set this params in cycle correctly
   long int task_beat;
@@ -85,6 +223,9 @@ class TaskParams : public std::enable_shared_from_this<TaskParams> {
   std::weak_ptr<Object> obj;
   std::shared_ptr<char> params;
   std::shared_ptr<AlgTask> alg;
+  std::shared_ptr<TaskParams> shared;
+  std::mutex sub_mtx;
+  std::vector<std::pair<std::weak_ptr<TaskElement>, std::shared_ptr<PacketQueue>>> sub_vec;
 };
 
 #endif
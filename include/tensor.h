@@ -22,9 +22,36 @@
 #include <unistd.h>
 #include <vector>
 #include <queue>
+#include <atomic>
+#include <memory>
+#include <mutex>
 #include <condition_variable>
+#include <chrono>
+#include <functional>
+#include <algorithm>
+#include "bufpool.h"
+#include "jsondoc.h"
 
 #define MAX_DIMS    4
+#define CACHE_LINE_SIZE   64
+// lookup the ring a few times before sleeping on the condition
+#define QUEUE_SPIN_CNT    64
+// gop cache not updated for it is not used to prime consumers
+#define GOP_CACHE_STALE_USEC  5000000
+
+// what the producer does when the queue of an edge is full
+enum {
+  QUEUE_DROP_OLDEST = 0,
+  QUEUE_DROP_NEWEST,
+  // wait up to timeout_ms, then drop the new one, producers run by the
+  // executor are parked before processing instead of waiting in the worker
+  QUEUE_BLOCK,
+  // only the newest packet is kept
+  QUEUE_LATEST,
+  // drop the new one and all after it until the next key frame,
+  // for compressed video, the decoder never gets a broken reference
+  QUEUE_GOP,
+};
 
 typedef void* IHandle;
 typedef void* hostPtr_t;
@@ -67,11 +94,54 @@ typedef struct {
   IDims dims;
 } TTensor;
 
+// monotonic clock shared by aistream and plugins
+static inline int64_t GetMonotonicUsec(void) {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+         std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// codec of compressed video, annex-b with 4 bytes start code
+enum {
+  VIDEO_CODEC_H264 = 0,
+  VIDEO_CODEC_H265,
+};
+
+// nal unit type of the first nal of data
+static inline int VideoNalType(int codec, const char* data) {
+  unsigned char nal = data[4];
+  return codec == VIDEO_CODEC_H265 ? (nal >> 1) & 0x3f : nal & 0x1f;
+}
+
+// slices referring to previous frames
+static inline bool VideoNalDelta(int codec, int type) {
+  return codec == VIDEO_CODEC_H265 ? type <= 9 : type == 1;
+}
+
+// parameter sets and random access slices, decoding can restart here
+static inline bool VideoNalKey(int codec, int type) {
+  if (codec == VIDEO_CODEC_H265) {
+    return (type >= 16 && type <= 21) || (type >= 32 && type <= 34);
+  }
+  return type == 5 || type == 7 || type == 8;
+}
+
 typedef struct {
   int type;
   int width;
   int height;
   int frame_id;
+  // compressed video only, decoding can start from this packet
+  int key_frame;
+  // compressed video only, VIDEO_CODEC_x
+  int codec;
+  // decoded frames only, the decoder already drops frames by the analysis
+  // rate, elements after it should not skip frames again
+  int decimated;
+  // when the frame arrived from source, by GetMonotonicUsec, 0 if unknown,
+  // copied to the output of every element by the task
+  int64_t ingest_usec;
+  // presentation time of source in usec, 0 if unknown
+  int64_t pts;
   char* ptr;
   size_t ptr_size;
   //TTensor tensor;
@@ -99,28 +169,76 @@ typedef struct {
 
 class Packet {
  public:
+  // copy data from buf
   Packet(void* buf, size_t size, HeadParams* params = nullptr) {
     if (size > 0) {
-      _data = new char[size];
-      memcpy(_data, buf, size);
+      _buf = BufferAlloc(size);
+      memcpy(_buf.get(), buf, size);
+      _data = _buf.get();
       _size = size;
     }
-    if (params != nullptr) {
-      _params = *params;
-    }
+    SetParams(params);
   }
-  ~Packet() {
-    if (_data != nullptr) {
-      delete _data;
-    }
-    if (_params.ptr != nullptr && _params.ptr_size > 0) {
-      delete _params.ptr;
+  // share buf with other packets, no copy
+  Packet(std::shared_ptr<char> buf, size_t size, HeadParams* params = nullptr) {
+    _buf = buf;
+    _data = buf.get();
+    _size = size;
+    SetParams(params);
+  }
+  ~Packet() {}
+  // packets are created and freed for every frame, take them from pool
+  static void* operator new(size_t size) {
+    void* ptr = BufferGet(size);
+    if (ptr == nullptr) {
+      throw std::bad_alloc();
     }
+    return ptr;
+  }
+  static void operator delete(void* ptr) {
+    BufferPut((char* )ptr);
+  }
+  // adopt buf owned by others, such as AVPacket of ffmpeg,
+  // release(opaque) is invoked when the last user is gone
+  static Packet* Wrap(void* buf, size_t size, void (*release)(void* opaque),
+                      void* opaque, HeadParams* params = nullptr) {
+    std::shared_ptr<char> _buf((char* )buf, [release, opaque](char* p) {
+      release(opaque);
+    });
+    return new Packet(_buf, size, params);
+  }
+  // share params.ptr of other packet, no copy
+  void SharePtr(std::shared_ptr<char> ptr, size_t size) {
+    _ptr_buf = ptr;
+    _params.ptr = ptr.get();
+    _params.ptr_size = size;
+  }
+  // packets are shared by all consumers and read only, a new packet with
+  // a copy of data is written instead, params.ptr is shared
+  Packet* Clone(void) {
+    Packet* pkt = new Packet(_data, _size);
+    pkt->_params = _params;
+    pkt->_ptr_buf = _ptr_buf;
+    return pkt;
   }
 
   char* _data = nullptr;
   size_t _size = 0;
   HeadParams _params = {0};
+  // owner of _data and _params.ptr
+  std::shared_ptr<char> _buf;
+  std::shared_ptr<char> _ptr_buf;
+ private:
+  void SetParams(HeadParams* params) {
+    if (params == nullptr) {
+      return;
+    }
+    _params = *params;
+    // take over params.ptr allocated by new[]
+    if (_params.ptr != nullptr && _params.ptr_size > 0) {
+      _ptr_buf.reset(_params.ptr, std::default_delete<char[]>());
+    }
+  }
 };
 
 typedef struct {
@@ -130,13 +248,503 @@ typedef struct {
   Packet* output;
 } TensorBuffer;
 
+// consumer of a queue, waked up when a packet is pushed
+class QueueListener {
+ public:
+  virtual ~QueueListener(void) {}
+  virtual void OnPush(void) = 0;
+};
+
+// bounded ring of packets between two elements, the slots are allocated once
+// by the producer with capacity queue_len or reserve if larger, the limit
+// follows queue_len of later pushes up to the capacity, push and pop are lock free,
+// the consumer only sleeps on the condition when the ring is empty
 class PacketQueue {
  public:
+  PacketQueue(void) {
+    memset(name, 0, sizeof(name));
+    running = nullptr;
+    head = 0;
+    tail = 0;
+    waiters = 0;
+    send_waiters = 0;
+    parked = false;
+    ring = nullptr;
+    policy = QUEUE_DROP_OLDEST;
+    timeout_ms = 0;
+    reserve = 0;
+    gop_skip = false;
+    decimate = 0;
+    offered = 0;
+    extra = 0;
+    primed = false;
+    primed_first = 0;
+    primed_last = -1;
+    pushed = 0;
+    dropped = 0;
+  }
+  ~PacketQueue(void) {
+    Ring* r = ring.load(std::memory_order_acquire);
+    if (r != nullptr) {
+      delete r;
+    }
+  }
+  // return false if the queue is full, the packet is not queued
+  bool Push(const std::shared_ptr<Packet>& pkt, size_t limit) {
+    Ring* r = GetRing(limit);
+    limit = std::max((size_t)1, std::min(limit, r->mask + 1));
+    if (r->limit.load(std::memory_order_relaxed) != limit) {
+      r->limit.store(limit, std::memory_order_relaxed);
+    }
+    size_t pos = tail.load(std::memory_order_relaxed);
+    for (;;) {
+      size_t h = head.load(std::memory_order_acquire);
+      if (pos >= h && pos - h >= limit) {
+        return false;
+      }
+      Slot& slot = r->slots[pos & r->mask];
+      size_t seq = slot.seq.load(std::memory_order_acquire);
+      intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+      if (dif == 0) {
+        if (tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+          slot.pkt = pkt;
+          slot.seq.store(pos + 1, std::memory_order_release);
+          break;
+        }
+      } else if (dif < 0) {
+        return false;
+      } else {
+        pos = tail.load(std::memory_order_relaxed);
+      }
+    }
+    // pairs with the fence in Pop, either the consumer sees the packet,
+    // or we see the consumer waiting
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (waiters.load(std::memory_order_relaxed) > 0) {
+      std::unique_lock<std::mutex> lock(mtx);
+      condition.notify_one();
+    }
+    auto _listener = listener.lock();
+    if (_listener != nullptr) {
+      _listener->OnPush();
+    }
+    return true;
+  }
+  bool TryPop(std::shared_ptr<Packet>& pkt) {
+    Ring* r = ring.load(std::memory_order_acquire);
+    if (r == nullptr) {
+      return false;
+    }
+    size_t pos = head.load(std::memory_order_relaxed);
+    for (;;) {
+      Slot& slot = r->slots[pos & r->mask];
+      size_t seq = slot.seq.load(std::memory_order_acquire);
+      intptr_t dif = (intptr_t)seq - (intptr_t)(pos + 1);
+      if (dif == 0) {
+        if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+          pkt = std::move(slot.pkt);
+          slot.seq.store(pos + r->mask + 1, std::memory_order_release);
+          // pairs with the fence in WaitSpace and Park
+          std::atomic_thread_fence(std::memory_order_seq_cst);
+          if (send_waiters.load(std::memory_order_relaxed) > 0) {
+            WakeProducer();
+          }
+          return true;
+        }
+      } else if (dif < 0) {
+        return false;
+      } else {
+        pos = head.load(std::memory_order_relaxed);
+      }
+    }
+  }
+  // block until a packet arrives, return false if the task is stopped
+  bool Pop(std::shared_ptr<Packet>& pkt) {
+    return PopWait(pkt, nullptr);
+  }
+  // the same as Pop, but return false at end
+  bool PopUntil(std::shared_ptr<Packet>& pkt, std::chrono::steady_clock::time_point end) {
+    return PopWait(pkt, &end);
+  }
+  // end is nullptr for no timeout
+  bool PopWait(std::shared_ptr<Packet>& pkt, const std::chrono::steady_clock::time_point* end) {
+    for (int i = 0; i < QUEUE_SPIN_CNT; i ++) {
+      if (TryPop(pkt)) {
+        return true;
+      }
+    }
+    std::unique_lock<std::mutex> lock(mtx);
+    waiters.fetch_add(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    bool ret = false;
+    for (;;) {
+      if (TryPop(pkt)) {
+        ret = true;
+        break;
+      }
+      if (running != nullptr && !(*running)) {
+        break;
+      }
+      if (end == nullptr) {
+        condition.wait(lock);
+      } else if (condition.wait_until(lock, *end) == std::cv_status::timeout) {
+        ret = TryPop(pkt);
+        break;
+      }
+    }
+    waiters.fetch_sub(1, std::memory_order_relaxed);
+    return ret;
+  }
+  size_t Size(void) {
+    size_t h = head.load(std::memory_order_acquire);
+    size_t t = tail.load(std::memory_order_acquire);
+    return t > h ? t - h : 0;
+  }
+  // 0 before the first push
+  size_t Limit(void) {
+    Ring* r = ring.load(std::memory_order_acquire);
+    return r != nullptr ? r->limit.load(std::memory_order_relaxed) : 0;
+  }
+  // slots allocated by the first push, queue_len above it is cut
+  size_t Capacity(void) {
+    Ring* r = ring.load(std::memory_order_acquire);
+    return r != nullptr ? r->mask + 1 : 0;
+  }
+  // limit as Send sees it, only called by the producer
+  bool Full(size_t limit) {
+    return Size() >= limit + extra;
+  }
+  // the producer run by executor waits for a free slot, unit is told by
+  // OnPush when the consumer pops, return false if the queue is not full
+  bool Park(std::shared_ptr<QueueListener> unit, size_t limit) {
+    std::unique_lock<std::mutex> lock(space_mtx);
+    if (!parked) {
+      parked = true;
+      send_waiters.fetch_add(1, std::memory_order_relaxed);
+    }
+    producer = unit;
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (Full(limit)) {
+      return true;
+    }
+    parked = false;
+    producer.reset();
+    send_waiters.fetch_sub(1, std::memory_order_relaxed);
+    return false;
+  }
+  void Clear(void) {
+    std::shared_ptr<Packet> pkt;
+    while (TryPop(pkt)) {
+      pkt = nullptr;
+    }
+  }
+  // push by the policy of the edge, return false if any packet is dropped,
+  // QUEUE_BLOCK only waits for a free slot if block is set.
+  // single producer: gop_skip, extra and primed_last are plain fields, so
+  // threads sending to the same queue have to be serialized by the caller
+  bool Send(const std::shared_ptr<Packet>& pkt, size_t limit, bool block = true) {
+    bool ret = true;
+    std::shared_ptr<Packet> old;
+    // skipped by decimation, not counted as dropped
+    if (decimate > 1 && offered.fetch_add(1, std::memory_order_relaxed) % decimate != 0) {
+      return true;
+    }
+    // frames primed by gop cache are not sent again,
+    // and they are above the limit until consumed
+    if (primed_last >= 0) {
+      int id = pkt->_params.frame_id;
+      if (id >= primed_first && id <= primed_last) {
+        return true;
+      }
+      primed_last = -1;
+    }
+    if (extra > 0) {
+      extra = Size() < limit ? 0 : extra;
+      limit += extra;
+    }
+    switch (policy) {
+      case QUEUE_DROP_NEWEST:
+        if (!Push(pkt, limit)) {
+          dropped ++;
+          return false;
+        }
+        break;
+      case QUEUE_BLOCK: {
+        auto end = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+        while (!Push(pkt, limit)) {
+          if (!block || !WaitSpace(limit, end)) {
+            dropped ++;
+            return false;
+          }
+        }
+        break;
+      }
+      case QUEUE_GOP:
+        if (gop_skip && !pkt->_params.key_frame) {
+          dropped ++;
+          return false;
+        }
+        if (!Push(pkt, limit)) {
+          gop_skip = true;
+          dropped ++;
+          return false;
+        }
+        gop_skip = false;
+        break;
+      case QUEUE_LATEST:
+        while (TryPop(old)) {
+          dropped ++;
+          ret = false;
+        }
+        // fall through
+      default:
+        while (!Push(pkt, limit)) {
+          TryPop(old);
+          dropped ++;
+          ret = false;
+        }
+        break;
+    }
+    pushed ++;
+    return ret;
+  }
+  // wake up the blocked consumer and producer, for example, when stopping task
+  void Notify(void) {
+    std::unique_lock<std::mutex> lock(mtx);
+    condition.notify_all();
+    lock.unlock();
+    std::unique_lock<std::mutex> _lock(space_mtx);
+    space.notify_all();
+  }
   char name[256];
+  int *running;
+  // set by consumer before the task is running, never changed after
+  std::weak_ptr<QueueListener> listener;
+  int policy;
+  int timeout_ms;
+  // set by consumer like policy, the least slots allocated by the first push,
+  // so queue_len of the producer can be raised in place up to it
+  size_t reserve;
+  // set by consumer like policy, pass one of every decimate packets
+  int decimate;
+  std::atomic<uint64_t> offered;
+  // set by GopCache::Prime, the packets and frame ids primed,
+  // only touched by the producer after that
+  size_t extra;
+  // offered the gop cache once, by Subscribe or the start of the stage
+  bool primed;
+  int primed_first;
+  int primed_last;
+  std::atomic<uint64_t> pushed;
+  std::atomic<uint64_t> dropped;
+ private:
+  struct alignas(CACHE_LINE_SIZE) Slot {
+    std::atomic<size_t> seq;
+    std::shared_ptr<Packet> pkt;
+  };
+  struct Ring {
+    Ring(size_t _limit) {
+      limit = _limit > 0 ? _limit : 1;
+      size_t size = 2;
+      while (size < limit) size <<= 1;
+      mask = size - 1;
+      slots = new Slot[size];
+      for (size_t i = 0; i < size; i ++) {
+        slots[i].seq.store(i, std::memory_order_relaxed);
+      }
+    }
+    ~Ring(void) {
+      delete[] slots;
+    }
+    std::atomic<size_t> limit;
+    size_t mask;
+    Slot* slots;
+  };
+  // the first producer allocates the slots, capacity decided by its queue_len
+  Ring* GetRing(size_t limit) {
+    Ring* r = ring.load(std::memory_order_acquire);
+    if (r != nullptr) {
+      return r;
+    }
+    Ring* _ring = new Ring(std::max(limit, reserve));
+    if (!ring.compare_exchange_strong(r, _ring, std::memory_order_acq_rel)) {
+      delete _ring;
+      return r;
+    }
+    return _ring;
+  }
+  // the producer with its own thread sleeps until a slot is free
+  bool WaitSpace(size_t limit, std::chrono::steady_clock::time_point end) {
+    std::unique_lock<std::mutex> lock(space_mtx);
+    send_waiters.fetch_add(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    bool ret = true;
+    while (Size() >= limit) {
+      if ((running != nullptr && !(*running)) ||
+          space.wait_until(lock, end) == std::cv_status::timeout) {
+        ret = false;
+        break;
+      }
+    }
+    send_waiters.fetch_sub(1, std::memory_order_relaxed);
+    return ret;
+  }
+  void WakeProducer(void) {
+    std::unique_lock<std::mutex> lock(space_mtx);
+    space.notify_all();
+    std::shared_ptr<QueueListener> unit = nullptr;
+    if (parked) {
+      parked = false;
+      unit = producer.lock();
+      producer.reset();
+      send_waiters.fetch_sub(1, std::memory_order_relaxed);
+    }
+    lock.unlock();
+    if (unit != nullptr) {
+      unit->OnPush();
+    }
+  }
+  std::atomic<Ring*> ring;
+  // QUEUE_GOP, dropping until the next key frame
+  bool gop_skip;
+  alignas(CACHE_LINE_SIZE) std::atomic<size_t> head;
+  alignas(CACHE_LINE_SIZE) std::atomic<size_t> tail;
+  alignas(CACHE_LINE_SIZE) std::atomic<int> waiters;
+  // producers waiting for a free slot, QUEUE_BLOCK only
+  std::atomic<int> send_waiters;
   std::mutex mtx;
   std::condition_variable condition;
-  std::queue<std::shared_ptr<Packet>> _queue;
-  int *running;
+  // TryPop runs under mtx in Pop, so the producer side has its own
+  std::mutex space_mtx;
+  std::condition_variable space;
+  // the parked producer, woken once by the next pop
+  bool parked;
+  std::weak_ptr<QueueListener> producer;
+};
+
+// the producer run by executor holds its next packet while a QUEUE_BLOCK
+// output is full, start is when the held packet began to wait and wake the
+// earliest deadline still ahead, both zero if not parked. an edge past its
+// timeout_ms is given up, the packet is then dropped on it by Send, and the
+// next packet waits with its own deadline like WaitSpace in thread mode
+static inline bool ParkOutputs(std::vector<std::shared_ptr<PacketQueue>>& outputs, size_t limit,
+                               std::shared_ptr<QueueListener> unit,
+                               std::chrono::steady_clock::time_point now,
+                               std::chrono::steady_clock::time_point* start,
+                               std::chrono::steady_clock::time_point* wake) {
+  bool parked = false;
+  for (size_t i = 0; i < outputs.size(); i ++) {
+    auto& output = outputs[i];
+    if (output == nullptr || output->policy != QUEUE_BLOCK || !output->Full(limit)) {
+      continue;
+    }
+    if (*start == std::chrono::steady_clock::time_point()) {
+      *start = now;
+    }
+    auto end = *start + std::chrono::milliseconds(output->timeout_ms);
+    if (now >= end || !output->Park(unit, limit)) {
+      continue;
+    }
+    if (!parked || end < *wake) {
+      *wake = end;
+    }
+    parked = true;
+  }
+  if (!parked) {
+    *start = std::chrono::steady_clock::time_point();
+    *wake = std::chrono::steady_clock::time_point();
+  }
+  return parked;
+}
+
+// packets of a source since its last key frame, the queues of new consumers
+// are primed with them, so decoding starts at once instead of waiting for the
+// next key frame, filled by one writer, and the gop is dropped if it grows
+// above max_bytes
+class GopCache {
+ public:
+  GopCache(size_t _max_bytes)
+    : max_bytes(_max_bytes), bytes(0), delta(false), update_usec(0), writer(nullptr) {
+  }
+  void Put(const std::shared_ptr<Packet>& pkt, const void* _writer) {
+    std::unique_lock<std::mutex> lock(mtx);
+    if (writer != _writer) {
+      if (writer != nullptr) {
+        return;
+      }
+      writer = _writer;
+      Reset();
+    }
+    if (pkt->_params.key_frame) {
+      // parameter sets and slices of one key frame may come as several packets
+      if (delta) {
+        Reset();
+      }
+    } else if (pkts.empty()) {
+      return;
+    } else if (pkt->_params.type == 0) {
+      delta = true;
+    }
+    bytes += pkt->_size;
+    if (bytes > max_bytes) {
+      Reset();
+      return;
+    }
+    pkts.push_back(pkt);
+    update_usec = GetMonotonicUsec();
+  }
+  // another writer takes over the cache
+  void Detach(const void* _writer) {
+    std::unique_lock<std::mutex> lock(mtx);
+    if (writer == _writer) {
+      writer = nullptr;
+    }
+  }
+  // push the cached packets to the queue before the producer sends to it,
+  // limit is queue_len of the producer, return the packets primed.
+  // a queue is primed only once, the callers are serialized by the producer
+  size_t Prime(PacketQueue* queue, size_t limit) {
+    if (queue->primed) {
+      return 0;
+    }
+    queue->primed = true;
+    std::unique_lock<std::mutex> lock(mtx);
+    if (pkts.empty() || GetMonotonicUsec() - update_usec > GOP_CACHE_STALE_USEC) {
+      return 0;
+    }
+    auto _pkts = pkts;
+    lock.unlock();
+    size_t n = 0;
+    for (; n < _pkts.size(); n ++) {
+      if (!queue->Push(_pkts[n], _pkts.size() + limit)) {
+        break;
+      }
+    }
+    if (n > 0) {
+      queue->extra = n;
+      queue->primed_first = _pkts[0]->_params.frame_id;
+      queue->primed_last = _pkts[n - 1]->_params.frame_id;
+    }
+    return n;
+  }
+  size_t Bytes(void) {
+    std::unique_lock<std::mutex> lock(mtx);
+    return bytes;
+  }
+ private:
+  void Reset(void) {
+    pkts.clear();
+    bytes = 0;
+    delta = false;
+  }
+  std::mutex mtx;
+  std::vector<std::shared_ptr<Packet>> pkts;
+  size_t max_bytes;
+  size_t bytes;
+  // a packet not of the key frame is cached, the next key frame starts new gop
+  bool delta;
+  int64_t update_usec;
+  const void* writer;
 };
 
 class ElementData {
@@ -155,8 +763,13 @@ class ElementData {
   // every element have only one output, 
   // but the same data can be send to many other elements
   std::vector<std::shared_ptr<PacketQueue>> output;
-  int queue_len;
+  // may be changed by reloading the pipeline while running
+  std::atomic<int> queue_len;
   int sleep_usec;
+  // cfg/config.json and params of the element, parsed once and set by the
+  // task before Init, read them here instead of parsing files again
+  std::shared_ptr<JsonDoc> config;
+  std::shared_ptr<JsonDoc> params;
 };
 
 class TensorData {
@@ -170,6 +783,11 @@ class TensorData {
   std::vector<std::shared_ptr<Packet>> _in;
   std::shared_ptr<Packet> _out;
   TensorBuffer tensor_buf;
+  // set if the element is run by executor, a plugin finishing frames in
+  // its own threads may keep the input and return without output, then
+  // call wake once for every finished frame, Process is called again
+  // with input_num 0 to take it. nullptr means Process has to block
+  std::function<void()> wake;
 };
 
 typedef struct {
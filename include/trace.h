@@ -0,0 +1,84 @@
+/****************************************************************************************
+ * Copyright (C) 2021 aistream <aistream@yeah.net>
+ *
+ * Licensed under the BSD 3-Clause License (the "License"); you may not use this
+ * file except in compliance with the License. You may obtain a copy of the License at
+ *
+ * https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Unless required by applicable law or agreed to in writing, software distributed
+ * under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+ * CONDITIONS OF ANY KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations under the License.
+ *
+ ***************************************************************************************/
+
+#ifndef __AISTREAM_TRACE_H__
+#define __AISTREAM_TRACE_H__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <atomic>
+#include <string>
+#include "tensor.h"
+
+// Spans are kept in a ring of every thread and dumped as chrome trace json,
+// which can be opened by chrome://tracing or ui.perfetto.dev.
+// implemented in aistream, plugins use it by symbols exported with -rdynamic
+
+#define TRACE_RING_SIZE     4096
+#define TRACE_DUMP_DIR      "log"
+
+typedef struct {
+  bool enable;
+  // spans kept by every thread, rounded up to power of 2
+  int ring_size;
+} TraceConfig;
+
+extern std::atomic<bool> trace_enable;
+static inline bool TraceEnabled(void) {
+  return trace_enable.load(std::memory_order_relaxed);
+}
+
+void TraceInit(TraceConfig* config);
+// names are interned once, spans only carry the index
+int TraceName(const char* name);
+void TraceRecord(int name, int cat, int64_t start_usec, int64_t end_usec, int id, int frame_id);
+// spans ended in last sec seconds, all spans if sec <= 0
+std::string TraceDump(int sec);
+// dump all spans to TRACE_DUMP_DIR, the name of file is returned by path
+int TraceDumpFile(const char* reason, char* path, size_t len);
+
+class TraceSpan {
+ public:
+  TraceSpan(int _name, int _cat, int _id = 0, int _frame_id = 0)
+    : name(_name), cat(_cat), id(_id), frame_id(_frame_id) {
+    start = TraceEnabled() ? GetMonotonicUsec() : 0;
+  }
+  ~TraceSpan(void) {
+    if (start > 0) {
+      TraceRecord(name, cat, start, GetMonotonicUsec(), id, frame_id);
+    }
+  }
+  // frame may be known after the span starts
+  void SetFrame(int _frame_id) {
+    frame_id = _frame_id;
+  }
+ private:
+  int name;
+  int cat;
+  int id;
+  int frame_id;
+  int64_t start;
+};
+
+// span of the enclosing scope, cat and name are string literals
+#define TRACE_SPAN(var, cat, name, id, frame_id)          \
+  static int var##_cat = TraceName(cat);                  \
+  static int var##_name = TraceName(name);                \
+  TraceSpan var(var##_name, var##_cat, id, frame_id)
+
+#endif
+
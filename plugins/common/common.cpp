@@ -16,6 +16,11 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <immintrin.h>
+#include <vector>
+#include <algorithm>
 extern "C" {
 #include <libavformat/avformat.h>
 #include <libavcodec/avcodec.h>
@@ -27,6 +32,8 @@ extern "C" {
 #include <libavutil/time.h>
 #include <libavutil/opt.h>
 }
+#include "tensor.h"
+#include "common.h"
 
 // Conversion from RGB to YUV420
 static int RGB2YUV_YR[256], RGB2YUV_YG[256], RGB2YUV_YB[256];
@@ -39,6 +46,12 @@ static long int cgu_tab[256];
 static long int cgv_tab[256];
 static long int tab_76309[256];
 static unsigned char clp[1024]; //for clip in CCIR601
+// SIMD kernels selected by cpu feature in RGBInit, NULL means scalar
+static void (*yuv2rgb_simd)(unsigned char*, unsigned char*, unsigned char*,
+                            unsigned char*, int, int, bool) = NULL;
+static void (*rgb2yuv_simd)(int, int, unsigned char*,
+                            unsigned char*, unsigned char*) = NULL;
+static void (*area_row_simd)(const unsigned char*, float*, int, float) = NULL;
 
 // Table used for RGB to YUV420 conversion
 static void InitLookupTable(void) {
@@ -83,6 +96,10 @@ void ConvertRGBToYUV420p(int w,
                          unsigned char* rgb,
                          unsigned char* yuv, 
                          unsigned char* work_space) {
+  if (rgb2yuv_simd != NULL) {
+    rgb2yuv_simd(w, h, rgb, yuv, work_space);
+    return;
+  }
   int i,j;
   unsigned char *u,*v,*y,*uu,*vv;
   unsigned char *pu1,*pu2,*pu3,*pu4;
@@ -246,13 +263,406 @@ static void ConvertYuv420pToRGB24(unsigned char *src0,
   }
 }
 
+/* SIMD kernels, the integer math is the same as the tables above,
+ * rgb to yuv multiplies in float and truncates like the table init does,
+ * so the outputs are bit-exact with the scalar path.
+ * 16 pixels each loop, the rest of the row is done by scalar code */
+
+// pshufb masks, interleave r,g,b to rgb24: [out][channel]
+static const int8_t rgb_out_mask[3][3][16] = {
+  {{0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1, -1, 5},
+   {-1, 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1, -1},
+   {-1, -1, 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1}},
+  {{-1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1, 10, -1},
+   {5, -1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1, 10},
+   {-1, 5, -1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1}},
+  {{-1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15, -1, -1},
+   {-1, -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15, -1},
+   {10, -1, -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15}},
+};
+// pshufb masks, rgb24 to r,g,b: [channel][in]
+static const int8_t rgb_in_mask[3][3][16] = {
+  {{0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+   {-1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14, -1, -1, -1, -1, -1},
+   {-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 1, 4, 7, 10, 13}},
+  {{1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+   {-1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1},
+   {-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14}},
+  {{2, 5, 8, 11, 14, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+   {-1, -1, -1, -1, -1, 1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1},
+   {-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15}},
+};
+// nv12 uv to u and v
+static const int8_t uv_mask[2][16] = {
+  {0, 2, 4, 6, 8, 10, 12, 14, -1, -1, -1, -1, -1, -1, -1, -1},
+  {1, 3, 5, 7, 9, 11, 13, 15, -1, -1, -1, -1, -1, -1, -1, -1},
+};
+
+// scalar yuv to rgb of columns [start, width) in two rows
+static void Yuv2RGBTail(unsigned char* py1, unsigned char* py2,
+                        unsigned char* pu, unsigned char* pv, int step,
+                        unsigned char* d1, unsigned char* d2,
+                        int start, int width) {
+  for (int i = start; i < width; i += 2) {
+    int u = pu[i/2*step];
+    int v = pv[i/2*step];
+    int c1 = crv_tab[v];
+    int c2 = cgu_tab[u];
+    int c3 = cgv_tab[v];
+    int c4 = cbu_tab[u];
+    for (int k = i; k < i + 2; k ++) {
+      int y1 = tab_76309[py1[k]];
+      d1[3*k] = clp[384+((y1 + c1)>>16)];
+      d1[3*k+1] = clp[384+((y1 - c2 - c3)>>16)];
+      d1[3*k+2] = clp[384+((y1 + c4)>>16)];
+      int y2 = tab_76309[py2[k]];
+      d2[3*k] = clp[384+((y2 + c1)>>16)];
+      d2[3*k+1] = clp[384+((y2 - c2 - c3)>>16)];
+      d2[3*k+2] = clp[384+((y2 + c4)>>16)];
+    }
+  }
+}
+
+// scalar rgb to full size y,u,v of pixels [start, w) in one row
+static void RGB2YuvTail(unsigned char* rgb, unsigned char* y, unsigned char* u,
+                        unsigned char* v, int start, int w) {
+  for (int i = start; i < w; i ++) {
+    unsigned char r = rgb[3*i], g = rgb[3*i+1], b = rgb[3*i+2];
+    y[i]=( RGB2YUV_YR[r] +RGB2YUV_YG[g]+RGB2YUV_YB[b]+1048576)>>16;
+    u[i]=(-RGB2YUV_UR[r] -RGB2YUV_UG[g]+RGB2YUV_UBVR[b]+8388608)>>16;
+    v[i]=( RGB2YUV_UBVR[r]-RGB2YUV_VG[g]-RGB2YUV_VB[b]+8388608)>>16;
+  }
+}
+
+__attribute__((target("sse4.1")))
+static inline __m128i LoadMask(const int8_t* mask) {
+  return _mm_loadu_si128((const __m128i* )mask);
+}
+
+__attribute__((target("sse4.1")))
+static inline void StoreRGB24(__m128i r, __m128i g, __m128i b, unsigned char* dst) {
+  for (int j = 0; j < 3; j ++) {
+    __m128i out = _mm_or_si128(_mm_shuffle_epi8(r, LoadMask(rgb_out_mask[j][0])),
+                               _mm_shuffle_epi8(g, LoadMask(rgb_out_mask[j][1])));
+    out = _mm_or_si128(out, _mm_shuffle_epi8(b, LoadMask(rgb_out_mask[j][2])));
+    _mm_storeu_si128((__m128i* )(dst + 16*j), out);
+  }
+}
+
+__attribute__((target("sse4.1")))
+static inline void LoadRGB24(unsigned char* src, __m128i* rgb) {
+  __m128i in[3];
+  for (int j = 0; j < 3; j ++) {
+    in[j] = _mm_loadu_si128((const __m128i* )(src + 16*j));
+  }
+  for (int c = 0; c < 3; c ++) {
+    __m128i x = _mm_or_si128(_mm_shuffle_epi8(in[0], LoadMask(rgb_in_mask[c][0])),
+                             _mm_shuffle_epi8(in[1], LoadMask(rgb_in_mask[c][1])));
+    rgb[c] = _mm_or_si128(x, _mm_shuffle_epi8(in[2], LoadMask(rgb_in_mask[c][2])));
+  }
+}
+
+// load chroma of 16 pixels, each u/v is used by two pixels
+__attribute__((target("sse4.1")))
+static inline void LoadChroma(unsigned char* pu, unsigned char* pv, int i,
+                              bool nv12, __m128i& u, __m128i& v) {
+  if (nv12) {
+    __m128i uv = _mm_loadu_si128((const __m128i* )(pu + i));
+    u = _mm_shuffle_epi8(uv, LoadMask(uv_mask[0]));
+    v = _mm_shuffle_epi8(uv, LoadMask(uv_mask[1]));
+  } else {
+    u = _mm_loadl_epi64((const __m128i* )(pu + i/2));
+    v = _mm_loadl_epi64((const __m128i* )(pv + i/2));
+  }
+  u = _mm_unpacklo_epi8(u, u);
+  v = _mm_unpacklo_epi8(v, v);
+}
+
+// (float)k * (x<<8), truncated as the tables
+__attribute__((target("sse4.1")))
+static inline __m128i RGBTerm(__m128i x, __m128 k) {
+  return _mm_cvttps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(_mm_slli_epi32(x, 8)), k));
+}
+
+// average 2x2 of full size u/v, same as scalar (a+b+c+d)>>2
+__attribute__((target("sse4.1")))
+static void SubsampleRow(unsigned char* p1, unsigned char* p2,
+                         unsigned char* out, int w) {
+  const __m128i ones = _mm_set1_epi8(1);
+  int i = 0;
+  for (; i + 32 <= w; i += 32) {
+    __m128i s0 = _mm_add_epi16(
+      _mm_maddubs_epi16(_mm_loadu_si128((const __m128i* )(p1 + i)), ones),
+      _mm_maddubs_epi16(_mm_loadu_si128((const __m128i* )(p2 + i)), ones));
+    __m128i s1 = _mm_add_epi16(
+      _mm_maddubs_epi16(_mm_loadu_si128((const __m128i* )(p1 + i + 16)), ones),
+      _mm_maddubs_epi16(_mm_loadu_si128((const __m128i* )(p2 + i + 16)), ones));
+    _mm_storeu_si128((__m128i* )(out + i/2),
+                     _mm_packus_epi16(_mm_srli_epi16(s0, 2), _mm_srli_epi16(s1, 2)));
+  }
+  for (; i < w; i += 2) {
+    out[i/2] = (p1[i] + p1[i+1] + p2[i] + p2[i+1])>>2;
+  }
+}
+
+__attribute__((target("sse4.1")))
+static void Yuv2RGB24_SSE41(unsigned char* src0, unsigned char* src1,
+                            unsigned char* src2, unsigned char* dst,
+                            int width, int height, bool nv12) {
+  const __m128i k16 = _mm_set1_epi32(16), k128 = _mm_set1_epi32(128);
+  const __m128i ky = _mm_set1_epi32(76309), kcrv = _mm_set1_epi32(104597);
+  const __m128i kcbu = _mm_set1_epi32(132201), kcgu = _mm_set1_epi32(25675);
+  const __m128i kcgv = _mm_set1_epi32(53279);
+  for (int j = 0; j < height; j += 2) {
+    unsigned char* py1 = src0 + j*width;
+    unsigned char* py2 = py1 + width;
+    unsigned char* d1 = dst + 3*j*width;
+    unsigned char* d2 = d1 + 3*width;
+    unsigned char* pu = nv12 ? src1 + j/2*width : src1 + j/2*(width/2);
+    unsigned char* pv = nv12 ? pu + 1 : src2 + j/2*(width/2);
+    int i = 0;
+    for (; i + 16 <= width; i += 16) {
+      __m128i u, v, cr[4], cg[4], cb[4];
+      LoadChroma(pu, pv, i, nv12, u, v);
+      for (int q = 0; q < 4; q ++) {
+        __m128i c = _mm_sub_epi32(_mm_cvtepu8_epi32(u), k128);
+        __m128i d = _mm_sub_epi32(_mm_cvtepu8_epi32(v), k128);
+        u = _mm_srli_si128(u, 4);
+        v = _mm_srli_si128(v, 4);
+        cr[q] = _mm_mullo_epi32(d, kcrv);
+        cg[q] = _mm_add_epi32(_mm_mullo_epi32(c, kcgu), _mm_mullo_epi32(d, kcgv));
+        cb[q] = _mm_mullo_epi32(c, kcbu);
+      }
+      unsigned char* py[2] = {py1 + i, py2 + i};
+      unsigned char* pd[2] = {d1 + 3*i, d2 + 3*i};
+      for (int k = 0; k < 2; k ++) {
+        __m128i y = _mm_loadu_si128((const __m128i* )py[k]);
+        __m128i r32[4], g32[4], b32[4];
+        for (int q = 0; q < 4; q ++) {
+          __m128i y32 = _mm_mullo_epi32(_mm_sub_epi32(_mm_cvtepu8_epi32(y), k16), ky);
+          y = _mm_srli_si128(y, 4);
+          r32[q] = _mm_srai_epi32(_mm_add_epi32(y32, cr[q]), 16);
+          g32[q] = _mm_srai_epi32(_mm_sub_epi32(y32, cg[q]), 16);
+          b32[q] = _mm_srai_epi32(_mm_add_epi32(y32, cb[q]), 16);
+        }
+        // saturation works as clp
+        __m128i r = _mm_packus_epi16(_mm_packs_epi32(r32[0], r32[1]),
+                                     _mm_packs_epi32(r32[2], r32[3]));
+        __m128i g = _mm_packus_epi16(_mm_packs_epi32(g32[0], g32[1]),
+                                     _mm_packs_epi32(g32[2], g32[3]));
+        __m128i b = _mm_packus_epi16(_mm_packs_epi32(b32[0], b32[1]),
+                                     _mm_packs_epi32(b32[2], b32[3]));
+        StoreRGB24(r, g, b, pd[k]);
+      }
+    }
+    Yuv2RGBTail(py1, py2, pu, pv, nv12 ? 2 : 1, d1, d2, i, width);
+  }
+}
+
+__attribute__((target("avx2")))
+static inline __m128i Pack32To8(__m256i a, __m256i b) {
+  __m256i x = _mm256_permute4x64_epi64(_mm256_packs_epi32(a, b), 0xD8);
+  return _mm_packus_epi16(_mm256_castsi256_si128(x), _mm256_extracti128_si256(x, 1));
+}
+
+__attribute__((target("avx2")))
+static void Yuv2RGB24_AVX2(unsigned char* src0, unsigned char* src1,
+                           unsigned char* src2, unsigned char* dst,
+                           int width, int height, bool nv12) {
+  const __m256i k16 = _mm256_set1_epi32(16), k128 = _mm256_set1_epi32(128);
+  const __m256i ky = _mm256_set1_epi32(76309), kcrv = _mm256_set1_epi32(104597);
+  const __m256i kcbu = _mm256_set1_epi32(132201), kcgu = _mm256_set1_epi32(25675);
+  const __m256i kcgv = _mm256_set1_epi32(53279);
+  for (int j = 0; j < height; j += 2) {
+    unsigned char* py1 = src0 + j*width;
+    unsigned char* py2 = py1 + width;
+    unsigned char* d1 = dst + 3*j*width;
+    unsigned char* d2 = d1 + 3*width;
+    unsigned char* pu = nv12 ? src1 + j/2*width : src1 + j/2*(width/2);
+    unsigned char* pv = nv12 ? pu + 1 : src2 + j/2*(width/2);
+    int i = 0;
+    for (; i + 16 <= width; i += 16) {
+      __m128i u, v;
+      __m256i cr[2], cg[2], cb[2];
+      LoadChroma(pu, pv, i, nv12, u, v);
+      for (int q = 0; q < 2; q ++) {
+        __m256i c = _mm256_sub_epi32(_mm256_cvtepu8_epi32(u), k128);
+        __m256i d = _mm256_sub_epi32(_mm256_cvtepu8_epi32(v), k128);
+        u = _mm_srli_si128(u, 8);
+        v = _mm_srli_si128(v, 8);
+        cr[q] = _mm256_mullo_epi32(d, kcrv);
+        cg[q] = _mm256_add_epi32(_mm256_mullo_epi32(c, kcgu), _mm256_mullo_epi32(d, kcgv));
+        cb[q] = _mm256_mullo_epi32(c, kcbu);
+      }
+      unsigned char* py[2] = {py1 + i, py2 + i};
+      unsigned char* pd[2] = {d1 + 3*i, d2 + 3*i};
+      for (int k = 0; k < 2; k ++) {
+        __m128i y = _mm_loadu_si128((const __m128i* )py[k]);
+        __m256i r32[2], g32[2], b32[2];
+        for (int q = 0; q < 2; q ++) {
+          __m256i y32 = _mm256_mullo_epi32(_mm256_sub_epi32(_mm256_cvtepu8_epi32(y), k16), ky);
+          y = _mm_srli_si128(y, 8);
+          r32[q] = _mm256_srai_epi32(_mm256_add_epi32(y32, cr[q]), 16);
+          g32[q] = _mm256_srai_epi32(_mm256_sub_epi32(y32, cg[q]), 16);
+          b32[q] = _mm256_srai_epi32(_mm256_add_epi32(y32, cb[q]), 16);
+        }
+        StoreRGB24(Pack32To8(r32[0], r32[1]), Pack32To8(g32[0], g32[1]),
+                   Pack32To8(b32[0], b32[1]), pd[k]);
+      }
+    }
+    Yuv2RGBTail(py1, py2, pu, pv, nv12 ? 2 : 1, d1, d2, i, width);
+  }
+}
+
+__attribute__((target("sse4.1")))
+static void RGB2Yuv420p_SSE41(int w, int h, unsigned char* rgb,
+                              unsigned char* yuv, unsigned char* work_space) {
+  const __m128 kyr = _mm_set1_ps((float)65.481), kyg = _mm_set1_ps((float)128.553);
+  const __m128 kyb = _mm_set1_ps((float)24.966), kur = _mm_set1_ps((float)37.797);
+  const __m128 kug = _mm_set1_ps((float)74.203), kvg = _mm_set1_ps((float)93.786);
+  const __m128 kvb = _mm_set1_ps((float)18.214), kubvr = _mm_set1_ps((float)112);
+  const __m128i ky = _mm_set1_epi32(1048576), kuv = _mm_set1_epi32(8388608);
+  unsigned char* uu = work_space;
+  unsigned char* vv = work_space + w*h;
+  for (int j = 0; j < h; j ++) {
+    unsigned char* src = rgb + 3*j*w;
+    unsigned char* y = yuv + j*w;
+    unsigned char* u = uu + j*w;
+    unsigned char* v = vv + j*w;
+    int i = 0;
+    for (; i + 16 <= w; i += 16) {
+      __m128i c[3], y32[4], u32[4], v32[4];
+      LoadRGB24(src + 3*i, c);
+      for (int q = 0; q < 4; q ++) {
+        __m128i r = _mm_cvtepu8_epi32(c[0]);
+        __m128i g = _mm_cvtepu8_epi32(c[1]);
+        __m128i b = _mm_cvtepu8_epi32(c[2]);
+        c[0] = _mm_srli_si128(c[0], 4);
+        c[1] = _mm_srli_si128(c[1], 4);
+        c[2] = _mm_srli_si128(c[2], 4);
+        __m128i x = _mm_add_epi32(RGBTerm(r, kyr), RGBTerm(g, kyg));
+        x = _mm_add_epi32(_mm_add_epi32(x, RGBTerm(b, kyb)), ky);
+        y32[q] = _mm_srai_epi32(x, 16);
+        x = _mm_sub_epi32(RGBTerm(b, kubvr), RGBTerm(r, kur));
+        x = _mm_add_epi32(_mm_sub_epi32(x, RGBTerm(g, kug)), kuv);
+        u32[q] = _mm_srai_epi32(x, 16);
+        x = _mm_sub_epi32(RGBTerm(r, kubvr), RGBTerm(g, kvg));
+        x = _mm_add_epi32(_mm_sub_epi32(x, RGBTerm(b, kvb)), kuv);
+        v32[q] = _mm_srai_epi32(x, 16);
+      }
+      _mm_storeu_si128((__m128i* )(y + i), _mm_packus_epi16(
+        _mm_packs_epi32(y32[0], y32[1]), _mm_packs_epi32(y32[2], y32[3])));
+      _mm_storeu_si128((__m128i* )(u + i), _mm_packus_epi16(
+        _mm_packs_epi32(u32[0], u32[1]), _mm_packs_epi32(u32[2], u32[3])));
+      _mm_storeu_si128((__m128i* )(v + i), _mm_packus_epi16(
+        _mm_packs_epi32(v32[0], v32[1]), _mm_packs_epi32(v32[2], v32[3])));
+    }
+    RGB2YuvTail(src, y, u, v, i, w);
+  }
+  unsigned char* u = yuv + w*h;
+  unsigned char* v = u + (w*h)/4;
+  for (int j = 0; j < h; j += 2) {
+    SubsampleRow(uu + j*w, uu + (j+1)*w, u + j/2*(w/2), w);
+    SubsampleRow(vv + j*w, vv + (j+1)*w, v + j/2*(w/2), w);
+  }
+}
+
+__attribute__((target("avx2")))
+static inline __m256i RGBTerm256(__m256i x, __m256 k) {
+  return _mm256_cvttps_epi32(_mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_slli_epi32(x, 8)), k));
+}
+
+__attribute__((target("avx2")))
+static void RGB2Yuv420p_AVX2(int w, int h, unsigned char* rgb,
+                             unsigned char* yuv, unsigned char* work_space) {
+  const __m256 kyr = _mm256_set1_ps((float)65.481), kyg = _mm256_set1_ps((float)128.553);
+  const __m256 kyb = _mm256_set1_ps((float)24.966), kur = _mm256_set1_ps((float)37.797);
+  const __m256 kug = _mm256_set1_ps((float)74.203), kvg = _mm256_set1_ps((float)93.786);
+  const __m256 kvb = _mm256_set1_ps((float)18.214), kubvr = _mm256_set1_ps((float)112);
+  const __m256i ky = _mm256_set1_epi32(1048576), kuv = _mm256_set1_epi32(8388608);
+  unsigned char* uu = work_space;
+  unsigned char* vv = work_space + w*h;
+  for (int j = 0; j < h; j ++) {
+    unsigned char* src = rgb + 3*j*w;
+    unsigned char* y = yuv + j*w;
+    unsigned char* u = uu + j*w;
+    unsigned char* v = vv + j*w;
+    int i = 0;
+    for (; i + 16 <= w; i += 16) {
+      __m128i c[3];
+      __m256i y32[2], u32[2], v32[2];
+      LoadRGB24(src + 3*i, c);
+      for (int q = 0; q < 2; q ++) {
+        __m256i r = _mm256_cvtepu8_epi32(c[0]);
+        __m256i g = _mm256_cvtepu8_epi32(c[1]);
+        __m256i b = _mm256_cvtepu8_epi32(c[2]);
+        c[0] = _mm_srli_si128(c[0], 8);
+        c[1] = _mm_srli_si128(c[1], 8);
+        c[2] = _mm_srli_si128(c[2], 8);
+        __m256i x = _mm256_add_epi32(RGBTerm256(r, kyr), RGBTerm256(g, kyg));
+        x = _mm256_add_epi32(_mm256_add_epi32(x, RGBTerm256(b, kyb)), ky);
+        y32[q] = _mm256_srai_epi32(x, 16);
+        x = _mm256_sub_epi32(RGBTerm256(b, kubvr), RGBTerm256(r, kur));
+        x = _mm256_add_epi32(_mm256_sub_epi32(x, RGBTerm256(g, kug)), kuv);
+        u32[q] = _mm256_srai_epi32(x, 16);
+        x = _mm256_sub_epi32(RGBTerm256(r, kubvr), RGBTerm256(g, kvg));
+        x = _mm256_add_epi32(_mm256_sub_epi32(x, RGBTerm256(b, kvb)), kuv);
+        v32[q] = _mm256_srai_epi32(x, 16);
+      }
+      _mm_storeu_si128((__m128i* )(y + i), Pack32To8(y32[0], y32[1]));
+      _mm_storeu_si128((__m128i* )(u + i), Pack32To8(u32[0], u32[1]));
+      _mm_storeu_si128((__m128i* )(v + i), Pack32To8(v32[0], v32[1]));
+    }
+    RGB2YuvTail(src, y, u, v, i, w);
+  }
+  unsigned char* u = yuv + w*h;
+  unsigned char* v = u + (w*h)/4;
+  for (int j = 0; j < h; j += 2) {
+    SubsampleRow(uu + j*w, uu + (j+1)*w, u + j/2*(w/2), w);
+    SubsampleRow(vv + j*w, vv + (j+1)*w, v + j/2*(w/2), w);
+  }
+}
+
+// acc += row*alpha of n bytes, rows of a blob row weighted by area resize
+static void AreaAddRow(const unsigned char* row, float* acc, int n, float alpha) {
+  for (int i = 0; i < n; i ++) {
+    acc[i] += row[i]*alpha;
+  }
+}
+
+__attribute__((target("sse4.1")))
+static void AreaAddRow_SSE41(const unsigned char* row, float* acc, int n, float alpha) {
+  const __m128 a = _mm_set1_ps(alpha);
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m128 x = _mm_cvtepi32_ps(_mm_cvtepu8_epi32(_mm_cvtsi32_si128(*(const int* )(row + i))));
+    _mm_storeu_ps(acc + i, _mm_add_ps(_mm_loadu_ps(acc + i), _mm_mul_ps(x, a)));
+  }
+  AreaAddRow(row + i, acc + i, n - i, alpha);
+}
+
+__attribute__((target("avx2")))
+static void AreaAddRow_AVX2(const unsigned char* row, float* acc, int n, float alpha) {
+  const __m256 a = _mm256_set1_ps(alpha);
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m128i b = _mm_loadl_epi64((const __m128i* )(row + i));
+    __m256 x = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(b));
+    _mm256_storeu_ps(acc + i, _mm256_add_ps(_mm256_loadu_ps(acc + i), _mm256_mul_ps(x, a)));
+  }
+  AreaAddRow(row + i, acc + i, n - i, alpha);
+}
+
 // Convert from YUV420 to RGB24
 void ConvertYUV2RGB(unsigned char *src0,
                     unsigned char *src1,
                     unsigned char *src2,
                     unsigned char *dst_ori, 
                     int width,int height, int format) {
-  if (format == AV_PIX_FMT_NV12) {
+  if (yuv2rgb_simd != NULL && (format == AV_PIX_FMT_NV12 ||
+      format == AV_PIX_FMT_YUVJ420P || format == AV_PIX_FMT_YUV420P)) {
+    yuv2rgb_simd(src0, src1, src2, dst_ori, width, height, format == AV_PIX_FMT_NV12);
+  } else if (format == AV_PIX_FMT_NV12) {
     ConvertNv12ToRGB24(src0, src1, dst_ori, width, height);
   } else if (format == AV_PIX_FMT_YUVJ420P || format == AV_PIX_FMT_YUV420P) {
     ConvertYuv420pToRGB24(src0, src1, src2, dst_ori, width, height);
@@ -261,6 +671,136 @@ void ConvertYUV2RGB(unsigned char *src0,
   }
 }
 
+// one source pixel of a blob pixel and its weight
+typedef struct {
+  int di;
+  int si;
+  float alpha;
+} AreaTab;
+
+// weights of one axis, the same as INTER_AREA of cv::resize,
+// ordered by blob pixel and then source pixel
+static void AreaTabs(int src, int dst, std::vector<AreaTab>& tab) {
+  double scale = (double)src/dst;
+  tab.clear();
+  for (int dx = 0; dx < dst; dx ++) {
+    double fsx1 = dx*scale;
+    double fsx2 = fsx1 + scale;
+    double cell = std::min(scale, src - fsx1);
+    int sx1 = (int)ceil(fsx1);
+    int sx2 = std::min((int)floor(fsx2), src - 1);
+    sx1 = std::min(sx1, sx2);
+    if (sx1 - fsx1 > 1e-3) {
+      tab.push_back({dx, sx1 - 1, (float)((sx1 - fsx1)/cell)});
+    }
+    for (int sx = sx1; sx < sx2; sx ++) {
+      tab.push_back({dx, sx, (float)(1.0/cell)});
+    }
+    if (fsx2 - sx2 > 1e-3) {
+      tab.push_back({dx, sx2, (float)(std::min(std::min(fsx2 - sx2, 1.0), cell)/cell)});
+    }
+  }
+}
+
+// the rows of frame are converted to rgb in pairs by the simd kernels,
+// then resized in rgb like cv::resize INTER_AREA and normalized, rounded
+// to pixel values first, so the blob is the same as blobFromImage of
+// the resized rgb frame
+int ConvertYUV2Blob(unsigned char *src0,
+                    unsigned char *src1,
+                    unsigned char *src2,
+                    int width, int height, int format,
+                    const BlobParams* params, float* dst) {
+  bool nv12 = (format == AV_PIX_FMT_NV12);
+  if (!nv12 && format != AV_PIX_FMT_YUVJ420P && format != AV_PIX_FMT_YUV420P) {
+    printf("not support yuv format : %d\n", format);
+    return -1;
+  }
+  int bw = params->width;
+  int bh = params->height;
+  int rw = params->resize_w < bw ? params->resize_w : bw;
+  int rh = params->resize_h < bh ? params->resize_h : bh;
+  if (rw <= 0 || rh <= 0 || width <= 0 || height <= 0) {
+    return -1;
+  }
+  // normalized value of every pixel value, no multiply in the loop
+  float lut[3][256];
+  for (int c = 0; c < 3; c ++) {
+    for (int i = 0; i < 256; i ++) {
+      lut[c][i] = (i - params->mean[c]) * params->scale[c];
+    }
+  }
+  size_t plane = (size_t)bw*bh;
+  float* pc[3];
+  pc[0] = dst + (params->bgr ? 2 : 0)*plane;
+  pc[1] = dst + plane;
+  pc[2] = dst + (params->bgr ? 0 : 2)*plane;
+  // kept by the thread, frames of a channel have the same size
+  static thread_local std::vector<AreaTab> xtab, ytab;
+  static thread_local std::vector<unsigned char> rgb;
+  static thread_local std::vector<float> acc;
+  static thread_local std::vector<int> xofs;
+  AreaTabs(width, rw, xtab);
+  AreaTabs(height, rh, ytab);
+  // weights of blob column i are xtab[xofs[i], xofs[i + 1])
+  xofs.assign(rw + 1, (int)xtab.size());
+  for (int n = (int)xtab.size() - 1; n >= 0; n --) {
+    xofs[xtab[n].di] = n;
+  }
+  rgb.resize((size_t)6*width);
+  acc.resize((size_t)3*width);
+  auto add_row = area_row_simd != NULL ? area_row_simd : AreaAddRow;
+  // the sums of whole boxes round half up, others to even, as opencv does
+  bool whole = width % rw == 0 && height % rh == 0;
+  int pair = -1;
+  int row = 0;
+  std::fill(acc.begin(), acc.end(), 0.0f);
+  for (size_t k = 0; k <= ytab.size(); k ++) {
+    // the source rows of blob row are added, resize it in width
+    if (k == ytab.size() || ytab[k].di != row) {
+      size_t off = (size_t)row*bw;
+      for (int i = 0; i < rw; i ++) {
+        float sum[3] = {0, 0, 0};
+        for (int n = xofs[i]; n < xofs[i + 1]; n ++) {
+          const float* p = acc.data() + 3*xtab[n].si;
+          float a = xtab[n].alpha;
+          sum[0] += p[0]*a;
+          sum[1] += p[1]*a;
+          sum[2] += p[2]*a;
+        }
+        for (int c = 0; c < 3; c ++) {
+          int v = whole ? (int)(sum[c] + 0.5f) : _mm_cvt_ss2si(_mm_set_ss(sum[c]));
+          pc[c][off + i] = lut[c][v > 255 ? 255 : v];
+        }
+      }
+      for (int i = rw; i < bw; i ++) {
+        for (int c = 0; c < 3; c ++) {
+          pc[c][off + i] = lut[c][0];
+        }
+      }
+      if (k == ytab.size()) {
+        break;
+      }
+      row = ytab[k].di;
+      std::fill(acc.begin(), acc.end(), 0.0f);
+    }
+    int y = ytab[k].si;
+    if (y/2 != pair) {
+      pair = y/2;
+      unsigned char* u = nv12 ? src1 + (size_t)pair*width : src1 + (size_t)pair*(width/2);
+      unsigned char* v = nv12 ? NULL : src2 + (size_t)pair*(width/2);
+      ConvertYUV2RGB(src0 + (size_t)2*pair*width, u, v, rgb.data(), width, 2, format);
+    }
+    add_row(rgb.data() + (size_t)3*width*(y & 1), acc.data(), 3*width, ytab[k].alpha);
+  }
+  for (size_t k = (size_t)rh*bw; k < plane; k ++) {
+    for (int c = 0; c < 3; c ++) {
+      pc[c][k] = lut[c][0];
+    }
+  }
+  return 0;
+}
+
 void RGBInit(void) {
   static int init = 0;
   if (__sync_add_and_fetch(&init, 1) > 1) {
@@ -268,6 +808,16 @@ void RGBInit(void) {
   }
   InitLookupTable();
   InitConvertTable();
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    yuv2rgb_simd = Yuv2RGB24_AVX2;
+    rgb2yuv_simd = RGB2Yuv420p_AVX2;
+    area_row_simd = AreaAddRow_AVX2;
+  } else if (__builtin_cpu_supports("sse4.1")) {
+    yuv2rgb_simd = Yuv2RGB24_SSE41;
+    rgb2yuv_simd = RGB2Yuv420p_SSE41;
+    area_row_simd = AreaAddRow_SSE41;
+  }
 }
 
 void FFmpegInit(void) {
@@ -280,3 +830,111 @@ void FFmpegInit(void) {
   av_log_set_level(AV_LOG_FATAL);
 }
 
+void DecodeRateInit(DecodeRate* rate, int skip, int fps) {
+  rate->skip = skip > 0 ? skip : 1;
+  rate->fps = fps > 0 ? fps : 0;
+  rate->discard = AVDISCARD_DEFAULT;
+  rate->frames = 0;
+  rate->key_id = -1;
+  rate->gop = 0;
+  rate->next_id = 0;
+}
+
+void DecodeRateSet(DecodeRate* rate, int skip, int fps) {
+  rate->skip = skip > 0 ? skip : 1;
+  rate->fps = fps > 0 ? fps : 0;
+}
+
+// frames between two outputs
+static double DecodeInterval(DecodeRate* rate, AVCodecContext* ctx) {
+  if (rate->fps <= 0) {
+    return rate->skip;
+  }
+  double src_fps = 25;
+  if (ctx->framerate.num > 0 && ctx->framerate.den > 0) {
+    src_fps = av_q2d(ctx->framerate);
+  }
+  return src_fps / rate->fps;
+}
+
+bool DecodeRateActive(DecodeRate* rate, AVCodecContext* ctx) {
+  return DecodeInterval(rate, ctx) > 1;
+}
+
+// the first slice of a frame, 0 if it is not, 1 for a delta frame, 2 for a key frame
+static int FrameStart(int codec, const unsigned char* nal, int size) {
+  if (codec == VIDEO_CODEC_H265) {
+    int type = (nal[0] >> 1) & 0x3f;
+    // first_slice_segment_in_pic_flag
+    if (type >= 32 || size < 3 || !(nal[2] & 0x80)) {
+      return 0;
+    }
+    return VideoNalKey(codec, type) ? 2 : 1;
+  }
+  int type = nal[0] & 0x1f;
+  // first_mb_in_slice is 0, ue(v) coded as a single 1 bit
+  if (type < 1 || type > 5 || size < 2 || !(nal[1] & 0x80)) {
+    return 0;
+  }
+  return type == 5 ? 2 : 1;
+}
+
+void DecodeRateUpdate(DecodeRate* rate, AVCodecContext* ctx, const char* data, int size) {
+  int codec = ctx->codec_id == AV_CODEC_ID_HEVC ? VIDEO_CODEC_H265 : VIDEO_CODEC_H264;
+  const unsigned char* p = (const unsigned char* )data;
+  int key = 0;
+  // every nal after a start code
+  for (int i = 0; i + 3 < size; i ++) {
+    if (p[i] != 0 || p[i+1] != 0 || p[i+2] != 1) {
+      continue;
+    }
+    int start = FrameStart(codec, p + i + 3, size - i - 3);
+    if (start > 0) {
+      rate->frames ++;
+      key = start == 2 ? 1 : 0;
+    }
+    i += 2;
+  }
+  if (!key) {
+    return;
+  }
+  int64_t key_id = rate->frames - 1;
+  if (rate->key_id >= 0 && key_id > rate->key_id) {
+    rate->gop = (int)(key_id - rate->key_id);
+  }
+  rate->key_id = key_id;
+  // no reference is lost at key frame, the discard mode changes here only
+  double interval = DecodeInterval(rate, ctx);
+  int discard = AVDISCARD_DEFAULT;
+  if (interval >= 2) {
+    discard = (rate->gop > 0 && interval >= rate->gop) ? AVDISCARD_NONKEY : AVDISCARD_NONREF;
+  }
+  if (discard != rate->discard) {
+    rate->discard = discard;
+    ctx->skip_frame = (enum AVDiscard)discard;
+  }
+}
+
+bool DecodeRateOutput(DecodeRate* rate, AVCodecContext* ctx) {
+  double interval = DecodeInterval(rate, ctx);
+  if (interval <= 1) {
+    return true;
+  }
+  int64_t frame_id = rate->frames - 1;
+  // decoded frames are spacing apart, take the one nearest to next_id
+  double spacing = rate->discard == AVDISCARD_NONKEY ? rate->gop : 1;
+  if (frame_id + spacing/2 < rate->next_id) {
+    return false;
+  }
+  rate->next_id += interval;
+  if (rate->next_id <= frame_id) {
+    rate->next_id = frame_id + interval;
+  }
+  return true;
+}
+
+void FreeAVPacket(void* opaque) {
+  AVPacket* pkt = (AVPacket* )opaque;
+  av_packet_free(&pkt);
+}
+
@@ -19,8 +19,13 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+
+struct AVCodecContext;
 
 void FFmpegInit(void);
+// release callback of Packet::Wrap, opaque is AVPacket*
+void FreeAVPacket(void* opaque);
 void RGBInit(void);
 void ConvertYUV2RGB(unsigned char *src0,
                     unsigned char *src1,
@@ -33,5 +38,59 @@ void ConvertRGBToYUV420p(int w,
                          unsigned char* yuv, 
                          unsigned char* work_space);
 
+// Parameters of ConvertYUV2Blob
+typedef struct {
+  // blob size, the output is 1 x 3 x height x width float
+  int width;
+  int height;
+  // frame is resized to resize_w x resize_h at the top-left of blob,
+  // the rest is padded with pixel value 0
+  int resize_w;
+  int resize_h;
+  // out = (pixel - mean) * scale, channel order is r,g,b or b,g,r
+  float mean[3];
+  float scale[3];
+  bool bgr;
+} BlobParams;
+
+// Convert yuv420p/nv12 frame to the normalized NCHW float blob, the frame is
+// resized like cv::resize INTER_AREA of its rgb, without an rgb copy of it,
+// dst is supplied by caller and must hold 3*width*height floats
+int ConvertYUV2Blob(unsigned char *src0,
+                    unsigned char *src1,
+                    unsigned char *src2,
+                    int width, int height, int format,
+                    const BlobParams* params, float* dst);
+
+// Analysis rate of decoder, frames not to be analysed are discarded
+// by the decoder before reconstruction if the rate allows
+typedef struct {
+  // output every skip frames, used when fps is 0
+  int skip;
+  // target analysis fps, 0 means disabled
+  int fps;
+  // AVDiscard of decoder, only changed at key frame
+  int discard;
+  // access units sent to decoder, frame ids count packets, and parameter
+  // sets or sei may come in packets of their own
+  int64_t frames;
+  // frames at last key frame, -1 means none
+  int64_t key_id;
+  // frames between key frames, 0 means unknown
+  int gop;
+  // frames at next output
+  double next_id;
+} DecodeRate;
+
+void DecodeRateInit(DecodeRate* rate, int skip, int fps);
+// change skip and fps of a running decoder, the discard mode follows at next key frame
+void DecodeRateSet(DecodeRate* rate, int skip, int fps);
+// call before sending h264 or h265 packet to decoder, data is annex-b
+void DecodeRateUpdate(DecodeRate* rate, AVCodecContext* ctx, const char* data, int size);
+// call for each decoded frame, returns true if the frame is to be output
+bool DecodeRateOutput(DecodeRate* rate, AVCodecContext* ctx);
+// frames are dropped by the rate, plugins after the decoder should not skip again
+bool DecodeRateActive(DecodeRate* rate, AVCodecContext* ctx);
+
 #endif
 
@@ -0,0 +1,107 @@
+/****************************************************************************************
+ * Copyright (C) 2021 aistream <aistream@yeah.net>
+ *
+ * Licensed under the BSD 3-Clause License (the "License"); you may not use this
+ * file except in compliance with the License. You may obtain a copy of the License at
+ *
+ * https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Unless required by applicable law or agreed to in writing, software distributed
+ * under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+ * CONDITIONS OF ANY KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations under the License.
+ *
+ ***************************************************************************************/
+
+#include <stdio.h>
+#include <future>
+#include <event2/event.h>
+#include <event2/dns.h>
+#include "reactor.h"
+#include "share.h"
+#include "log.h"
+
+typedef struct {
+  std::function<void()> cb;
+  std::promise<void>* done;
+} ReactorCall;
+
+static void ReactorLoopRun(ReactorLoop* loop) {
+  event_base_loop(loop->base, EVLOOP_NO_EXIT_ON_EMPTY);
+}
+
+static void ReactorCallRun(evutil_socket_t fd, short what, void* arg) {
+  ReactorCall* call = (ReactorCall* )arg;
+  call->cb();
+  if (call->done != NULL) {
+    call->done->set_value();
+  }
+  delete call;
+}
+
+int Reactor::Start(int threads) {
+  threads = threads > 0 ? threads : 1;
+  LibevntInit();
+  std::unique_lock<std::mutex> lock(mtx);
+  for (int i = 0; i < threads; i ++) {
+    ReactorLoop* loop = new ReactorLoop();
+    loop->base = event_base_new();
+    if (loop->base == NULL) {
+      AppError("event base init failed");
+      delete loop;
+      return -1;
+    }
+    loop->dns = evdns_base_new(loop->base, EVDNS_BASE_INITIALIZE_NAMESERVERS);
+    loop->t = new std::thread(&ReactorLoopRun, loop);
+    loops.push_back(loop);
+  }
+  AppDebug("threads:%d", threads);
+  return 0;
+}
+
+void Reactor::Stop(void) {
+  std::unique_lock<std::mutex> lock(mtx);
+  for (auto loop : loops) {
+    event_base_loopbreak(loop->base);
+    if (loop->t->joinable()) {
+      loop->t->join();
+    }
+    delete loop->t;
+    // pending lookups are failed and completed before the base is gone
+    if (loop->dns != NULL) {
+      evdns_base_free(loop->dns, 1);
+      event_base_loop(loop->base, EVLOOP_NONBLOCK);
+    }
+    event_base_free(loop->base);
+    delete loop;
+  }
+  loops.clear();
+}
+
+ReactorLoop* Reactor::GetLoop(void) {
+  std::unique_lock<std::mutex> lock(mtx);
+  if (loops.empty()) {
+    return NULL;
+  }
+  return loops[next++ % loops.size()];
+}
+
+void Reactor::Run(ReactorLoop* loop, std::function<void()> cb, bool sync) {
+  if (loop->t->get_id() == std::this_thread::get_id()) {
+    cb();
+    return;
+  }
+  std::promise<void> done;
+  ReactorCall* call = new ReactorCall();
+  call->cb = cb;
+  call->done = sync ? &done : NULL;
+  struct timeval tv = {0, 0};
+  if (event_base_once(loop->base, -1, EV_TIMEOUT, ReactorCallRun, call, &tv) != 0) {
+    AppWarn("event once failed");
+    delete call;
+    return;
+  }
+  if (sync) {
+    done.get_future().wait();
+  }
+}
@@ -0,0 +1,51 @@
+/****************************************************************************************
+ * Copyright (C) 2021 aistream <aistream@yeah.net>
+ *
+ * Licensed under the BSD 3-Clause License (the "License"); you may not use this
+ * file except in compliance with the License. You may obtain a copy of the License at
+ *
+ * https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Unless required by applicable law or agreed to in writing, software distributed
+ * under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+ * CONDITIONS OF ANY KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations under the License.
+ *
+ ***************************************************************************************/
+
+#ifndef __AISTREAM_REACTOR_H__
+#define __AISTREAM_REACTOR_H__
+
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <functional>
+
+struct event_base;
+struct evdns_base;
+
+typedef struct {
+  struct event_base* base;
+  struct evdns_base* dns;
+  std::thread* t;
+} ReactorLoop;
+
+// Fixed pool of event loops, the sockets of many streams are multiplexed
+// on a few threads instead of one blocking thread per stream
+class Reactor {
+ public:
+  Reactor(void) {}
+  ~Reactor(void) {Stop();}
+  int Start(int threads);
+  void Stop(void);
+  // loop of a new stream, round robin
+  ReactorLoop* GetLoop(void);
+  // run cb in the thread of loop, wait for it to finish if sync
+  static void Run(ReactorLoop* loop, std::function<void()> cb, bool sync = false);
+ private:
+  std::mutex mtx;
+  std::vector<ReactorLoop*> loops;
+  size_t next = 0;
+};
+
+#endif
@@ -65,7 +65,7 @@ static void CopyToPacket(DebugParams* debug, TensorData* data) {
 extern "C" int DebugInit(ElementData* data, char* params) {
   share_params = GlobalConfig();
   strncpy(data->input_name[0], "debug_input", sizeof(data->input_name[0]));
-  data->queue_len = GetIntValFromFile(share_params.config_file, "video", "rgb_queue_len");
+  data->queue_len = data->config->GetInt("video", "rgb_queue_len");
   if (data->queue_len < 0) {
     data->queue_len = 10;
   }
@@ -16,6 +16,11 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <chrono>
+#include <deque>
+#include <map>
+#include <thread>
+#include <condition_variable>
 #include <opencv2/dnn.hpp>
 #include "opencv2/core.hpp"
 #include <opencv2/imgproc.hpp>
@@ -24,35 +29,104 @@
 #include "share.h"
 #include "common.h"
 #include "tensor.h"
+#include "trace.h"
 #include "log.h"
 
 using namespace cv;
 using namespace dnn;
 
+struct BatchChannel;
+struct FaceEngine;
+
+// thresholds of one element, applied to the outputs of the shared engine
+typedef struct {
+  float score_threshold;
+  float nms_threshold;
+  int top_k;
+  int skip;
+} DetectionConfig;
+
 typedef struct {
   int id;
   bool init;
+  FaceEngine* engine;
+  DetectionConfig config;
+  // frames submitted without waiting, see DetectionProcess
+  std::shared_ptr<BatchChannel> channel;
   int input_w;
   int input_h;
-  unsigned char* rgb_buf;
+  // input = frame * scale, padded to input_w x input_h at right and bottom
+  float scale;
+  BlobParams blob_params;
+  float* blob_buf;
   std::vector<cv::Rect2f> priors;
   std::vector<DetectionResult> result;
 } DetectionParams;
 
+// one frame waiting for batch forward
 typedef struct {
+  Mat blob;
+  std::chrono::steady_clock::time_point time;
+  // outputs point to the memory of batch outputs, holder keeps it alive
+  std::vector<cv::Mat> output_blobs;
+  std::shared_ptr<std::vector<cv::Mat>> holder;
+  bool done;
+  // Process waits for done, if channel is nullptr
+  std::mutex mtx;
+  std::condition_variable condition;
+  // or the frame is kept here and finished to channel
+  std::shared_ptr<BatchChannel> channel;
+  std::shared_ptr<char> frame;
+  HeadParams params;
+  // not forwarded, the results of the previous frame are used
+  bool skipped;
+} BatchRequest;
+
+// frames of one channel in the order of input, owned by it until taken,
+// ready of them at the front are done and told to the task by wake
+typedef struct BatchChannel {
+  std::mutex mtx;
+  std::deque<BatchRequest*> pending;
+  size_t ready;
+  std::function<void()> wake;
+  // the channel is stopped, requests are freed when done
+  bool stopped;
+} BatchChannel;
+
+// one engine for every model, input size and batch setting, the net is
+// loaded once and kept, the batch thread only runs while channels use it
+typedef struct FaceEngine {
   std::mutex mtx;
   Net net;
-  float score_threshold;
-  float nms_threshold;
-  int top_k;
-  int skip;
+  // network input size, 0 means the frame size
+  int input_w;
+  int input_h;
+  // frames from all channels are gathered to one blob,
+  // forward when max_batch frames arrived or max_delay_ms timeout
+  int max_batch;
+  int max_delay_ms;
+  std::mutex batch_mtx;
+  std::condition_variable batch_cond;
+  std::deque<BatchRequest*> batch_que;
+  // channels started, guarded by engines_mtx
+  int refs;
+  bool running;
+  std::thread thread;
 } FaceEngine;
 
-static FaceEngine* engine = NULL;
+static std::mutex engines_mtx;
+static std::map<std::string, FaceEngine*> engines;
+// Init and Start of an element run one after the other in its thread,
+// the engine found by Init is handed to Start
+static thread_local FaceEngine* init_engine = NULL;
+static thread_local DetectionConfig init_config;
+
 static cv::Mat postProcess(const std::vector<cv::Mat>& output_blobs, DetectionParams* detection) {
-  auto priors = detection->priors;
-  int inputW = detection->input_w;
-  int inputH = detection->input_h;
+  DetectionConfig* config = &detection->config;
+  auto& priors = detection->priors;
+  // letterbox is at the right and bottom, only scale back to frame
+  float inputW = detection->input_w / detection->scale;
+  float inputH = detection->input_h / detection->scale;
 
   // Extract from output_blobs
   cv::Mat loc = output_blobs[0];
@@ -140,8 +214,11 @@ static cv::Mat postProcess(const std::vector<cv::Mat>& output_blobs, DetectionPa
     }
 
     std::vector<int> keepIdx;
-    dnn::NMSBoxes(faceBoxes, faceScores, engine->score_threshold,
-                  engine->nms_threshold, keepIdx, 1.f, engine->top_k);
+    {
+      TRACE_SPAN(span, "plugin", "nms", 0, 0);
+      dnn::NMSBoxes(faceBoxes, faceScores, config->score_threshold,
+                    config->nms_threshold, keepIdx, 1.f, config->top_k);
+    }
 
     // Get NMS results
     cv::Mat nms_faces;
@@ -214,6 +291,156 @@ static void GeneratePriors(DetectionParams* detection) {
   }
 }
 
+static bool SameShape(BatchRequest* a, BatchRequest* b) {
+  return a->blob.size == b->blob.size;
+}
+
+static size_t BatchReadyNum(FaceEngine* engine, BatchRequest* first) {
+  size_t num = 0;
+  for (size_t i = 0; i < engine->batch_que.size(); i ++) {
+    if (SameShape(first, engine->batch_que[i])) {
+      num ++;
+    }
+  }
+  return num;
+}
+
+static void Forward(FaceEngine* engine, Mat& blob, std::vector<cv::Mat>& output_blobs) {
+  std::vector<cv::String> output_names = { "loc", "conf", "iou" };
+  TRACE_SPAN(span, "plugin", "forward", 0, 0);
+  engine->mtx.lock();
+  engine->net.setInput(blob);
+  engine->net.forward(output_blobs, output_names);
+  engine->mtx.unlock();
+}
+
+static bool BatchForward(FaceEngine* engine, std::vector<BatchRequest*>& batch) {
+  int num = batch.size();
+  const MatSize& size = batch[0]->blob.size;
+  int dims[4] = {num, size[1], size[2], size[3]};
+  Mat input(4, dims, CV_32F);
+  size_t total = batch[0]->blob.total();
+  for (int i = 0; i < num; i ++) {
+    memcpy(input.ptr<float>() + i*total, batch[i]->blob.ptr<float>(),
+           total*sizeof(float));
+  }
+  auto outputs = std::make_shared<std::vector<cv::Mat>>();
+  try {
+    Forward(engine, input, *outputs);
+  } catch (cv::Exception& e) {
+    AppWarn("batch %d forward failed, %s", num, e.what());
+    return false;
+  }
+  // scatter, every frame gets its slice of outputs
+  for (size_t k = 0; k < outputs->size(); k ++) {
+    Mat& out = (*outputs)[k];
+    if (!out.isContinuous() || out.total() % num != 0) {
+      AppWarn("batch %d, output %ld shape exception", num, k);
+      return false;
+    }
+  }
+  for (int i = 0; i < num; i ++) {
+    batch[i]->output_blobs.clear();
+    for (size_t k = 0; k < outputs->size(); k ++) {
+      Mat& out = (*outputs)[k];
+      int cnt = out.total() / num;
+      batch[i]->output_blobs.push_back(Mat(1, cnt, CV_32F, out.ptr<float>() + i*cnt));
+    }
+    batch[i]->holder = outputs;
+  }
+  return true;
+}
+
+// tell the task about the frames done at the front, called with channel->mtx
+static void BatchAnnounce(BatchChannel* channel) {
+  size_t num = 0;
+  while (num < channel->pending.size() && channel->pending[num]->done) {
+    num ++;
+  }
+  for (; channel->ready < num; channel->ready ++) {
+    channel->wake();
+  }
+}
+
+static void BatchDone(BatchRequest* req) {
+  if (req->channel == nullptr) {
+    std::unique_lock<std::mutex> lock(req->mtx);
+    req->done = true;
+    req->condition.notify_one();
+    return;
+  }
+  auto channel = req->channel;
+  std::unique_lock<std::mutex> lock(channel->mtx);
+  req->done = true;
+  if (channel->stopped) {
+    auto& pending = channel->pending;
+    pending.erase(std::remove(pending.begin(), pending.end(), req), pending.end());
+    delete req;
+    return;
+  }
+  BatchAnnounce(channel.get());
+}
+
+static void BatchThread(FaceEngine* engine) {
+  auto delay = std::chrono::milliseconds(engine->max_delay_ms);
+  while (1) {
+    std::unique_lock<std::mutex> lock(engine->batch_mtx);
+    engine->batch_cond.wait(lock, [engine] {
+      return !engine->batch_que.empty() || !engine->running;
+    });
+    // no channel is left, so nothing is queued
+    if (engine->batch_que.empty()) {
+      break;
+    }
+    BatchRequest* first = engine->batch_que.front();
+    engine->batch_cond.wait_until(lock, first->time + delay, [engine, first] {
+      return BatchReadyNum(engine, first) >= (size_t)engine->max_batch;
+    });
+    std::vector<BatchRequest*> batch;
+    for (auto itr = engine->batch_que.begin(); itr != engine->batch_que.end(); ) {
+      if (batch.size() < (size_t)engine->max_batch && SameShape(first, *itr)) {
+        batch.push_back(*itr);
+        itr = engine->batch_que.erase(itr);
+      } else {
+        ++itr;
+      }
+    }
+    lock.unlock();
+
+    if (batch.size() == 1 || !BatchForward(engine, batch)) {
+      for (size_t i = 0; i < batch.size(); i ++) {
+        Forward(engine, batch[i]->blob, batch[i]->output_blobs);
+      }
+    }
+    for (size_t i = 0; i < batch.size(); i ++) {
+      BatchDone(batch[i]);
+    }
+  }
+  AppDebug("batch thread exit, input:%dx%d", engine->input_w, engine->input_h);
+}
+
+static void BatchPut(FaceEngine* engine, BatchRequest* req) {
+  req->time = std::chrono::steady_clock::now();
+  req->done = false;
+  std::unique_lock<std::mutex> batch_lock(engine->batch_mtx);
+  engine->batch_que.push_back(req);
+  engine->batch_cond.notify_one();
+}
+
+// put frame to batch queue, and wait for the results
+static void BatchProcess(FaceEngine* engine, Mat& blob, std::vector<cv::Mat>& output_blobs) {
+  BatchRequest req;
+  req.blob = blob;
+  req.channel = nullptr;
+  BatchPut(engine, &req);
+
+  std::unique_lock<std::mutex> lock(req.mtx);
+  req.condition.wait(lock, [&req] {
+    return req.done;
+  });
+  output_blobs = req.output_blobs;
+}
+
 static int get_detections(cv::Mat faces, int w, int h, auto& result) {
   for (int i = 0; i < faces.rows; i++) {
     float left = faces.at<float>(i, 0);
@@ -249,13 +476,11 @@ static int get_detections(cv::Mat faces, int w, int h, auto& result) {
 
 extern "C" int DetectionInit(ElementData* data, char* params) {
   strncpy(data->input_name[0], "detection_input", sizeof(data->input_name[0]));
+  init_engine = NULL;
   if (params == NULL) {
     AppWarn("params is null");
     return -1;
   }
-  if (engine != NULL) {
-    return 0;
-  }
   auto model = GetStrValFromJson(params, "model");
   int backend_id = GetIntValFromJson(params, "backend_id");
   int target_id = GetIntValFromJson(params, "target_id");
@@ -271,7 +496,37 @@ extern "C" int DetectionInit(ElementData* data, char* params) {
   if (skip <= 0) {
     skip = 1;
   }
+  int max_batch = GetIntValFromJson(params, "max_batch");
+  if (max_batch <= 0) {
+    max_batch = 1;
+  }
+  int input_w = GetIntValFromJson(params, "input_width");
+  int input_h = GetIntValFromJson(params, "input_height");
+  if (input_w <= 0 || input_h <= 0) {
+    input_w = 0;
+    input_h = 0;
+  }
+  int max_delay_ms = GetIntValFromJson(params, "max_delay_ms");
+  if (max_delay_ms < 0) {
+    max_delay_ms = 10;
+  }
+
+  init_config.score_threshold = score_threshold;
+  init_config.nms_threshold = nms_threshold;
+  init_config.top_k = top_k;
+  init_config.skip = skip;
 
+  // frames of different input size can not be batched together, thresholds
+  // are kept by every element, the rest decides how the net is run
+  char key[1024];
+  snprintf(key, sizeof(key), "%s:%dx%d:%d:%d:%d:%d", model.get(), input_w, input_h,
+           backend_id, target_id, max_batch, max_delay_ms);
+  std::unique_lock<std::mutex> lock(engines_mtx);
+  auto itr = engines.find(key);
+  if (itr != engines.end()) {
+    init_engine = itr->second;
+    return 0;
+  }
   Net net = readNet(model.get(), "");
   if (net.empty()) {
     AppWarn("create engine failed, model:%s", model.get());
@@ -279,85 +534,200 @@ extern "C" int DetectionInit(ElementData* data, char* params) {
   }
   net.setPreferableBackend(backend_id);
   net.setPreferableTarget(target_id);
-  engine = new FaceEngine();
+  FaceEngine* engine = new FaceEngine();
   engine->net = net;
-  engine->score_threshold = score_threshold;
-  engine->nms_threshold = nms_threshold;
-  engine->top_k = top_k;
-  engine->skip = skip;
+  engine->input_w = input_w;
+  engine->input_h = input_h;
+  engine->max_batch = max_batch;
+  engine->max_delay_ms = max_delay_ms;
+  engine->refs = 0;
+  engine->running = false;
+  engines[key] = engine;
+  init_engine = engine;
   RGBInit();
-  AppDebug("detection skip: %d", skip);
+  AppDebug("detection skip: %d, input:%dx%d, max batch:%d, max delay:%dms",
+           skip, engine->input_w, engine->input_h, max_batch, max_delay_ms);
 
   return 0;
 }
 
 extern "C" IHandle DetectionStart(int channel, char* params) {
+  FaceEngine* engine = init_engine;
+  if (engine == NULL) {
+    AppWarn("id:%d, engine is not created", channel);
+    return NULL;
+  }
   DetectionParams* detection = new DetectionParams();
   detection->id = channel;
+  detection->engine = engine;
+  detection->config = init_config;
+  detection->channel = std::make_shared<BatchChannel>();
+  detection->channel->ready = 0;
+  detection->channel->stopped = false;
+  std::unique_lock<std::mutex> lock(engines_mtx);
+  if (engine->refs++ == 0 && engine->max_batch > 1) {
+    engine->running = true;
+    engine->thread = std::thread(&BatchThread, engine);
+  }
   return detection;
 }
 
+static Packet* DetectionOutput(DetectionParams* detection, std::shared_ptr<char> frame,
+                               HeadParams* in) {
+  HeadParams params = {0};
+  size_t size= sizeof(DetectionResult)*detection->result.size();
+  if (size > 0) {
+    char* ptr = new char[size]();
+    DetectionResult* dets = (DetectionResult* )ptr;
+    for (size_t i = 0; i < detection->result.size(); i ++) {
+      DetectionResult* det = dets + i;
+      det->left = detection->result[i].left;
+      det->top = detection->result[i].top;
+      det->width = detection->result[i].width;
+      det->height = detection->result[i].height;
+      det->score = detection->result[i].score;
+      det->classid = detection->result[i].classid;
+      strcpy(det->name, detection->result[i].name);
+    }
+    params.ptr = ptr;
+    params.ptr_size = size;
+  }
+  params.type = in->type;
+  params.frame_id = in->frame_id;
+  params.width = in->width;
+  params.height = in->height;
+  params.ingest_usec = in->ingest_usec;
+  params.pts = in->pts;
+  // share the yuv frame of decoder, no copy
+  return new Packet(frame, in->ptr_size, &params);
+}
+
+static void DetectionResults(DetectionParams* detection, const std::vector<cv::Mat>& output_blobs,
+                             int w, int h) {
+  cv::Mat faces;
+  cv::Mat results = postProcess(output_blobs, detection);
+  results.convertTo(faces, CV_32FC1);
+  // Copy to out
+  detection->result.clear();
+  get_detections(faces, w, h, detection->result);
+}
+
+// the first frame finished by the batch thread, in the order of input
+static int DetectionTake(DetectionParams* detection, TensorData* data) {
+  auto channel = detection->channel;
+  std::unique_lock<std::mutex> lock(channel->mtx);
+  if (channel->ready == 0) {
+    return 0;
+  }
+  BatchRequest* req = channel->pending.front();
+  channel->pending.pop_front();
+  channel->ready --;
+  lock.unlock();
+  if (!req->skipped) {
+    DetectionResults(detection, req->output_blobs, req->params.width, req->params.height);
+  }
+  data->tensor_buf.output = DetectionOutput(detection, req->frame, &req->params);
+  delete req;
+  return 0;
+}
+
 extern "C" int DetectionProcess(IHandle handle, TensorData* data) {
+  DetectionParams* detection = (DetectionParams* )handle;
+  FaceEngine* engine = detection->engine;
+  if (data->tensor_buf.input_num == 0) {
+    return DetectionTake(detection, data);
+  }
   auto pkt = data->tensor_buf.input[0];
   int w = pkt->_params.width;
   int h = pkt->_params.height;
   std::vector<cv::Mat> output_blobs;
-  std::vector<cv::String> output_names = { "loc", "conf", "iou" };
-  DetectionParams* detection = (DetectionParams* )handle;
 
   if (!detection->init) {
     detection->input_w = w;
     detection->input_h = h;
-    detection->rgb_buf = (unsigned char* )malloc(w*h*3);
+    detection->scale = 1.0f;
+    if (engine->input_w > 0 && (engine->input_w != w || engine->input_h != h)) {
+      detection->input_w = engine->input_w;
+      detection->input_h = engine->input_h;
+      detection->scale = std::min((float)engine->input_w/w, (float)engine->input_h/h);
+    }
+    // same as blobFromImage of the rgb frame, no mean and scale
+    BlobParams* bp = &detection->blob_params;
+    bp->width = detection->input_w;
+    bp->height = detection->input_h;
+    bp->resize_w = std::min((int)(w*detection->scale + 0.5f), detection->input_w);
+    bp->resize_h = std::min((int)(h*detection->scale + 0.5f), detection->input_h);
+    for (int c = 0; c < 3; c ++) {
+      bp->mean[c] = 0;
+      bp->scale[c] = 1.0f;
+    }
+    bp->bgr = false;
+    detection->blob_buf = (float* )malloc(sizeof(float)*3*bp->width*bp->height);
     detection->init = true;
+    // priors only depend on input size
     GeneratePriors(detection);
   }
-  if (pkt->_params.frame_id % engine->skip == 0) {
+  // the rate of decoder is the only one if it is active
+  bool forward = pkt->_params.decimated || pkt->_params.frame_id % detection->config.skip == 0;
+  // batched without waiting in the worker of task, the frame is kept and
+  // given back by DetectionTake when it is done
+  if (engine->max_batch > 1 && data->wake != nullptr) {
+    BatchRequest* req = new BatchRequest();
+    req->channel = detection->channel;
+    req->frame = pkt->_ptr_buf;
+    req->params = pkt->_params;
+    req->params.ptr = NULL;
+    req->skipped = !forward;
+    if (forward) {
+      int dims[4] = {1, 3, detection->input_h, detection->input_w};
+      req->blob = Mat(4, dims, CV_32F);
+      unsigned char* y = (unsigned char*)pkt->_params.ptr;
+      unsigned char* u = y + w*h;
+      unsigned char* v = u + w*h/4;
+      if (ConvertYUV2Blob(y, u, v, w, h, pkt->_params.type,
+                          &detection->blob_params, req->blob.ptr<float>()) != 0) {
+        AppWarn("id:%d, convert to blob failed, type:%d", detection->id, pkt->_params.type);
+        delete req;
+        return -1;
+      }
+    }
+    auto channel = detection->channel;
+    std::unique_lock<std::mutex> lock(channel->mtx);
+    channel->wake = data->wake;
+    channel->pending.push_back(req);
+    if (!forward) {
+      req->done = true;
+      BatchAnnounce(channel.get());
+      return 0;
+    }
+    lock.unlock();
+    BatchPut(engine, req);
+    return 0;
+  }
+  if (forward) {
     // PreProcess
     unsigned char* y = (unsigned char*)pkt->_params.ptr;
     unsigned char* u = y + w*h;
     unsigned char* v = u + w*h/4;
-    ConvertYUV2RGB(y, u, v, detection->rgb_buf, w, h, pkt->_params.type);
-    Mat img = Mat(h, w, CV_8UC3, detection->rgb_buf);
-    Mat input_blob = blobFromImage(img);
+    if (ConvertYUV2Blob(y, u, v, w, h, pkt->_params.type,
+                        &detection->blob_params, detection->blob_buf) != 0) {
+      AppWarn("id:%d, convert to blob failed, type:%d", detection->id, pkt->_params.type);
+      return -1;
+    }
+    // blob_buf is reused by the next frame, forward is done before that
+    int dims[4] = {1, 3, detection->input_h, detection->input_w};
+    Mat input_blob(4, dims, CV_32F, detection->blob_buf);
     // Forward
-    engine->mtx.lock();
-    engine->net.setInput(input_blob);
-    engine->net.forward(output_blobs, output_names);
-    engine->mtx.unlock();
+    if (engine->max_batch > 1) {
+      BatchProcess(engine, input_blob, output_blobs);
+    } else {
+      Forward(engine, input_blob, output_blobs);
+    }
     // Post process
-    cv::Mat faces;
-    cv::Mat results = postProcess(output_blobs, detection);
-    results.convertTo(faces, CV_32FC1);
-    // Copy to out
-    detection->result.clear();
-    get_detections(faces, w, h, detection->result);
+    DetectionResults(detection, output_blobs, w, h);
   }
 
-  HeadParams params = {0};
-  size_t size= sizeof(DetectionResult)*detection->result.size();
-  if (size > 0) {
-    char* ptr = new char[size]();
-    DetectionResult* dets = (DetectionResult* )ptr;
-    for (size_t i = 0; i < detection->result.size(); i ++) {
-      DetectionResult* det = dets + i;
-      det->left = detection->result[i].left;
-      det->top = detection->result[i].top;
-      det->width = detection->result[i].width;
-      det->height = detection->result[i].height;
-      det->score = detection->result[i].score;
-      det->classid = detection->result[i].classid;
-      strcpy(det->name, detection->result[i].name);
-    }
-    params.ptr = ptr;
-    params.ptr_size = size;
-  }
-  params.type = pkt->_params.type;
-  params.frame_id = pkt->_params.frame_id;
-  params.width = w;
-  params.height = h;
-  auto _packet = new Packet(pkt->_params.ptr, pkt->_params.ptr_size, &params);
-  data->tensor_buf.output = _packet;
+  data->tensor_buf.output = DetectionOutput(detection, pkt->_ptr_buf, &pkt->_params);
 
   return 0;
 }
@@ -368,8 +738,34 @@ extern "C" int DetectionStop(IHandle handle) {
     AppWarn("id:%d, detection is null", detection->id);
     return -1;
   }
-  if (detection->rgb_buf) {
-    free(detection->rgb_buf);
+  // frames still in the batch queue are freed by the batch thread
+  auto channel = detection->channel;
+  std::unique_lock<std::mutex> lock(channel->mtx);
+  channel->stopped = true;
+  channel->wake = nullptr;
+  auto& pending = channel->pending;
+  for (auto itr = pending.begin(); itr != pending.end(); ) {
+    if ((*itr)->done) {
+      delete *itr;
+      itr = pending.erase(itr);
+    } else {
+      ++itr;
+    }
+  }
+  lock.unlock();
+  // the last channel stops the batch thread of engine
+  FaceEngine* engine = detection->engine;
+  std::unique_lock<std::mutex> engines_lock(engines_mtx);
+  if (--engine->refs == 0 && engine->thread.joinable()) {
+    std::unique_lock<std::mutex> batch_lock(engine->batch_mtx);
+    engine->running = false;
+    engine->batch_cond.notify_all();
+    batch_lock.unlock();
+    engine->thread.join();
+  }
+  engines_lock.unlock();
+  if (detection->blob_buf) {
+    free(detection->blob_buf);
   }
   detection->priors.clear();
   delete detection;
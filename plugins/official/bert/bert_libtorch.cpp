@@ -65,7 +65,7 @@ extern "C" int BertInit(ElementData* data, char* params) {
     AppWarn("params is null");
     return -1;
   }
-  data->queue_len = GetIntValFromFile(share_params.config_file, "img", "queue_len");
+  data->queue_len = data->config->GetInt("img", "queue_len");
   if (data->queue_len < 0) {
     data->queue_len = 50;
   }
@@ -34,10 +34,15 @@ extern "C" {
 #include "config.h"
 #include "share.h"
 #include "common.h"
+#include "governor.h"
+#include "pipeline.h"
+#include "trace.h"
 #include "log.h"
 
 typedef struct {
   int dec_init;
+  // VIDEO_CODEC_x, given by the packets of source
+  int codec;
   AVFrame *decFrame;
   AVPacket decAvpkt;
   AVCodecContext *decContex;
@@ -46,17 +51,36 @@ typedef struct {
 
 typedef struct {
   int id;
-  int skip;
+  DecodeRate rate;
+  // adaptive analysis fps, nullptr if the governor is disabled
+  StreamRate* gov;
+  // analysis fps of the channel, -1 means the one of config
+  int channel_fps;
+  // of the config the rate is read from
+  uint64_t generation;
   FFmpegParam *ffmpeg;
   FrameParam rgb;
 } DecodeParams;
 
 static ShareParams share_params = {0};
-static int InitFFmpeg(FFmpegParam *ffmpeg) {
+
+// config reloaded, changes skip and fps in place without restarting the stream
+static void DecodeReload(DecodeParams* dec_params) {
+  int skip = GetIntValFromFile(share_params.config_file, "video", "rgb_skip");
+  int fps = GetIntValFromFile(share_params.config_file, "video", "analysis_fps");
+  if (dec_params->channel_fps >= 0) {
+    fps = dec_params->channel_fps;
+  }
+  DecodeRateSet(&dec_params->rate, skip, fps);
+  GovernorSetMax(dec_params->gov, fps);
+  AppDebug("id:%d, rgb skip : %d, analysis fps : %d",
+           dec_params->id, dec_params->rate.skip, dec_params->rate.fps);
+}
+static int InitFFmpeg(FFmpegParam *ffmpeg, int video_codec) {
   int ret;
   const AVCodec *codec;
   av_init_packet(&(ffmpeg->decAvpkt));
-  codec = avcodec_find_decoder(AV_CODEC_ID_H264);
+  codec = avcodec_find_decoder(video_codec == VIDEO_CODEC_H265 ? AV_CODEC_ID_HEVC : AV_CODEC_ID_H264);
   if (!codec) {
     fprintf(stderr, "Codec not found\n");
     return -1;
@@ -87,6 +111,7 @@ static int InitFFmpeg(FFmpegParam *ffmpeg) {
     fprintf(stderr, "parser not found\n");
     return -1;
   }
+  ffmpeg->codec = video_codec;
   return 0;
 }
 
@@ -107,6 +132,25 @@ static int FreeFFmpeg(FFmpegParam *ffmpeg) {
   return 0;
 }
 
+// the codec is known from the packets only, the decoder is rebuilt for it
+// and waits for the next key frame
+static int DecodeSwitch(DecodeParams* dec_params, int codec) {
+  FFmpegParam* ffmpeg = dec_params->ffmpeg;
+  AppDebug("id:%d, video codec %d -> %d", dec_params->id, ffmpeg->codec, codec);
+  FreeFFmpeg(ffmpeg);
+  ffmpeg->dec_init = 0;
+  if (dec_params->rgb.buf != NULL) {
+    free(dec_params->rgb.buf);
+    dec_params->rgb.buf = NULL;
+  }
+  if (InitFFmpeg(ffmpeg, codec) != 0) {
+    AppWarn("init ffmpeg failed, id:%d, codec:%d", dec_params->id, codec);
+    FreeFFmpeg(ffmpeg);
+    return -1;
+  }
+  return 0;
+}
+
 static int InitWithFFmpeg(FrameParam* frame, FrameParam* rgb, FFmpegParam* ffmpeg, int id) {
   int ret;
   ffmpeg->decAvpkt.size = frame->size;
@@ -134,7 +178,7 @@ static int InitWithFFmpeg(FrameParam* frame, FrameParam* rgb, FFmpegParam* ffmpe
 
 }
 
-static int FFmpegDecoding(FrameParam* frame, FrameParam* rgb, FFmpegParam* ffmpeg, int id, bool enable) {
+static int FFmpegDecoding(FrameParam* frame, FrameParam* rgb, FFmpegParam* ffmpeg, int id, DecodeRate* rate) {
   int num = 0;
   int ret, len;
   char *data = frame->buf;
@@ -162,7 +206,7 @@ static int FFmpegDecoding(FrameParam* frame, FrameParam* rgb, FFmpegParam* ffmpe
     while (ret >= 0) {
       ret = avcodec_receive_frame(ffmpeg->decContex, ffmpeg->decFrame);
       if (!ret) {
-        if (enable) {
+        if (DecodeRateOutput(rate, ffmpeg->decContex)) {
           ConvertYUV2RGB(ffmpeg->decFrame->data[0], ffmpeg->decFrame->data[1],
                          ffmpeg->decFrame->data[2], (unsigned char *)rgb->buf,
                          rgb->width, rgb->height, ffmpeg->decFrame->format);
@@ -182,13 +226,16 @@ static int FFmpegDecoding(FrameParam* frame, FrameParam* rgb, FFmpegParam* ffmpe
   return num;
 }
 
-static int FFmpegDecode(FrameParam* frame, FrameParam* rgb, FFmpegParam* ffmpeg, int id, bool enable) {
+static int FFmpegDecode(FrameParam* frame, FrameParam* rgb, FFmpegParam* ffmpeg, int id, DecodeRate* rate) {
   if (ffmpeg->dec_init) {
-    return FFmpegDecoding(frame, rgb, ffmpeg, id, enable);
-  } else if ((frame->buf[4]&0x1f) != 1 && !InitWithFFmpeg(frame, rgb, ffmpeg, id)) {
+    DecodeRateUpdate(rate, ffmpeg->decContex, frame->buf, frame->size);
+    return FFmpegDecoding(frame, rgb, ffmpeg, id, rate);
+  } else if (!VideoNalDelta(ffmpeg->codec, VideoNalType(ffmpeg->codec, frame->buf)) &&
+             !InitWithFFmpeg(frame, rgb, ffmpeg, id)) {
     ffmpeg->dec_init = 1;
     AppDebug("find IDR ok, id:%d, %dx%d", id, rgb->width, rgb->height);
-    return FFmpegDecoding(frame, rgb, ffmpeg, id, enable);
+    DecodeRateUpdate(rate, ffmpeg->decContex, frame->buf, frame->size);
+    return FFmpegDecoding(frame, rgb, ffmpeg, id, rate);
   }
   return -1;
 }
@@ -196,7 +243,7 @@ static int FFmpegDecode(FrameParam* frame, FrameParam* rgb, FFmpegParam* ffmpeg,
 extern "C" int DecodeInit(ElementData* data, char* params) {
   share_params = GlobalConfig();
   strncpy(data->input_name[0], "decode_input", sizeof(data->input_name[0]));
-  data->queue_len = GetIntValFromFile(share_params.config_file, "video", "rgb_queue_len");
+  data->queue_len = data->config->GetInt("video", "rgb_queue_len");
   if (data->queue_len < 0) {
     data->queue_len = 10;
   }
@@ -209,17 +256,26 @@ extern "C" IHandle DecodeStart(int channel, char* params) {
   DecodeParams* dec_params = (DecodeParams* )calloc(1, sizeof(DecodeParams));
   dec_params->id = channel;
   dec_params->ffmpeg = (FFmpegParam* )calloc(1, sizeof(FFmpegParam));
-  if (InitFFmpeg(dec_params->ffmpeg) != 0) {
+  if (InitFFmpeg(dec_params->ffmpeg, VIDEO_CODEC_H264) != 0) {
     AppWarn("init ffmpeg failed, id:%d", channel);
     free(dec_params->ffmpeg);
     free(dec_params);
     return NULL;
   }
-  dec_params->skip = GetIntValFromFile(share_params.config_file, "video", "rgb_skip");
-  if (dec_params->skip < 0) {
-    dec_params->skip = 1;
+  dec_params->generation = ConfigGeneration();
+  int skip = GetIntValFromFile(share_params.config_file, "video", "rgb_skip");
+  int fps = GetIntValFromFile(share_params.config_file, "video", "analysis_fps");
+  // analysis fps of the channel overrides the config
+  int channel_fps = params != NULL ? GetIntValFromJson(params, "analysis_fps") : -1;
+  if (channel_fps >= 0) {
+    fps = channel_fps;
   }
-  AppDebug("rgb skip : %d", dec_params->skip);
+  dec_params->channel_fps = channel_fps;
+  DecodeRateInit(&dec_params->rate, skip, fps);
+  int priority = params != NULL ? GetIntValFromJson(params, "priority") : -1;
+  dec_params->gov = GovernorRegister(channel, fps, priority);
+  AppDebug("id:%d, rgb skip : %d, analysis fps : %d",
+           channel, dec_params->rate.skip, dec_params->rate.fps);
   return dec_params;
 }
 
@@ -232,12 +288,25 @@ extern "C" int DecodeProcess(IHandle handle, TensorData* data) {
   frame.buf = pkt->_data;
   frame.size = (int)pkt->_size;
   frame.frame_id = pkt->_params.frame_id;
-  bool enable = pkt->_params.frame_id % dec_params->skip == 0;
-  if (FFmpegDecode(&frame, rgb, dec_params->ffmpeg, dec_params->id, enable) > 0) {
+  TRACE_SPAN(span, "plugin", "decode", dec_params->id, frame.frame_id);
+  uint64_t generation = ConfigGeneration();
+  if (generation != dec_params->generation) {
+    dec_params->generation = generation;
+    DecodeReload(dec_params);
+  }
+  if (dec_params->gov != NULL) {
+    dec_params->rate.fps = dec_params->gov->fps.load(std::memory_order_relaxed);
+  }
+  if (pkt->_params.codec != dec_params->ffmpeg->codec &&
+      DecodeSwitch(dec_params, pkt->_params.codec) != 0) {
+    return -1;
+  }
+  if (FFmpegDecode(&frame, rgb, dec_params->ffmpeg, dec_params->id, &dec_params->rate) > 0) {
     HeadParams params = {0};
     params.frame_id = pkt->_params.frame_id;
     params.width = rgb->width;
     params.height = rgb->height;
+    params.decimated = DecodeRateActive(&dec_params->rate, dec_params->ffmpeg->decContex);
     auto _packet = new Packet(rgb->buf, rgb->size, &params);
     data->tensor_buf.output = _packet;
   }
@@ -254,6 +323,7 @@ extern "C" int DecodeStop(IHandle handle) {
   if (rgb->buf != NULL) {
     free(rgb->buf);
   }
+  GovernorUnregister(dec_params->gov);
   FreeFFmpeg(dec_params->ffmpeg);
   free(dec_params->ffmpeg);
   free(dec_params);
@@ -78,7 +78,7 @@ static int SendHttpReply2(struct evhttp_request* req, int code, const char* url)
 
 extern "C" int HttpInit(ElementData* data, char* params) {
   share_params = GlobalConfig();
-  data->queue_len = GetIntValFromFile(share_params.config_file, "img", "queue_len");
+  data->queue_len = data->config->GetInt("img", "queue_len");
   if (data->queue_len < 0) {
     data->queue_len = 50;
   }
@@ -272,6 +272,7 @@ static void Copy2Queue(HttpFilee& http_file, HttpServer* http, char url[URL_LEN]
     strncpy(params.ptr + params.ptr_size, url, URL_LEN);
   }
   params.frame_id = ++http->frame_id;
+  params.ingest_usec = GetMonotonicUsec();
   std::unique_lock<std::mutex> lock(http->mtx);
   if (http->_queue.size() < (size_t)http->queue_len_max) {
     auto _packet = new Packet(http_file.buf, http_file.size, &params);
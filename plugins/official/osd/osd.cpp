@@ -483,8 +483,12 @@ static int Encoding(auto pkt, OSDParams* osd, TensorData* data) {
       //printf("##debug, recv %d:%ld\n", pkt->_params.frame_id, avpkt->pts);
       HeadParams params = {0};
       params.frame_id = pkt->_params.frame_id;
-      auto _packet = new Packet(avpkt->data, avpkt->size, &params);
-      data->tensor_buf.output = _packet;
+      // take over the buffer of avpkt, no copy
+      AVPacket* _avpkt = av_packet_clone(avpkt);
+      if (_avpkt != NULL) {
+        auto _packet = Packet::Wrap(_avpkt->data, _avpkt->size, FreeAVPacket, _avpkt, &params);
+        data->tensor_buf.output = _packet;
+      }
       //WriteFile("test.264", avpkt->data, avpkt->size, "a+");
       //printf("frameid:%d, h264 size:%d, %02x:%02x:%02x:%02x:%02x\n", pkt->_params.frame_id,
       //  avpkt->size, avpkt->data[0], avpkt->data[1], avpkt->data[2], avpkt->data[3], avpkt->data[4]);
@@ -567,7 +571,7 @@ static int FontInit(char* params) {
 extern "C" int OSDInit(ElementData* data, char* params) {
   share_params = GlobalConfig();
   strncpy(data->input_name[0], "osd_input", sizeof(data->input_name[0]));
-  data->queue_len = GetIntValFromFile(share_params.config_file, "video", "queue_len");
+  data->queue_len = data->config->GetInt("video", "queue_len");
   if (data->queue_len < 0) {
     data->queue_len = 50;
   }
@@ -598,8 +602,10 @@ extern "C" int OSDProcess(IHandle handle, TensorData* data) {
     osd->encoder.init = 1;
     CreateEncoder(pkt, osd);
   }
-  osd->set_rect_text(pkt);
-  Encoding(pkt, osd, data);
+  // frame is shared with other elements, draw on a copy
+  std::unique_ptr<Packet> frame(pkt->Clone());
+  osd->set_rect_text(frame.get());
+  Encoding(frame.get(), osd, data);
   return 0;
 }
 
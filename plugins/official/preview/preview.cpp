@@ -192,7 +192,8 @@ static int ReadVideoPacket(void *opaque, uint8_t *buf, int size) {
     preview->_queue.pop();
     lock.unlock();
     if (!preview->find_idr) {
-      if ((pkt->_data[4] & 0x1f) != 1) {
+      int codec = pkt->_params.codec;
+      if (!VideoNalDelta(codec, VideoNalType(codec, pkt->_data))) {
         preview->find_idr = 1;
         AppDebug("id:%d, size:%d, find IDR ok", preview->id, size);
       }
@@ -539,7 +540,7 @@ extern "C" int PreviewProcess(IHandle handle, TensorData* data) {
   if (preview->_queue.size() < (size_t)config.queue_len) {
     HeadParams params = {0};
     params.frame_id = pkt->_params.frame_id;
-    auto _packet = std::make_shared<Packet>(pkt->_data, pkt->_size, &params);
+    auto _packet = std::make_shared<Packet>(pkt->_buf, pkt->_size, &params);
     preview->_queue.push(_packet);
   } else if (pkt->_params.frame_id % 200 == 0) {
     printf("warning,preview,id:%d,frameid:%d,put to queue failed,quelen:%ld\n",
@@ -16,7 +16,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <thread>
+#include <algorithm>
 extern "C" {
 #include <libavformat/avformat.h>
 #include <libavcodec/avcodec.h>
@@ -32,192 +32,225 @@ extern "C" {
 #include "config.h"
 #include "share.h"
 #include "common.h"
+#include "rtmp_client.h"
 #include "log.h"
 
+// one upstream connection, shared by all objects of the same stream
 typedef struct {
-  int id;
+  char key[1024];
   char url[512];
   int frame_id;
-  pthread_t pid;
+  RtmpClient* client;
+  // annex-b conversion, only used in the loop of client
+  AVBSFContext* bsf;
+  // VIDEO_CODEC_x the bsf is built for
+  int codec;
+  // subscribers, ModuleObj
+  std::mutex mtx;
+  std::vector<void*> subs;
+} Session;
+
+typedef struct {
+  int id;
+  Session* session;
   std::mutex mtx;
   std::condition_variable condition;
   std::queue<Packet*> _queue;
   int queue_len_max;
-  std::thread* t;
-  long int rtmp_beat;
   int running;
-  int _running;
 } ModuleObj;
 
 typedef struct {
   int init;
-  uint64_t now_sec;
   ShareParams share_params;
+  // queue_len of the element config, the objects started after init use it
+  int queue_len;
   std::mutex obj_mtx;
-  std::vector<ModuleObj*> objs;
-  std::thread* t;
-  int running;
+  std::vector<Session*> sessions;
+  // sockets of all sessions are driven by a few loops
+  Reactor reactor;
 } ModuleParams;
 
 static ModuleParams module = {0};
-static void CopyToPacket(uint8_t* buf, int size, ModuleObj* obj) {
-  HeadParams params = {0};
-  params.frame_id = ++obj->frame_id;
-  std::unique_lock<std::mutex> lock(obj->mtx);
-  if (obj->_queue.size() < (size_t)obj->queue_len_max) {
-    auto _packet = new Packet(buf, size, &params);
-    obj->_queue.push(_packet);
-  } else {
-    printf("warning,rtmp,id:%d, put to queue failed, quelen:%ld\n",
-           obj->id, obj->_queue.size());
+
+// nal unit type of the first slice of an access unit, the bitstream filter
+// puts sei and parameter sets before it, -1 if there is no slice
+static int SliceNalType(int codec, const uint8_t* data, int size) {
+  for (int i = 0; i + 3 < size; i ++) {
+    if (data[i] != 0 || data[i + 1] != 0 || data[i + 2] != 1) {
+      continue;
+    }
+    uint8_t nal = data[i + 3];
+    int type = codec == VIDEO_CODEC_H265 ? (nal >> 1) & 0x3f : nal & 0x1f;
+    if (codec == VIDEO_CODEC_H265 ? type < 32 : (type >= 1 && type <= 5)) {
+      return type;
+    }
+    i += 3;
   }
-  obj->condition.notify_one();
+  return -1;
 }
 
-static void RtmpThread(ModuleObj* obj) {
-  int ret;
-  char errstr[256];
-  AVBSFContext* bsf_ctx = NULL;
-  AVFormatContext* ifmt_ctx = NULL;
-  int video_index = -1, audio_index = -1;
+static void CopyToPacket(AVPacket* pkt, AVRational time_base, Session* session) {
+  HeadParams params = {0};
+  params.codec = session->codec;
+  params.frame_id = ++session->frame_id;
+  params.ingest_usec = GetMonotonicUsec();
+  if (pkt->pts != AV_NOPTS_VALUE) {
+    params.pts = av_rescale_q(pkt->pts, time_base, AVRational{1, 1000000});
+  }
+  params.key_frame = (pkt->flags & AV_PKT_FLAG_KEY) != 0;
+  // packets are whole access units, typed by their slices like rtsp nals
+  int type = SliceNalType(session->codec, pkt->data, pkt->size);
+  params.type = type < 0 || !VideoNalDelta(session->codec, type);
+  // reference the buffer of pkt once, the packets of all subscribers share it
+  std::shared_ptr<char> _buf = nullptr;
+  std::unique_lock<std::mutex> session_lock(session->mtx);
+  for (size_t i = 0; i < session->subs.size(); i ++) {
+    ModuleObj* obj = (ModuleObj* )session->subs[i];
+    std::unique_lock<std::mutex> lock(obj->mtx);
+    if (obj->_queue.size() < (size_t)obj->queue_len_max) {
+      if (_buf == nullptr) {
+        AVPacket* _pkt = av_packet_clone(pkt);
+        if (_pkt == NULL) {
+          return;
+        }
+        _buf = std::shared_ptr<char>((char* )_pkt->data, [_pkt](char* p) {
+          FreeAVPacket(_pkt);
+        });
+      }
+      auto _packet = new Packet(_buf, pkt->size, &params);
+      obj->_queue.push(_packet);
+    } else {
+      printf("warning,rtmp,id:%d, put to queue failed, quelen:%ld\n",
+             obj->id, obj->_queue.size());
+    }
+    obj->condition.notify_one();
+  }
+}
 
-  if ((ret = avformat_open_input(&ifmt_ctx, obj->url, NULL, NULL)) < 0) {
-    av_strerror(ret, errstr, sizeof(errstr));
-    AppWarn("id:%d, could not open input file, %s", obj->id, errstr);
+// sequence header of flv, the bitstream filter is rebuilt with it and the
+// codec of the stream follows
+static void BsfInit(Session* session, const FlvVideo* video) {
+  av_bsf_free(&session->bsf);
+  bool hevc = video->codec == FLV_CODEC_H265;
+  const char* name = hevc ? "hevc_mp4toannexb" : "h264_mp4toannexb";
+  const AVBitStreamFilter* pfilter = av_bsf_get_by_name(name);
+  if (pfilter == NULL) {
+    AppWarn("%s,get bsf failed", session->url);
     return;
   }
-  if ((ret = avformat_find_stream_info(ifmt_ctx, 0)) < 0) {
-    AppWarn("id:%d, failed to retrieve input stream information", obj->id);
+  if (av_bsf_alloc(pfilter, &session->bsf) != 0) {
+    AppWarn("%s,alloc bsf failed", session->url);
     return;
   }
-  for (int i = 0; i < (int)ifmt_ctx->nb_streams; i++) {
-    if (ifmt_ctx->streams[i]->codecpar->codec_type == AVMEDIA_TYPE_VIDEO) {
-      video_index = i;
-    } else if (ifmt_ctx->streams[i]->codecpar->codec_type == AVMEDIA_TYPE_AUDIO) {
-      audio_index = i;
-    } else {
-      AppWarn("id:%d, streams:%d, unsupport type : %d", obj->id,
-              ifmt_ctx->nb_streams, ifmt_ctx->streams[i]->codec->codec_type);
-      return;
-    }
+  AVCodecParameters* par = session->bsf->par_in;
+  par->codec_type = AVMEDIA_TYPE_VIDEO;
+  par->codec_id = hevc ? AV_CODEC_ID_HEVC : AV_CODEC_ID_H264;
+  par->extradata = (uint8_t* )av_mallocz(video->size + AV_INPUT_BUFFER_PADDING_SIZE);
+  if (par->extradata == NULL) {
+    av_bsf_free(&session->bsf);
+    return;
   }
-  const AVBitStreamFilter* pfilter = av_bsf_get_by_name("h264_mp4toannexb");
-  if (pfilter == NULL) {
-    AppWarn("id:%d,get bsf failed", obj->id);
+  memcpy(par->extradata, video->data, video->size);
+  par->extradata_size = video->size;
+  session->bsf->time_base_in = AVRational{1, 1000};
+  if (av_bsf_init(session->bsf) < 0) {
+    AppWarn("%s,init bsf failed", session->url);
+    av_bsf_free(&session->bsf);
+    return;
+  }
+  session->codec = hevc ? VIDEO_CODEC_H265 : VIDEO_CODEC_H264;
+}
+
+static void RtmpOutput(const FlvVideo* video, void* arg) {
+  Session* session = (Session* )arg;
+  if (video->config) {
+    BsfInit(session, video);
     return;
   }
-  if ((ret = av_bsf_alloc(pfilter, &bsf_ctx)) != 0) {
-    AppWarn("id:%d,alloc bsf failed", obj->id);
+  // waits for the sequence header of the codec
+  int codec = video->codec == FLV_CODEC_H265 ? VIDEO_CODEC_H265 : VIDEO_CODEC_H264;
+  if (session->bsf == NULL || codec != session->codec) {
     return;
   }
-  ret = avcodec_parameters_from_context(bsf_ctx->par_in, ifmt_ctx->streams[video_index]->codec);
-  if (ret < 0) {
-    AppWarn("id:%d,set codec failed", obj->id);
+  AVPacket* pkt = av_packet_alloc();
+  if (pkt == NULL || av_new_packet(pkt, video->size) < 0) {
+    av_packet_free(&pkt);
     return;
   }
-  bsf_ctx->time_base_in = ifmt_ctx->streams[video_index]->codec->time_base;
-  ret = av_bsf_init(bsf_ctx);
-  if (ret < 0) {
-    AppWarn("id:%d,init bsf failed", obj->id);
+  memcpy(pkt->data, video->data, video->size);
+  pkt->dts = video->dts;
+  pkt->pts = video->pts;
+  pkt->flags |= video->key_frame ? AV_PKT_FLAG_KEY : 0;
+  int ret = av_bsf_send_packet(session->bsf, pkt);
+  if (ret != 0) {
+    printf("warning, send pkt failed, ret:%d\n", ret);
+    av_packet_free(&pkt);
     return;
   }
-  AppDebug("id:%d, start ...", obj->id);
+  while (av_bsf_receive_packet(session->bsf, pkt) == 0) {
+    CopyToPacket(pkt, AVRational{1, 1000}, session);
+    av_packet_unref(pkt);
+  }
+  av_packet_free(&pkt);
+}
 
-  AVPacket pkt;
-  while (obj->running && obj->_running) {
-    ret = av_read_frame(ifmt_ctx, &pkt);
-    if (ret < 0) {
-      printf("id:%d, av_read_frame failed, %d, continue\n", obj->id, ret);
-      usleep(200000);
-      continue;
-    }
-    if (pkt.stream_index != video_index) {
-      printf("warning, id:%d, not support stream index %d, video:%d,audio:%d\n",
-             obj->id, pkt.stream_index, video_index, audio_index);
-      av_packet_unref(&pkt);
-      continue;
-    }
-    ret = av_bsf_send_packet(bsf_ctx, &pkt);
-    if (ret != 0) {
-      printf("warning, send pkt failed, ret:%d\n", ret);
-      break;
-    }
-    ret = av_bsf_receive_packet(bsf_ctx, &pkt);
-    if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) {
-      printf("warning, recv pkt EAGAIN/EOF, ret:%d\n", ret);
-      break;
-    } else if (ret < 0) {
-      printf("warning, recv pkt failed, ret:%d\n", ret);
-      break;
+static void ClearQueue(ModuleObj* obj) {
+  std::unique_lock<std::mutex> lock(obj->mtx);
+  while (!obj->_queue.empty()) {
+    Packet* pkt = obj->_queue.front();
+    obj->_queue.pop();
+    if (pkt != nullptr) {
+      delete pkt;
     }
-    //printf("##test, frameid:%d, pkt size:%d, %02x:%02x:%02x:%02x:%02x\n", obj->frame_id,
-    //        pkt.size, pkt.data[0], pkt.data[1], pkt.data[2], pkt.data[3], pkt.data[4]);
-    CopyToPacket(pkt.data, pkt.size, obj);
-    av_packet_unref(&pkt);
-    obj->rtmp_beat = module.now_sec;
   }
-
-  av_bsf_free(&bsf_ctx);
-  avformat_close_input(&ifmt_ctx);
-  AppDebug("id:%d, run ok", obj->id);
 }
 
-static void RtmpDaemon(void) {
-  struct timeval tv;
-  while (module.running) {
-    gettimeofday(&tv, NULL);
-    module.now_sec = tv.tv_sec;
-    std::unique_lock<std::mutex> obj_lock(module.obj_mtx);
-    for (size_t i = 0; i < module.objs.size(); i ++) {
-      auto obj = module.objs[i];
-      if (module.now_sec - obj->rtmp_beat > 15) {
-        AppWarn("id:%d,detect exception,restart it ...", obj->id);
-        obj->_running = 0;
-        if (obj->t != nullptr) {
-          if (obj->t->joinable()) {
-            obj->t->join();
-          }
-          delete obj->t;
-          obj->t = nullptr;
-        }
-        std::unique_lock<std::mutex> lock(obj->mtx);
-        while (!obj->_queue.empty()) {
-          Packet* pkt = obj->_queue.front();
-          obj->_queue.pop();
-          if (pkt != nullptr) {
-            delete pkt;
-          }
-        }
-        lock.unlock();
-        obj->_running = 1;
-        obj->t = new std::thread(&RtmpThread, obj);
-        obj->rtmp_beat = module.now_sec;
-      }
-    }
-    obj_lock.unlock();
-    sleep(3);
+static void SessionFree(Session* session) {
+  if (session->client != NULL) {
+    session->client->Stop();
+    delete session->client;
   }
-  AppDebug("run ok");
+  av_bsf_free(&session->bsf);
+  delete session;
 }
 
 extern "C" int RtmpInit(ElementData* data, char* params) {
   if (__sync_add_and_fetch(&module.init, 1) <= 1) {
-    struct timeval tv;
-    gettimeofday(&tv, NULL);
-    module.now_sec = tv.tv_sec;
     module.share_params = GlobalConfig();
     FFmpegInit();
-    module.t = new std::thread(&RtmpDaemon);
-    module.running = 1;
+    const char* cfg_file = module.share_params.config_file;
+    int threads = GetIntValFromFile(cfg_file, "video", "ingest_threads");
+    module.reactor.Start(threads > 0 ? threads : 2);
   }
-  const char* cfg_file = module.share_params.config_file;
-  data->queue_len = GetIntValFromFile(cfg_file, "video", "queue_len");
+  data->queue_len = data->config->GetInt("video", "queue_len");
   if (data->queue_len < 0) {
     data->queue_len = 50;
   }
+  module.queue_len = data->queue_len;
   return 0;
 }
 
+// the session of url, created if it is the first object of the stream
+static Session* SessionGet(const char* key, const char* url) {
+  for (size_t i = 0; i < module.sessions.size(); i ++) {
+    if (!strcmp(module.sessions[i]->key, key)) {
+      return module.sessions[i];
+    }
+  }
+  Session* session = new Session();
+  strncpy(session->key, key, sizeof(session->key));
+  strncpy(session->url, url, sizeof(session->url));
+  session->client = new RtmpClient(module.reactor.GetLoop(), url, RtmpOutput, session);
+  if (session->client->Start() != 0) {
+    AppError("start play %s failed", url);
+    SessionFree(session);
+    return NULL;
+  }
+  module.sessions.push_back(session);
+  return session;
+}
+
 extern "C" IHandle RtmpStart(int channel, char* params) {
   if (params == NULL) {
     AppWarn("id:%d, params is null", channel);
@@ -228,19 +261,27 @@ extern "C" IHandle RtmpStart(int channel, char* params) {
     AppWarn("get url failed, %s", params);
     return NULL;
   }
+  // objects of the same url share the session
+  char key[1024];
+  int port = strncasecmp(url.get(), "http://", 7) ? 1935 : 80;
+  if (NormalizeUrl(url.get(), port, key, sizeof(key)) != 0) {
+    AppWarn("id:%d, url is too long, %s", channel, url.get());
+    return NULL;
+  }
   ModuleObj* obj = new ModuleObj();
   obj->id = channel;
-  obj->rtmp_beat = module.now_sec;
-  const char* cfg_file = module.share_params.config_file;
-  obj->queue_len_max = GetIntValFromFile(cfg_file, "video", "queue_len");
-  obj->queue_len_max = obj->queue_len_max > 0 ? obj->queue_len_max : 50;
-  strncpy(obj->url, url.get(), sizeof(obj->url));
+  obj->queue_len_max = module.queue_len > 0 ? module.queue_len : 50;
   obj->running = 1;
-  obj->_running = 1;
-  obj->t = new std::thread(&RtmpThread, obj);
   std::unique_lock<std::mutex> obj_lock(module.obj_mtx);
-  module.objs.push_back(obj);
-  obj_lock.unlock();
+  Session* session = SessionGet(key, url.get());
+  if (session == NULL) {
+    delete obj;
+    return NULL;
+  }
+  obj->session = session;
+  std::unique_lock<std::mutex> session_lock(session->mtx);
+  session->subs.push_back(obj);
+  AppDebug("id:%d, %s, objects:%ld", channel, key, session->subs.size());
   return obj;
 }
 
@@ -267,31 +308,23 @@ extern "C" int RtmpStop(IHandle handle) {
     return -1;
   }
   obj->running = 0;
-  if (obj->t != nullptr) {
-    if (obj->t->joinable()) {
-      obj->t->join();
-    }
-    delete obj->t;
-    obj->t = nullptr;
-  }
-  std::unique_lock<std::mutex> lock(obj->mtx);
-  while (!obj->_queue.empty()) {
-    Packet* pkt = obj->_queue.front();
-    obj->_queue.pop();
-    if (pkt != nullptr) {
-      delete pkt;
-    }
-  }
-  lock.unlock();
+  // the last object closes the session
+  Session* session = obj->session;
   std::unique_lock<std::mutex> obj_lock(module.obj_mtx);
-  for (auto itr = module.objs.begin(); itr != module.objs.end(); ++itr) {
-    auto _obj = *itr;
-    if (_obj->id == obj->id) {
-      module.objs.erase(itr);
-      break;
-    }
+  std::unique_lock<std::mutex> session_lock(session->mtx);
+  auto& subs = session->subs;
+  subs.erase(std::remove(subs.begin(), subs.end(), obj), subs.end());
+  bool last = subs.empty();
+  session_lock.unlock();
+  if (last) {
+    auto& sessions = module.sessions;
+    sessions.erase(std::remove(sessions.begin(), sessions.end(), session), sessions.end());
   }
   obj_lock.unlock();
+  if (last) {
+    SessionFree(session);
+  }
+  ClearQueue(obj);
   delete obj;
   return 0;
 }
@@ -309,14 +342,7 @@ extern "C" int RtmpNotify(IHandle handle) {
 }
 
 extern "C" int RtmpRelease(void) {
-  module.running = 0;
-  if (module.t != nullptr) {
-    if (module.t->joinable()) {
-      module.t->join();
-    }
-    delete module.t;
-    module.t = nullptr;
-  }
+  module.reactor.Stop();
   return 0;
 }
 
@@ -0,0 +1,835 @@
+/****************************************************************************************
+ * Copyright (C) 2021 aistream <aistream@yeah.net>
+ *
+ * Licensed under the BSD 3-Clause License (the "License"); you may not use this
+ * file except in compliance with the License. You may obtain a copy of the License at
+ *
+ * https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Unless required by applicable law or agreed to in writing, software distributed
+ * under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+ * CONDITIONS OF ANY KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations under the License.
+ *
+ ***************************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <event2/event.h>
+#include <event2/buffer.h>
+#include <event2/bufferevent.h>
+#include <event2/dns.h>
+#include "rtmp_client.h"
+#include "log.h"
+
+#define RTMP_HANDSHAKE_SIZE 1536
+#define RTMP_CHUNK_SIZE 128
+#define RTMP_MSG_MAX (16 * 1024 * 1024)
+#define RTMP_BACKOFF_MAX 32
+// no data for it, the connection is considered broken
+#define RTMP_READ_TIMEOUT 15
+#define RTMP_WRITE_TIMEOUT 10
+
+static uint32_t Be16(const uint8_t* p) {
+  return (p[0] << 8) | p[1];
+}
+
+static uint32_t Be24(const uint8_t* p) {
+  return (p[0] << 16) | (p[1] << 8) | p[2];
+}
+
+static uint32_t Be32(const uint8_t* p) {
+  return ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static void PutBe(std::string& s, uint32_t v, int bytes) {
+  for (int i = bytes - 1; i >= 0; i --) {
+    s += (char)((v >> (i * 8)) & 0xff);
+  }
+}
+
+// amf0, the encoding of rtmp commands
+static void AmfString(std::string& s, const std::string& v) {
+  s += (char)0x02;
+  PutBe(s, v.size(), 2);
+  s += v;
+}
+
+static void AmfNumber(std::string& s, double v) {
+  uint64_t bits;
+  memcpy(&bits, &v, sizeof(bits));
+  s += (char)0x00;
+  PutBe(s, bits >> 32, 4);
+  PutBe(s, bits & 0xffffffff, 4);
+}
+
+static void AmfBool(std::string& s, bool v) {
+  s += (char)0x01;
+  s += (char)(v ? 1 : 0);
+}
+
+static void AmfNull(std::string& s) {
+  s += (char)0x05;
+}
+
+static void AmfKey(std::string& s, const char* key) {
+  PutBe(s, strlen(key), 2);
+  s += key;
+}
+
+static void AmfObjectEnd(std::string& s) {
+  PutBe(s, 9, 3);
+}
+
+// bytes of the amf0 value at p, -1 if it is broken
+static int AmfSkip(const uint8_t* p, int size, int depth = 0) {
+  if (size < 1 || depth > 8) {
+    return -1;
+  }
+  int off = 1;
+  switch (p[0]) {
+    case 0x00:
+      off += 8;
+      break;
+    case 0x01:
+      off += 1;
+      break;
+    case 0x02:
+      if (size < 3) {
+        return -1;
+      }
+      off += 2 + Be16(p + 1);
+      break;
+    case 0x05:
+    case 0x06:
+      break;
+    case 0x08:
+      off += 4;
+      // fall through
+    case 0x03:
+      while (1) {
+        if (off + 3 > size) {
+          return -1;
+        }
+        int len = Be16(p + off);
+        if (len == 0 && p[off + 2] == 0x09) {
+          off += 3;
+          break;
+        }
+        off += 2 + len;
+        int ret = AmfSkip(p + off, size - off, depth + 1);
+        if (ret < 0) {
+          return -1;
+        }
+        off += ret;
+      }
+      break;
+    case 0x0a: {
+      if (size < 5) {
+        return -1;
+      }
+      uint32_t count = Be32(p + 1);
+      off += 4;
+      for (uint32_t i = 0; i < count; i ++) {
+        int ret = AmfSkip(p + off, size - off, depth + 1);
+        if (ret < 0) {
+          return -1;
+        }
+        off += ret;
+      }
+      break;
+    }
+    case 0x0b:
+      off += 10;
+      break;
+    case 0x0c:
+      if (size < 5) {
+        return -1;
+      }
+      off += 4 + Be32(p + 1);
+      break;
+    default:
+      return -1;
+  }
+  return off <= size ? off : -1;
+}
+
+static int AmfReadString(const uint8_t* p, int size, std::string& v) {
+  if (size < 3 || p[0] != 0x02 || (int)Be16(p + 1) + 3 > size) {
+    return -1;
+  }
+  v.assign((const char* )p + 3, Be16(p + 1));
+  return 3 + Be16(p + 1);
+}
+
+static int AmfReadNumber(const uint8_t* p, int size, double& v) {
+  if (size < 9 || p[0] != 0x00) {
+    return -1;
+  }
+  uint64_t bits = ((uint64_t)Be32(p + 1) << 32) | Be32(p + 5);
+  memcpy(&v, &bits, sizeof(v));
+  return 9;
+}
+
+// string property of the amf0 object at p
+static bool AmfFindString(const uint8_t* p, int size, const char* key, std::string& v) {
+  int off = 1;
+  if (size < 1 || (p[0] != 0x03 && p[0] != 0x08)) {
+    return false;
+  }
+  off += p[0] == 0x08 ? 4 : 0;
+  while (off + 3 <= size) {
+    int len = Be16(p + off);
+    if (len == 0) {
+      break;
+    }
+    off += 2;
+    if (off + len > size) {
+      break;
+    }
+    bool match = len == (int)strlen(key) && !memcmp(p + off, key, len);
+    off += len;
+    if (match) {
+      return AmfReadString(p + off, size - off, v) > 0;
+    }
+    int ret = AmfSkip(p + off, size - off);
+    if (ret < 0) {
+      break;
+    }
+    off += ret;
+  }
+  return false;
+}
+
+RtmpClient::RtmpClient(ReactorLoop* _loop, const char* _url, FlvCallback _cb, void* _arg)
+  : loop(_loop), url(_url), cb(_cb), arg(_arg), http(false), chunked(false), port(0),
+    bev(NULL), retry_ev(NULL), state(STATE_IDLE), backoff_sec(1), running(false),
+    http_chunk(-1), body(NULL), in_chunk_size(RTMP_CHUNK_SIZE), window(0),
+    received(0), acked(0), stream_id(0) {
+}
+
+RtmpClient::~RtmpClient(void) {
+  if (body != NULL) {
+    evbuffer_free(body);
+  }
+}
+
+int RtmpClient::ParseUrl(void) {
+  const char* p = url.c_str();
+  if (!strncasecmp(p, "rtmp://", 7)) {
+    port = 1935;
+    p += 7;
+  } else if (!strncasecmp(p, "http://", 7)) {
+    http = true;
+    port = 80;
+    p += 7;
+  } else if (!strncasecmp(p, "https://", 8)) {
+    AppWarn("https-flv is not supported, use http:// or rtmp://, %s", url.c_str());
+    return -1;
+  } else {
+    AppWarn("unsupported url, %s", url.c_str());
+    return -1;
+  }
+  const char* slash = strchr(p, '/');
+  std::string authority = slash != NULL ? std::string(p, slash - p) : std::string(p);
+  path = slash != NULL ? slash : "/";
+  size_t at = authority.rfind('@');
+  if (at != std::string::npos) {
+    authority = authority.substr(at + 1);
+  }
+  size_t colon = authority.rfind(':');
+  size_t bracket = authority.rfind(']');
+  if (colon != std::string::npos && (bracket == std::string::npos || colon > bracket)) {
+    port = atoi(authority.c_str() + colon + 1);
+    authority = authority.substr(0, colon);
+  }
+  if (authority.size() > 2 && authority[0] == '[' && authority.back() == ']') {
+    authority = authority.substr(1, authority.size() - 2);
+  }
+  host = authority;
+  if (host.empty() || port <= 0 || port > 65535) {
+    AppWarn("invalid host, %s", url.c_str());
+    return -1;
+  }
+  if (http) {
+    return 0;
+  }
+  // rtmp://host/app/stream, app may contain '/' as well
+  size_t last = path.rfind('/');
+  if (last == 0 || last + 1 >= path.size()) {
+    AppWarn("no app or stream, %s", url.c_str());
+    return -1;
+  }
+  app = path.substr(1, last - 1);
+  stream = path.substr(last + 1);
+  return 0;
+}
+
+int RtmpClient::Start(void) {
+  if (ParseUrl() != 0) {
+    return -1;
+  }
+  body = evbuffer_new();
+  retry_ev = evtimer_new(loop->base, OnRetry, this);
+  if (body == NULL || retry_ev == NULL) {
+    AppError("alloc event failed, %s", url.c_str());
+    return -1;
+  }
+  running = true;
+  alive = std::make_shared<bool>(true);
+  std::shared_ptr<bool> _alive = alive;
+  Reactor::Run(loop, [this, _alive] {
+    if (*_alive) {
+      Connect();
+    }
+  });
+  return 0;
+}
+
+void RtmpClient::Stop(void) {
+  Reactor::Run(loop, [this] {
+    running = false;
+    if (alive != nullptr) {
+      *alive = false;
+    }
+    Close();
+    if (retry_ev != NULL) {
+      event_free(retry_ev);
+      retry_ev = NULL;
+    }
+  }, true);
+}
+
+void RtmpClient::Connect(void) {
+  if (!running) {
+    return;
+  }
+  bev = bufferevent_socket_new(loop->base, -1, BEV_OPT_CLOSE_ON_FREE);
+  if (bev == NULL) {
+    Retry("alloc socket failed");
+    return;
+  }
+  bufferevent_setcb(bev, OnRead, NULL, OnEvent, this);
+  struct timeval rtv = {RTMP_READ_TIMEOUT, 0};
+  struct timeval wtv = {RTMP_WRITE_TIMEOUT, 0};
+  bufferevent_set_timeouts(bev, &rtv, &wtv);
+  bufferevent_enable(bev, EV_READ | EV_WRITE);
+  streams.clear();
+  in_chunk_size = RTMP_CHUNK_SIZE;
+  window = 0;
+  received = 0;
+  acked = 0;
+  stream_id = 0;
+  chunked = false;
+  http_chunk = -1;
+  evbuffer_drain(body, evbuffer_get_length(body));
+  state = STATE_CONNECTING;
+  if (bufferevent_socket_connect_hostname(bev, loop->dns, AF_UNSPEC, host.c_str(), port) < 0) {
+    Retry("connect failed");
+  }
+}
+
+void RtmpClient::Close(void) {
+  if (bev != NULL) {
+    bufferevent_free(bev);
+    bev = NULL;
+  }
+  state = STATE_IDLE;
+}
+
+void RtmpClient::Retry(const char* reason) {
+  Close();
+  if (!running || retry_ev == NULL) {
+    return;
+  }
+  AppWarn("%s, %s, retry in %ds", url.c_str(), reason, backoff_sec);
+  struct timeval tv = {backoff_sec, 0};
+  evtimer_add(retry_ev, &tv);
+  backoff_sec = backoff_sec * 2 < RTMP_BACKOFF_MAX ? backoff_sec * 2 : RTMP_BACKOFF_MAX;
+}
+
+void RtmpClient::OnRetry(int fd, short what, void* arg) {
+  RtmpClient* client = (RtmpClient* )arg;
+  client->Connect();
+}
+
+void RtmpClient::OnEvent(struct bufferevent* bev, short what, void* arg) {
+  RtmpClient* client = (RtmpClient* )arg;
+  if (what & BEV_EVENT_CONNECTED) {
+    if (client->http) {
+      char req[2048];
+      snprintf(req, sizeof(req), "GET %s HTTP/1.1\r\nHost: %s\r\nUser-Agent: aistream\r\n"
+               "Accept: */*\r\nConnection: close\r\n\r\n", client->path.c_str(), client->host.c_str());
+      bufferevent_write(bev, req, strlen(req));
+      client->state = STATE_HTTP_HEADER;
+    } else {
+      // c0 and c1, version 3 and no digest
+      uint8_t c0c1[RTMP_HANDSHAKE_SIZE + 1] = {0x03};
+      for (int i = 9; i < (int)sizeof(c0c1); i ++) {
+        c0c1[i] = rand() & 0xff;
+      }
+      bufferevent_write(bev, c0c1, sizeof(c0c1));
+      client->state = STATE_HANDSHAKE;
+    }
+    return;
+  }
+  if (what & BEV_EVENT_TIMEOUT) {
+    client->Retry("timeout");
+  } else if (what & BEV_EVENT_EOF) {
+    client->Retry("closed by peer");
+  } else if (what & BEV_EVENT_ERROR) {
+    int err = bufferevent_socket_get_dns_error(bev);
+    client->Retry(err != 0 ? evutil_gai_strerror(err) :
+                  evutil_socket_error_to_string(EVUTIL_SOCKET_ERROR()));
+  }
+}
+
+void RtmpClient::OnRead(struct bufferevent* bev, void* arg) {
+  RtmpClient* client = (RtmpClient* )arg;
+  struct evbuffer* input = bufferevent_get_input(bev);
+  int ret = 0;
+  if (client->state == STATE_HANDSHAKE || client->state == STATE_HANDSHAKE_S2) {
+    ret = client->ReadHandshake(input);
+  } else if (client->state == STATE_HTTP_HEADER) {
+    ret = client->ReadHttp(input);
+  }
+  if (ret == 0 && client->http && client->state >= STATE_FLV_HEADER) {
+    if (client->chunked) {
+      ret = client->Dechunk(input);
+      input = client->body;
+    }
+    ret = ret == 0 ? client->ReadFlv(input) : ret;
+  } else if (ret == 0 && client->state == STATE_STREAMING) {
+    ret = client->ReadChunk(input);
+  }
+  if (ret < 0) {
+    client->Retry("protocol error");
+  }
+}
+
+int RtmpClient::ReadHttp(struct evbuffer* input) {
+  struct evbuffer_ptr end = evbuffer_search(input, "\r\n\r\n", 4, NULL);
+  if (end.pos < 0) {
+    return evbuffer_get_length(input) > 8192 ? -1 : 0;
+  }
+  std::string header((const char* )evbuffer_pullup(input, end.pos + 4), end.pos + 4);
+  evbuffer_drain(input, end.pos + 4);
+  int code = 0;
+  if (sscanf(header.c_str(), "HTTP/%*d.%*d %d", &code) != 1 || code != 200) {
+    AppWarn("%s, http status %d", url.c_str(), code);
+    return -1;
+  }
+  chunked = strcasestr(header.c_str(), "transfer-encoding: chunked") != NULL;
+  state = STATE_FLV_HEADER;
+  return 0;
+}
+
+int RtmpClient::Dechunk(struct evbuffer* input) {
+  while (evbuffer_get_length(input) > 0) {
+    if (http_chunk == -1) {
+      size_t eol_len = 0;
+      struct evbuffer_ptr eol = evbuffer_search_eol(input, NULL, &eol_len, EVBUFFER_EOL_CRLF);
+      if (eol.pos < 0) {
+        return evbuffer_get_length(input) > 1024 ? -1 : 0;
+      }
+      char* line = evbuffer_readln(input, NULL, EVBUFFER_EOL_CRLF);
+      http_chunk = strtoll(line, NULL, 16);
+      free(line);
+      if (http_chunk <= 0) {
+        // the last chunk, the stream is over
+        return -1;
+      }
+    } else if (http_chunk == -2) {
+      if (evbuffer_get_length(input) < 2) {
+        return 0;
+      }
+      evbuffer_drain(input, 2);
+      http_chunk = -1;
+    } else {
+      int64_t len = evbuffer_get_length(input);
+      len = len < http_chunk ? len : http_chunk;
+      evbuffer_remove_buffer(input, body, len);
+      http_chunk -= len;
+      http_chunk = http_chunk == 0 ? -2 : http_chunk;
+    }
+  }
+  return 0;
+}
+
+int RtmpClient::ReadFlv(struct evbuffer* input) {
+  if (state == STATE_FLV_HEADER) {
+    if (evbuffer_get_length(input) < 13) {
+      return 0;
+    }
+    uint8_t* p = evbuffer_pullup(input, 9);
+    uint32_t offset = Be32(p + 5);
+    if (memcmp(p, "FLV", 3) || offset < 9 || offset > 1024) {
+      AppWarn("%s, not flv", url.c_str());
+      return -1;
+    }
+    // header and the first previous tag size
+    if (evbuffer_get_length(input) < offset + 4) {
+      return 0;
+    }
+    evbuffer_drain(input, offset + 4);
+    state = STATE_STREAMING;
+  }
+  while (evbuffer_get_length(input) >= 11) {
+    uint8_t* p = evbuffer_pullup(input, 11);
+    int type = p[0] & 0x1f;
+    uint32_t size = Be24(p + 1);
+    uint32_t ts = Be24(p + 4) | ((uint32_t)p[7] << 24);
+    if (size > RTMP_MSG_MAX) {
+      return -1;
+    }
+    if (evbuffer_get_length(input) < 11 + size + 4) {
+      return 0;
+    }
+    if (type == 9) {
+      p = evbuffer_pullup(input, 11 + size);
+      HandleVideo(p + 11, size, ts);
+    }
+    evbuffer_drain(input, 11 + size + 4);
+  }
+  return 0;
+}
+
+int RtmpClient::ReadHandshake(struct evbuffer* input) {
+  if (state == STATE_HANDSHAKE) {
+    if (evbuffer_get_length(input) < RTMP_HANDSHAKE_SIZE + 1) {
+      return 0;
+    }
+    uint8_t* p = evbuffer_pullup(input, RTMP_HANDSHAKE_SIZE + 1);
+    if (p[0] != 0x03) {
+      AppWarn("%s, unsupported rtmp version %d", url.c_str(), p[0]);
+      return -1;
+    }
+    // c2 echoes s1
+    bufferevent_write(bev, p + 1, RTMP_HANDSHAKE_SIZE);
+    evbuffer_drain(input, RTMP_HANDSHAKE_SIZE + 1);
+    state = STATE_HANDSHAKE_S2;
+  }
+  if (evbuffer_get_length(input) < RTMP_HANDSHAKE_SIZE) {
+    return 0;
+  }
+  evbuffer_drain(input, RTMP_HANDSHAKE_SIZE);
+  state = STATE_STREAMING;
+  SendConnect();
+  return ReadChunk(input);
+}
+
+int RtmpClient::ReadChunk(struct evbuffer* input) {
+  static const int header_size[] = {11, 7, 3, 0};
+  while (1) {
+    uint8_t hdr[18];
+    size_t len = evbuffer_get_length(input);
+    size_t peek = len < sizeof(hdr) ? len : sizeof(hdr);
+    if (peek < 1) {
+      return 0;
+    }
+    evbuffer_copyout(input, hdr, peek);
+    int fmt = hdr[0] >> 6;
+    int csid = hdr[0] & 0x3f;
+    size_t off = 1;
+    if (csid == 0) {
+      csid = 64 + hdr[1];
+      off = 2;
+    } else if (csid == 1) {
+      csid = 64 + hdr[1] + hdr[2] * 256;
+      off = 3;
+    }
+    if (peek < off + header_size[fmt]) {
+      return 0;
+    }
+    RtmpChunkStream& cs = streams[csid];
+    const uint8_t* p = hdr + off;
+    uint32_t ts_field = fmt <= 2 ? Be24(p) : cs.ts_field;
+    uint32_t msg_len = fmt <= 1 ? Be24(p + 3) : cs.len;
+    uint8_t type = fmt <= 1 ? p[6] : cs.type;
+    uint32_t sid = fmt == 0 ? (p[7] | (p[8] << 8) | (p[9] << 16) | ((uint32_t)p[10] << 24)) : cs.sid;
+    off += header_size[fmt];
+    bool ext = fmt <= 2 ? ts_field == 0xffffff : cs.ext;
+    if (ext) {
+      if (peek < off + 4) {
+        return 0;
+      }
+      ts_field = Be32(hdr + off);
+      off += 4;
+    }
+    if (msg_len > RTMP_MSG_MAX) {
+      AppWarn("%s, message too large, %u", url.c_str(), msg_len);
+      return -1;
+    }
+    // a new header drops the message in progress
+    if (fmt <= 1) {
+      cs.buf.clear();
+    }
+    bool start = cs.buf.empty();
+    uint32_t chunk = msg_len - cs.buf.size();
+    chunk = chunk < in_chunk_size ? chunk : in_chunk_size;
+    if (len < off + chunk) {
+      return 0;
+    }
+    if (start) {
+      cs.ts = fmt == 0 ? ts_field : cs.ts + ts_field;
+    }
+    cs.ts_field = ts_field;
+    cs.ext = ext;
+    cs.len = msg_len;
+    cs.type = type;
+    cs.sid = sid;
+    evbuffer_drain(input, off);
+    size_t size = cs.buf.size();
+    cs.buf.resize(size + chunk);
+    evbuffer_remove(input, cs.buf.data() + size, chunk);
+    received += off + chunk;
+    if (cs.buf.size() == cs.len) {
+      int ret = HandleMessage(&cs);
+      cs.buf.clear();
+      if (ret < 0) {
+        return -1;
+      }
+    }
+    if (window > 0 && received - acked >= window / 2) {
+      SendAck();
+    }
+  }
+  return 0;
+}
+
+int RtmpClient::HandleMessage(RtmpChunkStream* cs) {
+  const uint8_t* data = cs->buf.data();
+  int size = cs->buf.size();
+  switch (cs->type) {
+    case 1:
+      if (size >= 4) {
+        in_chunk_size = Be32(data) & 0x7fffffff;
+        in_chunk_size = in_chunk_size > 0 ? in_chunk_size : 1;
+      }
+      break;
+    case 2:
+      if (size >= 4) {
+        streams[Be32(data)].buf.clear();
+      }
+      break;
+    case 4:
+      // ping request, answered with the same timestamp
+      if (size >= 6 && Be16(data) == 6) {
+        std::string msg;
+        PutBe(msg, 7, 2);
+        msg.append((const char* )data + 2, 4);
+        SendMessage(2, 4, 0, msg);
+      }
+      break;
+    case 5:
+      if (size >= 4) {
+        window = Be32(data);
+      }
+      break;
+    case 6:
+      if (size >= 4) {
+        std::string msg;
+        PutBe(msg, Be32(data), 4);
+        SendMessage(2, 5, 0, msg);
+      }
+      break;
+    case 9:
+      HandleVideo(data, size, cs->ts);
+      break;
+    case 20:
+      return HandleCommand(data, size);
+    case 22: {
+      // aggregate, flv tags with timestamps relative to the first one
+      int off = 0;
+      int64_t base = -1;
+      while (off + 11 <= size) {
+        int tag_type = data[off] & 0x1f;
+        uint32_t tag_size = Be24(data + off + 1);
+        uint32_t tag_ts = Be24(data + off + 4) | ((uint32_t)data[off + 7] << 24);
+        if (off + 11 + (int)tag_size > size) {
+          break;
+        }
+        base = base < 0 ? tag_ts : base;
+        if (tag_type == 9) {
+          HandleVideo(data + off + 11, tag_size, cs->ts + (tag_ts - base));
+        }
+        off += 11 + tag_size + 4;
+      }
+      break;
+    }
+    default:
+      break;
+  }
+  return 0;
+}
+
+int RtmpClient::HandleCommand(const uint8_t* data, int size) {
+  std::string name;
+  double txn = 0;
+  int off = AmfReadString(data, size, name);
+  if (off < 0) {
+    return 0;
+  }
+  int ret = AmfReadNumber(data + off, size - off, txn);
+  off += ret > 0 ? ret : 0;
+  if (name == "_result" && txn == 1) {
+    std::string msg;
+    AmfString(msg, "createStream");
+    AmfNumber(msg, 2);
+    AmfNull(msg);
+    SendMessage(3, 20, 0, msg);
+  } else if (name == "_result" && txn == 2) {
+    double sid = 0;
+    ret = AmfSkip(data + off, size - off);
+    if (ret < 0 || AmfReadNumber(data + off + ret, size - off - ret, sid) < 0) {
+      AppWarn("%s, createStream without stream id", url.c_str());
+      return -1;
+    }
+    stream_id = (uint32_t)sid;
+    std::string msg;
+    AmfString(msg, "play");
+    AmfNumber(msg, 0);
+    AmfNull(msg);
+    AmfString(msg, stream);
+    // live stream, or recorded one if not found
+    AmfNumber(msg, -2000);
+    SendMessage(8, 20, stream_id, msg);
+    // buffer length of 3s
+    std::string ctrl;
+    PutBe(ctrl, 3, 2);
+    PutBe(ctrl, stream_id, 4);
+    PutBe(ctrl, 3000, 4);
+    SendMessage(2, 4, 0, ctrl);
+  } else if (name == "_error") {
+    AppWarn("%s, command %.0f failed", url.c_str(), txn);
+    return -1;
+  } else if (name == "onStatus") {
+    std::string code;
+    ret = AmfSkip(data + off, size - off);
+    if (ret > 0) {
+      AmfFindString(data + off + ret, size - off - ret, "code", code);
+    }
+    AppDebug("%s, %s", url.c_str(), code.c_str());
+    if (code.find("Failed") != std::string::npos ||
+        code.find("StreamNotFound") != std::string::npos ||
+        code.find("UnpublishNotify") != std::string::npos ||
+        code == "NetStream.Play.Stop") {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+void RtmpClient::HandleVideo(const uint8_t* data, int size, uint32_t ts) {
+  if (size < 5) {
+    return;
+  }
+  FlvVideo video = {0};
+  int frame_type = 0;
+  // composition time offset, signed 24 bits
+  int32_t cts = 0;
+  int off = 5;
+  if (data[0] & 0x80) {
+    // enhanced rtmp, packet type and fourcc instead of codec id
+    frame_type = (data[0] >> 4) & 0x07;
+    int packet_type = data[0] & 0x0f;
+    if (!memcmp(data + 1, "hvc1", 4)) {
+      video.codec = FLV_CODEC_H265;
+    } else if (!memcmp(data + 1, "avc1", 4)) {
+      video.codec = FLV_CODEC_H264;
+    } else {
+      return;
+    }
+    // 0 is sequence start, 1 is coded frames, 3 is coded frames without cts
+    if (packet_type == 1) {
+      if (size < 8) {
+        return;
+      }
+      cts = (int32_t)(Be24(data + 5) << 8) >> 8;
+      off = 8;
+    } else if (packet_type != 0 && packet_type != 3) {
+      return;
+    }
+    video.config = packet_type == 0;
+  } else {
+    frame_type = data[0] >> 4;
+    video.codec = data[0] & 0x0f;
+    // 2 is end of sequence
+    if ((video.codec != FLV_CODEC_H264 && video.codec != FLV_CODEC_H265) || data[1] == 2) {
+      return;
+    }
+    cts = (int32_t)(Be24(data + 2) << 8) >> 8;
+    video.config = data[1] == 0;
+  }
+  // 5 is video info or command frame
+  if (frame_type == 5) {
+    return;
+  }
+  video.key_frame = frame_type == 1;
+  video.dts = ts;
+  video.pts = (int64_t)ts + cts;
+  video.data = data + off;
+  video.size = size - off;
+  // healthy stream, the next retry starts from the shortest delay
+  backoff_sec = 1;
+  cb(&video, arg);
+}
+
+void RtmpClient::SendMessage(int csid, int type, uint32_t sid, const std::string& body) {
+  std::string msg;
+  msg += (char)csid;
+  PutBe(msg, 0, 3);
+  PutBe(msg, body.size(), 3);
+  msg += (char)type;
+  for (int i = 0; i < 4; i ++) {
+    msg += (char)((sid >> (i * 8)) & 0xff);
+  }
+  for (size_t off = 0; off < body.size(); off += RTMP_CHUNK_SIZE) {
+    if (off > 0) {
+      msg += (char)(0xc0 | csid);
+    }
+    msg.append(body, off, RTMP_CHUNK_SIZE);
+  }
+  bufferevent_write(bev, msg.data(), msg.size());
+}
+
+void RtmpClient::SendConnect(void) {
+  std::string tc_url = "rtmp://" + host + ":" + std::to_string(port) + "/" + app;
+  std::string msg;
+  AmfString(msg, "connect");
+  AmfNumber(msg, 1);
+  msg += (char)0x03;
+  AmfKey(msg, "app");
+  AmfString(msg, app);
+  AmfKey(msg, "flashVer");
+  AmfString(msg, "LNX 9,0,124,2");
+  AmfKey(msg, "tcUrl");
+  AmfString(msg, tc_url);
+  AmfKey(msg, "fpad");
+  AmfBool(msg, false);
+  AmfKey(msg, "capabilities");
+  AmfNumber(msg, 15);
+  AmfKey(msg, "audioCodecs");
+  AmfNumber(msg, 4071);
+  AmfKey(msg, "videoCodecs");
+  AmfNumber(msg, 252);
+  AmfKey(msg, "videoFunction");
+  AmfNumber(msg, 1);
+  // enhanced rtmp, hevc may be sent by the fourcc
+  AmfKey(msg, "fourCcList");
+  msg += (char)0x0a;
+  PutBe(msg, 2, 4);
+  AmfString(msg, "hvc1");
+  AmfString(msg, "avc1");
+  AmfObjectEnd(msg);
+  SendMessage(3, 20, 0, msg);
+}
+
+void RtmpClient::SendAck(void) {
+  std::string msg;
+  PutBe(msg, received & 0xffffffff, 4);
+  SendMessage(2, 3, 0, msg);
+  acked = received;
+}
@@ -0,0 +1,128 @@
+/****************************************************************************************
+ * Copyright (C) 2021 aistream <aistream@yeah.net>
+ *
+ * Licensed under the BSD 3-Clause License (the "License"); you may not use this
+ * file except in compliance with the License. You may obtain a copy of the License at
+ *
+ * https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Unless required by applicable law or agreed to in writing, software distributed
+ * under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+ * CONDITIONS OF ANY KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations under the License.
+ *
+ ***************************************************************************************/
+
+#ifndef __AISTREAM_RTMP_CLIENT_H__
+#define __AISTREAM_RTMP_CLIENT_H__
+
+#include <stdint.h>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include "reactor.h"
+
+struct event;
+struct bufferevent;
+struct evbuffer;
+
+// flv codec id of video tag, 12 is the de facto one of hevc, enhanced rtmp
+// signals it by the fourcc hvc1 instead
+#define FLV_CODEC_H264 7
+#define FLV_CODEC_H265 12
+
+// Video tag of flv, as received by rtmp or http-flv
+typedef struct {
+  int codec;
+  bool key_frame;
+  // sequence header, data is the decoder configuration record
+  bool config;
+  // msec
+  int64_t dts;
+  int64_t pts;
+  const uint8_t* data;
+  int size;
+} FlvVideo;
+
+typedef void (*FlvCallback)(const FlvVideo* video, void* arg);
+
+typedef struct {
+  uint32_t ts;
+  uint32_t ts_field;
+  uint32_t len;
+  uint8_t type;
+  uint32_t sid;
+  bool ext;
+  std::vector<uint8_t> buf;
+} RtmpChunkStream;
+
+// Non-blocking client of rtmp:// and http-flv, all the callbacks run
+// in the thread of its reactor loop, broken connections are retried
+// with exponential backoff
+class RtmpClient {
+ public:
+  RtmpClient(ReactorLoop* _loop, const char* _url, FlvCallback _cb, void* _arg);
+  ~RtmpClient(void);
+  int Start(void);
+  // closes the connection, no callback is invoked after it returns
+  void Stop(void);
+ private:
+  enum {
+    STATE_IDLE = 0,
+    STATE_CONNECTING,
+    STATE_HANDSHAKE,
+    STATE_HANDSHAKE_S2,
+    STATE_HTTP_HEADER,
+    STATE_FLV_HEADER,
+    STATE_STREAMING,
+  };
+  static void OnRead(struct bufferevent* bev, void* arg);
+  static void OnEvent(struct bufferevent* bev, short what, void* arg);
+  static void OnRetry(int fd, short what, void* arg);
+  int ParseUrl(void);
+  void Connect(void);
+  void Close(void);
+  void Retry(const char* reason);
+  int ReadHttp(struct evbuffer* input);
+  int Dechunk(struct evbuffer* input);
+  int ReadFlv(struct evbuffer* input);
+  int ReadHandshake(struct evbuffer* input);
+  int ReadChunk(struct evbuffer* input);
+  int HandleMessage(RtmpChunkStream* cs);
+  int HandleCommand(const uint8_t* data, int size);
+  void HandleVideo(const uint8_t* data, int size, uint32_t ts);
+  void SendMessage(int csid, int type, uint32_t sid, const std::string& body);
+  void SendConnect(void);
+  void SendAck(void);
+  ReactorLoop* loop;
+  std::string url;
+  FlvCallback cb;
+  void* arg;
+  bool http;
+  bool chunked;
+  std::string host;
+  int port;
+  std::string path;
+  std::string app;
+  std::string stream;
+  struct bufferevent* bev;
+  struct event* retry_ev;
+  int state;
+  int backoff_sec;
+  bool running;
+  // cleared by Stop, the connect queued by Start may run after the client is gone
+  std::shared_ptr<bool> alive;
+  // left bytes of http chunk, -1 means the size line is expected,
+  // -2 means the crlf after data
+  int64_t http_chunk;
+  struct evbuffer* body;
+  std::map<int, RtmpChunkStream> streams;
+  uint32_t in_chunk_size;
+  uint32_t window;
+  uint64_t received;
+  uint64_t acked;
+  uint32_t stream_id;
+};
+
+#endif
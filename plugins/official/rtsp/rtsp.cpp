@@ -16,101 +16,125 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <thread>
+#include <algorithm>
 #include "tensor.h"
 #include "config.h"
 #include "share.h"
-#include "playerapi.h"
+#include "rtsp_client.h"
 #include "log.h"
 
+// one upstream connection, shared by all objects of the same camera
 typedef struct {
-  int id;
+  char key[1024];
   int frame_id;
+  RtspClient* client;
+  // subscribers, ModuleObj
+  std::mutex mtx;
+  std::vector<void*> subs;
+} Session;
+
+typedef struct {
+  int id;
+  Session* session;
   std::mutex mtx;
   std::condition_variable condition;
   std::queue<Packet*> _queue;
-  RtspPlayer player;
   int queue_len_max;
-  long int rtsp_beat;
   int running;
 } ModuleObj;
 
 typedef struct {
   int init;
-  uint64_t now_sec;
   ShareParams share_params;
+  // queue_len of the element config, the objects started after init use it
+  int queue_len;
   std::mutex obj_mtx;
-  std::vector<ModuleObj*> objs;
-  std::thread* t;
-  int running;
+  std::vector<Session*> sessions;
+  // sockets of all sessions are driven by a few loops
+  Reactor reactor;
 } ModuleParams;
 
 static ModuleParams module = {0};
-static void RtspDaemon(void) {
-  struct timeval tv;
-  while (module.running) {
-    gettimeofday(&tv, NULL);
-    module.now_sec = tv.tv_sec;
-    std::unique_lock<std::mutex> obj_lock(module.obj_mtx);
-    for (size_t i = 0; i < module.objs.size(); i ++) {
-      auto obj = module.objs[i];
-      RtspPlayer* player = &obj->player;
-      if (module.now_sec - obj->rtsp_beat > 15) {
-        AppWarn("id:%d,detect exception,restart it ...", obj->id);
-        if (player->playhandle != NULL) {
-          RtspPlayerStop(player);
-        }
-        if (RtspPlayerStart(player)) {
-          AppError("start play %s failed ", player->url);
-        }
-        obj->rtsp_beat = module.now_sec;
-      }
+static void RtspOutput(const RtspNal* nal, void* arg) {
+  HeadParams params = {0};
+  Session* session = (Session* )arg;
+  int type = VideoNalType(nal->codec, nal->buf.get());
+  params.codec = nal->codec;
+  params.type = !VideoNalDelta(nal->codec, type);
+  // parameter sets or idr, decoding can restart here
+  params.key_frame = VideoNalKey(nal->codec, type);
+  params.frame_id = ++session->frame_id;
+  params.pts = nal->pts;
+  params.ingest_usec = GetMonotonicUsec();
+  // the nal is assembled in a pooled buffer, the packets of all subscribers share it
+  std::unique_lock<std::mutex> session_lock(session->mtx);
+  for (size_t i = 0; i < session->subs.size(); i ++) {
+    ModuleObj* obj = (ModuleObj* )session->subs[i];
+    std::unique_lock<std::mutex> lock(obj->mtx);
+    if (obj->_queue.size() < (size_t)obj->queue_len_max) {
+      auto _packet = new Packet(nal->buf, nal->size, &params);
+      obj->_queue.push(_packet);
+    } else {
+      printf("warning,rtsp,id:%d, put to queue failed, quelen:%ld\n",
+             obj->id, obj->_queue.size());
     }
-    obj_lock.unlock();
-    sleep(3);
+    obj->condition.notify_one();
   }
-  AppDebug("run ok");
 }
 
-static int RtspCallback(unsigned char *buf, int size, void *arg) {
-  HeadParams params = {0};
-  ModuleObj* obj = (ModuleObj* )arg;
-
-  //printf("rtsp,id:%d,frameid:%d,size:%d,%02x:%02x:%02x:%02x:%02x\n",
-  //      obj->id, obj->frame_id, size, buf[0], buf[1], buf[2], buf[3], buf[4]);
-  params.type = (buf[4]&0x1f) != 0x1;
-  params.frame_id = ++obj->frame_id;
+static void ClearQueue(ModuleObj* obj) {
   std::unique_lock<std::mutex> lock(obj->mtx);
-  if (obj->_queue.size() < (size_t)obj->queue_len_max) {
-    auto _packet = new Packet(buf, size, &params);
-    obj->_queue.push(_packet);
-  } else {
-    printf("warning,rtsp,id:%d, put to queue failed, quelen:%ld\n",
-           obj->id, obj->_queue.size());
+  while (!obj->_queue.empty()) {
+    Packet* pkt = obj->_queue.front();
+    obj->_queue.pop();
+    if (pkt != nullptr) {
+      delete pkt;
+    }
   }
-  obj->condition.notify_one();
-  obj->rtsp_beat = module.now_sec;
+}
 
-  return 0;
+static void SessionFree(Session* session) {
+  if (session->client != NULL) {
+    session->client->Stop();
+    delete session->client;
+  }
+  delete session;
 }
 
 extern "C" int RtspInit(ElementData* data, char* params) {
   if (__sync_add_and_fetch(&module.init, 1) <= 1) {
-    struct timeval tv;
-    gettimeofday(&tv, NULL);
-    module.now_sec = tv.tv_sec;
     module.share_params = GlobalConfig();
-    module.t = new std::thread(&RtspDaemon);
-    module.running = 1;
+    const char* cfg_file = module.share_params.config_file;
+    int threads = GetIntValFromFile(cfg_file, "video", "ingest_threads");
+    module.reactor.Start(threads > 0 ? threads : 2);
   }
-  const char* cfg_file = module.share_params.config_file;
-  data->queue_len = GetIntValFromFile(cfg_file, "video", "queue_len");
+  data->queue_len = data->config->GetInt("video", "queue_len");
   if (data->queue_len < 0) {
     data->queue_len = 50;
   }
+  module.queue_len = data->queue_len;
   return 0;
 }
 
+// the session of url, created if it is the first object of the camera
+static Session* SessionGet(const char* key, const char* url, int tcp_enable) {
+  for (size_t i = 0; i < module.sessions.size(); i ++) {
+    if (!strcmp(module.sessions[i]->key, key)) {
+      return module.sessions[i];
+    }
+  }
+  Session* session = new Session();
+  strncpy(session->key, key, sizeof(session->key));
+  session->client = new RtspClient(module.reactor.GetLoop(), url, tcp_enable, RtspOutput, session);
+  if (session->client->Start() != 0) {
+    AppError("start play %s failed", url);
+    SessionFree(session);
+    return NULL;
+  }
+  module.sessions.push_back(session);
+  return session;
+}
+
 extern "C" IHandle RtspStart(int channel, char* params) {
   if (params == NULL) {
     AppWarn("id:%d, params is null", channel);
@@ -123,28 +147,27 @@ extern "C" IHandle RtspStart(int channel, char* params) {
     AppWarn("get url failed, %s", params);
     return NULL;
   }
+  // objects of the same url and transport share the session
+  char key[1024];
+  if (NormalizeUrl(url.get(), 554, key, sizeof(key) - 8) != 0) {
+    AppWarn("id:%d, url is too long, %s", channel, url.get());
+    return NULL;
+  }
+  strcat(key, tcp_enable ? "#tcp" : "#udp");
   ModuleObj* obj = new ModuleObj();
   obj->id = channel;
-  obj->rtsp_beat = module.now_sec;
-  RtspPlayer* player = &obj->player;
-  player->cb = RtspCallback;
-  player->streamUsingTCP = tcp_enable;
-  const char* cfg_file = module.share_params.config_file;
-  player->buffersize = GetIntValFromFile(cfg_file, "video", "framesize_max");
-  player->buffersize = player->buffersize > 0 ? player->buffersize : 1024000;
-  strncpy((char *)player->url, url.get(), sizeof(player->url));
-  player->arg = obj;
-  if (RtspPlayerStart(player)) {
-    AppError("start play %s failed ", player->url);
+  obj->queue_len_max = module.queue_len > 0 ? module.queue_len : 50;
+  obj->running = 1;
+  std::unique_lock<std::mutex> obj_lock(module.obj_mtx);
+  Session* session = SessionGet(key, url.get(), tcp_enable);
+  if (session == NULL) {
     delete obj;
     return NULL;
   }
-  obj->queue_len_max = GetIntValFromFile(cfg_file, "video", "queue_len");
-  obj->queue_len_max = obj->queue_len_max > 0 ? obj->queue_len_max : 50;
-  obj->running = 1;
-  std::unique_lock<std::mutex> obj_lock(module.obj_mtx);
-  module.objs.push_back(obj);
-  obj_lock.unlock();
+  obj->session = session;
+  std::unique_lock<std::mutex> session_lock(session->mtx);
+  session->subs.push_back(obj);
+  AppDebug("id:%d, %s, objects:%ld", channel, key, session->subs.size());
 
   return obj;
 }
@@ -172,28 +195,23 @@ extern "C" int RtspStop(IHandle handle) {
     return -1;
   }
   obj->running = 0;
-  RtspPlayer *player = &obj->player;
-  if (player->playhandle != NULL) {
-    RtspPlayerStop(player);
-  }
-  std::unique_lock<std::mutex> lock(obj->mtx);
-  while (!obj->_queue.empty()) {
-    Packet* pkt = obj->_queue.front();
-    obj->_queue.pop();
-    if (pkt != nullptr) {
-      delete pkt;
-    }
-  }
-  lock.unlock();
+  // the last object closes the session
+  Session* session = obj->session;
   std::unique_lock<std::mutex> obj_lock(module.obj_mtx);
-  for (auto itr = module.objs.begin(); itr != module.objs.end(); ++itr) {
-    auto _obj = *itr;
-    if (_obj->id == obj->id) {
-      module.objs.erase(itr);
-      break;
-    }
+  std::unique_lock<std::mutex> session_lock(session->mtx);
+  auto& subs = session->subs;
+  subs.erase(std::remove(subs.begin(), subs.end(), obj), subs.end());
+  bool last = subs.empty();
+  session_lock.unlock();
+  if (last) {
+    auto& sessions = module.sessions;
+    sessions.erase(std::remove(sessions.begin(), sessions.end(), session), sessions.end());
   }
   obj_lock.unlock();
+  if (last) {
+    SessionFree(session);
+  }
+  ClearQueue(obj);
   delete obj;
   return 0;
 }
@@ -211,14 +229,7 @@ extern "C" int RtspNotify(IHandle handle) {
 }
 
 extern "C" int RtspRelease(void) {
-  module.running = 0;
-  if (module.t != nullptr) {
-    if (module.t->joinable()) {
-      module.t->join();
-    }
-    delete module.t;
-    module.t = nullptr;
-  }
+  module.reactor.Stop();
   return 0;
 }
 
@@ -0,0 +1,1017 @@
+/****************************************************************************************
+ * Copyright (C) 2021 aistream <aistream@yeah.net>
+ *
+ * Licensed under the BSD 3-Clause License (the "License"); you may not use this
+ * file except in compliance with the License. You may obtain a copy of the License at
+ *
+ * https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Unless required by applicable law or agreed to in writing, software distributed
+ * under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+ * CONDITIONS OF ANY KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations under the License.
+ *
+ ***************************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <event2/event.h>
+#include <event2/buffer.h>
+#include <event2/bufferevent.h>
+#include <event2/dns.h>
+#include "rtsp_client.h"
+#include "tensor.h"
+#include "log.h"
+
+#define RTSP_BACKOFF_MAX 32
+// no response or rtp data for it, the session is considered broken
+#define RTSP_READ_TIMEOUT 15
+#define RTSP_WRITE_TIMEOUT 10
+#define RTSP_SESSION_TIMEOUT 60
+#define RTSP_HEADER_MAX (64 * 1024)
+#define RTSP_NAL_MAX (16 * 1024 * 1024)
+// first buffer of a fragmented nal, doubled when it is full
+#define RTSP_FU_SIZE (64 * 1024)
+#define RTSP_UDP_RCVBUF (2 * 1024 * 1024)
+
+static uint32_t Be16(const uint8_t* p) {
+  return (p[0] << 8) | p[1];
+}
+
+static uint32_t Be32(const uint8_t* p) {
+  return ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static const char* base64_table = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+static std::string Base64Encode(const std::string& in) {
+  std::string out;
+  size_t i = 0;
+  for (; i + 2 < in.size(); i += 3) {
+    uint32_t v = ((uint8_t)in[i] << 16) | ((uint8_t)in[i + 1] << 8) | (uint8_t)in[i + 2];
+    out += base64_table[(v >> 18) & 0x3f];
+    out += base64_table[(v >> 12) & 0x3f];
+    out += base64_table[(v >> 6) & 0x3f];
+    out += base64_table[v & 0x3f];
+  }
+  if (i < in.size()) {
+    uint32_t v = (uint8_t)in[i] << 16;
+    v |= i + 1 < in.size() ? (uint8_t)in[i + 1] << 8 : 0;
+    out += base64_table[(v >> 18) & 0x3f];
+    out += base64_table[(v >> 12) & 0x3f];
+    out += i + 1 < in.size() ? base64_table[(v >> 6) & 0x3f] : '=';
+    out += '=';
+  }
+  return out;
+}
+
+static std::string Base64Decode(const std::string& in) {
+  std::string out;
+  uint32_t v = 0;
+  int bits = 0;
+  for (char c : in) {
+    const char* p = c != '\0' ? strchr(base64_table, c) : NULL;
+    if (p == NULL) {
+      continue;
+    }
+    v = (v << 6) | (p - base64_table);
+    bits += 6;
+    if (bits >= 8) {
+      bits -= 8;
+      out += (char)((v >> bits) & 0xff);
+    }
+  }
+  return out;
+}
+
+// md5 of rfc 1321, only used by digest authentication
+static std::string Md5Hex(const std::string& in) {
+  static const uint32_t k[64] = {
+    0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+    0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be, 0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+    0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+    0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+    0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c, 0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+    0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+    0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+    0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1, 0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391,
+  };
+  static const int r[16] = {7, 12, 17, 22, 5, 9, 14, 20, 4, 11, 16, 23, 6, 10, 15, 21};
+  uint32_t h[4] = {0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476};
+  std::string msg = in;
+  uint64_t bits = (uint64_t)in.size() * 8;
+  msg += (char)0x80;
+  while (msg.size() % 64 != 56) {
+    msg += (char)0;
+  }
+  for (int i = 0; i < 8; i ++) {
+    msg += (char)((bits >> (i * 8)) & 0xff);
+  }
+  for (size_t off = 0; off < msg.size(); off += 64) {
+    uint32_t w[16];
+    for (int i = 0; i < 16; i ++) {
+      const uint8_t* p = (const uint8_t* )msg.data() + off + i * 4;
+      w[i] = p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+    }
+    uint32_t a = h[0], b = h[1], c = h[2], d = h[3];
+    for (int i = 0; i < 64; i ++) {
+      uint32_t f;
+      int g;
+      if (i < 16) {
+        f = (b & c) | (~b & d);
+        g = i;
+      } else if (i < 32) {
+        f = (d & b) | (~d & c);
+        g = (5 * i + 1) % 16;
+      } else if (i < 48) {
+        f = b ^ c ^ d;
+        g = (3 * i + 5) % 16;
+      } else {
+        f = c ^ (b | ~d);
+        g = (7 * i) % 16;
+      }
+      uint32_t x = a + f + k[i] + w[g];
+      int s = r[(i / 16) * 4 + i % 4];
+      a = d;
+      d = c;
+      c = b;
+      b = b + ((x << s) | (x >> (32 - s)));
+    }
+    h[0] += a;
+    h[1] += b;
+    h[2] += c;
+    h[3] += d;
+  }
+  char hex[33];
+  for (int i = 0; i < 16; i ++) {
+    snprintf(hex + i * 2, 3, "%02x", (h[i / 4] >> ((i % 4) * 8)) & 0xff);
+  }
+  return std::string(hex, 32);
+}
+
+static std::string UrlDecode(const std::string& in) {
+  std::string out;
+  for (size_t i = 0; i < in.size(); i ++) {
+    if (in[i] == '%' && i + 2 < in.size() && isxdigit(in[i + 1]) && isxdigit(in[i + 2])) {
+      out += (char)strtol(in.substr(i + 1, 2).c_str(), NULL, 16);
+      i += 2;
+    } else {
+      out += in[i];
+    }
+  }
+  return out;
+}
+
+static std::string Trim(const std::string& s) {
+  size_t start = s.find_first_not_of(" \t\r\n");
+  if (start == std::string::npos) {
+    return "";
+  }
+  size_t end = s.find_last_not_of(" \t\r\n");
+  return s.substr(start, end - start + 1);
+}
+
+// value of the header line name of head, empty if not found
+static std::string HeaderValue(const std::string& head, const char* name) {
+  size_t len = strlen(name);
+  size_t pos = 0;
+  while (pos < head.size()) {
+    size_t eol = head.find("\r\n", pos);
+    eol = eol != std::string::npos ? eol : head.size();
+    if (eol - pos > len && head[pos + len] == ':' &&
+        !strncasecmp(head.c_str() + pos, name, len)) {
+      return Trim(head.substr(pos + len + 1, eol - pos - len - 1));
+    }
+    pos = eol + 2;
+  }
+  return "";
+}
+
+// parameter of an authenticate header, key="value" or key=value
+static std::string AuthParam(const std::string& value, const char* key) {
+  size_t len = strlen(key);
+  size_t pos = 0;
+  while ((pos = value.find(key, pos)) != std::string::npos) {
+    bool start = pos == 0 || value[pos - 1] == ' ' || value[pos - 1] == ',';
+    pos += len;
+    if (!start || pos >= value.size() || value[pos] != '=') {
+      continue;
+    }
+    pos ++;
+    if (pos < value.size() && value[pos] == '"') {
+      size_t end = value.find('"', pos + 1);
+      return value.substr(pos + 1, end != std::string::npos ? end - pos - 1 : std::string::npos);
+    }
+    size_t end = value.find(',', pos);
+    return Trim(value.substr(pos, end != std::string::npos ? end - pos : std::string::npos));
+  }
+  return "";
+}
+
+// control url of sdp, relative ones are resolved against base
+static std::string ResolveControl(const std::string& base, const std::string& control) {
+  if (control.empty() || control == "*") {
+    return base;
+  }
+  if (!strncasecmp(control.c_str(), "rtsp://", 7)) {
+    return control;
+  }
+  if (!base.empty() && base.back() == '/') {
+    return base + control;
+  }
+  return base + "/" + control;
+}
+
+RtspClient::RtspClient(ReactorLoop* _loop, const char* _url, bool _tcp, RtspNalCallback _cb, void* _arg)
+  : loop(_loop), url(_url), tcp(_tcp), cb(_cb), arg(_arg), port(0), auth(AUTH_NONE),
+    auth_tries(0), qop(false), nc(0), cseq(0), timeout_sec(RTSP_SESSION_TIMEOUT),
+    keepalive_options(false), bev(NULL), retry_ev(NULL), tick_ev(NULL), state(STATE_IDLE),
+    backoff_sec(1), running(false), codec(VIDEO_CODEC_H264), payload_type(-1), clock_rate(90000),
+    sprops_sent(false), udp_fd{-1, -1}, udp_ev{NULL, NULL}, have_seq(false), last_seq(0),
+    last_ts(0), ext_ts(0), data_usec(0), keepalive_usec(0), fu_buf(nullptr), fu_size(0), fu_cap(0) {
+}
+
+RtspClient::~RtspClient(void) {
+}
+
+int RtspClient::ParseUrl(void) {
+  const char* p = url.c_str();
+  if (strncasecmp(p, "rtsp://", 7)) {
+    AppWarn("unsupported url, %s", url.c_str());
+    return -1;
+  }
+  p += 7;
+  port = 554;
+  const char* slash = strchr(p, '/');
+  std::string authority = slash != NULL ? std::string(p, slash - p) : std::string(p);
+  std::string path = slash != NULL ? slash : "/";
+  // credentials are kept out of the request line and sent on 401
+  size_t at = authority.rfind('@');
+  if (at != std::string::npos) {
+    std::string userinfo = authority.substr(0, at);
+    size_t colon = userinfo.find(':');
+    user = UrlDecode(userinfo.substr(0, colon));
+    password = colon != std::string::npos ? UrlDecode(userinfo.substr(colon + 1)) : "";
+    authority = authority.substr(at + 1);
+  }
+  uri = "rtsp://" + authority + path;
+  size_t colon = authority.rfind(':');
+  size_t bracket = authority.rfind(']');
+  if (colon != std::string::npos && (bracket == std::string::npos || colon > bracket)) {
+    port = atoi(authority.c_str() + colon + 1);
+    authority = authority.substr(0, colon);
+  }
+  if (authority.size() > 2 && authority[0] == '[' && authority.back() == ']') {
+    authority = authority.substr(1, authority.size() - 2);
+  }
+  host = authority;
+  if (host.empty() || port <= 0 || port > 65535) {
+    AppWarn("invalid host, %s", url.c_str());
+    return -1;
+  }
+  return 0;
+}
+
+int RtspClient::Start(void) {
+  if (ParseUrl() != 0) {
+    return -1;
+  }
+  retry_ev = evtimer_new(loop->base, OnRetry, this);
+  tick_ev = event_new(loop->base, -1, EV_PERSIST, OnTick, this);
+  if (retry_ev == NULL || tick_ev == NULL) {
+    AppError("alloc event failed, %s", uri.c_str());
+    if (retry_ev != NULL) {
+      event_free(retry_ev);
+      retry_ev = NULL;
+    }
+    if (tick_ev != NULL) {
+      event_free(tick_ev);
+      tick_ev = NULL;
+    }
+    return -1;
+  }
+  running = true;
+  alive = std::make_shared<bool>(true);
+  std::shared_ptr<bool> _alive = alive;
+  Reactor::Run(loop, [this, _alive] {
+    if (*_alive) {
+      Connect();
+    }
+  });
+  return 0;
+}
+
+void RtspClient::Stop(void) {
+  Reactor::Run(loop, [this] {
+    running = false;
+    if (alive != nullptr) {
+      *alive = false;
+    }
+    // best effort, the socket is closed right after it
+    if (bev != NULL && !session.empty()) {
+      cseq ++;
+      std::string req = Request("TEARDOWN", play_uri, "");
+      send(bufferevent_getfd(bev), req.data(), req.size(), MSG_NOSIGNAL | MSG_DONTWAIT);
+    }
+    Close();
+    if (retry_ev != NULL) {
+      event_free(retry_ev);
+      retry_ev = NULL;
+    }
+    if (tick_ev != NULL) {
+      event_free(tick_ev);
+      tick_ev = NULL;
+    }
+  }, true);
+}
+
+void RtspClient::Connect(void) {
+  if (!running) {
+    return;
+  }
+  bev = bufferevent_socket_new(loop->base, -1, BEV_OPT_CLOSE_ON_FREE);
+  if (bev == NULL) {
+    Retry("alloc socket failed");
+    return;
+  }
+  bufferevent_setcb(bev, OnRead, NULL, OnEvent, this);
+  struct timeval rtv = {RTSP_READ_TIMEOUT, 0};
+  struct timeval wtv = {RTSP_WRITE_TIMEOUT, 0};
+  bufferevent_set_timeouts(bev, &rtv, &wtv);
+  bufferevent_enable(bev, EV_READ | EV_WRITE);
+  auth = AUTH_NONE;
+  auth_tries = 0;
+  nc = 0;
+  session.clear();
+  timeout_sec = RTSP_SESSION_TIMEOUT;
+  keepalive_options = false;
+  payload_type = -1;
+  sprops.clear();
+  sprops_sent = false;
+  have_seq = false;
+  ext_ts = 0;
+  fu_buf = nullptr;
+  fu_size = 0;
+  state = STATE_CONNECTING;
+  if (bufferevent_socket_connect_hostname(bev, loop->dns, AF_UNSPEC, host.c_str(), port) < 0) {
+    Retry("connect failed");
+  }
+}
+
+void RtspClient::Close(void) {
+  if (bev != NULL) {
+    bufferevent_free(bev);
+    bev = NULL;
+  }
+  for (int i = 0; i < 2; i ++) {
+    if (udp_ev[i] != NULL) {
+      event_free(udp_ev[i]);
+      udp_ev[i] = NULL;
+    }
+    if (udp_fd[i] >= 0) {
+      close(udp_fd[i]);
+      udp_fd[i] = -1;
+    }
+  }
+  if (tick_ev != NULL) {
+    event_del(tick_ev);
+  }
+  fu_buf = nullptr;
+  fu_size = 0;
+  session.clear();
+  state = STATE_IDLE;
+}
+
+void RtspClient::Retry(const char* reason) {
+  Close();
+  if (!running || retry_ev == NULL) {
+    return;
+  }
+  AppWarn("%s, %s, retry in %ds", uri.c_str(), reason, backoff_sec);
+  struct timeval tv = {backoff_sec, 0};
+  evtimer_add(retry_ev, &tv);
+  backoff_sec = backoff_sec * 2 < RTSP_BACKOFF_MAX ? backoff_sec * 2 : RTSP_BACKOFF_MAX;
+}
+
+void RtspClient::OnRetry(int fd, short what, void* arg) {
+  RtspClient* client = (RtspClient* )arg;
+  client->Connect();
+}
+
+void RtspClient::OnTick(int fd, short what, void* arg) {
+  RtspClient* client = (RtspClient* )arg;
+  if (client->state != STATE_PLAYING) {
+    return;
+  }
+  int64_t now = GetMonotonicUsec();
+  if (now - client->data_usec > RTSP_READ_TIMEOUT * 1000000LL) {
+    client->Retry("no rtp data");
+    return;
+  }
+  // the session is kept alive at half of its timeout
+  if (now - client->keepalive_usec > client->timeout_sec * 500000LL) {
+    client->keepalive_usec = now;
+    client->SendRequest(client->keepalive_options ? "OPTIONS" : "GET_PARAMETER",
+                        client->play_uri, "");
+  }
+}
+
+void RtspClient::OnEvent(struct bufferevent* bev, short what, void* arg) {
+  RtspClient* client = (RtspClient* )arg;
+  if (what & BEV_EVENT_CONNECTED) {
+    client->SendRequest("DESCRIBE", client->uri, "Accept: application/sdp\r\n");
+    client->state = STATE_DESCRIBE;
+    return;
+  }
+  if (what & BEV_EVENT_TIMEOUT) {
+    client->Retry("timeout");
+  } else if (what & BEV_EVENT_EOF) {
+    client->Retry("closed by peer");
+  } else if (what & BEV_EVENT_ERROR) {
+    int err = bufferevent_socket_get_dns_error(bev);
+    client->Retry(err != 0 ? evutil_gai_strerror(err) :
+                  evutil_socket_error_to_string(EVUTIL_SOCKET_ERROR()));
+  }
+}
+
+void RtspClient::OnRead(struct bufferevent* bev, void* arg) {
+  RtspClient* client = (RtspClient* )arg;
+  struct evbuffer* input = bufferevent_get_input(bev);
+  while (client->bev != NULL && evbuffer_get_length(input) > 0) {
+    uint8_t hdr[4];
+    size_t len = evbuffer_get_length(input);
+    evbuffer_copyout(input, hdr, 1);
+    if (hdr[0] == '$') {
+      // interleaved frame, channel 0 is rtp and 1 is rtcp
+      if (len < 4) {
+        return;
+      }
+      evbuffer_copyout(input, hdr, 4);
+      size_t size = Be16(hdr + 2);
+      if (len < 4 + size) {
+        return;
+      }
+      if (hdr[1] == 0) {
+        uint8_t* p = evbuffer_pullup(input, 4 + size);
+        client->HandleRtp(p + 4, size);
+        // the session may be closed by the callback
+        if (client->bev == NULL) {
+          return;
+        }
+      }
+      evbuffer_drain(input, 4 + size);
+    } else if (hdr[0] >= 'A' && hdr[0] <= 'Z') {
+      int ret = client->ReadMessage(input);
+      if (ret < 0) {
+        client->Retry("protocol error");
+        return;
+      } else if (ret == 0) {
+        return;
+      }
+    } else {
+      // garbage, resync at the next interleaved frame
+      struct evbuffer_ptr dollar = evbuffer_search(input, "$", 1, NULL);
+      evbuffer_drain(input, dollar.pos >= 0 ? dollar.pos : len);
+    }
+  }
+}
+
+// a response or request of server, 1 if one is consumed, 0 if incomplete
+int RtspClient::ReadMessage(struct evbuffer* input) {
+  struct evbuffer_ptr end = evbuffer_search(input, "\r\n\r\n", 4, NULL);
+  if (end.pos < 0) {
+    return evbuffer_get_length(input) > RTSP_HEADER_MAX ? -1 : 0;
+  }
+  size_t head_size = end.pos + 4;
+  std::string head((const char* )evbuffer_pullup(input, head_size), head_size);
+  int content_length = atoi(HeaderValue(head, "Content-Length").c_str());
+  if (content_length < 0 || content_length > RTSP_HEADER_MAX) {
+    return -1;
+  }
+  if (evbuffer_get_length(input) < head_size + content_length) {
+    return 0;
+  }
+  std::string body((const char* )evbuffer_pullup(input, head_size + content_length) + head_size,
+                   content_length);
+  evbuffer_drain(input, head_size + content_length);
+  if (strncmp(head.c_str(), "RTSP/", 5)) {
+    // requests of server, e.g. ANNOUNCE or GET_PARAMETER, are not supported
+    std::string reply = "RTSP/1.0 501 Not Implemented\r\nCSeq: " + HeaderValue(head, "CSeq") + "\r\n\r\n";
+    bufferevent_write(bev, reply.data(), reply.size());
+    return 1;
+  }
+  int code = 0;
+  if (sscanf(head.c_str(), "RTSP/%*d.%*d %d", &code) != 1) {
+    return -1;
+  }
+  // answers of keepalive are not waited for
+  if (atoi(HeaderValue(head, "CSeq").c_str()) != cseq) {
+    return 1;
+  }
+  return HandleResponse(code, head, body) < 0 ? -1 : 1;
+}
+
+std::string RtspClient::Request(const char* _method, const std::string& _uri, const std::string& headers) {
+  std::string req = std::string(_method) + " " + _uri + " RTSP/1.0\r\n";
+  req += "CSeq: " + std::to_string(cseq) + "\r\n";
+  req += "User-Agent: aistream\r\n";
+  if (auth == AUTH_BASIC) {
+    req += "Authorization: Basic " + Base64Encode(user + ":" + password) + "\r\n";
+  } else if (auth == AUTH_DIGEST) {
+    std::string ha1 = Md5Hex(user + ":" + realm + ":" + password);
+    std::string ha2 = Md5Hex(std::string(_method) + ":" + _uri);
+    std::string response;
+    req += "Authorization: Digest username=\"" + user + "\", realm=\"" + realm +
+           "\", nonce=\"" + nonce + "\", uri=\"" + _uri + "\"";
+    if (qop) {
+      char count[16];
+      snprintf(count, sizeof(count), "%08x", ++nc);
+      std::string cnonce = Md5Hex(std::to_string(rand())).substr(0, 16);
+      response = Md5Hex(ha1 + ":" + nonce + ":" + count + ":" + cnonce + ":auth:" + ha2);
+      req += std::string(", qop=auth, nc=") + count + ", cnonce=\"" + cnonce + "\"";
+    } else {
+      response = Md5Hex(ha1 + ":" + nonce + ":" + ha2);
+    }
+    req += ", response=\"" + response + "\"";
+    if (!opaque.empty()) {
+      req += ", opaque=\"" + opaque + "\"";
+    }
+    req += "\r\n";
+  }
+  if (!session.empty()) {
+    req += "Session: " + session + "\r\n";
+  }
+  req += headers + "\r\n";
+  return req;
+}
+
+void RtspClient::SendRequest(const char* _method, const std::string& _uri, const std::string& headers) {
+  cseq ++;
+  method = _method;
+  method_uri = _uri;
+  method_headers = headers;
+  std::string req = Request(_method, _uri, headers);
+  bufferevent_write(bev, req.data(), req.size());
+}
+
+int RtspClient::ParseAuth(const std::string& head) {
+  if (user.empty()) {
+    AppWarn("%s, authentication required", uri.c_str());
+    return -1;
+  }
+  // the digest challenge is preferred if several are offered
+  std::string value;
+  size_t pos = 0;
+  while (pos < head.size()) {
+    size_t eol = head.find("\r\n", pos);
+    eol = eol != std::string::npos ? eol : head.size();
+    std::string line = head.substr(pos, eol - pos);
+    if (!strncasecmp(line.c_str(), "WWW-Authenticate:", 17)) {
+      std::string v = Trim(line.substr(17));
+      if (value.empty() || !strncasecmp(v.c_str(), "Digest", 6)) {
+        value = v;
+      }
+    }
+    pos = eol + 2;
+  }
+  if (!strncasecmp(value.c_str(), "Digest", 6)) {
+    auth = AUTH_DIGEST;
+    realm = AuthParam(value, "realm");
+    nonce = AuthParam(value, "nonce");
+    opaque = AuthParam(value, "opaque");
+    std::string qop_value = AuthParam(value, "qop");
+    qop = qop_value.find("auth") != std::string::npos;
+    nc = 0;
+  } else if (!strncasecmp(value.c_str(), "Basic", 5)) {
+    auth = AUTH_BASIC;
+  } else {
+    AppWarn("%s, unsupported authentication, %s", uri.c_str(), value.c_str());
+    return -1;
+  }
+  return 0;
+}
+
+int RtspClient::HandleResponse(int code, const std::string& head, const std::string& body) {
+  if (state == STATE_PLAYING) {
+    // keepalive, OPTIONS is used by the servers without GET_PARAMETER
+    if (code == 405 || code == 501) {
+      keepalive_options = true;
+    }
+    return 0;
+  }
+  if (code == 401) {
+    // the nonce may be stale, it is answered twice at most
+    if (++auth_tries > 2 || ParseAuth(head) != 0) {
+      AppWarn("%s, %s unauthorized", uri.c_str(), method.c_str());
+      return -1;
+    }
+    std::string _method = method;
+    SendRequest(_method.c_str(), method_uri, method_headers);
+    return 0;
+  }
+  if (code != 200) {
+    AppWarn("%s, %s failed, status %d", uri.c_str(), method.c_str(), code);
+    return -1;
+  }
+  auth_tries = 0;
+  if (state == STATE_DESCRIBE) {
+    std::string base = HeaderValue(head, "Content-Base");
+    base = base.empty() ? HeaderValue(head, "Content-Location") : base;
+    base = base.empty() ? uri : base;
+    play_uri.clear();
+    track_uri.clear();
+    if (ParseSdp(body) != 0) {
+      return -1;
+    }
+    play_uri = ResolveControl(base, play_uri);
+    track_uri = ResolveControl(base, track_uri);
+    std::string transport;
+    if (tcp) {
+      transport = "Transport: RTP/AVP/TCP;unicast;interleaved=0-1\r\n";
+    } else {
+      int udp_port = OpenUdp();
+      if (udp_port < 0) {
+        return -1;
+      }
+      transport = "Transport: RTP/AVP;unicast;client_port=" + std::to_string(udp_port) + "-" +
+                  std::to_string(udp_port + 1) + "\r\n";
+    }
+    SendRequest("SETUP", track_uri, transport);
+    state = STATE_SETUP;
+  } else if (state == STATE_SETUP) {
+    std::string value = HeaderValue(head, "Session");
+    size_t semi = value.find(';');
+    session = Trim(value.substr(0, semi));
+    if (session.empty()) {
+      AppWarn("%s, no session of SETUP", uri.c_str());
+      return -1;
+    }
+    if (semi != std::string::npos) {
+      size_t pos = value.find("timeout=", semi);
+      int timeout = pos != std::string::npos ? atoi(value.c_str() + pos + 8) : 0;
+      timeout_sec = timeout > 0 ? timeout : RTSP_SESSION_TIMEOUT;
+    }
+    SendRequest("PLAY", play_uri, "Range: npt=0.000-\r\n");
+    state = STATE_PLAY;
+  } else if (state == STATE_PLAY) {
+    state = STATE_PLAYING;
+    data_usec = GetMonotonicUsec();
+    keepalive_usec = data_usec;
+    // rtp is checked by the tick instead, a camera may send no response for long
+    struct timeval wtv = {RTSP_WRITE_TIMEOUT, 0};
+    bufferevent_set_timeouts(bev, NULL, &wtv);
+    struct timeval tv = {1, 0};
+    event_add(tick_ev, &tv);
+    AppDebug("%s, playing, session:%s, timeout:%d", uri.c_str(), session.c_str(), timeout_sec);
+  }
+  return 0;
+}
+
+int RtspClient::ParseSdp(const std::string& sdp) {
+  // the first video track, parameter sets of h265 are ordered as vps, sps, pps
+  bool media = false;
+  bool video = false;
+  bool found = false;
+  std::string codec_name;
+  std::string h265_sprops[3];
+  size_t pos = 0;
+  while (pos < sdp.size()) {
+    size_t eol = sdp.find('\n', pos);
+    eol = eol != std::string::npos ? eol : sdp.size();
+    std::string line = Trim(sdp.substr(pos, eol - pos));
+    pos = eol + 1;
+    if (!strncmp(line.c_str(), "m=", 2)) {
+      if (found) {
+        break;
+      }
+      media = true;
+      video = !strncmp(line.c_str(), "m=video ", 8);
+      if (video) {
+        int pt = -1;
+        if (sscanf(line.c_str(), "m=video %*d %*s %d", &pt) != 1) {
+          video = false;
+          continue;
+        }
+        found = true;
+        payload_type = pt;
+      }
+    } else if (!strncmp(line.c_str(), "a=control:", 10)) {
+      // the session level one is the url of PLAY
+      if (video) {
+        track_uri = Trim(line.substr(10));
+      } else if (!media) {
+        play_uri = Trim(line.substr(10));
+      }
+    } else if (video && !strncmp(line.c_str(), "a=rtpmap:", 9)) {
+      char name[32] = {0};
+      int pt = -1, rate = 0;
+      if (sscanf(line.c_str(), "a=rtpmap:%d %31[^/]/%d", &pt, name, &rate) >= 2 && pt == payload_type) {
+        codec_name = name;
+        clock_rate = rate > 0 ? rate : 90000;
+      }
+    } else if (video && !strncmp(line.c_str(), "a=fmtp:", 7)) {
+      size_t space = line.find(' ');
+      if (space == std::string::npos || atoi(line.c_str() + 7) != payload_type) {
+        continue;
+      }
+      std::string params = line.substr(space + 1);
+      size_t start = 0;
+      while (start < params.size()) {
+        size_t semi = params.find(';', start);
+        semi = semi != std::string::npos ? semi : params.size();
+        std::string param = Trim(params.substr(start, semi - start));
+        start = semi + 1;
+        size_t eq = param.find('=');
+        if (eq == std::string::npos) {
+          continue;
+        }
+        std::string key = param.substr(0, eq);
+        std::string value = param.substr(eq + 1);
+        if (key == "sprop-parameter-sets") {
+          size_t s = 0;
+          while (s < value.size()) {
+            size_t comma = value.find(',', s);
+            comma = comma != std::string::npos ? comma : value.size();
+            std::string nal = Base64Decode(value.substr(s, comma - s));
+            if (!nal.empty()) {
+              sprops.push_back(nal);
+            }
+            s = comma + 1;
+          }
+        } else if (key == "sprop-vps" || key == "sprop-sps" || key == "sprop-pps") {
+          int i = key == "sprop-vps" ? 0 : (key == "sprop-sps" ? 1 : 2);
+          h265_sprops[i] = Base64Decode(value);
+        }
+      }
+    }
+  }
+  if (!found) {
+    AppWarn("%s, no video in sdp", uri.c_str());
+    return -1;
+  }
+  if (!strcasecmp(codec_name.c_str(), "H264")) {
+    codec = VIDEO_CODEC_H264;
+  } else if (!strcasecmp(codec_name.c_str(), "H265") || !strcasecmp(codec_name.c_str(), "HEVC")) {
+    codec = VIDEO_CODEC_H265;
+    for (int i = 0; i < 3; i ++) {
+      if (!h265_sprops[i].empty()) {
+        sprops.push_back(h265_sprops[i]);
+      }
+    }
+  } else {
+    AppWarn("%s, unsupported video codec %s, payload type %d", uri.c_str(),
+            codec_name.c_str(), payload_type);
+    return -1;
+  }
+  return 0;
+}
+
+// bound to a pair of even and odd ports, returns the rtp one
+int RtspClient::OpenUdp(void) {
+  for (int tries = 0; tries < 16; tries ++) {
+    int udp_port = 10000 + (rand() % 25000) * 2;
+    int i = 0;
+    for (; i < 2; i ++) {
+      udp_fd[i] = socket(AF_INET, SOCK_DGRAM, 0);
+      if (udp_fd[i] < 0) {
+        break;
+      }
+      struct sockaddr_in addr;
+      memset(&addr, 0, sizeof(addr));
+      addr.sin_family = AF_INET;
+      addr.sin_addr.s_addr = htonl(INADDR_ANY);
+      addr.sin_port = htons(udp_port + i);
+      if (bind(udp_fd[i], (struct sockaddr* )&addr, sizeof(addr)) != 0) {
+        break;
+      }
+      int rcvbuf = RTSP_UDP_RCVBUF;
+      setsockopt(udp_fd[i], SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+      evutil_make_socket_nonblocking(udp_fd[i]);
+      udp_ev[i] = event_new(loop->base, udp_fd[i], EV_READ | EV_PERSIST, OnUdp, this);
+      if (udp_ev[i] == NULL || event_add(udp_ev[i], NULL) != 0) {
+        break;
+      }
+    }
+    if (i == 2) {
+      return udp_port;
+    }
+    for (i = 0; i < 2; i ++) {
+      if (udp_ev[i] != NULL) {
+        event_free(udp_ev[i]);
+        udp_ev[i] = NULL;
+      }
+      if (udp_fd[i] >= 0) {
+        close(udp_fd[i]);
+        udp_fd[i] = -1;
+      }
+    }
+  }
+  AppWarn("%s, bind udp port failed", uri.c_str());
+  return -1;
+}
+
+void RtspClient::OnUdp(int fd, short what, void* arg) {
+  RtspClient* client = (RtspClient* )arg;
+  auto& buf = client->udp_buf;
+  buf.resize(65536);
+  // drained in one go, rtcp is read and ignored
+  for (int i = 0; i < 64 && client->udp_fd[0] >= 0; i ++) {
+    ssize_t size = recv(fd, buf.data(), buf.size(), 0);
+    if (size <= 0) {
+      break;
+    }
+    if (fd == client->udp_fd[0] && client->state == STATE_PLAYING) {
+      client->HandleRtp(buf.data(), size);
+    }
+  }
+}
+
+void RtspClient::HandleRtp(const uint8_t* data, int size) {
+  if (size < 12 || (data[0] >> 6) != 2 || (data[1] & 0x7f) != payload_type) {
+    return;
+  }
+  int off = 12 + (data[0] & 0x0f) * 4;
+  if ((data[0] & 0x10) && off + 4 <= size) {
+    off += 4 + Be16(data + off + 2) * 4;
+  }
+  if ((data[0] & 0x20) && size > 0) {
+    size -= data[size - 1];
+  }
+  if (off >= size) {
+    return;
+  }
+  uint16_t seq = Be16(data + 2);
+  uint32_t ts = Be32(data + 4);
+  if (have_seq) {
+    int16_t diff = (int16_t)(seq - last_seq);
+    // duplicated or reordered too late
+    if (diff <= 0) {
+      return;
+    }
+    // the fragmented nal in progress is broken by the loss
+    if (diff > 1 && fu_buf != nullptr) {
+      fu_buf = nullptr;
+      fu_size = 0;
+    }
+    ext_ts += (int32_t)(ts - last_ts);
+  }
+  have_seq = true;
+  last_seq = seq;
+  last_ts = ts;
+  data_usec = GetMonotonicUsec();
+  // healthy stream, the next retry starts from the shortest delay
+  backoff_sec = 1;
+  int64_t pts = ext_ts * 1000000 / clock_rate;
+  if (!sprops_sent) {
+    sprops_sent = true;
+    for (auto& nal : sprops) {
+      Emit((const uint8_t* )nal.data(), nal.size(), pts);
+    }
+  }
+  if (codec == VIDEO_CODEC_H265) {
+    HandleH265(data + off, size - off, pts);
+  } else {
+    HandleH264(data + off, size - off, pts);
+  }
+}
+
+void RtspClient::HandleH264(const uint8_t* p, int size, int64_t pts) {
+  int type = p[0] & 0x1f;
+  if (type >= 1 && type <= 23) {
+    Emit(p, size, pts);
+  } else if (type == 24) {
+    // stap-a, nal units with 16 bits size
+    int off = 1;
+    while (off + 2 <= size) {
+      int len = Be16(p + off);
+      off += 2;
+      if (len == 0 || off + len > size) {
+        break;
+      }
+      Emit(p + off, len, pts);
+      off += len;
+    }
+  } else if (type == 28 && size > 2) {
+    // fu-a, the nal header is rebuilt from the indicator and fu header
+    uint8_t header = (p[0] & 0xe0) | (p[1] & 0x1f);
+    if (p[1] & 0x80) {
+      FuBegin(&header, 1);
+    }
+    if (fu_buf == nullptr) {
+      return;
+    }
+    FuAppend(p + 2, size - 2);
+    if (fu_buf != nullptr && (p[1] & 0x40)) {
+      FuEnd(pts);
+    }
+  }
+}
+
+void RtspClient::HandleH265(const uint8_t* p, int size, int64_t pts) {
+  if (size < 3) {
+    return;
+  }
+  int type = (p[0] >> 1) & 0x3f;
+  if (type < 48) {
+    Emit(p, size, pts);
+  } else if (type == 48) {
+    // aggregation packet, nal units with 16 bits size
+    int off = 2;
+    while (off + 2 <= size) {
+      int len = Be16(p + off);
+      off += 2;
+      if (len == 0 || off + len > size) {
+        break;
+      }
+      Emit(p + off, len, pts);
+      off += len;
+    }
+  } else if (type == 49 && size > 3) {
+    uint8_t header[2] = {(uint8_t)((p[0] & 0x81) | ((p[2] & 0x3f) << 1)), p[1]};
+    if (p[2] & 0x80) {
+      FuBegin(header, 2);
+    }
+    if (fu_buf == nullptr) {
+      return;
+    }
+    FuAppend(p + 3, size - 3);
+    if (fu_buf != nullptr && (p[2] & 0x40)) {
+      FuEnd(pts);
+    }
+  }
+}
+
+void RtspClient::Emit(const uint8_t* nal, int size, int64_t pts) {
+  RtspNal out;
+  out.buf = BufferAlloc(size + 4);
+  if (out.buf == nullptr) {
+    return;
+  }
+  char* p = out.buf.get();
+  p[0] = 0;
+  p[1] = 0;
+  p[2] = 0;
+  p[3] = 1;
+  memcpy(p + 4, nal, size);
+  out.size = size + 4;
+  out.codec = codec;
+  out.pts = pts;
+  cb(&out, arg);
+}
+
+void RtspClient::FuBegin(const uint8_t* header, int header_size) {
+  fu_cap = RTSP_FU_SIZE;
+  fu_buf = BufferAlloc(fu_cap);
+  if (fu_buf == nullptr) {
+    fu_size = 0;
+    return;
+  }
+  char* p = fu_buf.get();
+  p[0] = 0;
+  p[1] = 0;
+  p[2] = 0;
+  p[3] = 1;
+  memcpy(p + 4, header, header_size);
+  fu_size = 4 + header_size;
+}
+
+void RtspClient::FuAppend(const uint8_t* data, int size) {
+  if (fu_size + size > fu_cap) {
+    if (fu_size + size > RTSP_NAL_MAX) {
+      AppWarn("%s, nal too large, dropped", uri.c_str());
+      fu_buf = nullptr;
+      fu_size = 0;
+      return;
+    }
+    int cap = fu_cap * 2;
+    cap = cap >= fu_size + size ? cap : fu_size + size;
+    auto buf = BufferAlloc(cap);
+    if (buf == nullptr) {
+      fu_buf = nullptr;
+      fu_size = 0;
+      return;
+    }
+    memcpy(buf.get(), fu_buf.get(), fu_size);
+    fu_buf = buf;
+    fu_cap = cap;
+  }
+  memcpy(fu_buf.get() + fu_size, data, size);
+  fu_size += size;
+}
+
+void RtspClient::FuEnd(int64_t pts) {
+  // handed over as is, the nal is not copied again
+  RtspNal out;
+  out.buf = fu_buf;
+  out.size = fu_size;
+  out.codec = codec;
+  out.pts = pts;
+  fu_buf = nullptr;
+  fu_size = 0;
+  cb(&out, arg);
+}
@@ -0,0 +1,150 @@
+/****************************************************************************************
+ * Copyright (C) 2021 aistream <aistream@yeah.net>
+ *
+ * Licensed under the BSD 3-Clause License (the "License"); you may not use this
+ * file except in compliance with the License. You may obtain a copy of the License at
+ *
+ * https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Unless required by applicable law or agreed to in writing, software distributed
+ * under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+ * CONDITIONS OF ANY KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations under the License.
+ *
+ ***************************************************************************************/
+
+#ifndef __AISTREAM_RTSP_CLIENT_H__
+#define __AISTREAM_RTSP_CLIENT_H__
+
+#include <stdint.h>
+#include <memory>
+#include <string>
+#include <vector>
+#include "reactor.h"
+
+struct event;
+struct bufferevent;
+struct evbuffer;
+
+// One nal unit with 4 bytes start code, assembled in a pooled buffer
+typedef struct {
+  std::shared_ptr<char> buf;
+  int size;
+  // VIDEO_CODEC_x of tensor.h, by the rtpmap of sdp
+  int codec;
+  // usec, from rtp timestamp
+  int64_t pts;
+} RtspNal;
+
+typedef void (*RtspNalCallback)(const RtspNal* nal, void* arg);
+
+// Non-blocking rtsp client, rtp over tcp interleaved or udp, all the
+// callbacks run in the thread of its reactor loop, broken sessions are
+// retried with exponential backoff
+class RtspClient {
+ public:
+  RtspClient(ReactorLoop* _loop, const char* _url, bool _tcp, RtspNalCallback _cb, void* _arg);
+  ~RtspClient(void);
+  int Start(void);
+  // closes the session, no callback is invoked after it returns
+  void Stop(void);
+ private:
+  enum {
+    STATE_IDLE = 0,
+    STATE_CONNECTING,
+    STATE_DESCRIBE,
+    STATE_SETUP,
+    STATE_PLAY,
+    STATE_PLAYING,
+  };
+  enum {
+    AUTH_NONE = 0,
+    AUTH_BASIC,
+    AUTH_DIGEST,
+  };
+  static void OnRead(struct bufferevent* bev, void* arg);
+  static void OnEvent(struct bufferevent* bev, short what, void* arg);
+  static void OnRetry(int fd, short what, void* arg);
+  static void OnTick(int fd, short what, void* arg);
+  static void OnUdp(int fd, short what, void* arg);
+  int ParseUrl(void);
+  void Connect(void);
+  void Close(void);
+  void Retry(const char* reason);
+  std::string Request(const char* _method, const std::string& _uri, const std::string& headers);
+  void SendRequest(const char* _method, const std::string& _uri, const std::string& headers);
+  int ReadMessage(struct evbuffer* input);
+  int HandleResponse(int code, const std::string& head, const std::string& body);
+  int ParseSdp(const std::string& sdp);
+  int ParseAuth(const std::string& head);
+  int OpenUdp(void);
+  void HandleRtp(const uint8_t* data, int size);
+  void HandleH264(const uint8_t* p, int size, int64_t pts);
+  void HandleH265(const uint8_t* p, int size, int64_t pts);
+  void Emit(const uint8_t* nal, int size, int64_t pts);
+  void FuBegin(const uint8_t* header, int header_size);
+  void FuAppend(const uint8_t* data, int size);
+  void FuEnd(int64_t pts);
+  ReactorLoop* loop;
+  std::string url;
+  bool tcp;
+  RtspNalCallback cb;
+  void* arg;
+  std::string host;
+  int port;
+  // url without credentials
+  std::string uri;
+  std::string user;
+  std::string password;
+  // authentication, answered to the last 401
+  int auth;
+  int auth_tries;
+  std::string realm;
+  std::string nonce;
+  std::string opaque;
+  bool qop;
+  uint32_t nc;
+  // request in flight, resent after authentication
+  std::string method;
+  std::string method_uri;
+  std::string method_headers;
+  int cseq;
+  // urls of PLAY and SETUP, resolved against the content base
+  std::string play_uri;
+  std::string track_uri;
+  std::string session;
+  int timeout_sec;
+  bool keepalive_options;
+  struct bufferevent* bev;
+  struct event* retry_ev;
+  struct event* tick_ev;
+  int state;
+  int backoff_sec;
+  bool running;
+  // cleared by Stop, the connect queued by Start may run after the client is gone
+  std::shared_ptr<bool> alive;
+  // video track of sdp
+  int codec;
+  int payload_type;
+  int clock_rate;
+  // parameter sets of sdp, sent ahead of the first nal
+  std::vector<std::string> sprops;
+  bool sprops_sent;
+  // udp, fds of rtp and rtcp
+  int udp_fd[2];
+  struct event* udp_ev[2];
+  std::vector<uint8_t> udp_buf;
+  // rtp state
+  bool have_seq;
+  uint16_t last_seq;
+  uint32_t last_ts;
+  int64_t ext_ts;
+  int64_t data_usec;
+  int64_t keepalive_usec;
+  // fragmented nal in progress, nullptr if none
+  std::shared_ptr<char> fu_buf;
+  int fu_size;
+  int fu_cap;
+};
+
+#endif
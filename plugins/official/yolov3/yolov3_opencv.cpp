@@ -24,6 +24,7 @@
 #include <opencv2/highgui.hpp>
 #include "cJSON.h"
 #include "tensor.h"
+#include "trace.h"
 #include "config.h"
 #include "share.h"
 #include "log.h"
@@ -156,7 +157,10 @@ static int Postprocess(std::vector<Mat> outs, std::vector<int>& classIds,
       localConfidences.push_back(confidences[classIndices[i]]);
     }
     std::vector<int> nmsIndices;
-    NMSBoxes(localBoxes, localConfidences, engine->conf_threshold, engine->nms_threshold, nmsIndices);
+    {
+      TRACE_SPAN(span, "plugin", "nms", 0, 0);
+      NMSBoxes(localBoxes, localConfidences, engine->conf_threshold, engine->nms_threshold, nmsIndices);
+    }
     for (size_t i = 0; i < nmsIndices.size(); i++) {
       size_t idx = nmsIndices[i];
       nmsBoxes.push_back(localBoxes[idx]);
@@ -177,7 +181,7 @@ extern "C" int YoloInit(ElementData* data, char* params) {
     AppWarn("params is null");
     return -1;
   }
-  data->queue_len = GetIntValFromFile(share_params.config_file, "img", "queue_len");
+  data->queue_len = data->config->GetInt("img", "queue_len");
   if (data->queue_len < 0) {
     data->queue_len = 50;
   }
@@ -254,11 +258,14 @@ extern "C" int YoloProcess(IHandle handle, TensorData* data) {
   blobFromImage(img, blob, 1.0, Size(engine->width, engine->height),
                 Scalar(), engine->rgb, engine->crop, CV_8U);
   // Forward
-  engine->mtx.lock();
-  engine->net.setInput(blob, "", engine->scale, engine->mean);
   std::vector<Mat> outs;
-  engine->net.forward(outs, engine->out_names);
-  engine->mtx.unlock();
+  {
+    TRACE_SPAN(span, "plugin", "forward", obj->id, pkt->_params.frame_id);
+    engine->mtx.lock();
+    engine->net.setInput(blob, "", engine->scale, engine->mean);
+    engine->net.forward(outs, engine->out_names);
+    engine->mtx.unlock();
+  }
   // Post process
   std::vector<int> classIds;
   std::vector<float> confidences;
@@ -25,6 +25,7 @@
 #include "cJSON.h"
 #include "share.h"
 #include "tensor.h"
+#include "trace.h"
 #include "config.h"
 #include "db.h"
 #include "log.h"
@@ -76,6 +77,7 @@ static void MatToJpg(const cv::Mat &mat, std::vector<unsigned char> &buff) {
   std::vector<int> compressing_factor;
   compressing_factor.push_back(IMWRITE_JPEG_QUALITY);
   compressing_factor.push_back(95); // default(95) 0-100
+  TRACE_SPAN(span, "plugin", "jpeg", 0, 0);
   cv::imencode(".jpg", mat, buff, compressing_factor);
 }
 
@@ -170,7 +172,9 @@ static std::unique_ptr<char[]> TrackCapture(vector<STrack> output_stracks,
       if (t->capture || obj->last_capture_frameid + 1 >= frame_id) {
         continue;
       }
-      if ((y_bottom >= line && !t->dir) || (y_up <= line && t->dir)) {
+      // rgb is null if its frame is lost, capture with a later frame
+      if (rgb != nullptr &&
+          ((y_bottom >= line && !t->dir) || (y_up <= line && t->dir))) {
         char scene_url[URL_LEN] = {0}, obj_url[URL_LEN] = {0};
         BObject det = RectCorrect(output_stracks[i], w, h);
         Rgb2Jpg(obj->id, det, rgb, scene_url, obj_url); // 40ms-50ms
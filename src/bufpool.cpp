@@ -0,0 +1,140 @@
+/****************************************************************************************
+ * Copyright (C) 2021 aistream <aistream@yeah.net>
+ *
+ * Licensed under the BSD 3-Clause License (the "License"); you may not use this
+ * file except in compliance with the License. You may obtain a copy of the License at
+ *
+ * https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Unless required by applicable law or agreed to in writing, software distributed
+ * under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+ * CONDITIONS OF ANY KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations under the License.
+ *
+ ***************************************************************************************/
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include "bufpool.h"
+#include "log.h"
+
+#define POOL_ALIGN        64
+#define POOL_MIN_SIZE     64
+// 8 classes between two powers of 2, at most 12.5% wasted
+#define POOL_CLASS_STEP   8
+// bigger buffers are not pooled
+#define POOL_MAX_SHIFT    26
+#define POOL_CLASS_NUM    ((POOL_MAX_SHIFT - 6) * POOL_CLASS_STEP + 1)
+#define POOL_MAX_BYTES    (256*1024*1024)
+
+typedef struct {
+  int idx;
+  size_t size;
+} BufferHead;
+
+// keep data aligned to cache line
+#define POOL_HEAD_SIZE    POOL_ALIGN
+
+typedef struct alignas(POOL_ALIGN) {
+  std::mutex mtx;
+  std::vector<char*> free_vec;
+} BufferClass;
+
+// never freed, packets may still be released by detached threads at exit
+static BufferClass* pool = new BufferClass[POOL_CLASS_NUM];
+static std::atomic<uint64_t> pool_hits(0);
+static std::atomic<uint64_t> pool_misses(0);
+static std::atomic<uint64_t> pool_held(0);
+static std::atomic<uint64_t> pool_used(0);
+static size_t pool_max = POOL_MAX_BYTES;
+
+// return index of size class, -1 if not pooled
+static int GetClass(size_t size, size_t& class_size) {
+  if (size <= POOL_MIN_SIZE) {
+    class_size = POOL_MIN_SIZE;
+    return 0;
+  }
+  int shift = 63 - __builtin_clzll(size - 1);
+  if (shift >= POOL_MAX_SHIFT) {
+    class_size = size;
+    return -1;
+  }
+  size_t base = 1ULL << shift;
+  size_t step = base / POOL_CLASS_STEP;
+  size_t n = (size - 1 - base) / step;
+  class_size = base + (n + 1) * step;
+  return (shift - 6) * POOL_CLASS_STEP + n + 1;
+}
+
+void BufferPoolInit(size_t max_bytes) {
+  pool_max = max_bytes;
+  AppDebug("buffer pool max bytes:%ld", max_bytes);
+}
+
+char* BufferGet(size_t size) {
+  size_t class_size;
+  char* ptr = nullptr;
+  int idx = GetClass(size, class_size);
+  if (idx >= 0) {
+    BufferClass& cls = pool[idx];
+    std::unique_lock<std::mutex> lock(cls.mtx);
+    if (!cls.free_vec.empty()) {
+      ptr = cls.free_vec.back();
+      cls.free_vec.pop_back();
+    }
+    lock.unlock();
+  }
+  if (ptr != nullptr) {
+    pool_hits ++;
+    pool_held -= class_size;
+  } else {
+    pool_misses ++;
+    size_t alloc_size = (POOL_HEAD_SIZE + class_size + POOL_ALIGN - 1) & ~(POOL_ALIGN - 1);
+    ptr = (char* )aligned_alloc(POOL_ALIGN, alloc_size);
+    if (ptr == nullptr) {
+      AppError("alloc %ld failed", alloc_size);
+      return nullptr;
+    }
+    BufferHead* head = (BufferHead* )ptr;
+    head->idx = idx;
+    head->size = class_size;
+  }
+  pool_used += class_size;
+  return ptr + POOL_HEAD_SIZE;
+}
+
+void BufferPut(char* buf) {
+  if (buf == nullptr) {
+    return;
+  }
+  char* ptr = buf - POOL_HEAD_SIZE;
+  BufferHead* head = (BufferHead* )ptr;
+  size_t class_size = head->size;
+  pool_used -= class_size;
+  if (head->idx >= 0 && pool_held + class_size <= pool_max) {
+    BufferClass& cls = pool[head->idx];
+    std::unique_lock<std::mutex> lock(cls.mtx);
+    cls.free_vec.push_back(ptr);
+    lock.unlock();
+    pool_held += class_size;
+    return;
+  }
+  free(ptr);
+}
+
+std::shared_ptr<char> BufferAlloc(size_t size) {
+  char* buf = BufferGet(size);
+  if (buf == nullptr) {
+    return nullptr;
+  }
+  return std::shared_ptr<char>(buf, BufferPut);
+}
+
+void BufferPoolStats(BufferPoolStat* stat) {
+  stat->hits = pool_hits;
+  stat->misses = pool_misses;
+  stat->bytes_held = pool_held;
+  stat->bytes_used = pool_used;
+  stat->bytes_max = pool_max;
+}
@@ -14,6 +14,8 @@
  ***************************************************************************************/
 
 #include "stream.h"
+#include "governor.h"
+#include "trace.h"
 
 ConfigParams::ConfigParams(MediaServer* _media)
   : media(_media) {
@@ -24,25 +26,52 @@ ConfigParams::~ConfigParams(void) {
 }
 
 bool ConfigParams::Read(const char *cfg) {
-  auto buf = ReadFile2Buf(cfg);
-  if (buf == nullptr) {
-    AppWarn("%s, ReadFile2Buf failed", cfg);
+  auto doc = JsonDoc::Load(cfg);
+  if (doc == nullptr) {
+    AppWarn("%s, load failed", cfg);
     return false;
   }
-  char *ptr = buf.get();
-  master_enable = GetIntValFromJson(ptr, "master", "enable");
-  slave_enable = GetIntValFromJson(ptr, "slave", "enable");
-  master_rest_port = GetIntValFromJson(ptr, "master", "rest_port");
-  slave_rest_port = GetIntValFromJson(ptr, "slave", "rest_port");
-  obj_max = GetIntValFromJson(ptr, "system", "obj_max");
-  task_timeout_sec = GetIntValFromJson(ptr, "system", "task_timeout_sec");
+  master_enable = doc->GetInt("master", "enable");
+  slave_enable = doc->GetInt("slave", "enable");
+  master_rest_port = doc->GetInt("master", "rest_port");
+  slave_rest_port = doc->GetInt("slave", "rest_port");
+  obj_max = doc->GetInt("system", "obj_max");
+  task_timeout_sec = doc->GetInt("system", "task_timeout_sec");
   if (task_timeout_sec < 0) {
     task_timeout_sec = 180;
   }
-  img_save_days = GetIntValFromJson(ptr, "img", "save_days");
-  auto localhost = GetStrValFromJson(ptr, "system", "localhost");
-  if (localhost != nullptr) {
-    strncpy(local_ip, localhost.get(), sizeof(local_ip));
+  // 0: number of cpu cores, -1: disabled
+  executor_threads = doc->GetInt("system", "executor_threads");
+  gop_cache_mb = doc->GetInt("video", "gop_cache_mb");
+  if (gop_cache_mb < 0) {
+    gop_cache_mb = 8;
+  }
+  int bufpool_max_mb = doc->GetInt("system", "bufpool_max_mb");
+  if (bufpool_max_mb >= 0) {
+    BufferPoolInit((size_t)bufpool_max_mb*1024*1024);
+  }
+  GovernorConfig governor;
+  governor.enable = doc->GetInt("system", "governor", "enable") > 0;
+  governor.interval_ms = doc->GetInt("system", "governor", "interval_ms");
+  governor.min_fps = doc->GetInt("system", "governor", "min_fps");
+  governor.max_fps = doc->GetInt("system", "governor", "max_fps");
+  governor.high_water = doc->GetDouble("system", "governor", "high_water");
+  governor.low_water = doc->GetDouble("system", "governor", "low_water");
+  if (governor.high_water <= 0) {
+    governor.high_water = 0.8;
+  }
+  if (governor.low_water < 0) {
+    governor.low_water = 0.3;
+  }
+  GovernorInit(&governor);
+  TraceConfig trace;
+  trace.enable = doc->GetInt("system", "trace", "enable") > 0;
+  trace.ring_size = doc->GetInt("system", "trace", "ring_size");
+  TraceInit(&trace);
+  img_save_days = doc->GetInt("img", "save_days");
+  const char* localhost = doc->GetStr("system", "localhost");
+  if (localhost != NULL) {
+    strncpy(local_ip, localhost, sizeof(local_ip));
   } else {
     GetLocalIp(local_ip);
   }
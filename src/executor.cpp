@@ -0,0 +1,143 @@
+/****************************************************************************************
+ * Copyright (C) 2021 aistream <aistream@yeah.net>
+ *
+ * Licensed under the BSD 3-Clause License (the "License"); you may not use this
+ * file except in compliance with the License. You may obtain a copy of the License at
+ *
+ * https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Unless required by applicable law or agreed to in writing, software distributed
+ * under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+ * CONDITIONS OF ANY KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations under the License.
+ *
+ ***************************************************************************************/
+
+#include "stream.h"
+#include "executor.h"
+
+// index of the worker running in this thread, -1 if not a worker
+static thread_local int worker_idx = -1;
+
+Executor::Executor(MediaServer* _media)
+  : media(_media) {
+  next = 0;
+  pending = 0;
+  idle = 0;
+}
+
+Executor::~Executor(void) {
+}
+
+void Executor::Start(int num) {
+  if (num <= 0) {
+    num = std::thread::hardware_concurrency();
+  }
+  if (num <= 0) {
+    num = 1;
+  }
+  for (int i = 0; i < num; i ++) {
+    workers.push_back(std::make_unique<Worker>());
+  }
+  for (int i = 0; i < num; i ++) {
+    std::thread t(&Executor::WorkerFunc, this, i);
+    t.detach();
+  }
+  std::thread t(&Executor::TimerFunc, this);
+  t.detach();
+  AppDebug("executor start ok, threads:%d", num);
+}
+
+void Executor::Submit(std::shared_ptr<ExecUnit> unit) {
+  size_t idx;
+  if (worker_idx >= 0) {
+    // keep the unit on the current worker, cache is hot
+    idx = worker_idx;
+  } else {
+    idx = next.fetch_add(1, std::memory_order_relaxed) % workers.size();
+  }
+  auto worker = workers[idx].get();
+  std::unique_lock<std::mutex> lock(worker->mtx);
+  worker->_queue.push_back(unit);
+  lock.unlock();
+
+  pending.fetch_add(1);
+  if (idle.load() > 0) {
+    std::unique_lock<std::mutex> lock(mtx);
+    condition.notify_one();
+  }
+}
+
+void Executor::After(std::chrono::steady_clock::duration delay, std::function<void()> cb) {
+  auto when = std::chrono::steady_clock::now() + delay;
+  std::unique_lock<std::mutex> lock(timer_mtx);
+  bool first = timers.empty() || when < timers.begin()->first;
+  timers.emplace(when, cb);
+  if (first) {
+    timer_cond.notify_one();
+  }
+}
+
+void Executor::TimerFunc(void) {
+  std::unique_lock<std::mutex> lock(timer_mtx);
+  while (media->running) {
+    auto now = std::chrono::steady_clock::now();
+    if (timers.empty() || timers.begin()->first > now) {
+      auto end = now + std::chrono::milliseconds(100);
+      if (!timers.empty() && timers.begin()->first < end) {
+        end = timers.begin()->first;
+      }
+      timer_cond.wait_until(lock, end);
+      continue;
+    }
+    auto cb = timers.begin()->second;
+    timers.erase(timers.begin());
+    lock.unlock();
+    cb();
+    lock.lock();
+  }
+  AppDebug("timer run ok");
+}
+
+std::shared_ptr<ExecUnit> Executor::GetUnit(int idx) {
+  std::shared_ptr<ExecUnit> unit = nullptr;
+  auto worker = workers[idx].get();
+  std::unique_lock<std::mutex> lock(worker->mtx);
+  if (!worker->_queue.empty()) {
+    unit = worker->_queue.front();
+    worker->_queue.pop_front();
+    return unit;
+  }
+  lock.unlock();
+  // steal from the tail of others
+  size_t num = workers.size();
+  for (size_t i = 1; i < num; i ++) {
+    auto victim = workers[(idx + i) % num].get();
+    std::unique_lock<std::mutex> lock(victim->mtx);
+    if (!victim->_queue.empty()) {
+      unit = victim->_queue.back();
+      victim->_queue.pop_back();
+      return unit;
+    }
+  }
+  return unit;
+}
+
+void Executor::WorkerFunc(int idx) {
+  worker_idx = idx;
+  while (media->running) {
+    auto unit = GetUnit(idx);
+    if (unit != nullptr) {
+      pending.fetch_sub(1);
+      unit->Run();
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(mtx);
+    idle.fetch_add(1);
+    condition.wait_for(lock, std::chrono::milliseconds(100), [this] {
+      return pending.load() > 0 || !media->running;
+    });
+    idle.fetch_sub(1);
+  }
+  AppDebug("worker %d run ok", idx);
+}
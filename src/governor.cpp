@@ -0,0 +1,190 @@
+/****************************************************************************************
+ * Copyright (C) 2021 aistream <aistream@yeah.net>
+ *
+ * Licensed under the BSD 3-Clause License (the "License"); you may not use this
+ * file except in compliance with the License. You may obtain a copy of the License at
+ *
+ * https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Unless required by applicable law or agreed to in writing, software distributed
+ * under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+ * CONDITIONS OF ANY KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations under the License.
+ *
+ ***************************************************************************************/
+
+#include <unordered_map>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include "stream.h"
+#include "governor.h"
+#include "log.h"
+
+static GovernorConfig gov_config = {false, 1000, 1, 25, 0.8, 0.3};
+static std::mutex gov_mtx;
+static std::vector<StreamRate*> gov_rates;
+
+// load of the slave in one interval
+typedef struct {
+  double max_fill;
+  uint64_t dropped;
+  uint64_t busy_usec;
+  // counters of last interval, keyed by queue and element
+  std::unordered_map<void*, uint64_t> last;
+  std::unordered_map<void*, uint64_t> now;
+} GovernorLoad;
+
+void GovernorInit(GovernorConfig* config) {
+  gov_config = *config;
+  if (gov_config.interval_ms <= 0) {
+    gov_config.interval_ms = 1000;
+  }
+  if (gov_config.min_fps <= 0) {
+    gov_config.min_fps = 1;
+  }
+  if (gov_config.max_fps < gov_config.min_fps) {
+    gov_config.max_fps = gov_config.min_fps;
+  }
+  AppDebug("governor enable:%d, interval:%dms, fps:%d-%d, water:%.2f-%.2f",
+           gov_config.enable, gov_config.interval_ms, gov_config.min_fps,
+           gov_config.max_fps, gov_config.low_water, gov_config.high_water);
+}
+
+StreamRate* GovernorRegister(int id, int max_fps, int priority) {
+  if (!gov_config.enable) {
+    return nullptr;
+  }
+  StreamRate* rate = new StreamRate();
+  rate->id = id;
+  rate->max_fps = max_fps > 0 ? max_fps : gov_config.max_fps;
+  rate->min_fps = std::min(gov_config.min_fps, rate->max_fps);
+  rate->priority = priority > 0 ? priority : 1;
+  rate->fps = rate->max_fps;
+  std::unique_lock<std::mutex> lock(gov_mtx);
+  gov_rates.push_back(rate);
+  return rate;
+}
+
+void GovernorUnregister(StreamRate* rate) {
+  if (rate == nullptr) {
+    return;
+  }
+  std::unique_lock<std::mutex> lock(gov_mtx);
+  for (auto itr = gov_rates.begin(); itr != gov_rates.end(); ++itr) {
+    if (*itr == rate) {
+      gov_rates.erase(itr);
+      break;
+    }
+  }
+  lock.unlock();
+  delete rate;
+}
+
+void GovernorSetMax(StreamRate* rate, int max_fps) {
+  if (rate == nullptr) {
+    return;
+  }
+  std::unique_lock<std::mutex> lock(gov_mtx);
+  rate->max_fps = max_fps > 0 ? max_fps : gov_config.max_fps;
+  rate->min_fps = std::min(gov_config.min_fps, rate->max_fps);
+  rate->fps = std::max(rate->min_fps, std::min(rate->max_fps, rate->fps.load()));
+}
+
+void GovernorTraverse(int id, void* arg, int (*cb)(StreamRate* rate, void* arg)) {
+  std::unique_lock<std::mutex> lock(gov_mtx);
+  for (auto itr = gov_rates.begin(); itr != gov_rates.end(); ++itr) {
+    if ((*itr)->id == id && cb(*itr, arg) != 0) {
+      break;
+    }
+  }
+}
+
+// delta of a counter since last interval
+static uint64_t LoadDelta(GovernorLoad* load, void* key, uint64_t val) {
+  load->now[key] = val;
+  auto itr = load->last.find(key);
+  if (itr == load->last.end() || itr->second > val) {
+    return 0;
+  }
+  return val - itr->second;
+}
+
+static int TaskLoad(std::shared_ptr<TaskParams> task, void* arg) {
+  GovernorLoad* load = (GovernorLoad* )arg;
+  for (size_t i = 0; i < task->thread_vec.size(); i ++) {
+    auto tt = task->thread_vec[i];
+    for (size_t j = 0; j < tt->t_ele_vec.size(); j ++) {
+      auto ele = tt->t_ele_vec[j];
+      load->busy_usec += LoadDelta(load, ele.get(), ele->process_usec.Sum());
+      // replicas share the input of the first one
+      for (size_t k = 0; k < ele->data.input.size() && ele->replica_id == 0; k ++) {
+        auto input = ele->data.input[k];
+        size_t limit = input->Limit();
+        if (limit > 0) {
+          load->max_fill = std::max(load->max_fill, (double)input->Size() / limit);
+        }
+        load->dropped += LoadDelta(load, input.get(), input->dropped);
+      }
+    }
+  }
+  return 0;
+}
+
+static int ObjLoad(std::shared_ptr<Object> obj, void* arg) {
+  obj->TraverseTaskQue(arg, TaskLoad);
+  return 0;
+}
+
+static void GovernorAdjust(bool over, bool under) {
+  std::unique_lock<std::mutex> lock(gov_mtx);
+  for (size_t i = 0; i < gov_rates.size(); i ++) {
+    StreamRate* rate = gov_rates[i];
+    int fps = rate->fps;
+    if (over) {
+      // slow down by up to a quarter, less for higher priority
+      fps -= std::max(1, fps / (4 * rate->priority));
+    } else if (under) {
+      fps += rate->priority;
+    }
+    fps = std::max(rate->min_fps, std::min(rate->max_fps, fps));
+    if (fps != rate->fps) {
+      AppDebug("id:%d, fps %d -> %d, priority:%d", rate->id, rate->fps.load(), fps, rate->priority);
+      rate->fps = fps;
+    }
+  }
+}
+
+static void GovernorThread(MediaServer* media) {
+  ObjParams* obj_params = media->GetObjParams();
+  Executor* executor = media->GetSlave()->GetExecutor();
+  GovernorLoad load;
+  while (media->running) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(gov_config.interval_ms));
+    load.max_fill = 0;
+    load.dropped = 0;
+    load.busy_usec = 0;
+    load.now.clear();
+    obj_params->TraverseObjQue(&load, ObjLoad);
+    load.last.swap(load.now);
+    // time spent in plugins against the time of all workers
+    size_t threads = executor != nullptr ? executor->GetThreadNum() :
+                     std::thread::hardware_concurrency();
+    double busy = (double)load.busy_usec / (gov_config.interval_ms * 1000.0 * std::max((size_t)1, threads));
+    bool over = load.dropped > 0 || load.max_fill > gov_config.high_water ||
+                busy > gov_config.high_water;
+    bool under = load.dropped == 0 && load.max_fill < gov_config.low_water &&
+                 busy < gov_config.low_water;
+    GovernorAdjust(over, under);
+  }
+  AppDebug("run ok");
+}
+
+void GovernorStart(MediaServer* media) {
+  if (!gov_config.enable) {
+    return;
+  }
+  std::thread t(GovernorThread, media);
+  t.detach();
+}
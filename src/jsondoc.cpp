@@ -0,0 +1,143 @@
+/****************************************************************************************
+ * Copyright (C) 2021 aistream <aistream@yeah.net>
+ *
+ * Licensed under the BSD 3-Clause License (the "License"); you may not use this
+ * file except in compliance with the License. You may obtain a copy of the License at
+ *
+ * https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Unless required by applicable law or agreed to in writing, software distributed
+ * under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+ * CONDITIONS OF ANY KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations under the License.
+ *
+ ***************************************************************************************/
+
+#include <sys/stat.h>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include "jsondoc.h"
+#include "share.h"
+#include "log.h"
+#include "cJSON.h"
+
+// texts of element params, the oldest half is dropped when it is full
+#define JSON_TEXT_CACHE_MAX   512
+
+typedef struct {
+  struct timespec mtime;
+  off_t size;
+  std::shared_ptr<JsonDoc> doc;
+} JsonFile;
+
+static std::mutex json_mtx;
+static std::unordered_map<std::string, std::shared_ptr<JsonDoc>> json_texts;
+static std::unordered_map<std::string, uint64_t> json_text_age;
+static uint64_t json_text_cnt = 0;
+static std::unordered_map<std::string, JsonFile> json_files;
+
+cJSON* JsonItem(const cJSON* node, const char* name1, const char* name2, const char* name3) {
+  const char* names[3] = {name1, name2, name3};
+  if (node == NULL || name1 == NULL) {
+    return NULL;
+  }
+  cJSON* item = (cJSON* )node;
+  for (int i = 0; i < 3 && names[i] != NULL && item != NULL; i ++) {
+    item = cJSON_GetObjectItem(item, names[i]);
+  }
+  return item;
+}
+
+int JsonInt(const cJSON* node, const char* name1, const char* name2, const char* name3) {
+  cJSON* item = JsonItem(node, name1, name2, name3);
+  return item != NULL ? item->valueint : -1;
+}
+
+double JsonDouble(const cJSON* node, const char* name1, const char* name2, const char* name3) {
+  cJSON* item = JsonItem(node, name1, name2, name3);
+  return item != NULL ? item->valuedouble : -1;
+}
+
+const char* JsonStr(const cJSON* node, const char* name1, const char* name2, const char* name3) {
+  cJSON* item = JsonItem(node, name1, name2, name3);
+  return item != NULL ? item->valuestring : NULL;
+}
+
+JsonDoc::JsonDoc(cJSON* _root)
+  : root(_root) {
+}
+
+JsonDoc::~JsonDoc(void) {
+  cJSON_Delete(root);
+}
+
+static void TrimTexts(void) {
+  if (json_texts.size() < JSON_TEXT_CACHE_MAX) {
+    return;
+  }
+  uint64_t keep = json_text_cnt - JSON_TEXT_CACHE_MAX/2;
+  for (auto itr = json_text_age.begin(); itr != json_text_age.end(); ) {
+    if (itr->second < keep) {
+      json_texts.erase(itr->first);
+      itr = json_text_age.erase(itr);
+    } else {
+      ++itr;
+    }
+  }
+}
+
+std::shared_ptr<JsonDoc> JsonDoc::Parse(const char* buf, bool cache) {
+  if (buf == NULL) {
+    return nullptr;
+  }
+  std::string text(buf);
+  std::unique_lock<std::mutex> lock(json_mtx);
+  auto itr = json_texts.find(text);
+  if (itr != json_texts.end()) {
+    json_text_age[text] = ++json_text_cnt;
+    return itr->second;
+  }
+  lock.unlock();
+  cJSON* root = cJSON_Parse(buf);
+  if (root == NULL) {
+    return nullptr;
+  }
+  std::shared_ptr<JsonDoc> doc(new JsonDoc(root));
+  if (!cache) {
+    return doc;
+  }
+  lock.lock();
+  TrimTexts();
+  json_texts[text] = doc;
+  json_text_age[text] = ++json_text_cnt;
+  return doc;
+}
+
+std::shared_ptr<JsonDoc> JsonDoc::Load(const char* filename) {
+  struct stat st;
+  if (filename == NULL || stat(filename, &st) != 0) {
+    return nullptr;
+  }
+  std::unique_lock<std::mutex> lock(json_mtx);
+  auto itr = json_files.find(filename);
+  if (itr != json_files.end() && itr->second.size == st.st_size &&
+      itr->second.mtime.tv_sec == st.st_mtim.tv_sec &&
+      itr->second.mtime.tv_nsec == st.st_mtim.tv_nsec) {
+    return itr->second.doc;
+  }
+  lock.unlock();
+  auto buf = ReadFile2Buf(filename);
+  if (buf == nullptr) {
+    return nullptr;
+  }
+  cJSON* root = cJSON_Parse(buf.get());
+  if (root == NULL) {
+    AppError("cJSON_Parse err, %s", filename);
+    return nullptr;
+  }
+  std::shared_ptr<JsonDoc> doc(new JsonDoc(root));
+  lock.lock();
+  json_files[filename] = {st.st_mtim, st.st_size, doc};
+  return doc;
+}
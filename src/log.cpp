@@ -0,0 +1,278 @@
+/****************************************************************************************
+ * Copyright (C) 2021 aistream <aistream@yeah.net>
+ *
+ * Licensed under the BSD 3-Clause License (the "License"); you may not use this
+ * file except in compliance with the License. You may obtain a copy of the License at
+ *
+ * https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Unless required by applicable law or agreed to in writing, software distributed
+ * under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+ * CONDITIONS OF ANY KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations under the License.
+ *
+ ***************************************************************************************/
+
+#include <stdarg.h>
+#include <time.h>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <condition_variable>
+#include "log.h"
+
+// must be power of 2
+#define LOG_RING_SIZE     2048
+#define LOG_LINE_MAX      1024
+#define LOG_WHERE_MAX     192
+#define LOG_WAIT_MS       100
+
+typedef struct {
+  std::atomic<size_t> seq;
+  int level;
+  int pid;
+  struct timeval tv;
+  char where[LOG_WHERE_MAX];
+  char msg[LOG_LINE_MAX];
+} LogSlot;
+
+typedef struct {
+  LogSlot slots[LOG_RING_SIZE];
+  alignas(64) std::atomic<size_t> tail;
+  alignas(64) std::atomic<size_t> head;
+  std::atomic<uint64_t> dropped;
+  std::atomic<int> started;
+  std::atomic<bool> waiting;
+  // held by the consumer, only one drains at a time
+  std::mutex write_mtx;
+  std::mutex wait_mtx;
+  std::condition_variable cond;
+  FILE* fp;
+  long size;
+} LogRing;
+
+static void LogReset(LogRing* ring) {
+  for (size_t i = 0; i < LOG_RING_SIZE; i ++) {
+    ring->slots[i].seq.store(i, std::memory_order_relaxed);
+  }
+  ring->tail.store(0, std::memory_order_relaxed);
+  ring->head.store(0, std::memory_order_relaxed);
+  ring->dropped.store(0, std::memory_order_relaxed);
+  ring->started.store(0, std::memory_order_relaxed);
+  ring->waiting.store(false, std::memory_order_relaxed);
+}
+
+// never freed, detached threads may still log at exit
+static LogRing* GetRing(void) {
+  static LogRing* ring = [] {
+    LogRing* r = new LogRing();
+    LogReset(r);
+    r->fp = NULL;
+    r->size = 0;
+    return r;
+  }();
+  return ring;
+}
+
+static const char* level_name[] = {"debug", "warning", "error"};
+static const char* level_color[] = {APREFIX_GREEN, APREFIX_YELLOW, APREFIX_RED};
+
+static bool LogOpen(LogRing* ring) {
+  if (ring->fp != NULL) {
+    return true;
+  }
+  ring->fp = fopen(DEBUG_LOG_FILE, "a");
+  if (ring->fp == NULL) {
+    return false;
+  }
+  fseek(ring->fp, 0, SEEK_END);
+  ring->size = ftell(ring->fp);
+  return true;
+}
+
+static void LogRotate(LogRing* ring) {
+  if (ring->fp == NULL || ring->size <= LOG_SIZE_MAX) {
+    return;
+  }
+  fclose(ring->fp);
+  ring->fp = NULL;
+  rename(DEBUG_LOG_FILE, DEBUG_LOG_BAK_FILE);
+  LogOpen(ring);
+}
+
+static void LogLine(LogRing* ring, int level, int pid, struct timeval* tv,
+                    const char* where, const char* msg) {
+  printf("%s%s, %s, %s" APREFIX_NONE "\n", level_color[level], level_name[level], where, msg);
+  if (!LogOpen(ring)) {
+    return;
+  }
+  struct tm _time;
+  localtime_r(&tv->tv_sec, &_time);
+  int len;
+  if (level == LOG_LEVEL_DEBUG) {
+    len = fprintf(ring->fp, "%d-%02d-%02d %02d:%02d:%02d.%03d, %s, %s, %s\n",
+                  _time.tm_year + 1900, _time.tm_mon + 1, _time.tm_mday, _time.tm_hour,
+                  _time.tm_min, _time.tm_sec, (int)tv->tv_usec/1000,
+                  level_name[level], where, msg);
+  } else {
+    len = fprintf(ring->fp, "%d-%02d-%02d %02d:%02d:%02d.%03d, %s, pid:%d %s, %s\n",
+                  _time.tm_year + 1900, _time.tm_mon + 1, _time.tm_mday, _time.tm_hour,
+                  _time.tm_min, _time.tm_sec, (int)tv->tv_usec/1000,
+                  level_name[level], pid, where, msg);
+  }
+  if (len > 0) {
+    ring->size += len;
+  }
+}
+
+// write all logs in the ring, caller holds write_mtx
+static void LogDrain(LogRing* ring) {
+  size_t head = ring->head.load(std::memory_order_relaxed);
+  int num = 0;
+  while (1) {
+    LogSlot* slot = &ring->slots[head & (LOG_RING_SIZE - 1)];
+    if (slot->seq.load(std::memory_order_acquire) != head + 1) {
+      break;
+    }
+    LogLine(ring, slot->level, slot->pid, &slot->tv, slot->where, slot->msg);
+    slot->seq.store(head + LOG_RING_SIZE, std::memory_order_release);
+    head ++;
+    ring->head.store(head, std::memory_order_relaxed);
+    if (++num % 256 == 0) {
+      LogRotate(ring);
+    }
+  }
+  uint64_t dropped = ring->dropped.exchange(0, std::memory_order_relaxed);
+  if (dropped > 0) {
+    struct timeval tv;
+    char msg[64];
+    gettimeofday(&tv, NULL);
+    snprintf(msg, sizeof(msg), "log ring full, %lu logs dropped", dropped);
+    LogLine(ring, LOG_LEVEL_WARN, getpid(), &tv, "log.cpp", msg);
+  }
+  if (num > 0 || dropped > 0) {
+    fflush(stdout);
+    if (ring->fp != NULL) {
+      fflush(ring->fp);
+    }
+    LogRotate(ring);
+  }
+}
+
+static bool LogPending(LogRing* ring) {
+  size_t head = ring->head.load(std::memory_order_relaxed);
+  LogSlot* slot = &ring->slots[head & (LOG_RING_SIZE - 1)];
+  return slot->seq.load(std::memory_order_acquire) == head + 1;
+}
+
+static void LogThread(LogRing* ring) {
+  while (1) {
+    {
+      std::unique_lock<std::mutex> lock(ring->wait_mtx);
+      ring->waiting.store(true, std::memory_order_seq_cst);
+      ring->cond.wait_for(lock, std::chrono::milliseconds(LOG_WAIT_MS), [ring] {
+        return LogPending(ring);
+      });
+      ring->waiting.store(false, std::memory_order_relaxed);
+    }
+    std::lock_guard<std::mutex> lock(ring->write_mtx);
+    LogDrain(ring);
+  }
+}
+
+// the writer thread does not exist in the child, no lock is held across fork
+static void LogForkPrepare(void) {
+  GetRing()->write_mtx.lock();
+  GetRing()->wait_mtx.lock();
+}
+
+static void LogForkParent(void) {
+  GetRing()->wait_mtx.unlock();
+  GetRing()->write_mtx.unlock();
+}
+
+// logs not written yet belong to the parent, and the child starts its own writer
+static void LogForkChild(void) {
+  LogRing* ring = GetRing();
+  ring->wait_mtx.unlock();
+  ring->write_mtx.unlock();
+  LogReset(ring);
+}
+
+static void LogStart(LogRing* ring) {
+  static std::once_flag once;
+  std::call_once(once, [] {
+    pthread_atfork(LogForkPrepare, LogForkParent, LogForkChild);
+    atexit(LogFlush);
+  });
+  std::thread t(LogThread, ring);
+  t.detach();
+}
+
+static int64_t LogNowMs(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+  return (int64_t)ts.tv_sec*1000 + ts.tv_nsec/1000000;
+}
+
+void LogWrite(LogSite* site, int level, const char* file, int line,
+              const char* func, const char* format, ...) {
+  int64_t window = LogNowMs() / LOG_SITE_WINDOW_MS;
+  int64_t last = site->window.load(std::memory_order_relaxed);
+  if (last != window && site->window.compare_exchange_strong(last, window)) {
+    site->count.store(0, std::memory_order_relaxed);
+  }
+  if (site->count.fetch_add(1, std::memory_order_relaxed) >= LOG_SITE_BURST) {
+    site->suppressed.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  LogRing* ring = GetRing();
+  int started = 0;
+  if (ring->started.load(std::memory_order_acquire) == 0 &&
+      ring->started.compare_exchange_strong(started, 1)) {
+    LogStart(ring);
+  }
+
+  size_t pos = ring->tail.load(std::memory_order_relaxed);
+  LogSlot* slot;
+  while (1) {
+    slot = &ring->slots[pos & (LOG_RING_SIZE - 1)];
+    size_t seq = slot->seq.load(std::memory_order_acquire);
+    intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+    if (diff == 0) {
+      if (ring->tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+        break;
+      }
+    } else if (diff < 0) {
+      // never block the caller, the writer reports the count
+      ring->dropped.fetch_add(1, std::memory_order_relaxed);
+      return;
+    } else {
+      pos = ring->tail.load(std::memory_order_relaxed);
+    }
+  }
+  slot->level = level;
+  slot->pid = getpid();
+  gettimeofday(&slot->tv, NULL);
+  snprintf(slot->where, sizeof(slot->where), "%s:%d, %s", file, line, func);
+  va_list ap;
+  va_start(ap, format);
+  int len = vsnprintf(slot->msg, sizeof(slot->msg), format, ap);
+  va_end(ap);
+  int suppressed = site->suppressed.exchange(0, std::memory_order_relaxed);
+  if (suppressed > 0 && len >= 0 && len < (int)sizeof(slot->msg)) {
+    snprintf(slot->msg + len, sizeof(slot->msg) - len, " (%d suppressed)", suppressed);
+  }
+  slot->seq.store(pos + 1, std::memory_order_release);
+  if (ring->waiting.load(std::memory_order_seq_cst)) {
+    std::lock_guard<std::mutex> lock(ring->wait_mtx);
+    ring->cond.notify_one();
+  }
+}
+
+void LogFlush(void) {
+  LogRing* ring = GetRing();
+  std::lock_guard<std::mutex> lock(ring->write_mtx);
+  LogDrain(ring);
+}
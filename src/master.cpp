@@ -1266,6 +1266,7 @@ static UrlMap rest_url_map[] = {
   {"/api/obj/status",         request_obj_status},
   {"/api/obj/id/all",         request_obj_all_id},
   {"/api/system/slave/status",request_slave_status},
+  {"/metrics",                request_metrics},
   {NULL, NULL}
 };
 
@@ -0,0 +1,182 @@
+/****************************************************************************************
+ * Copyright (C) 2021 aistream <aistream@yeah.net>
+ *
+ * Licensed under the BSD 3-Clause License (the "License"); you may not use this
+ * file except in compliance with the License. You may obtain a copy of the License at
+ *
+ * https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Unless required by applicable law or agreed to in writing, software distributed
+ * under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+ * CONDITIONS OF ANY KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations under the License.
+ *
+ ***************************************************************************************/
+
+#include <mutex>
+#include <vector>
+#include <memory>
+#include "metrics.h"
+#include "log.h"
+
+const uint64_t metric_bounds[METRIC_BUCKETS - 1] = {
+  100, 250, 500, 1000, 2500, 5000, 10000, 25000,
+  50000, 100000, 250000, 500000, 1000000, 2500000, 5000000
+};
+
+typedef struct {
+  std::string name;
+  std::string help;
+  std::string labels;
+  std::unique_ptr<Metric> metric;
+} MetricEntry;
+
+typedef struct {
+  void* arg;
+  void (*cb)(MetricsWriter* writer, void* arg);
+} MetricCollector;
+
+static std::mutex metrics_mtx;
+static std::map<std::string, MetricEntry> metrics_map;
+static std::vector<MetricCollector> metrics_collectors;
+
+Metric::Metric(int _type)
+  : type(_type), val(0), sum(0) {
+  for (int i = 0; i < METRIC_BUCKETS; i ++) {
+    bucket[i] = 0;
+  }
+}
+
+uint64_t Metric::Count(void) {
+  uint64_t cnt = 0;
+  for (int i = 0; i < METRIC_BUCKETS; i ++) {
+    cnt += bucket[i].load(std::memory_order_relaxed);
+  }
+  return cnt;
+}
+
+uint64_t Metric::Quantile(double q) {
+  uint64_t cnt[METRIC_BUCKETS], total = 0;
+  for (int i = 0; i < METRIC_BUCKETS; i ++) {
+    cnt[i] = bucket[i].load(std::memory_order_relaxed);
+    total += cnt[i];
+  }
+  if (total == 0) {
+    return 0;
+  }
+  uint64_t rank = (uint64_t)(q * total), acc = 0;
+  for (int i = 0; i < METRIC_BUCKETS - 1; i ++) {
+    acc += cnt[i];
+    if (acc > rank) {
+      return metric_bounds[i];
+    }
+  }
+  // above the last bound
+  return metric_bounds[METRIC_BUCKETS - 2];
+}
+
+MetricsWriter::Family& MetricsWriter::GetFamily(const char* name, const char* help, int type) {
+  auto itr = families.find(name);
+  if (itr != families.end()) {
+    return itr->second;
+  }
+  Family& family = families[name];
+  family.help = help;
+  family.type = type;
+  return family;
+}
+
+static void AppendSample(std::string& out, const char* name, const char* suffix,
+                         const std::string& labels, const char* le, double val) {
+  char buf[64];
+  out += name;
+  out += suffix;
+  if (!labels.empty() || le != NULL) {
+    out += "{";
+    out += labels;
+    if (le != NULL) {
+      if (!labels.empty()) {
+        out += ",";
+      }
+      out += "le=\"";
+      out += le;
+      out += "\"";
+    }
+    out += "}";
+  }
+  snprintf(buf, sizeof(buf), " %.15g\n", val);
+  out += buf;
+}
+
+void MetricsWriter::Write(const char* name, const char* help, const std::string& labels, Metric* metric) {
+  if (metric->type != METRIC_HISTOGRAM) {
+    Write(name, help, metric->type, labels, (double)metric->Value());
+    return;
+  }
+  Family& family = GetFamily(name, help, METRIC_HISTOGRAM);
+  char le[32];
+  uint64_t cnt = 0;
+  for (int i = 0; i < METRIC_BUCKETS; i ++) {
+    cnt += metric->bucket[i].load(std::memory_order_relaxed);
+    if (i < METRIC_BUCKETS - 1) {
+      snprintf(le, sizeof(le), "%g", metric_bounds[i]/1e6);
+    } else {
+      snprintf(le, sizeof(le), "+Inf");
+    }
+    AppendSample(family.samples, name, "_bucket", labels, le, (double)cnt);
+  }
+  AppendSample(family.samples, name, "_sum", labels, NULL, metric->Sum()/1e6);
+  // count equals to +Inf bucket, buckets may be updated during reading
+  AppendSample(family.samples, name, "_count", labels, NULL, (double)cnt);
+}
+
+void MetricsWriter::Write(const char* name, const char* help, int type, const std::string& labels, double val) {
+  Family& family = GetFamily(name, help, type);
+  AppendSample(family.samples, name, "", labels, NULL, val);
+}
+
+std::string MetricsWriter::Text(void) {
+  static const char* type_name[] = {"counter", "gauge", "histogram"};
+  std::string out;
+  for (auto itr = families.begin(); itr != families.end(); ++itr) {
+    out += "# HELP " + itr->first + " " + itr->second.help + "\n";
+    out += "# TYPE " + itr->first + " " + type_name[itr->second.type] + "\n";
+    out += itr->second.samples;
+  }
+  return out;
+}
+
+Metric* MetricsGet(const char* name, const char* help, int type, const std::string& labels) {
+  std::string key = std::string(name) + "{" + labels + "}";
+  std::unique_lock<std::mutex> lock(metrics_mtx);
+  auto itr = metrics_map.find(key);
+  if (itr != metrics_map.end()) {
+    return itr->second.metric.get();
+  }
+  MetricEntry& entry = metrics_map[key];
+  entry.name = name;
+  entry.help = help;
+  entry.labels = labels;
+  entry.metric = std::make_unique<Metric>(type);
+  return entry.metric.get();
+}
+
+void MetricsAddCollector(void* arg, void (*cb)(MetricsWriter* writer, void* arg)) {
+  std::unique_lock<std::mutex> lock(metrics_mtx);
+  metrics_collectors.push_back({arg, cb});
+}
+
+std::string MetricsText(void) {
+  MetricsWriter writer;
+  std::unique_lock<std::mutex> lock(metrics_mtx);
+  for (auto itr = metrics_map.begin(); itr != metrics_map.end(); ++itr) {
+    MetricEntry& entry = itr->second;
+    writer.Write(entry.name.c_str(), entry.help.c_str(), entry.labels, entry.metric.get());
+  }
+  auto collectors = metrics_collectors;
+  lock.unlock();
+  for (size_t i = 0; i < collectors.size(); i ++) {
+    collectors[i].cb(&writer, collectors[i].arg);
+  }
+  return writer.Text();
+}
@@ -155,6 +155,16 @@ Object::Object(MediaServer *_media)
 Object::~Object(void) {
 }
 
+std::shared_ptr<GopCache> Object::GetGopCache(void) {
+  std::call_once(gop_once, [this] {
+    int mb = media->GetConfig()->GetGopCacheMb();
+    if (mb > 0) {
+      gop_cache = std::make_shared<GopCache>((size_t)mb*1024*1024);
+    }
+  });
+  return gop_cache;
+}
+
 void Object::SetParams(char *str) {
   std::shared_ptr<char> p(new char[strlen(str)+1]);
   strcpy(p.get(), str);
@@ -194,12 +204,90 @@ bool Object::DelFromTaskQue(const char *name) {
   return true;
 }
 
+std::shared_ptr<TaskParams> Object::AcquireShared(std::shared_ptr<AlgTask> alg,
+                                                  std::shared_ptr<TaskParams> task) {
+  std::string key = alg->GetSharedKey();
+  std::unique_lock<std::mutex> lock(shared_mtx);
+  auto itr = shared_map.find(key);
+  if (itr != shared_map.end()) {
+    itr->second.second ++;
+    return itr->second.first;
+  }
+  char name[256];
+  snprintf(name, sizeof(name), "shared:%s", task->GetTaskName());
+  auto stage = std::make_shared<TaskParams>(shared_from_this());
+  stage->SetTaskName(name);
+  auto params = task->GetParams();
+  if (params != nullptr) {
+    stage->SetParams(params.get());
+  }
+  if (stage->StartShared(alg) != 0) {
+    stage->Stop(true);
+    return nullptr;
+  }
+  shared_map[key] = {stage, 1};
+  AppDebug("id:%d, %s started", id, name);
+  return stage;
+}
+
+void Object::ReleaseShared(std::shared_ptr<TaskParams> stage, bool sync) {
+  std::unique_lock<std::mutex> lock(shared_mtx);
+  auto itr = shared_map.begin();
+  for (; itr != shared_map.end(); ++itr) {
+    if (itr->second.first == stage) {
+      break;
+    }
+  }
+  // not found if it is stopped as stalled
+  if (itr == shared_map.end() || -- itr->second.second > 0) {
+    return;
+  }
+  shared_map.erase(itr);
+  lock.unlock();
+  AppDebug("id:%d, %s stopped", id, stage->GetTaskName());
+  stage->Stop(sync);
+}
+
+void Object::TraverseTaskQue(void* arg, int (*cb)(std::shared_ptr<TaskParams> task, void* arg)) {
+  task_mtx.lock();
+  for (auto itr = task_vec.begin(); itr != task_vec.end(); ++itr) {
+    if (cb(*itr, arg) != 0) {
+      break;
+    }
+  }
+  task_mtx.unlock();
+  std::unique_lock<std::mutex> lock(shared_mtx);
+  for (auto itr = shared_map.begin(); itr != shared_map.end(); ++itr) {
+    if (cb(itr->second.first, arg) != 0) {
+      break;
+    }
+  }
+}
+
 void Object::TraverseTaskQue(void) {
   CheckWorkDir();
+  // a stalled shared stage is stopped, and the tasks using it
+  // restart with a new one
+  std::vector<std::shared_ptr<TaskParams>> stalled;
+  shared_mtx.lock();
+  for (auto itr = shared_map.begin(); itr != shared_map.end(); ) {
+    if (!itr->second.first->KeepAlive()) {
+      stalled.push_back(itr->second.first);
+      itr = shared_map.erase(itr);
+    } else {
+      ++itr;
+    }
+  }
+  shared_mtx.unlock();
+  for (size_t i = 0; i < stalled.size(); i ++) {
+    stalled[i]->Stop(true);
+  }
   task_mtx.lock();
   for (auto itr = task_vec.begin(); itr != task_vec.end(); ++itr) {
     auto task = (*itr);
-    if (!task->KeepAlive()) {
+    auto shared = task->GetShared();
+    if (!task->KeepAlive() || !task->SyncAlg() ||
+        (shared != nullptr && std::find(stalled.begin(), stalled.end(), shared) != stalled.end())) {
       task->Stop(true);
       task->Start();
     }
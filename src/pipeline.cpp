@@ -15,8 +15,11 @@
 
 #include "stream.h"
 #include "pipeline.h"
+#include "cJSON.h"
 #include <map>
 #include <algorithm>
+#include <poll.h>
+#include <sys/inotify.h>
 
 Pipeline::Pipeline(MediaServer* _media)
   : media(_media) {
@@ -25,28 +28,55 @@ Pipeline::Pipeline(MediaServer* _media)
 Pipeline::~Pipeline(void) {
 }
 
-static bool ParseMap(const char* name, const char* ele_name, char* ele_buf, auto ele) {
-  int size = 0;
-  auto buf = GetArrayBufFromJson(ele_buf, size, name);
-  if (buf == nullptr) {
+static int ParsePolicy(const char* policy) {
+  static const char* names[] = {
+    "drop_oldest", "drop_newest", "block", "latest", "gop"
+  };
+  for (int i = 0; i < (int)(sizeof(names)/sizeof(names[0])); i ++) {
+    if (!strcmp(policy, names[i])) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+// true or "true", the same as async
+static bool ParseBool(cJSON* node, const char* name) {
+  cJSON* item = JsonItem(node, name);
+  const char* str = JsonStr(node, name);
+  return (item != NULL && (item->type & 0xff) == cJSON_True) ||
+         (str != NULL && !strcmp(str, "true"));
+}
+
+static bool ParseMap(const char* name, const char* ele_name, cJSON* node, auto ele) {
+  cJSON* array = JsonItem(node, name);
+  if (array == NULL) {
     AppWarn("get %s:%s failed", ele_name, name);
     return false;
   }
+  int size = cJSON_GetArraySize(array);
   for (int i = 0; i < size; i ++) {
-    auto arrbuf = GetBufFromArray(buf.get(), i);
-    if (arrbuf == nullptr) {
-      AppWarn("get %s:%s array[%d] failed", ele_name, name, i);
-      return false;
-    }
-    auto key = GetStrValFromJson(arrbuf.get(), "key");
-    auto val = GetStrValFromJson(arrbuf.get(), "val");
-    if (key == nullptr || val == nullptr) {
+    cJSON* item = cJSON_GetArrayItem(array, i);
+    const char* key = JsonStr(item, "key");
+    const char* val = JsonStr(item, "val");
+    if (key == NULL || val == NULL) {
       AppWarn("get %s:%s array[%d] key/val failed", ele_name, name, i);
       return false;
     }
     auto _map = std::make_shared<KeyValue>();
-    strncpy(_map->key, key.get(), sizeof(_map->key));
-    strncpy(_map->val, val.get(), sizeof(_map->val));
+    strncpy(_map->key, key, sizeof(_map->key));
+    strncpy(_map->val, val, sizeof(_map->val));
+    _map->policy = QUEUE_DROP_OLDEST;
+    _map->timeout_ms = JsonInt(item, "timeout_ms");
+    _map->decimate = JsonInt(item, "decimate");
+    const char* policy = JsonStr(item, "policy");
+    if (policy != NULL) {
+      _map->policy = ParsePolicy(policy);
+      if (_map->policy < 0) {
+        AppWarn("unknown policy %s, use drop_oldest, %s:%s", policy, ele_name, key);
+        _map->policy = QUEUE_DROP_OLDEST;
+      }
+    }
     if (!strcmp(name, "input_map")) {
       ele->Put2InputMap(_map);
     } else if (!strcmp(name, "output_map")) {
@@ -59,51 +89,75 @@ static bool ParseMap(const char* name, const char* ele_name, char* ele_buf, auto
   return true;
 }
 
-static bool ParseElement(char* ptr, const char* alg_name, auto alg) {
-  int size = 0;
-  auto buf = GetArrayBufFromJson(ptr, size, "pipeline");
-  if (buf == nullptr) {
+static bool ParseElement(JsonDoc* doc, const char* alg_name, auto alg) {
+  cJSON* array = doc->Get("pipeline");
+  if (array == NULL) {
     AppWarn("get pipeline array failed, %s", alg_name);
     return false;
   }
+  int size = cJSON_GetArraySize(array);
   for (int i = 0; i < size; i ++) {
-    auto arrbuf = GetBufFromArray(buf.get(), i);
-    if (arrbuf == nullptr) {
-      AppWarn("get pipeline array[%d] failed, %s", i, alg_name);
-      return false;
-    }
+    cJSON* item = cJSON_GetArrayItem(array, i);
     auto ele = std::make_shared<Element>();
-    auto name = GetStrValFromJson(arrbuf.get(), "name");
-    auto path = GetStrValFromJson(arrbuf.get(), "path");
-    if (name == nullptr || path == nullptr) {
+    const char* name = JsonStr(item, "name");
+    const char* path = JsonStr(item, "path");
+    if (name == NULL || path == NULL) {
       AppWarn("get pipeline array[%d] name or path failed, %s", i, alg_name);
       return false;
     }
-    if (access(path.get(), F_OK) != 0) {
-      AppWarn("%s not exist, %s:%s", path.get(), alg_name, name.get());
+    if (access(path, F_OK) != 0) {
+      AppWarn("%s not exist, %s:%s", path, alg_name, name);
       return false;
     }
-    ele->SetName(name.get());
-    ele->SetPath(path.get());
-    if (ParseMap("input_map", name.get(), arrbuf.get(), ele) != true) {
-      AppWarn("get input map failed, %s:%s", alg_name, name.get());
+    ele->SetName(name);
+    ele->SetPath(path);
+    if (ParseMap("input_map", name, item, ele) != true) {
+      AppWarn("get input map failed, %s:%s", alg_name, name);
       return false;
     }
-    if (ParseMap("output_map", name.get(), arrbuf.get(), ele) != true) {
-      AppWarn("get output map failed, %s:%s", alg_name, name.get());
+    if (ParseMap("output_map", name, item, ele) != true) {
+      AppWarn("get output map failed, %s:%s", alg_name, name);
       return false;
     }
-    auto framework = GetStrValFromJson(arrbuf.get(), "framework");
-    if (framework != nullptr) {
-      ele->SetFramework(framework.get());
+    const char* framework = JsonStr(item, "framework");
+    if (framework != NULL) {
+      ele->SetFramework(framework);
     }
-    auto async = GetStrValFromJson(arrbuf.get(), "async");
-    if (async != nullptr && !strcmp(async.get(), "false")) {
+    const char* async = JsonStr(item, "async");
+    if (async != NULL && !strcmp(async, "false")) {
       ele->SetAsync(false);
     }
-    auto params = GetObjBufFromJson(arrbuf.get(), "params");
-    if (params != nullptr) {
-      ele->SetParams(params.get());
+    const char* join = JsonStr(item, "join_policy");
+    int join_wait_ms = JsonInt(item, "join_wait_ms");
+    if (join != NULL || join_wait_ms >= 0) {
+      int policy = JOIN_DROP;
+      if (join != NULL && !strcmp(join, "pass")) {
+        policy = JOIN_PASS;
+      } else if (join != NULL && !strcmp(join, "wait")) {
+        policy = JOIN_WAIT;
+      } else if (join != NULL && strcmp(join, "drop") != 0) {
+        AppWarn("unknown join_policy %s, use drop, %s:%s", join, alg_name, name);
+      }
+      ele->SetJoin(policy, join_wait_ms >= 0 ? join_wait_ms : JOIN_WAIT_MS);
+    }
+    ele->SetQueueLen(JsonInt(item, "queue_len"));
+    int replicas = JsonInt(item, "replicas");
+    if (replicas > 1) {
+      // replicas share the input, so only one input and not the entry
+      cJSON* input_map = JsonItem(item, "input_map");
+      const char* val = JsonStr(cJSON_GetArrayItem(input_map, 0), "val");
+      if (cJSON_GetArraySize(input_map) != 1 || val == NULL || !strcmp(val, "entry")) {
+        AppWarn("replicas need one input except entry, use 1, %s:%s", alg_name, name);
+        replicas = 1;
+      }
+      ele->SetReplicas(std::min(replicas, MAX_REPLICAS), ParseBool(item, "ordered"));
+    }
+    ele->SetShared(ParseBool(item, "shared"));
+    cJSON* params = JsonItem(item, "params");
+    if (params != NULL) {
+      char* tmp = cJSON_Print(params);
+      ele->SetParams(tmp);
+      free(tmp);
     }
     alg->Put2ElementQue(ele);
   }
@@ -111,73 +165,165 @@ static bool ParseElement(char* ptr, const char* alg_name, auto alg) {
   return true;
 }
 
-static void AddTaskSupport(char* ptr, const char* name, const char* config, auto alg, Pipeline* pipe) {
+static std::atomic<uint64_t> config_generation(0);
+
+uint64_t ConfigGeneration(void) {
+  return config_generation.load(std::memory_order_relaxed);
+}
+
+// the AlgTask of the new snapshot, old one is kept if the pipeline is the same,
+// or the new one is broken
+static std::shared_ptr<AlgTask> ReloadAlgTask(const char* name, const char* config,
+                                              std::shared_ptr<AlgTask> old, MediaServer* media) {
+  auto doc = JsonDoc::Load(config);
+  if (doc == nullptr) {
+    AppWarn("read %s failed, task:%s", config, name);
+    return old;
+  }
+  if (old != nullptr && old->GetDoc() == doc && !strcmp(old->GetConfig(), config)) {
+    return old;
+  }
+  auto alg = std::make_shared<AlgTask>(media);
   alg->SetName(name);
   alg->SetConfig(config);
-  pipe->Put2AlgQue(alg);
-  AppDebug("task:%s, total:%ld", name, pipe->GetAlgNum());
+  alg->SetDoc(doc);
+  if (ParseElement(doc.get(), name, alg) != true || alg->CheckShared() != true) {
+    return old;
+  }
+  if (old == nullptr) {
+    AppDebug("add task:%s, %s", name, config);
+    return alg;
+  }
+  int diff = alg->Compare(old.get());
+  if (diff == ALG_SAME) {
+    // touched but not changed, keep the running one
+    old->SetDoc(doc);
+    return old;
+  }
+  AppDebug("task:%s, pipeline %s", name, diff == ALG_TUNE ? "tuned" : "changed");
+  return alg;
 }
 
-static void UpdateTaskByConfig(auto config_map, Pipeline* pipe) {
-  // check and add
-  for (auto it = config_map.begin(); it != config_map.end(); ++it) {
-    const char *name = it->first.c_str();
-    const char *config = it->second.c_str();
-    auto buf = ReadFile2Buf(config);
-    if (buf == nullptr) {
-      AppWarn("read %s failed", config);
-      return ;
+void Pipeline::Reload(void) {
+  const char *filename = "cfg/task.json";
+  auto old = GetSnapshot();
+  auto snap = std::make_shared<PipelineSnapshot>();
+  snap->tasks = JsonDoc::Load(filename);
+  cJSON* array = snap->tasks != nullptr ? snap->tasks->Get("tasks") : NULL;
+  if (array == NULL) {
+    AppWarn("read %s failed", filename);
+    return;
+  }
+  snap->config = JsonDoc::Load(media->config_file.c_str());
+  if (snap->config == nullptr) {
+    AppWarn("read %s failed", media->config_file.c_str());
+    if (old == nullptr) {
+      return;
     }
-    if (pipe->GetAlgTask(name) != nullptr) {
-      continue;
+    snap->config = old->config;
+  }
+  int size = cJSON_GetArraySize(array);
+  for (int i = 0; i < size; i ++) {
+    cJSON* item = cJSON_GetArrayItem(array, i);
+    const char* name = JsonStr(item, "name");
+    const char* config = JsonStr(item, "config");
+    if (name == NULL || config == NULL) {
+      AppWarn("read name or config failed, %s", filename);
+      break;
     }
-    char* ptr = buf.get();
-    auto alg = std::make_shared<AlgTask>(pipe->media);
-    if (ParseElement(ptr, name, alg) != true) {
-      continue;
+    std::shared_ptr<AlgTask> last = nullptr;
+    if (old != nullptr) {
+      auto itr = old->algs.find(name);
+      last = itr != old->algs.end() ? itr->second : nullptr;
+    }
+    auto alg = ReloadAlgTask(name, config, last, media);
+    if (alg != nullptr) {
+      snap->algs[name] = alg;
     }
-    AddTaskSupport(ptr, name, config, alg, pipe);
   }
-  // check and del
-  pipe->CheckIfDelAlg(config_map);
+  if (old != nullptr) {
+    bool same = old->config == snap->config && old->algs == snap->algs;
+    for (auto itr = old->algs.begin(); itr != old->algs.end(); ++itr) {
+      if (snap->algs.find(itr->first) == snap->algs.end()) {
+        AppDebug("del task:%s", itr->first.c_str());
+      }
+    }
+    if (same) {
+      return;
+    }
+  }
+  // tasks pick up the new pipelines in their obj thread
+  std::shared_ptr<const PipelineSnapshot> _snap = snap;
+  std::atomic_store(&snapshot, _snap);
+  if (old == nullptr || old->config != snap->config) {
+    config_generation.fetch_add(1, std::memory_order_relaxed);
+  }
+  AppDebug("reload ok, tasks:%ld", snap->algs.size());
 }
 
-static void UpdateTask(const char *filename, Pipeline* pipe) {
-  int size = 0;
-  std::map<std::string, std::string> config_map;
-  auto buf = GetArrayBufFromFile(filename, size, "tasks");
-  if (buf == nullptr) {
-    AppWarn("read %s failed", filename);
-    return;
+// watch the directories, files are often replaced by rename when saving
+static void WatchFiles(int fd, Pipeline* pipe) {
+  auto snap = pipe->GetSnapshot();
+  std::vector<std::string> files = {"cfg/task.json", pipe->media->config_file};
+  if (snap != nullptr) {
+    for (auto itr = snap->algs.begin(); itr != snap->algs.end(); ++itr) {
+      files.push_back(itr->second->GetConfig());
+    }
   }
-  for (int i = 0; i < size; i ++) {
-    auto arrbuf = GetBufFromArray(buf.get(), i);
-    if (arrbuf == nullptr) {
-      break;
+  for (size_t i = 0; i < files.size(); i ++) {
+    std::string dir = files[i];
+    size_t pos = dir.rfind('/');
+    dir = pos != std::string::npos ? dir.substr(0, pos) : ".";
+    // the same directory gets the same watch
+    if (inotify_add_watch(fd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_DELETE) < 0) {
+      AppWarn("watch %s failed, %s", dir.c_str(), strerror(errno));
     }
-    auto name = GetStrValFromJson(arrbuf.get(), "name");
-    auto config = GetStrValFromJson(arrbuf.get(), "config");
-    if (name == nullptr || config == nullptr) {
-      AppWarn("read name or config failed, %s", filename);
-      break;
+  }
+}
+
+// wait for a change and the following ones, editors write several times
+static bool WaitChange(int fd, MediaServer* media) {
+  char buf[4096];
+  bool changed = false;
+  while (media->running) {
+    struct pollfd pfd = {fd, POLLIN, 0};
+    int ret = poll(&pfd, 1, changed ? 200 : 1000);
+    if (ret < 0 && errno != EINTR) {
+      AppWarn("poll failed, %s", strerror(errno));
+      sleep(1);
+      continue;
     }
-    config_map.insert({name.get(), config.get()});
+    if (ret <= 0) {
+      if (changed) {
+        return true;
+      }
+      continue;
+    }
+    while (read(fd, buf, sizeof(buf)) > 0) {
+    }
+    changed = true;
   }
-  UpdateTaskByConfig(config_map, pipe);
+  return false;
 }
 
 static void AlgThread(Pipeline* pipe) {
-  int size, last_size = 0;
-  const char *filename = "cfg/task.json";
   MediaServer* media = pipe->media;
-  while (media->running) {
-    size = GetFileSize(filename);
-    if (size != last_size) {
-      UpdateTask(filename, pipe);
-      last_size = size;
+  pipe->Reload();
+  int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (fd < 0) {
+    AppWarn("inotify init failed, %s, reload every 3s", strerror(errno));
+    while (media->running) {
+      sleep(3);
+      pipe->Reload();
     }
-    sleep(3);
+    return;
+  }
+  WatchFiles(fd, pipe);
+  while (WaitChange(fd, media)) {
+    pipe->Reload();
+    WatchFiles(fd, pipe);
   }
+  close(fd);
   AppDebug("run ok");
 }
 
@@ -186,45 +332,13 @@ void Pipeline::Start(void) {
   t.detach();
 }
 
-bool Pipeline::Put2AlgQue(auto alg) {
-  alg_mtx.lock();
-  alg_vec.push_back(alg);
-  alg_mtx.unlock();
-  return true;
-}
-
 std::shared_ptr<AlgTask> Pipeline::GetAlgTask(const char* name) {
-  std::shared_ptr<AlgTask> alg = nullptr;
-  alg_mtx.lock();
-  for (auto itr = alg_vec.begin(); itr != alg_vec.end(); ++itr) {
-    char *alg_name = (*itr)->GetName();
-    if (!strncmp(alg_name, name, strlen(alg_name)+1)) {
-      alg = *itr;
-      break;
-    }
+  auto snap = GetSnapshot();
+  if (snap == nullptr) {
+    return nullptr;
   }
-  alg_mtx.unlock();
-  return alg;
-}
-
-void Pipeline::CheckIfDelAlg(auto config_map) {
-  alg_mtx.lock();
-  auto sd = remove_if(alg_vec.begin(), alg_vec.end(), [config_map, this](auto alg) {
-    char *alg_name = alg->GetName();
-    auto search = config_map.find(alg_name);
-    if (search != config_map.end()) {
-      return false;
-    } else {
-      printf("del alg support:%s,total:%ld\n", alg_name, this->GetAlgNum()-1);
-      return true;
-    }
-  });
-  alg_vec.erase(sd, alg_vec.end());
-  alg_mtx.unlock();
-}
-
-size_t Pipeline::GetAlgNum(void) {
-  return alg_vec.size();
+  auto itr = snap->algs.find(name);
+  return itr != snap->algs.end() ? itr->second : nullptr;
 }
 
 AlgTask::AlgTask(MediaServer* _media)
@@ -288,37 +402,54 @@ auto AlgTask::GetNextEle(auto ele) {
   return next;
 }
 
-void AlgTask::AttachToThread(auto first, auto task) {
+// every replica gets its own thread, so they can run at the same time
+static void AttachReplicas(auto ele, auto task) {
+  auto group = std::make_shared<ReplicaGroup>(ele->GetOrdered());
+  for (int i = 0; i < ele->GetReplicas(); i ++) {
+    auto tt = std::make_shared<TaskThread>();
+    task->thread_vec.push_back(tt);
+    auto t_ele = std::make_shared<TaskElement>(task);
+    std::shared_ptr<Element> p = t_ele;
+    *p = *ele;
+    t_ele->replica = group;
+    t_ele->replica_id = i;
+    tt->t_ele_vec.push_back(t_ele);
+  }
+}
+
+void AlgTask::AttachToThread(auto first, auto task, bool shared) {
   if (first->attach_to_thread) {
     return;
   }
-  auto tt = std::make_shared<TaskThread>();
-  task->thread_vec.push_back(tt);
-  auto t_ele = std::make_shared<TaskElement>(task);
-  std::shared_ptr<Element> p = t_ele;
-  *p = *first;
-  tt->t_ele_vec.push_back(t_ele);
-  first->attach_to_thread = true;
-
+  std::shared_ptr<TaskThread> tt = nullptr;
   for (auto ele = first; ; ) {
-    auto next = GetNextEle(ele);
-    if (next.size() == 0) {
-      break;
-    } else if (next.size() == 1) {
-      ele = next[0];
-      if (ele->GetAsync()) {
+    if (ele->GetShared() != shared) {
+      // run by the other side, only walk through it
+      tt = nullptr;
+    } else if (ele->GetReplicas() > 1) {
+      AttachReplicas(ele, task);
+      // the next element can not share the thread of a replica
+      tt = nullptr;
+    } else {
+      if (tt == nullptr || ele->GetAsync()) {
         tt = std::make_shared<TaskThread>();
         task->thread_vec.push_back(tt);
       }
-      t_ele = std::make_shared<TaskElement>(task);
+      auto t_ele = std::make_shared<TaskElement>(task);
       std::shared_ptr<Element> p = t_ele;
       *p = *ele;
       tt->t_ele_vec.push_back(t_ele);
-      ele->attach_to_thread = true;
+    }
+    ele->attach_to_thread = true;
+    auto next = GetNextEle(ele);
+    if (next.size() == 0) {
+      break;
+    } else if (next.size() == 1) {
+      ele = next[0];
     } else {
       for (size_t i = 0; i < next.size(); i ++) {
         auto _ele = next[i];
-        AttachToThread(_ele, task);
+        AttachToThread(_ele, task, shared);
       }
       break;
     }
@@ -334,7 +465,72 @@ void AlgTask::ResetEleAttachFlag(void) {
   ele_mtx.unlock();
 }
 
-bool AlgTask::AssignToThreads(std::shared_ptr<TaskParams> task) {
+std::shared_ptr<Element> AlgTask::GetElement(const char* ele_name) {
+  std::shared_ptr<Element> ret = nullptr;
+  ele_mtx.lock();
+  for (auto itr = ele_vec.begin(); itr != ele_vec.end(); ++itr) {
+    if (!strcmp((*itr)->GetName(), ele_name)) {
+      ret = *itr;
+      break;
+    }
+  }
+  ele_mtx.unlock();
+  return ret;
+}
+
+bool AlgTask::CheckShared(void) {
+  std::unique_lock<std::mutex> lock(ele_mtx);
+  shared_key.clear();
+  for (size_t i = 0; i < ele_vec.size(); i ++) {
+    auto ele = ele_vec[i];
+    if (!ele->GetShared()) {
+      continue;
+    }
+    KeyValue* output = ele->GetOutputMap();
+    auto params = ele->GetParams();
+    shared_key += std::string(ele->GetName()) + "|" + ele->GetPath() + "|" +
+                  (output != nullptr ? output->val : "") + "|" +
+                  (params != nullptr ? params.get() : "") + "\n";
+    // every input comes from entry or another shared element
+    KeyValue* input = ele->GetInputMap([](KeyValue* p, void* arg) {
+      if (!strcmp(p->val, "entry")) {
+        return false;
+      }
+      auto _ele_vec = (std::vector<std::shared_ptr<Element>>* )arg;
+      for (size_t j = 0; j < _ele_vec->size(); j ++) {
+        KeyValue* _output = (*_ele_vec)[j]->GetOutputMap();
+        if ((*_ele_vec)[j]->GetShared() && _output != nullptr && !strcmp(_output->val, p->val)) {
+          return false;
+        }
+      }
+      return true;
+    }, &ele_vec);
+    if (input != nullptr) {
+      AppWarn("shared %s takes %s of element not shared, %s", ele->GetName(), input->val, name);
+      return false;
+    }
+    if (ele->GetReplicas() > 1) {
+      AppWarn("shared %s can not have replicas, %s", ele->GetName(), name);
+      return false;
+    }
+  }
+  return true;
+}
+
+int AlgTask::Compare(AlgTask* c) {
+  std::unique_lock<std::mutex> lock(ele_mtx);
+  std::unique_lock<std::mutex> _lock(c->ele_mtx);
+  if (ele_vec.size() != c->ele_vec.size()) {
+    return ALG_CHANGED;
+  }
+  int ret = ALG_SAME;
+  for (size_t i = 0; i < ele_vec.size(); i ++) {
+    ret = std::max(ret, ele_vec[i]->Compare(c->ele_vec[i].get()));
+  }
+  return ret;
+}
+
+bool AlgTask::AssignToThreads(std::shared_ptr<TaskParams> task, bool shared) {
   auto entry = SearchEntry();
   if (entry == nullptr) {
     AppWarn("search entry failed");
@@ -342,7 +538,7 @@ bool AlgTask::AssignToThreads(std::shared_ptr<TaskParams> task) {
   }
   ResetEleAttachFlag();
   task->thread_vec.clear();
-  AttachToThread(entry, task);
+  AttachToThread(entry, task, shared);
 
   return true;
 }
@@ -356,12 +552,24 @@ Element::Element(void) {
   // detection run slower, tracker_capture will block in ResetInput, waiting detection,
   // and detection will block in condition.wait
   async = true;
+  join_policy = JOIN_DROP;
+  join_wait_ms = JOIN_WAIT_MS;
+  queue_len = -1;
+  replicas = 1;
+  ordered = false;
+  shared = false;
   params = nullptr;
   attach_to_thread = false;
 }
 
 Element& Element::operator=(const Element& c) {
   async = c.async;
+  join_policy = c.join_policy;
+  join_wait_ms = c.join_wait_ms;
+  queue_len = c.queue_len;
+  replicas = c.replicas;
+  ordered = c.ordered;
+  shared = c.shared;
   strncpy(name, c.name, sizeof(name));
   strncpy(path, c.path, sizeof(path));
   strncpy(framework, c.framework, sizeof(framework));
@@ -374,6 +582,33 @@ Element& Element::operator=(const Element& c) {
 Element::~Element(void) {
 }
 
+static bool SameMap(auto& a, auto& b) {
+  if (a.size() != b.size()) {
+    return false;
+  }
+  for (size_t i = 0; i < a.size(); i ++) {
+    if (strcmp(a[i]->key, b[i]->key) || strcmp(a[i]->val, b[i]->val) ||
+        a[i]->policy != b[i]->policy || a[i]->timeout_ms != b[i]->timeout_ms ||
+        a[i]->decimate != b[i]->decimate) {
+      return false;
+    }
+  }
+  return true;
+}
+
+int Element::Compare(Element* c) {
+  const char* p1 = params != nullptr ? params.get() : "";
+  const char* p2 = c->params != nullptr ? c->params.get() : "";
+  if (strcmp(name, c->name) || strcmp(path, c->path) || strcmp(framework, c->framework) ||
+      async != c->async || join_policy != c->join_policy ||
+      join_wait_ms != c->join_wait_ms || replicas != c->replicas ||
+      ordered != c->ordered || shared != c->shared || strcmp(p1, p2) ||
+      !SameMap(input_map, c->input_map) || !SameMap(output_map, c->output_map)) {
+    return ALG_CHANGED;
+  }
+  return queue_len != c->queue_len ? ALG_TUNE : ALG_SAME;
+}
+
 void Element::SetParams(char *str) {
   std::shared_ptr<char> p(new char[strlen(str)+1]);
   strcpy(p.get(), str);
@@ -15,7 +15,9 @@
 
 #include "stream.h"
 #include "rest.h"
+#include "metrics.h"
 #include <thread>
+#include <chrono>
 
 int SendHttpReply(struct evhttp_request* req, int code, const char* buf) {
   struct evbuffer* evb;
@@ -190,7 +192,8 @@ int HttpGet(const char* url, HttpAck* ack, int timeout_sec) {
   return HttpClient(EVHTTP_REQ_GET, url, NULL, ack, timeout_sec);
 }
 
-int request_cb(struct evhttp_request* req, void (*http_task)(struct evhttp_request*, void* ), void* arg) {
+int request_cb(struct evhttp_request* req, void (*http_task)(struct evhttp_request*, void* ),
+               void* arg, const char* path) {
   char *url;
   int code = HTTP_OK;
   char *pbody = NULL;
@@ -253,6 +256,7 @@ int request_cb(struct evhttp_request* req, void (*http_task)(struct evhttp_reque
     Restful* rest = (Restful* )arg;
     AppDebug("%s,%s:%s", rest->GetType(), url, cbuf);
   }
+  auto start = std::chrono::steady_clock::now();
   if (http_task != NULL) {
     CommonParams params;
     params.arga = cbuf;
@@ -266,10 +270,30 @@ int request_cb(struct evhttp_request* req, void (*http_task)(struct evhttp_reque
   if (pbody != NULL) {
     free(pbody);
   }
+  // labeled by the registered url, not the one requested,
+  // so the label set is bounded by the url map
+  Metric* latency = MetricsGet("aistream_rest_request_seconds", "duration of rest requests",
+                               METRIC_HISTOGRAM, std::string("url=\"") + path + "\"");
+  latency->Observe(std::chrono::duration_cast<std::chrono::microseconds>(
+                   std::chrono::steady_clock::now() - start).count());
 
   return 0;
 }
 
+void request_metrics(struct evhttp_request* req, void* arg) {
+  if (req == NULL) {
+    AppWarn("req is null");
+    return ;
+  }
+  std::string text = MetricsText();
+  struct evbuffer* evb = evbuffer_new();
+  evbuffer_add(evb, text.c_str(), text.size());
+  evhttp_add_header(evhttp_request_get_output_headers(req),
+                    "Content-Type", "text/plain; version=0.0.4");
+  evhttp_send_reply(req, HTTP_OK, "OK", evb);
+  evbuffer_free(evb);
+}
+
 void CheckErrMsg(const char* msg, char** ppbody) {
   int len = strlen(msg);
   if (len > 0) {
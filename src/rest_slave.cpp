@@ -17,6 +17,8 @@
 #include "rest.h"
 #include "config.h"
 #include "log.h"
+#include "governor.h"
+#include "trace.h"
 #include "rtsp.h"
 #include "rtmp.h"
 #include "gat1400.h"
@@ -336,6 +338,27 @@ static void request_system_status(struct evhttp_request* req, void* arg) {
            "\"data\":{\"system_init\":%d}}", media->system_init);
 }
 
+static void request_bufpool_status(struct evhttp_request* req, void* arg) {
+  request_first_stage;
+  CommonParams* params = (CommonParams* )arg;
+  char** ppbody = (char **)params->argb;
+  BufferPoolStat stat;
+  BufferPoolStats(&stat);
+
+  cJSON* root = cJSON_CreateObject();
+  cJSON* data_root = cJSON_CreateObject();
+  cJSON_AddStringToObject(root, "code", "0");
+  cJSON_AddStringToObject(root, "msg", "success");
+  cJSON_AddItemToObject(root, "data", data_root);
+  cJSON_AddNumberToObject(data_root, "hits", stat.hits);
+  cJSON_AddNumberToObject(data_root, "misses", stat.misses);
+  cJSON_AddNumberToObject(data_root, "bytes_held", stat.bytes_held);
+  cJSON_AddNumberToObject(data_root, "bytes_used", stat.bytes_used);
+  cJSON_AddNumberToObject(data_root, "bytes_max", stat.bytes_max);
+  *ppbody = cJSON_Print(root);
+  cJSON_Delete(root);
+}
+
 static int ObjStatus(std::shared_ptr<Object> obj, void* arg) {
   cJSON *fld;
   cJSON *data_root = (cJSON *)arg;
@@ -365,6 +388,134 @@ static void request_obj_status(struct evhttp_request* req, void* arg) {
   cJSON_Delete(root);
 }
 
+// quantiles are upper bounds of histogram buckets
+static void LatencyStatus(cJSON* root, Metric* metric) {
+  cJSON* fld;
+  uint64_t cnt = metric->Count();
+  cJSON_AddItemToObject(root, "latency", fld = cJSON_CreateObject());
+  cJSON_AddNumberToObject(fld, "count", cnt);
+  cJSON_AddNumberToObject(fld, "avg_ms", cnt > 0 ? metric->Sum()/1000.0/cnt : 0);
+  cJSON_AddNumberToObject(fld, "p50_ms", metric->Quantile(0.5)/1000.0);
+  cJSON_AddNumberToObject(fld, "p90_ms", metric->Quantile(0.9)/1000.0);
+  cJSON_AddNumberToObject(fld, "p99_ms", metric->Quantile(0.99)/1000.0);
+}
+
+static int TaskStatus(std::shared_ptr<TaskParams> task, void* arg) {
+  static const char* policy_name[] = {
+    "drop_oldest", "drop_newest", "block", "latest", "gop"
+  };
+  cJSON *fld, *ele_root;
+  cJSON *task_root = (cJSON *)arg;
+  cJSON_AddItemToArray(task_root, fld = cJSON_CreateObject());
+  cJSON_AddStringToObject(fld, "name", task->GetTaskName());
+  cJSON_AddNumberToObject(fld, "running", task->running);
+  LatencyStatus(fld, &task->latency_usec);
+  cJSON_AddItemToObject(fld, "element", ele_root = cJSON_CreateArray());
+  for (size_t i = 0; i < task->thread_vec.size(); i ++) {
+    auto tt = task->thread_vec[i];
+    for (size_t j = 0; j < tt->t_ele_vec.size(); j ++) {
+      auto ele = tt->t_ele_vec[j];
+      cJSON *ele_fld, *input_root;
+      cJSON_AddItemToArray(ele_root, ele_fld = cJSON_CreateObject());
+      cJSON_AddStringToObject(ele_fld, "name", ele->GetName());
+      if (ele->replica != nullptr) {
+        cJSON_AddNumberToObject(ele_fld, "replica", ele->replica_id);
+      }
+      cJSON_AddNumberToObject(ele_fld, "processed", ele->frames_in.Value());
+      cJSON_AddNumberToObject(ele_fld, "busy_ms", ele->process_usec.Sum()/1000);
+      // queue_len of the pipeline not applied, above the capacity of outputs
+      int queue_len = ele->data.queue_len.load();
+      cJSON_AddNumberToObject(ele_fld, "queue_len", queue_len);
+      if (ele->GetQueueLen() > queue_len) {
+        cJSON_AddNumberToObject(ele_fld, "queue_len_wanted", ele->GetQueueLen());
+      }
+      LatencyStatus(ele_fld, &ele->latency_usec);
+      cJSON_AddItemToObject(ele_fld, "input", input_root = cJSON_CreateArray());
+      for (size_t k = 0; k < ele->data.input.size(); k ++) {
+        auto input = ele->data.input[k];
+        cJSON* input_fld;
+        cJSON_AddItemToArray(input_root, input_fld = cJSON_CreateObject());
+        cJSON_AddStringToObject(input_fld, "name", input->name);
+        cJSON_AddStringToObject(input_fld, "policy", policy_name[input->policy]);
+        cJSON_AddNumberToObject(input_fld, "size", input->Size());
+        cJSON_AddNumberToObject(input_fld, "capacity", input->Capacity());
+        cJSON_AddNumberToObject(input_fld, "pushed", input->pushed);
+        cJSON_AddNumberToObject(input_fld, "dropped", input->dropped);
+      }
+      auto join = ele->join.get();
+      if (join != nullptr) {
+        cJSON* join_fld;
+        cJSON_AddItemToObject(ele_fld, "join", join_fld = cJSON_CreateObject());
+        cJSON_AddNumberToObject(join_fld, "matched", join->matched);
+        cJSON_AddNumberToObject(join_fld, "passed", join->passed);
+        cJSON_AddNumberToObject(join_fld, "dropped", join->dropped);
+        cJSON_AddNumberToObject(join_fld, "stale", join->stale);
+      }
+    }
+  }
+  return 0;
+}
+
+static int RateStatus(StreamRate* rate, void* arg) {
+  cJSON *fld;
+  cJSON *rate_root = (cJSON *)arg;
+  cJSON_AddItemToArray(rate_root, fld = cJSON_CreateObject());
+  cJSON_AddNumberToObject(fld, "fps", rate->fps);
+  cJSON_AddNumberToObject(fld, "min_fps", rate->min_fps);
+  cJSON_AddNumberToObject(fld, "max_fps", rate->max_fps);
+  cJSON_AddNumberToObject(fld, "priority", rate->priority);
+  return 0;
+}
+
+static int ObjTaskStatus(std::shared_ptr<Object> obj, void* arg) {
+  cJSON *fld, *task_root, *rate_root;
+  cJSON *data_root = (cJSON *)arg;
+  cJSON_AddItemToArray(data_root, fld = cJSON_CreateObject());
+  cJSON_AddNumberToObject(fld, "id", obj->GetId());
+  // empty if the governor is disabled
+  cJSON_AddItemToObject(fld, "rate", rate_root = cJSON_CreateArray());
+  GovernorTraverse(obj->GetId(), rate_root, RateStatus);
+  cJSON_AddItemToObject(fld, "task", task_root = cJSON_CreateArray());
+  obj->TraverseTaskQue(task_root, TaskStatus);
+  return 0;
+}
+
+static void request_task_status(struct evhttp_request* req, void* arg) {
+  request_first_stage;
+  CommonParams* params = (CommonParams* )arg;
+  char** ppbody = (char **)params->argb;
+  Restful* rest = (Restful* )params->argc;
+  MediaServer* media = rest->media;
+  ObjParams* obj_params = media->GetObjParams();
+
+  cJSON* root = cJSON_CreateObject();
+  cJSON* data_root = cJSON_CreateObject();
+  cJSON* obj_root = cJSON_CreateArray();
+  cJSON_AddStringToObject(root, "code", "0");
+  cJSON_AddStringToObject(root, "msg", "success");
+  cJSON_AddItemToObject(root, "data", data_root);
+  cJSON_AddItemToObject(data_root, "obj", obj_root);
+  obj_params->TraverseObjQue(obj_root, ObjTaskStatus);
+  *ppbody = cJSON_Print(root);
+  cJSON_Delete(root);
+}
+
+// body is chrome trace json, not the common reply
+static void request_trace(struct evhttp_request* req, void* arg) {
+  request_first_stage;
+  CommonParams* params = (CommonParams* )arg;
+  char* url = (char *)params->arge;
+  char** ppbody = (char **)params->argb;
+
+  int sec = 5;
+  const char* flag = strstr(url, "sec=");
+  if (flag != NULL) {
+    sec = atoi(flag + strlen("sec="));
+  }
+  std::string text = TraceDump(sec);
+  *ppbody = strdup(text.c_str());
+}
+
 static UrlMap rest_url_map[] = {
   // HTTP POST
   {"/api/system/login",       request_login},
@@ -383,6 +534,10 @@ static UrlMap rest_url_map[] = {
   {"/api/task/support",       request_task_support},
   {"/api/system/status",      request_system_status},
   {"/api/obj/status",         request_obj_status},
+  {"/api/system/bufpool",     request_bufpool_status},
+  {"/api/task/status",        request_task_status},
+  {"/api/system/trace",       request_trace},
+  {"/metrics",                request_metrics},
   {NULL, NULL}
 };
 
@@ -41,6 +41,7 @@
 #include <ctype.h>
 #include <execinfo.h>
 #include <memory>
+#include <string>
 #include <event2/event.h>
 #include <event2/http.h>
 #include <event2/buffer.h>
@@ -188,325 +189,130 @@ int WriteFile(const char *filename, void *buf, int size, const char *mode) {
 }
 
 int GetIntValFromJson(char *buf, const char *name1, const char *name2, const char *name3) {
-  int val = -1;
-  char name[256];
-  cJSON *root, *pSub1, *pSub2, *pSub3;
-  root = cJSON_Parse(buf);
-  if (root == NULL) {
+  auto doc = JsonDoc::Parse(buf, false);
+  if (doc == nullptr) {
     AppError("cJSON_Parse err, buf:%s", buf);
-    goto end;
-  }
-  if (name1 == NULL) {
-    AppError("name1 is null");
-    goto end;
-  }
-  strncpy(name, name1, sizeof(name));
-  pSub1 = cJSON_GetObjectItem(root, name);
-  if (pSub1 == NULL) {
-    //printf("get json null, %s\n", name);
-    goto end;
-  }
-  if (name2 == NULL) {
-    val = pSub1->valueint;
-    goto end;
-  }
-  strncpy(name, name2, sizeof(name));
-  pSub2 = cJSON_GetObjectItem(pSub1, name);
-  if (pSub2 == NULL) {
-    //printf("get json null, %s\n", name);
-    goto end;
-  }
-  if (name3 == NULL) {
-    val = pSub2->valueint;
-    goto end;
+    return -1;
   }
-  strncpy(name, name3, sizeof(name));
-  pSub3 = cJSON_GetObjectItem(pSub2, name);
-  if (pSub3 == NULL) {
-    //printf("get json null, %s\n", name);
-    goto end;
+  return doc->GetInt(name1, name2, name3);
+}
+
+static std::unique_ptr<char[]> CopyStr(const char *str) {
+  std::unique_ptr<char[]> val = nullptr;
+  if (str != NULL) {
+    val = std::make_unique<char[]>(strlen(str) + 1);
+    strcpy(val.get(), str);
   }
-  val = pSub3->valueint;
-end:
-  if (root != NULL) {
-    cJSON_Delete(root);
+  return val;
+}
+
+// print item to a buffer owned by caller
+static std::unique_ptr<char[]> PrintItem(cJSON *item) {
+  if (item == NULL) {
+    return nullptr;
   }
+  char *tmp = cJSON_Print(item);
+  auto val = CopyStr(tmp);
+  free(tmp);
   return val;
 }
 
 std::unique_ptr<char[]> GetStrValFromJson(char *buf,
     const char *name1, const char *name2, const char *name3) {
-  char name[256];
-  char *tmp = NULL;
-  cJSON *root, *pSub1, *pSub2, *pSub3;
-  root = cJSON_Parse(buf);
-  if (root == NULL) {
+  auto doc = JsonDoc::Parse(buf, false);
+  if (doc == nullptr) {
     AppError("cJSON_Parse err, buf:%s", buf);
-    goto end;
-  }
-  if (name1 == NULL) {
-    //printf("get json null, %s\n", name);
-    goto end;
-  }
-  strncpy(name, name1, sizeof(name));
-  pSub1 = cJSON_GetObjectItem(root, name);
-  if (pSub1 == NULL) {
-    //printf("get json null, %s\n", name);
-    goto end;
-  }
-  if (name2 == NULL) {
-    tmp = pSub1->valuestring;
-    goto end;
-  }
-  strncpy(name, name2, sizeof(name));
-  pSub2 = cJSON_GetObjectItem(pSub1, name);
-  if (pSub2 == NULL) {
-    //printf("get json null, %s\n", name);
-    goto end;
-  }
-  if (name3 == NULL) {
-    tmp = pSub2->valuestring;
-    goto end;
-  }
-  strncpy(name, name3, sizeof(name));
-  pSub3 = cJSON_GetObjectItem(pSub2, name);
-  if (pSub3 == NULL) {
-    //printf("get json null, %s\n", name);
-    goto end;
-  }
-  tmp = pSub3->valuestring;
-end:
-  std::unique_ptr<char[]> val = nullptr;
-  if (tmp != NULL) {
-    int len = strlen(tmp) + 1;
-    val = std::make_unique<char[]>(len);
-    strcpy(val.get(), tmp);
-  }
-  if (root != NULL) {
-    cJSON_Delete(root);
+    return nullptr;
   }
-  return val;
+  return CopyStr(doc->GetStr(name1, name2, name3));
 }
 
 int GetIntValFromFile(const char *filename, const char *name1, const char *name2, const char *name3) {
-  auto buf = ReadFile2Buf(filename);
-  if (buf == nullptr) {
-    AppWarn("%s, ReadFile2Buf failed", filename);
+  auto doc = JsonDoc::Load(filename);
+  if (doc == nullptr) {
+    AppWarn("%s, load failed", filename);
     return -1;
   }
-  return GetIntValFromJson(buf.get(), name1, name2, name3);
+  return doc->GetInt(name1, name2, name3);
 }
 
 std::unique_ptr<char[]>  GetStrValFromFile(const char *filename,
     const char *name1, const char *name2, const char *name3) {
-  auto buf = ReadFile2Buf(filename);
-  if (buf == NULL) {
-    AppWarn("%s, ReadFile2Buf failed", filename);
+  auto doc = JsonDoc::Load(filename);
+  if (doc == nullptr) {
+    AppWarn("%s, load failed", filename);
     return nullptr;
   }
-  return GetStrValFromJson(buf.get(), name1, name2, name3);
+  return CopyStr(doc->GetStr(name1, name2, name3));
 }
 
 std::unique_ptr<char[]> GetArrayBufFromJson(char *buf, int &size,
     const char *name1, const char *name2, const char *name3) {
-  char name[256];
-  cJSON *pArray = NULL;
-  cJSON *root, *pSub1, *pSub2, *pSub3;
-  root = cJSON_Parse(buf);
-  if (root == NULL) {
+  auto doc = JsonDoc::Parse(buf, false);
+  if (doc == nullptr) {
     AppError("cJSON_Parse err, buf:%s", buf);
-    goto end;
-  }
-  if (name1 == NULL) {
-    AppError("name1 is null");
-    goto end;
-  }
-  strncpy(name, name1, sizeof(name));
-  pSub1 = cJSON_GetObjectItem(root, name);
-  if (pSub1 == NULL) {
-    //printf("get json null, %s\n", name);
-    goto end;
-  }
-  if (name2 == NULL) {
-    pArray = pSub1;
-    goto end;
-  }
-  strncpy(name, name2, sizeof(name));
-  pSub2 = cJSON_GetObjectItem(pSub1, name);
-  if (pSub2 == NULL) {
-    //printf("get json null, %s\n", name);
-    goto end;
-  }
-  if (name3 == NULL) {
-    pArray = pSub2;
-    goto end;
-  }
-  strncpy(name, name3, sizeof(name));
-  pSub3 = cJSON_GetObjectItem(pSub2, name);
-  if (pSub3 == NULL) {
-    //printf("get json null, %s\n", name);
-    goto end;
-  }
-  pArray = pSub3;
-end:
-  std::unique_ptr<char[]> val = nullptr;
-  if (pArray != NULL) {
-    size = cJSON_GetArraySize(pArray);
-    char* tmp = cJSON_Print(pArray);
-    int len = strlen(tmp) + 1;
-    val = std::make_unique<char[]>(len);
-    strcpy(val.get(), tmp);
-    free(tmp);
-  } else {
-    //printf("pArray is null\n");
+    return nullptr;
   }
-  if (root != NULL) {
-    cJSON_Delete(root);
+  cJSON *array = doc->Get(name1, name2, name3);
+  if (array != NULL) {
+    size = cJSON_GetArraySize(array);
   }
-  return val;
+  return PrintItem(array);
 }
 
 std::unique_ptr<char[]> GetArrayBufFromFile(const char *filename, int &size,
     const char *name1, const char *name2, const char *name3) {
-  auto buf = ReadFile2Buf(filename);
-  if (buf == nullptr) {
-    AppWarn("%s, ReadFile2Buf failed", filename);
+  auto doc = JsonDoc::Load(filename);
+  if (doc == nullptr) {
+    AppWarn("%s, load failed", filename);
     return nullptr;
   }
-  return GetArrayBufFromJson(buf.get(), size, name1, name2, name3);
+  cJSON *array = doc->Get(name1, name2, name3);
+  if (array != NULL) {
+    size = cJSON_GetArraySize(array);
+  }
+  return PrintItem(array);
 }
 
 std::unique_ptr<char[]> GetBufFromArray(char *buf, int index) {
-  cJSON *root, *pSub;
-  std::unique_ptr<char[]> val = nullptr;
-  root = cJSON_Parse(buf);
-  if (root == NULL) {
+  auto doc = JsonDoc::Parse(buf, false);
+  if (doc == nullptr) {
     AppError("cJSON_Parse err, buf:%s", buf);
-    return val;
-  }
-  int size = cJSON_GetArraySize(root);
-  if (index >= 0 && index < size) {
-    pSub = cJSON_GetArrayItem(root, index);
-    char* tmp = cJSON_Print(pSub);
-    int len = strlen(tmp) + 1;
-    val = std::make_unique<char[]>(len);
-    strcpy(val.get(), tmp);
-    free(tmp);
+    return nullptr;
   }
-  cJSON_Delete(root);
-  return val;
+  int size = cJSON_GetArraySize(doc->Root());
+  if (index < 0 || index >= size) {
+    return nullptr;
+  }
+  return PrintItem(cJSON_GetArrayItem(doc->Root(), index));
 }
 
 std::unique_ptr<char[]> GetObjBufFromJson(char *buf,
     const char *name1, const char *name2, const char *name3) {
-  char name[256];
-  char *tmp = NULL;
-  cJSON *root, *pSub1, *pSub2, *pSub3;
-  root = cJSON_Parse(buf);
-  if (root == NULL) {
+  auto doc = JsonDoc::Parse(buf, false);
+  if (doc == nullptr) {
     AppError("cJSON_Parse err, buf:%s", buf);
-    goto end;
-  }
-  if (name1 == NULL) {
-    //printf("get json null, %s\n", name);
-    goto end;
-  }
-  strncpy(name, name1, sizeof(name));
-  pSub1 = cJSON_GetObjectItem(root, name);
-  if (pSub1 == NULL) {
-    //printf("get json null, %s\n", name);
-    goto end;
-  }
-  if (name2 == NULL) {
-    tmp = cJSON_Print(pSub1);
-    goto end;
-  }
-  strncpy(name, name2, sizeof(name));
-  pSub2 = cJSON_GetObjectItem(pSub1, name);
-  if (pSub2 == NULL) {
-    //printf("get json null, %s\n", name);
-    goto end;
-  }
-  if (name3 == NULL) {
-    tmp = cJSON_Print(pSub2);
-    goto end;
-  }
-  strncpy(name, name3, sizeof(name));
-  pSub3 = cJSON_GetObjectItem(pSub2, name);
-  if (pSub3 == NULL) {
-    //printf("get json null, %s\n", name);
-    goto end;
-  }
-  tmp = cJSON_Print(pSub3);
-end:
-  std::unique_ptr<char[]> val = nullptr;
-  if (tmp != NULL) {
-    int len = strlen(tmp) + 1;
-    val = std::make_unique<char[]>(len);
-    strcpy(val.get(), tmp);
-  }
-  if (root != NULL) {
-    cJSON_Delete(root);
+    return nullptr;
   }
-  return val;
+  return PrintItem(doc->Get(name1, name2, name3));
 }
 
 double GetDoubleValFromJson(char *buf, const char *name1, const char *name2, const char *name3) {
-  char name[256];
-  double val = -1;
-  cJSON *root, *pSub1, *pSub2, *pSub3;
-
-  root = cJSON_Parse(buf);
-  if (root == NULL) {
-    AppError("parse json err, buf:%s", buf);
-    goto end;
-  }
-  if (name1 == NULL) {
-    AppError("name1 is null");
-    goto end;
-  }
-  strncpy(name, name1, 256);
-  pSub1 = cJSON_GetObjectItem(root, name);
-  if (pSub1 == NULL) {
-    //printf("get json null, %s\n", name);
-    goto end;
-  }
-  if (name2 == NULL) {
-    val = pSub1->valuedouble;
-    goto end;
-  }
-  strncpy(name, name2, 256);
-  pSub2 = cJSON_GetObjectItem(pSub1, name);
-  if (pSub2 == NULL) {
-    //printf("get json null, %s\n", name);
-    goto end;
-  }
-  if (name3 == NULL) {
-    val = pSub2->valuedouble;
-    goto end;
-  }
-  strncpy(name, name3, 256);
-  pSub3 = cJSON_GetObjectItem(pSub2, name);
-  if (pSub3 == NULL) {
-    //printf("get json null, %s\n", name);
-    goto end;
-  }
-  val = pSub3->valuedouble;
-end:
-  if (root != NULL) {
-    cJSON_Delete(root);
+  auto doc = JsonDoc::Parse(buf, false);
+  if (doc == nullptr) {
+    return -1;
   }
-  return val;
+  return doc->GetDouble(name1, name2, name3);
 }
 
 double GetDoubleValFromFile(const char *filename,
                             const char *name1, const char *name2, const char *name3) {
-  auto buf = ReadFile2Buf(filename);
-  if (buf == nullptr) {
-    AppWarn("%s, ReadFile2Buf failed", filename);
+  auto doc = JsonDoc::Load(filename);
+  if (doc == nullptr) {
+    AppWarn("%s, load failed", filename);
     return -1;
   }
-  return GetDoubleValFromJson(buf.get(), name1, name2, name3);
+  return doc->GetDouble(name1, name2, name3);
 }
 
 int GetFileSize(const char *filename) {
@@ -515,6 +321,50 @@ int GetFileSize(const char *filename) {
   return statbuf.st_size;
 }
 
+int NormalizeUrl(const char* url, int default_port, char* key, int size) {
+  std::string str(url);
+  while (!str.empty() && isspace((unsigned char)str.back())) {
+    str.pop_back();
+  }
+  size_t pos = 0;
+  while (pos < str.size() && isspace((unsigned char)str[pos])) {
+    pos ++;
+  }
+  str = str.substr(pos);
+  std::string scheme;
+  pos = str.find("://");
+  if (pos != std::string::npos) {
+    scheme = str.substr(0, pos + 3);
+    str = str.substr(pos + 3);
+  }
+  pos = str.find('/');
+  std::string path = pos != std::string::npos ? str.substr(pos) : "";
+  std::string host = str.substr(0, pos);
+  // user and password are kept as they are, another account is another session
+  std::string cred;
+  pos = host.rfind('@');
+  if (pos != std::string::npos) {
+    cred = host.substr(0, pos + 1);
+    host = host.substr(pos + 1);
+  }
+  for (size_t i = 0; i < scheme.size(); i ++) {
+    scheme[i] = tolower(scheme[i]);
+  }
+  for (size_t i = 0; i < host.size(); i ++) {
+    host[i] = tolower(host[i]);
+  }
+  std::string port = ":" + std::to_string(default_port);
+  if (default_port > 0 && host.size() > port.size() &&
+      host.compare(host.size() - port.size(), port.size(), port) == 0) {
+    host.erase(host.size() - port.size());
+  }
+  while (!path.empty() && path.back() == '/') {
+    path.pop_back();
+  }
+  int len = snprintf(key, size, "%s%s%s%s", scheme.c_str(), cred.c_str(), host.c_str(), path.c_str());
+  return len < size ? 0 : -1;
+}
+
 std::unique_ptr<char[]> AddStrJson(char *buf, const char *val,
                                    const char *name1, const char *name2, const char *name3) {
   const char *name;
@@ -15,10 +15,13 @@
 
 #include "stream.h"
 #include "rest.h"
+#include "governor.h"
+#include "metrics.h"
 
 SlaveParams::SlaveParams(MediaServer* _media)
   : media(_media) {
   pipe = new Pipeline(media);
+  executor = nullptr;
 }
 
 SlaveParams::~SlaveParams(void) {
@@ -45,12 +48,77 @@ void SlaveParams::SlaveManager(void) {
   AppDebug("run ok");
 }
 
+typedef struct {
+  MetricsWriter* writer;
+  std::string obj_label;
+} MetricsArg;
+
+static int TaskMetrics(std::shared_ptr<TaskParams> task, void* arg) {
+  MetricsArg* metrics_arg = (MetricsArg* )arg;
+  MetricsWriter* writer = metrics_arg->writer;
+  std::string task_label = metrics_arg->obj_label + ",task=\"" + task->GetTaskName() + "\"";
+  writer->Write("aistream_task_latency_seconds", "from ingest to the end of elements without output",
+                task_label, &task->latency_usec);
+  for (size_t i = 0; i < task->thread_vec.size(); i ++) {
+    auto tt = task->thread_vec[i];
+    for (size_t j = 0; j < tt->t_ele_vec.size(); j ++) {
+      auto ele = tt->t_ele_vec[j];
+      std::string label = task_label + ",element=\"" + ele->GetName() + "\"";
+      if (ele->replica != nullptr) {
+        label += ",replica=\"" + std::to_string(ele->replica_id) + "\"";
+      }
+      writer->Write("aistream_element_frames_in_total", "packets consumed by element", label, &ele->frames_in);
+      writer->Write("aistream_element_frames_out_total", "packets produced by element", label, &ele->frames_out);
+      writer->Write("aistream_element_fps", "packets produced by element in last second, decode fps for decoders",
+                    label, &ele->fps);
+      writer->Write("aistream_element_process_seconds", "duration of Framework::Process", label, &ele->process_usec);
+      writer->Write("aistream_element_latency_seconds", "from ingest to the end of Process", label, &ele->latency_usec);
+      // replicas share the input of the first one
+      for (size_t k = 0; k < ele->data.input.size() && ele->replica_id == 0; k ++) {
+        auto input = ele->data.input[k];
+        std::string queue_label = label + ",queue=\"" + input->name + "\"";
+        writer->Write("aistream_queue_depth", "packets in queue", METRIC_GAUGE, queue_label, input->Size());
+        writer->Write("aistream_queue_pushed_total", "packets pushed to queue", METRIC_COUNTER,
+                      queue_label, input->pushed);
+        writer->Write("aistream_queue_dropped_total", "packets dropped by queue policy", METRIC_COUNTER,
+                      queue_label, input->dropped);
+      }
+    }
+  }
+  return 0;
+}
+
+static int ObjMetrics(std::shared_ptr<Object> obj, void* arg) {
+  MetricsArg* metrics_arg = (MetricsArg* )arg;
+  metrics_arg->obj_label = "obj=\"" + std::to_string(obj->GetId()) + "\"";
+  obj->TraverseTaskQue(arg, TaskMetrics);
+  return 0;
+}
+
+static void SlaveMetrics(MetricsWriter* writer, void* arg) {
+  MediaServer* media = (MediaServer* )arg;
+  MetricsArg metrics_arg = {writer, ""};
+  media->GetObjParams()->TraverseObjQue(&metrics_arg, ObjMetrics);
+  BufferPoolStat stat;
+  BufferPoolStats(&stat);
+  writer->Write("aistream_bufpool_bytes_used", "bytes of pooled buffers in use", METRIC_GAUGE, "", stat.bytes_used);
+  writer->Write("aistream_bufpool_bytes_held", "bytes of free buffers kept by pool", METRIC_GAUGE, "", stat.bytes_held);
+}
+
 void SlaveParams::Start(void) {
   SlaveRestful* rest = new SlaveRestful(media);
   ObjParams* obj_params = media->GetObjParams();
+  ConfigParams* config = media->GetConfig();
+  // executor_threads < 0, every element runs in its own thread
+  if (config->GetExecutorThreads() >= 0) {
+    executor = new Executor(media);
+    executor->Start(config->GetExecutorThreads());
+  }
+  MetricsAddCollector(media, SlaveMetrics);
   pipe->Start();
   rest->Start();
   obj_params->Start();
+  GovernorStart(media);
   std::thread t(&SlaveParams::SlaveManager, this);
   t.detach();
 }
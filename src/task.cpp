@@ -18,12 +18,13 @@
 #include "dylib.h"
 
 TaskParams::TaskParams(std::shared_ptr<Object> _obj)
-  : obj(_obj) {
+  : latency_usec(METRIC_HISTOGRAM), obj(_obj) {
   running = 0;
   task_beat = 0;
   thread_sync = 0;
   params = nullptr;
   alg = nullptr;
+  shared = nullptr;
 }
 
 TaskParams::~TaskParams(void) {
@@ -47,7 +48,32 @@ int TaskParams::Start(void) {
     AppWarn("id:%d, task:%s, get task failed", _obj->GetId(), name);
     return -1;
   }
-  if (alg->AssignToThreads(shared_from_this()) != true) {
+  if (!alg->GetSharedKey().empty()) {
+    shared = _obj->AcquireShared(alg, shared_from_this());
+    if (shared == nullptr) {
+      AppWarn("id:%d, task:%s, start shared stage failed", _obj->GetId(), name);
+      return -1;
+    }
+  }
+  return StartThreads(false);
+}
+
+int TaskParams::StartShared(std::shared_ptr<AlgTask> _alg) {
+  alg = _alg;
+  if (StartThreads(true) != 0) {
+    return -1;
+  }
+  // not started by the obj thread, so beat before the first check
+  auto _obj = GetTaskObj();
+  assert(_obj != nullptr);
+  BeatAlive(_obj->media);
+  return 0;
+}
+
+int TaskParams::StartThreads(bool _shared) {
+  auto _obj = GetTaskObj();
+  assert(_obj != nullptr);
+  if (alg->AssignToThreads(shared_from_this(), _shared) != true) {
     AppWarn("assign ele to threads failed, id:%d,task:%s", _obj->GetId(), name);
     return -1;
   }
@@ -71,10 +97,42 @@ int TaskParams::Stop(bool sync) {
   if (sync) {
     thread_vec.clear();
   }
+  if (shared != nullptr) {
+    Unsubscribe();
+    auto _obj = GetTaskObj();
+    if (_obj != nullptr) {
+      _obj->ReleaseShared(shared, sync);
+    }
+    shared = nullptr;
+  }
 
   return 0;
 }
 
+void TaskParams::Subscribe(std::shared_ptr<TaskElement> ele, std::shared_ptr<PacketQueue> queue) {
+  std::unique_lock<std::mutex> lock(ele->data_mtx);
+  ele->PrimeOutput(queue);
+  ele->data.output.push_back(queue);
+  lock.unlock();
+  std::unique_lock<std::mutex> _lock(sub_mtx);
+  sub_vec.push_back({ele, queue});
+}
+
+// the shared stage goes on running for other tasks
+void TaskParams::Unsubscribe(void) {
+  std::unique_lock<std::mutex> lock(sub_mtx);
+  for (size_t i = 0; i < sub_vec.size(); i ++) {
+    auto ele = sub_vec[i].first.lock();
+    if (ele == nullptr) {
+      continue;
+    }
+    std::unique_lock<std::mutex> _lock(ele->data_mtx);
+    auto& output = ele->data.output;
+    output.erase(std::remove(output.begin(), output.end(), sub_vec[i].second), output.end());
+  }
+  sub_vec.clear();
+}
+
 bool TaskParams::KeepAlive(void) {
   auto _obj = GetTaskObj();
   assert(_obj != nullptr);
@@ -87,6 +145,14 @@ bool TaskParams::KeepAlive(void) {
   } else if (media->now_sec - task_beat > config->GetTaskTimeout()) {
     AppWarn("id:%d,task:%s,detected exception, restart it ...", 
             _obj->GetId(), name);
+    if (TraceEnabled()) {
+      char reason[300], path[URL_LEN];
+      snprintf(reason, sizeof(reason), "%d_%s", _obj->GetId(), name);
+      if (TraceDumpFile(reason, path, sizeof(path)) == 0) {
+        AppWarn("id:%d,task:%s,spans before restart are dumped to %s",
+                _obj->GetId(), name, path);
+      }
+    }
     task_beat = media->now_sec;
     return false;
   }
@@ -94,6 +160,45 @@ bool TaskParams::KeepAlive(void) {
   return true;
 }
 
+bool TaskParams::SyncAlg(void) {
+  if (alg == nullptr || running == 0) {
+    return true;
+  }
+  auto _obj = GetTaskObj();
+  assert(_obj != nullptr);
+  Pipeline* pipe = _obj->media->GetSlave()->GetPipe();
+  auto _alg = pipe->GetAlgTask(name);
+  // removed task keeps running until it is deleted
+  if (_alg == nullptr || _alg == alg) {
+    return true;
+  }
+  if (_alg->Compare(alg.get()) == ALG_CHANGED) {
+    AppDebug("id:%d,task:%s,pipeline changed, restart it", _obj->GetId(), name);
+    return false;
+  }
+  for (size_t i = 0; i < thread_vec.size(); i ++) {
+    auto tt = thread_vec[i];
+    for (size_t j = 0; j < tt->t_ele_vec.size(); j ++) {
+      auto t_ele = tt->t_ele_vec[j];
+      auto ele = _alg->GetElement(t_ele->GetName());
+      if (ele == nullptr || ele->GetQueueLen() == t_ele->GetQueueLen()) {
+        continue;
+      }
+      t_ele->SetQueueLen(ele->GetQueueLen());
+      if (!t_ele->ApplyQueueLen()) {
+        AppWarn("id:%d,task:%s,%s,queue_len:%d is cut to the capacity:%d",
+                _obj->GetId(), name, t_ele->GetName(), ele->GetQueueLen(),
+                t_ele->data.queue_len.load());
+        continue;
+      }
+      AppDebug("id:%d,task:%s,%s,queue_len:%d", _obj->GetId(), name,
+               t_ele->GetName(), t_ele->data.queue_len.load());
+    }
+  }
+  alg = _alg;
+  return true;
+}
+
 void TaskParams::BeatAlive(MediaServer* media) {
   task_beat = media->now_sec;
 }
@@ -123,14 +228,119 @@ void TaskParams::ThreadSync(const char* name) {
 }
 
 TaskElement::TaskElement(std::shared_ptr<TaskParams> _task)
-  : task(_task) {
+  : fps(METRIC_GAUGE), process_usec(METRIC_HISTOGRAM),
+    latency_usec(METRIC_HISTOGRAM), task(_task) {
   framework = nullptr;
   exception_cnt = 0;
+  trace_name = 0;
+  fps_start = std::chrono::steady_clock::now();
+  fps_frames = 0;
+  init_queue_len = -1;
+  replica = nullptr;
+  replica_id = 0;
+  wake = nullptr;
+  async_ready = 0;
 }
 
 TaskElement::~TaskElement(void) {
 }
 
+void TaskElement::UpdateLatency(TensorData& tensor, int64_t now_usec) {
+  // inputs joined by frame_id, the earliest one counts
+  int64_t ingest_usec = 0, pts = 0;
+  for (size_t i = 0; i < tensor._in.size(); i ++) {
+    auto& params = tensor._in[i]->_params;
+    if (params.ingest_usec > 0 &&
+        (ingest_usec == 0 || params.ingest_usec < ingest_usec)) {
+      ingest_usec = params.ingest_usec;
+      pts = params.pts;
+    }
+  }
+  // finished by the plugin later, it carries the ingest time itself
+  auto out = tensor._out;
+  if (tensor._in.empty() && out != nullptr) {
+    ingest_usec = out->_params.ingest_usec;
+  }
+  if (ingest_usec == 0) {
+    return;
+  }
+  // plugins create output packets without ingest time
+  if (out != nullptr && out->_params.ingest_usec == 0) {
+    out->_params.ingest_usec = ingest_usec;
+    out->_params.pts = pts;
+  }
+  uint64_t usec = now_usec > ingest_usec ? now_usec - ingest_usec : 0;
+  latency_usec.Observe(usec);
+  if (OutputNum() == 0) {
+    task->latency_usec.Observe(usec);
+  }
+}
+
+void TaskElement::UpdateFps(std::chrono::steady_clock::time_point now, bool output) {
+  if (output) {
+    fps_frames ++;
+  }
+  auto usec = std::chrono::duration_cast<std::chrono::microseconds>(now - fps_start).count();
+  if (usec >= 1000000) {
+    fps.Set(fps_frames * 1000000 / usec);
+    fps_start = now;
+    fps_frames = 0;
+  }
+}
+
+size_t TaskElement::OutputNum(void) {
+  std::unique_lock<std::mutex> lock(data_mtx);
+  return data.output.size();
+}
+
+// run unit again at end, even if no input arrives
+static void WakeAt(Executor* executor, std::shared_ptr<QueueListener> unit,
+                   std::chrono::steady_clock::time_point end) {
+  std::weak_ptr<QueueListener> _unit = unit;
+  executor->After(end - std::chrono::steady_clock::now(), [_unit] {
+    auto unit = _unit.lock();
+    if (unit != nullptr) {
+      unit->OnPush();
+    }
+  });
+}
+
+bool TaskElement::Parked(std::shared_ptr<QueueListener> unit, Executor* executor) {
+  std::unique_lock<std::mutex> lock(data_mtx);
+  size_t limit = (size_t)data.queue_len.load(std::memory_order_relaxed);
+  auto wake = park_wake;
+  if (!ParkOutputs(data.output, limit, unit, std::chrono::steady_clock::now(),
+                   &park_start, &park_wake)) {
+    return false;
+  }
+  if (park_wake != wake) {
+    // nothing may be popped before the timeout
+    WakeAt(executor, unit, park_wake);
+  }
+  return true;
+}
+
+bool TaskElement::ApplyQueueLen(void) {
+  int len = GetQueueLen() > 0 ? GetQueueLen() : init_queue_len;
+  size_t cap = 0;
+  std::unique_lock<std::mutex> lock(data_mtx);
+  for (size_t i = 0; i < data.output.size(); i ++) {
+    size_t _cap = data.output[i] != nullptr ? data.output[i]->Capacity() : 0;
+    if (_cap > 0 && (cap == 0 || _cap < cap)) {
+      cap = _cap;
+    }
+  }
+  lock.unlock();
+  if (cap > 0 && (size_t)len > cap) {
+    AppWarn("%s, queue_len %d is above the capacity %lu, raise video.queue_len_max "
+            "of config and restart the task", GetName(), len, cap);
+    data.queue_len = (int)cap;
+    return false;
+  }
+  data.queue_len = len;
+  return true;
+}
+
 void TaskElement::ConnectElement(void) {
   for (size_t i = 0; i < data.input.size(); i++) {
     auto _queue = data.input[i];
@@ -146,8 +356,14 @@ void TaskElement::ConnectElement(void) {
       AppWarn("%s, get input by %s failed", GetName(), _queue->name);
       continue;
     }
-    bool connect = false;
-    for (size_t j = 0; j < task->thread_vec.size() && !connect; j ++) {
+    _queue->policy = _map->policy;
+    _queue->timeout_ms = _map->timeout_ms > 0 ? _map->timeout_ms : 0;
+    // room for queue_len raised by reloading the pipeline
+    _queue->reserve = std::max(data.config->GetInt("video", "queue_len_max"), 0);
+    _queue->decimate = _map->decimate;
+    // the previous element, or all of its replicas
+    std::shared_ptr<TaskElement> connect = nullptr;
+    for (size_t j = 0; j < task->thread_vec.size(); j ++) {
       auto tt = task->thread_vec[j];
       for (size_t k = 0; k < tt->t_ele_vec.size(); k ++) {
         auto ele = tt->t_ele_vec[k];
@@ -156,23 +372,40 @@ void TaskElement::ConnectElement(void) {
           AppWarn("get output map failed, %s", ele->GetName());
           continue;
         }
-        if (!strncmp(_map->val, output->val, sizeof(output->val))) {
-          std::unique_lock<std::mutex> lock(ele->data_mtx);
-          ele->data.output.push_back(_queue);
-          lock.unlock();
-          connect = true;
+        if (strncmp(_map->val, output->val, sizeof(output->val)) != 0 ||
+            (connect != nullptr && (connect->replica == nullptr ||
+                                    connect->replica != ele->replica))) {
+          continue;
+        }
+        std::unique_lock<std::mutex> lock(ele->data_mtx);
+        ele->data.output.push_back(_queue);
+        lock.unlock();
+        connect = ele;
+      }
+    }
+    // or the element of the shared stage
+    auto shared = task->GetShared();
+    for (size_t j = 0; shared != nullptr && connect == nullptr &&
+                       j < shared->thread_vec.size(); j ++) {
+      auto tt = shared->thread_vec[j];
+      for (size_t k = 0; k < tt->t_ele_vec.size(); k ++) {
+        auto ele = tt->t_ele_vec[k];
+        auto output = ele->GetOutputMap();
+        if (output != nullptr && !strncmp(_map->val, output->val, sizeof(output->val))) {
+          task->Subscribe(ele, _queue);
+          connect = ele;
           break;
         }
       }
     }
-    if (!connect) {
+    if (connect == nullptr) {
       AppWarn("connect %s %s:%s to previous failed", 
               GetName(), _map->key, _map->val);
     }
   }
 }
 
-bool TaskElement::Start(bool sync_in) {
+bool TaskElement::Start(bool sync_in, std::shared_ptr<QueueListener> listener) {
   char* path = GetPath();
   auto obj = task->GetTaskObj();
   assert(obj != nullptr);
@@ -181,6 +414,7 @@ bool TaskElement::Start(bool sync_in) {
 
   auto ele_params = GetParams();
   auto task_params = task->GetParams();
+  trace_name = TraceName(GetName());
   framework = std::make_unique<DynamicLib>();
   if (!strcmp(GetName(), "object")) {
     path = obj->GetPath(path);
@@ -196,20 +430,44 @@ bool TaskElement::Start(bool sync_in) {
      (!strcmp(GetName(), "rabbitmq") || !strcmp(GetName(), "output"))) {
     params = out_params.get();
   }
+  // the config published with the pipeline, the same for all elements
+  auto snap = media->GetSlave()->GetPipe()->GetSnapshot();
+  data.config = snap != nullptr ? snap->config : JsonDoc::Load(GlobalConfig().config_file);
+  if (data.config == nullptr) {
+    AppWarn("load config failed, id:%d, %s", obj->GetId(), GetName());
+    return false;
+  }
+  data.params = JsonDoc::Parse(params);
   if (framework->Init(path, &data, params) != 0) {
     AppWarn("framework start failed, id:%d, %s", obj->GetId(), path);
     return false;
   }
+  init_queue_len = data.queue_len;
+  ApplyQueueLen();
+  if (!strcmp(GetName(), "object")) {
+    gop_cache = obj->GetGopCache();
+  }
   if (data.input.size() == 0 && strcmp(GetName(), "object") != 0) {
     AppWarn("%s input num is 0, please init correctly", GetName());
     return false;
   }
-  for (size_t j = 0; j < data.input.size(); j++) {
-    auto input = data.input[j];
-    input->running = &task->running;
+  bool connect = true;
+  if (replica != nullptr) {
+    connect = replica->ShareInput(data, &task->running, listener);
+  } else {
+    for (size_t j = 0; j < data.input.size(); j++) {
+      auto input = data.input[j];
+      input->running = &task->running;
+      input->listener = listener;
+    }
+  }
+  if (data.input.size() > 1) {
+    join = std::make_unique<JoinBuffer>(data.input.size(), GetJoinPolicy(), GetJoinWaitMs());
   }
   // connect ele input to it's previous output
-  ConnectElement();
+  if (connect) {
+    ConnectElement();
+  }
   // wait for object's element connecting to be done
   if (sync_in) {
     task->ThreadSync(GetName());
@@ -224,7 +482,21 @@ bool TaskElement::Start(bool sync_in) {
   return true;
 }
 
+void TaskElement::PrimeOutput(std::shared_ptr<PacketQueue> queue) {
+  if (gop_cache == nullptr) {
+    return;
+  }
+  size_t n = gop_cache->Prime(queue.get(), (size_t)data.queue_len.load());
+  if (n > 0) {
+    AppDebug("%s, %s, primed %lu packets, frame %d-%d", task->GetTaskName(),
+             queue->name, n, queue->primed_first, queue->primed_last);
+  }
+}
+
 bool TaskElement::Stop(void) {
+  if (gop_cache != nullptr) {
+    gop_cache->Detach(this);
+  }
   if (framework != nullptr) {
     framework->Stop();
     framework->Release();
@@ -232,67 +504,386 @@ bool TaskElement::Stop(void) {
   return 0;
 }
 
+// state of TaskThread run by executor
+enum {
+  EXEC_IDLE = 0,
+  EXEC_QUEUED,
+  EXEC_RUNNING,
+  // input arrived while running, run again
+  EXEC_RERUN,
+  EXEC_EXIT,
+};
+
+// max packets processed in one Run, to be fair to other tasks
+#define EXEC_BUDGET   16
+
 TaskThread::TaskThread(void) {
   t = nullptr;
   task = nullptr;
+  executor = nullptr;
+  // not handed over to executor yet
+  sched_state = EXEC_RUNNING;
+  exited = false;
 }
 
 TaskThread::~TaskThread(void) {
 }
 
-static int GetInput(TensorData& tensor, auto ele, auto obj) {
+JoinBuffer::JoinBuffer(size_t input_num, int _policy, int _wait_ms)
+  : policy(_policy), wait_ms(_wait_ms), matched(0), passed(0),
+    dropped(0), stale(0), lead_armed(false), slots(input_num) {
+}
+
+bool JoinBuffer::TakeDeadline(std::chrono::steady_clock::time_point* end) {
+  if (lead == nullptr || lead_armed || policy == JOIN_WAIT) {
+    return false;
+  }
+  lead_armed = true;
+  *end = lead_time + std::chrono::milliseconds(wait_ms);
+  return true;
+}
+
+int JoinBuffer::Get(TensorData& tensor, ElementData& data, bool block) {
+  while (1) {
+    int ret = Match(tensor, data, block);
+    // lead dropped, try the next one
+    if (ret != 2) {
+      return ret;
+    }
+  }
+}
+
+int JoinBuffer::Match(TensorData& tensor, ElementData& data, bool block) {
+  if (lead == nullptr) {
+    auto input = data.input[0];
+    if (block) {
+      if (!input->Pop(lead)) {
+        return -1;
+      }
+    } else if (!input->TryPop(lead)) {
+      return 1;
+    }
+    lead_time = std::chrono::steady_clock::now();
+    lead_armed = false;
+  }
+  int frame_id = lead->_params.frame_id;
+  bool ready = true;
+  bool missing = false;
+  for (size_t i = 1; i < data.input.size(); i ++) {
+    auto& slot = slots[i];
+    while (slot != nullptr || data.input[i]->TryPop(slot)) {
+      if (slot->_params.frame_id >= frame_id) {
+        break;
+      }
+      stale ++;
+      slot.reset();
+    }
+    if (slot == nullptr) {
+      ready = false;
+    } else if (slot->_params.frame_id != frame_id) {
+      // inputs come in order, the partner is lost
+      ready = false;
+      missing = true;
+    }
+  }
+  if (!ready && !missing) {
+    auto end = lead_time + std::chrono::milliseconds(wait_ms);
+    if (policy == JOIN_WAIT || std::chrono::steady_clock::now() < end) {
+      if (block) {
+        // the thread has nothing else to do, sleep on the first input
+        // without partner until the deadline
+        for (size_t i = 1; i < data.input.size(); i ++) {
+          if (slots[i] != nullptr) {
+            continue;
+          }
+          bool ret = policy == JOIN_WAIT ? data.input[i]->Pop(slots[i]) :
+                                           data.input[i]->PopUntil(slots[i], end);
+          if (!ret && data.input[i]->running != nullptr && !(*data.input[i]->running)) {
+            return -1;
+          }
+          break;
+        }
+      }
+      return 1;
+    }
+  }
+  if (!ready && policy != JOIN_PASS) {
+    dropped ++;
+    lead.reset();
+    return 2;
+  }
+  tensor._in.push_back(lead);
+  for (size_t i = 1; i < data.input.size(); i ++) {
+    auto& slot = slots[i];
+    if (slot != nullptr && slot->_params.frame_id == frame_id) {
+      tensor._in.push_back(slot);
+      slot.reset();
+    } else {
+      tensor._in.push_back(nullptr);
+    }
+  }
+  if (ready) {
+    matched ++;
+  } else {
+    passed ++;
+  }
+  lead.reset();
+  return 0;
+}
+
+ReplicaGroup::ReplicaGroup(bool _ordered)
+  : ordered(_ordered), pop_seq(0), next(0), out_seq(0) {
+}
+
+bool ReplicaGroup::ShareInput(ElementData& data, int* running,
+                              std::shared_ptr<QueueListener> listener) {
+  std::unique_lock<std::mutex> lock(mtx);
+  if (listener != nullptr) {
+    listeners.push_back(listener);
+  }
+  if (!input.empty()) {
+    data.input = input;
+    return false;
+  }
+  input = data.input;
+  for (size_t i = 0; i < input.size(); i ++) {
+    input[i]->running = running;
+    input[i]->listener = shared_from_this();
+  }
+  return true;
+}
+
+void ReplicaGroup::OnPush(void) {
+  std::unique_lock<std::mutex> lock(mtx);
+  if (listeners.empty()) {
+    return;
+  }
+  auto listener = listeners[next++ % listeners.size()].lock();
+  lock.unlock();
+  if (listener != nullptr) {
+    listener->OnPush();
+  }
+}
+
+void ReplicaGroup::Reorder(uint64_t seq, std::shared_ptr<Packet> pkt,
+                           std::function<void(std::shared_ptr<Packet>& pkt)> send) {
+  std::unique_lock<std::mutex> lock(out_mtx);
+  pending[seq] = pkt;
+  for (auto itr = pending.begin(); itr != pending.end() && itr->first == out_seq; ) {
+    if (itr->second != nullptr) {
+      send(itr->second);
+    }
+    out_seq ++;
+    itr = pending.erase(itr);
+  }
+}
+
+static int GetInput(TensorData& tensor, auto ele, auto obj, bool block) {
   if (ele->data.input.size() == 0) {
     return 0;
   }
+  if (ele->join != nullptr) {
+    auto join = ele->join.get();
+    uint64_t dropped = join->dropped;
+    int ret = join->Get(tensor, ele->data, block);
+    if (join->dropped != dropped && dropped % 200 == 0) {
+      AppWarn("id:%d, %s, join dropped:%lu, passed:%lu, matched:%lu, stale:%lu",
+              obj->GetId(), ele->GetName(), join->dropped.load(),
+              join->passed.load(), join->matched.load(), join->stale.load());
+    }
+    return ret;
+  }
   // pop highest priority input
   auto input = ele->data.input[0];
-  std::unique_lock<std::mutex> lock(input->mtx);
-  if (input->_queue.empty()) {
-    input->condition.wait(lock, [input] {
-      return !input->_queue.empty() || !(*input->running);
-    });
-    if (!(*input->running)) {
+  std::shared_ptr<Packet> pkt;
+  if (block) {
+    if (!input->Pop(pkt)) {
       return -1;
     }
+  } else if (!input->TryPop(pkt)) {
+    return 1;
   }
-  auto pkt = input->_queue.front();
-  input->_queue.pop();
-  lock.unlock();
   tensor._in.push_back(pkt);
+  return 0;
+}
 
-  // search and match other inputs
-  int frame_id = pkt->_params.frame_id;
-  for (size_t i = 1; i < ele->data.input.size(); i++) {
-    auto input = ele->data.input[i];
-    std::unique_lock<std::mutex> lock(input->mtx);
-    while (!input->_queue.empty()) {
-      auto pkt = input->_queue.front();
-      input->_queue.pop();
-      if (pkt->_params.frame_id >= frame_id) {
-        tensor._in.push_back(pkt);
+static void SendOutput(std::shared_ptr<Object> obj, TaskElement* ele,
+                       std::shared_ptr<Packet>& pkt, int frame_id, bool block) {
+  static int trace_output = TraceName("output");
+  TraceSpan span(ele->trace_name, trace_output, obj->GetId(), frame_id);
+  int queue_len = ele->data.queue_len.load(std::memory_order_relaxed);
+  // tasks subscribe to the shared element while it is running, a queue
+  // primed by Subscribe is taken with the packets it has got, sending is
+  // out of the lock, so a blocked edge does not hold up the others
+  std::unique_lock<std::mutex> lock(ele->data_mtx);
+  if (ele->gop_cache != nullptr) {
+    ele->gop_cache->Put(pkt, ele);
+  }
+  auto outputs = ele->data.output;
+  lock.unlock();
+  for (int j = 0; j < (int)outputs.size(); j ++) {
+    auto& output = outputs[j];
+    if (output == nullptr) {
+      AppWarn("id:%d,%s,%d,shared_ptr exception",
+              obj->GetId(), ele->GetName(), j);
+      continue;
+    }
+    if (!output->Send(pkt, (size_t)queue_len, block) &&
+        ele->exception_cnt++ % 200 == 0) {
+      AppWarn("id:%d,%s,output[%d],%d,%d,queue is full, policy:%d, dropped:%lu",
+              obj->GetId(), ele->GetName(), j, queue_len,
+              ele->exception_cnt.load(), output->policy, output->dropped.load());
+    }
+  }
+}
+
+// run every element once, return the number of processed packets
+int TaskThread::ProcessOnce(std::shared_ptr<Object> obj, bool block) {
+  static int trace_input = TraceName("input");
+  static int trace_process = TraceName("process");
+  int cnt = 0;
+  for (size_t i = 0; i < t_ele_vec.size(); i ++) {
+    TensorData tensor;
+    auto ele = t_ele_vec[i];
+    auto replica = ele->replica.get();
+    bool ordered = replica != nullptr && replica->ordered;
+    uint64_t seq = 0;
+    int ret, frame_id = 0;
+    if (!block && ele->Parked(shared_from_this(), executor)) {
+      continue;
+    }
+    // a finished output of the plugin is taken without input
+    int ready = ele->async_ready.load();
+    bool async = ready > 0 && ele->async_ready.compare_exchange_strong(ready, ready - 1);
+    if (async) {
+      ret = 0;
+    } else {
+      TraceSpan span(ele->trace_name, trace_input, obj->GetId());
+      if (ordered) {
+        std::unique_lock<std::mutex> lock(replica->pop_mtx);
+        ret = GetInput(tensor, ele, obj, block);
+        if (ret == 0) {
+          seq = replica->pop_seq ++;
+        }
+      } else {
+        ret = GetInput(tensor, ele, obj, block);
+      }
+      if (ret == 0 && !tensor._in.empty()) {
+        frame_id = tensor._in[0]->_params.frame_id;
+        span.SetFrame(frame_id);
+      }
+    }
+    if (ret != 0) {
+      if (ret < 0) {
         break;
       }
+      // the lead is released at its deadline, even if inputs stop
+      std::chrono::steady_clock::time_point end;
+      if (!block && ele->join != nullptr && ele->join->TakeDeadline(&end)) {
+        WakeAt(executor, shared_from_this(), end);
+      }
+      continue;
     }
-    if (tensor._in.size() != i + 1) {
-      AppWarn("id:%d, %s, i:%ld, match frameid %d failed, "
-              "please check if the slower input connect to input[0]",
-              obj->GetId(), ele->GetName(), i, frame_id);
-      return 1;
+    tensor.tensor_buf.output_num = ele->OutputNum();
+    tensor.wake = ordered ? nullptr : ele->wake;
+    auto start = std::chrono::steady_clock::now();
+    ret = ele->framework->Process(&tensor);
+    auto end = std::chrono::steady_clock::now();
+    int64_t start_usec = std::chrono::duration_cast<std::chrono::microseconds>(start.time_since_epoch()).count();
+    int64_t end_usec = std::chrono::duration_cast<std::chrono::microseconds>(end.time_since_epoch()).count();
+    ele->process_usec.Observe(end_usec - start_usec);
+    if (TraceEnabled()) {
+      TraceRecord(ele->trace_name, trace_process, start_usec, end_usec, obj->GetId(), frame_id);
+    }
+    ele->frames_in.Add(tensor._in.size());
+    if (tensor._out != nullptr) {
+      ele->frames_out.Add();
+    }
+    ele->UpdateFps(end, tensor._out != nullptr);
+    ele->UpdateLatency(tensor, end_usec);
+    if (async && tensor._out != nullptr) {
+      frame_id = tensor._out->_params.frame_id;
+    }
+    if (ordered) {
+      // every popped seq has to be given back, or the later ones wait forever
+      auto _ele = ele.get();
+      replica->Reorder(seq, ret == 0 ? tensor._out : nullptr,
+                       [obj, _ele, block](std::shared_ptr<Packet>& pkt) {
+        SendOutput(obj, _ele, pkt, pkt->_params.frame_id, block);
+      });
+    }
+    if (ret != 0) {
+      break;
+    }
+    cnt ++;
+    if (!ordered && tensor._out != nullptr) {
+      // replicas send to the same queues
+      std::unique_lock<std::mutex> lock;
+      if (replica != nullptr) {
+        lock = std::unique_lock<std::mutex>(replica->send_mtx);
+      }
+      SendOutput(obj, ele.get(), tensor._out, frame_id, block);
+    }
+    if (ele->data.sleep_usec) {
+      // Note: if t_ele_vec.size() > 1, please set sleep_usec correctly
+      usleep(ele->data.sleep_usec);
     }
   }
-  return 0;
+  return cnt;
+}
+
+void TaskThread::ThreadExit(std::shared_ptr<Object> obj) {
+  for (size_t i = 0; i < t_ele_vec.size(); i ++) {
+    auto ele = t_ele_vec[i];
+    std::unique_lock<std::mutex> lock(ele->data_mtx);
+    for (size_t j = 0; j < ele->data.output.size(); j ++) {
+      auto output = ele->data.output[j];
+      output->Clear();
+      /* when stoping task by restful api, in order to return quickly,
+       * sync is false, and tt->stop will not be invoked,
+       * so it should notify next module here */
+      output->Notify();
+    }
+    lock.unlock();
+    ele->Stop();
+  }
+  AppDebug("id:%d, %s, run ok", obj != nullptr ? obj->GetId() : -1,
+           t_ele_vec[0]->GetName());
+  std::unique_lock<std::mutex> lock(exit_mtx);
+  exited = true;
+  exit_cond.notify_all();
+}
+
+// entry element blocks in plugin to get data, and sleep_usec
+// means the element wants to be paced, both keep their own thread
+bool TaskThread::ExecEnable(void) {
+  if (executor == nullptr) {
+    return false;
+  }
+  for (size_t i = 0; i < t_ele_vec.size(); i ++) {
+    auto ele = t_ele_vec[i];
+    if (ele->data.input.size() == 0 || ele->data.sleep_usec) {
+      return false;
+    }
+  }
+  return true;
 }
 
 void TaskThread::ThreadFunc(void) {
   auto obj = task->GetTaskObj();
   assert(obj != nullptr);
   MediaServer* media = obj->media;
+  executor = media->GetSlave()->GetExecutor();
+  std::shared_ptr<QueueListener> listener = nullptr;
+  if (executor != nullptr) {
+    listener = shared_from_this();
+  }
 
   const char* name = "null";
   bool sync_in = t_ele_vec.size() == 1;
   for (size_t i = 0; i < t_ele_vec.size(); i ++) {
     auto ele = t_ele_vec[i];
-    if (!ele->Start(sync_in)) {
+    if (!ele->Start(sync_in, listener)) {
       task->running = 0;
       break;
     }
@@ -301,64 +892,86 @@ void TaskThread::ThreadFunc(void) {
   if (!sync_in) {
     task->ThreadSync(name);
   }
+  // consumers are connected, start them from the last key frame
+  for (size_t i = 0; i < t_ele_vec.size(); i ++) {
+    auto ele = t_ele_vec[i];
+    std::unique_lock<std::mutex> lock(ele->data_mtx);
+    for (size_t j = 0; j < ele->data.output.size(); j ++) {
+      ele->PrimeOutput(ele->data.output[j]);
+    }
+  }
 
-  while (task->running && media->running) {
+  if (ExecEnable() && task->running && media->running) {
+    // outputs finished by plugins run this unit again
+    std::weak_ptr<TaskThread> unit = shared_from_this();
     for (size_t i = 0; i < t_ele_vec.size(); i ++) {
-      TensorData tensor;
-      auto ele = t_ele_vec[i];
-      int ret = GetInput(tensor, ele, obj);
-      if (ret != 0) {
-        if (ret < 0) {
-          break;
+      auto _ele = t_ele_vec[i].get();
+      _ele->wake = [unit, _ele] {
+        auto _unit = unit.lock();
+        if (_unit != nullptr) {
+          _ele->async_ready ++;
+          _unit->OnPush();
         }
-        continue;
-      }
-      tensor.tensor_buf.output_num = ele->data.output.size();
-      if (ele->framework->Process(&tensor) != 0) {
-        break;
-      }
-      for (int j = 0; j < tensor.tensor_buf.output_num && 
-           tensor._out != nullptr; j ++) {
-        auto output = ele->data.output[j];
-        if (output == nullptr) {
-          AppWarn("id:%d,%s,%d,shared_ptr exception",
-                  obj->GetId(), ele->GetName(), j);
-          continue;
-        }
-        std::unique_lock<std::mutex> lock(output->mtx);
-        if (output->_queue.size() >= (size_t)ele->data.queue_len) {
-          output->_queue.pop();
-          if (ele->exception_cnt++ % 200 == 0) {
-            printf("warning,id:%d,%s,output[%d],%d,%d,queue is full\n",
-                   obj->GetId(), ele->GetName(), j,
-                   ele->data.queue_len, ele->exception_cnt);
-          }
-        }
-        output->_queue.push(tensor._out);
-        output->condition.notify_one();
-      }
-      if (ele->data.sleep_usec) {
-        // Note: if t_ele_vec.size() > 1, please set sleep_usec correctly
-        usleep(ele->data.sleep_usec);
-      }
+      };
     }
+    // elements are started, hand over to executor and release the thread
+    sched_state.store(EXEC_QUEUED);
+    executor->Submit(shared_from_this());
+    return;
+  }
+  while (task->running && media->running) {
+    ProcessOnce(obj, true);
     task->BeatAlive(media);
   }
+  ThreadExit(obj);
+}
 
-  for (size_t i = 0; i < t_ele_vec.size(); i ++) {
-    auto ele = t_ele_vec[i];
-    for (size_t j = 0; j < ele->data.output.size(); j ++) {
-      auto output = ele->data.output[j];
-      std::unique_lock<std::mutex> lock(output->mtx);
-      while (!output->_queue.empty()) output->_queue.pop();
-      /* when stoping task by restful api, in order to return quickly,
-       * sync is false, and tt->stop will not be invoked,
-       * so it should notify next module here */
-      output->condition.notify_all();
+void TaskThread::Run(void) {
+  sched_state.store(EXEC_RUNNING);
+  auto obj = task->GetTaskObj();
+  MediaServer* media = executor->media;
+  int cnt = 0;
+  while (obj != nullptr && task->running && media->running &&
+         cnt < EXEC_BUDGET) {
+    int ret = ProcessOnce(obj, false);
+    if (ret <= 0) {
+      break;
+    }
+    cnt += ret;
+  }
+  if (obj == nullptr || !task->running || !media->running) {
+    sched_state.store(EXEC_EXIT);
+    ThreadExit(obj);
+    return;
+  }
+  if (cnt > 0) {
+    task->BeatAlive(media);
+  }
+  int state = EXEC_RUNNING;
+  if (cnt >= EXEC_BUDGET ||
+      !sched_state.compare_exchange_strong(state, EXEC_IDLE)) {
+    // more input is waiting
+    sched_state.store(EXEC_QUEUED);
+    executor->Submit(shared_from_this());
+  }
+}
+
+void TaskThread::OnPush(void) {
+  int state = sched_state.load();
+  for (;;) {
+    if (state == EXEC_IDLE) {
+      if (sched_state.compare_exchange_weak(state, EXEC_QUEUED)) {
+        executor->Submit(shared_from_this());
+        return;
+      }
+    } else if (state == EXEC_RUNNING) {
+      if (sched_state.compare_exchange_weak(state, EXEC_RERUN)) {
+        return;
+      }
+    } else {
+      return;
     }
-    ele->Stop();
   }
-  AppDebug("id:%d, %s, run ok", obj->GetId(), t_ele_vec[0]->GetName());
 }
 
 void TaskThread::Start(std::shared_ptr<TaskParams> _task) {
@@ -369,19 +982,25 @@ void TaskThread::Start(std::shared_ptr<TaskParams> _task) {
 void TaskThread::Stop(bool sync) {
   for (size_t i = 0; i < t_ele_vec.size(); i ++) {
     auto ele = t_ele_vec[i];
+    std::unique_lock<std::mutex> lock(ele->data_mtx);
     for (size_t j = 0; j < ele->data.output.size(); j ++) {
       auto output = ele->data.output[j];
-      std::unique_lock<std::mutex> lock(output->mtx);
-      output->condition.notify_all();
+      output->Notify();
     }
+    lock.unlock();
     ele->framework->Notify();
   }
+  // wake up the idle one in executor, to release elements
+  OnPush();
   if (sync && t != nullptr) {
     if (t->joinable()) {
       t->join();
     }
     delete t;
     t = nullptr;
+    std::unique_lock<std::mutex> lock(exit_mtx);
+    exit_cond.wait(lock, [this] {
+      return exited;
+    });
   }
 }
-
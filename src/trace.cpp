@@ -0,0 +1,220 @@
+/****************************************************************************************
+ * Copyright (C) 2021 aistream <aistream@yeah.net>
+ *
+ * Licensed under the BSD 3-Clause License (the "License"); you may not use this
+ * file except in compliance with the License. You may obtain a copy of the License at
+ *
+ * https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Unless required by applicable law or agreed to in writing, software distributed
+ * under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+ * CONDITIONS OF ANY KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations under the License.
+ *
+ ***************************************************************************************/
+
+#include <sys/syscall.h>
+#include <mutex>
+#include <vector>
+#include <unordered_map>
+#include "trace.h"
+#include "log.h"
+
+// one slot is written by the owner thread only, readers check seq
+// before and after copying, odd seq means writing
+typedef struct {
+  std::atomic<uint64_t> seq;
+  std::atomic<int> name;
+  std::atomic<int> cat;
+  std::atomic<int> id;
+  std::atomic<int> frame_id;
+  std::atomic<int> tid;
+  std::atomic<int64_t> start;
+  std::atomic<int64_t> end;
+} TraceSlot;
+
+// rings of exited threads are reused by new threads, never freed
+typedef struct {
+  std::atomic<bool> used;
+  int tid;
+  std::atomic<uint64_t> pos;
+  size_t size;
+  TraceSlot* slots;
+} TraceRing;
+
+typedef struct {
+  int name;
+  int cat;
+  int id;
+  int frame_id;
+  int tid;
+  int64_t start;
+  int64_t end;
+} TraceEvent;
+
+std::atomic<bool> trace_enable(false);
+static size_t trace_ring_size = TRACE_RING_SIZE;
+static std::mutex trace_mtx;
+static std::vector<TraceRing*> trace_rings;
+static std::vector<std::string> trace_names;
+static std::unordered_map<std::string, int> trace_name_map;
+
+class TraceHolder {
+ public:
+  ~TraceHolder(void) {
+    if (ring != nullptr) {
+      ring->used.store(false, std::memory_order_release);
+    }
+  }
+  TraceRing* ring = nullptr;
+};
+
+static thread_local TraceHolder trace_holder;
+
+void TraceInit(TraceConfig* config) {
+  size_t size = config->ring_size > 0 ? config->ring_size : TRACE_RING_SIZE;
+  trace_ring_size = 1;
+  while (trace_ring_size < size) trace_ring_size <<= 1;
+  trace_enable = config->enable;
+  AppDebug("trace enable:%d, ring size:%lu", config->enable, trace_ring_size);
+}
+
+int TraceName(const char* name) {
+  std::unique_lock<std::mutex> lock(trace_mtx);
+  auto itr = trace_name_map.find(name);
+  if (itr != trace_name_map.end()) {
+    return itr->second;
+  }
+  int idx = (int)trace_names.size();
+  trace_names.push_back(name);
+  trace_name_map[name] = idx;
+  return idx;
+}
+
+static TraceRing* GetRing(void) {
+  TraceRing* ring = trace_holder.ring;
+  if (ring != nullptr) {
+    return ring;
+  }
+  std::unique_lock<std::mutex> lock(trace_mtx);
+  for (size_t i = 0; i < trace_rings.size() && ring == nullptr; i ++) {
+    bool used = false;
+    if (trace_rings[i]->used.compare_exchange_strong(used, true)) {
+      ring = trace_rings[i];
+    }
+  }
+  if (ring == nullptr) {
+    ring = new TraceRing();
+    ring->size = trace_ring_size;
+    ring->slots = new TraceSlot[ring->size]();
+    ring->used = true;
+    ring->pos = 0;
+    trace_rings.push_back(ring);
+  }
+  ring->tid = (int)syscall(SYS_gettid);
+  trace_holder.ring = ring;
+  return ring;
+}
+
+void TraceRecord(int name, int cat, int64_t start_usec, int64_t end_usec, int id, int frame_id) {
+  TraceRing* ring = GetRing();
+  uint64_t pos = ring->pos.load(std::memory_order_relaxed);
+  TraceSlot* slot = ring->slots + (pos & (ring->size - 1));
+  uint64_t seq = slot->seq.load(std::memory_order_relaxed);
+  slot->seq.store(seq + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  slot->name.store(name, std::memory_order_relaxed);
+  slot->cat.store(cat, std::memory_order_relaxed);
+  slot->id.store(id, std::memory_order_relaxed);
+  slot->frame_id.store(frame_id, std::memory_order_relaxed);
+  slot->tid.store(ring->tid, std::memory_order_relaxed);
+  slot->start.store(start_usec, std::memory_order_relaxed);
+  slot->end.store(end_usec, std::memory_order_relaxed);
+  slot->seq.store(seq + 2, std::memory_order_release);
+  ring->pos.store(pos + 1, std::memory_order_release);
+}
+
+static bool ReadSlot(TraceSlot* slot, TraceEvent* event) {
+  uint64_t seq = slot->seq.load(std::memory_order_acquire);
+  if (seq == 0 || (seq & 1)) {
+    return false;
+  }
+  event->name = slot->name.load(std::memory_order_relaxed);
+  event->cat = slot->cat.load(std::memory_order_relaxed);
+  event->id = slot->id.load(std::memory_order_relaxed);
+  event->frame_id = slot->frame_id.load(std::memory_order_relaxed);
+  event->tid = slot->tid.load(std::memory_order_relaxed);
+  event->start = slot->start.load(std::memory_order_relaxed);
+  event->end = slot->end.load(std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_acquire);
+  return slot->seq.load(std::memory_order_relaxed) == seq;
+}
+
+static void AppendJsonStr(std::string& out, const std::string& str) {
+  out += '"';
+  for (size_t i = 0; i < str.size(); i ++) {
+    char c = str[i];
+    if (c == '"' || c == '\\') {
+      out += '\\';
+      out += c;
+    } else if ((unsigned char)c >= 0x20) {
+      out += c;
+    }
+  }
+  out += '"';
+}
+
+std::string TraceDump(int sec) {
+  std::vector<TraceEvent> events;
+  int64_t since = sec > 0 ? GetMonotonicUsec() - (int64_t)sec*1000000 : 0;
+  std::unique_lock<std::mutex> lock(trace_mtx);
+  for (size_t i = 0; i < trace_rings.size(); i ++) {
+    TraceRing* ring = trace_rings[i];
+    for (size_t j = 0; j < ring->size; j ++) {
+      TraceEvent event;
+      if (ReadSlot(ring->slots + j, &event) && event.end >= since) {
+        events.push_back(event);
+      }
+    }
+  }
+  auto names = trace_names;
+  lock.unlock();
+
+  char buf[256];
+  int pid = getpid();
+  std::string out = "{\"traceEvents\":[";
+  for (size_t i = 0; i < events.size(); i ++) {
+    TraceEvent& event = events[i];
+    if (event.name >= (int)names.size() || event.cat >= (int)names.size()) {
+      continue;
+    }
+    out += i > 0 ? ",\n{\"name\":" : "\n{\"name\":";
+    AppendJsonStr(out, names[event.name]);
+    out += ",\"cat\":";
+    AppendJsonStr(out, names[event.cat]);
+    snprintf(buf, sizeof(buf), ",\"ph\":\"X\",\"ts\":%ld,\"dur\":%ld,\"pid\":%d,\"tid\":%d,"
+             "\"args\":{\"id\":%d,\"frame_id\":%d}}", event.start, event.end - event.start,
+             pid, event.tid, event.id, event.frame_id);
+    out += buf;
+  }
+  out += "\n]}\n";
+  return out;
+}
+
+int TraceDumpFile(const char* reason, char* path, size_t len) {
+  struct tm _time;
+  time_t now = time(NULL);
+  localtime_r(&now, &_time);
+  snprintf(path, len, "%s/trace_%s_%d%02d%02d%02d%02d%02d.json", TRACE_DUMP_DIR, reason,
+           _time.tm_year + 1900, _time.tm_mon + 1, _time.tm_mday,
+           _time.tm_hour, _time.tm_min, _time.tm_sec);
+  std::string text = TraceDump(0);
+  FILE* fp = fopen(path, "w");
+  if (fp == NULL) {
+    AppWarn("open %s failed", path);
+    return -1;
+  }
+  fwrite(text.c_str(), 1, text.size(), fp);
+  fclose(fp);
+  return 0;
+}
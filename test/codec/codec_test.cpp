@@ -0,0 +1,400 @@
+/****************************************************************************************
+ * Copyright (C) 2021 aistream <aistream@yeah.net>
+ *
+ * Licensed under the BSD 3-Clause License (the "License"); you may not use this
+ * file except in compliance with the License. You may obtain a copy of the License at
+ *
+ * https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Unless required by applicable law or agreed to in writing, software distributed
+ * under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+ * CONDITIONS OF ANY KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations under the License.
+ *
+ ***************************************************************************************/
+
+// Test of the cpu decoders with the h264 and h265 samples made by
+// test/script/codec_samples.sh: key nal units as the ingest flags them,
+// rgb and yuv output, and the decoder rebuilt when the codec changes.
+// The plugins are loaded as aistream does, the symbols they take from
+// aistream are given here and exported with -rdynamic.
+//
+// usage: codec_test libcpurgbdec.so libcpuyuvdec.so sample_dir
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dlfcn.h>
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "tensor.h"
+#include "share.h"
+#include "governor.h"
+#include "pipeline.h"
+#include "jsondoc.h"
+#include "trace.h"
+#include "bufpool.h"
+#include "dylib.h"
+#include "log.h"
+
+// ctest takes it as skipped, the samples are not made without ffmpeg
+#define TEST_SKIPPED 77
+
+// testsrc of codec_samples.sh, the sizes differ to tell the rebuilt decoder
+#define H264_WIDTH 320
+#define H264_HEIGHT 240
+#define H265_WIDTH 352
+#define H265_HEIGHT 288
+
+static int verbose = 0;
+
+void LogWrite(LogSite* site, int level, const char* file, int line,
+              const char* func, const char* format, ...) {
+  if (!verbose) {
+    return;
+  }
+  va_list args;
+  va_start(args, format);
+  fprintf(stderr, "[%s:%d] ", file, line);
+  vfprintf(stderr, format, args);
+  fprintf(stderr, "\n");
+  va_end(args);
+}
+
+ShareParams GlobalConfig(ShareParams* params) {
+  ShareParams share_params;
+  memset(&share_params, 0, sizeof(share_params));
+  return share_params;
+}
+
+std::unique_ptr<char[]> ReadFile2Buf(const char* filename) {
+  return nullptr;
+}
+
+// every frame is decoded and output
+int GetIntValFromFile(const char* filename, const char* name1, const char* name2, const char* name3) {
+  if (name2 != NULL && !strcmp(name2, "rgb_skip")) {
+    return 1;
+  }
+  if (name2 != NULL && !strcmp(name2, "analysis_fps")) {
+    return 0;
+  }
+  return -1;
+}
+
+int GetIntValFromJson(char* buf, const char* name1, const char* name2, const char* name3) {
+  return -1;
+}
+
+uint64_t ConfigGeneration(void) {
+  return 0;
+}
+
+// the governor is disabled
+StreamRate* GovernorRegister(int id, int max_fps, int priority) {
+  return nullptr;
+}
+
+void GovernorUnregister(StreamRate* rate) {
+}
+
+void GovernorSetMax(StreamRate* rate, int max_fps) {
+}
+
+std::atomic<bool> trace_enable(false);
+
+int TraceName(const char* name) {
+  return 0;
+}
+
+void TraceRecord(int name, int cat, int64_t start_usec, int64_t end_usec, int id, int frame_id) {
+}
+
+// nal units of annex-b, each with 4 bytes start code as the rtsp ingest gives them
+static std::vector<std::string> SplitNal(const std::string& data) {
+  std::vector<std::string> nals;
+  size_t begin = std::string::npos;
+  size_t i = 0;
+  while (i + 3 <= data.size()) {
+    if (data[i] != 0 || data[i + 1] != 0 || data[i + 2] != 1) {
+      i ++;
+      continue;
+    }
+    if (begin != std::string::npos) {
+      // zeros before the start code belong to it
+      size_t end = i;
+      while (end > begin && data[end - 1] == 0) {
+        end --;
+      }
+      nals.push_back(std::string("\x00\x00\x00\x01", 4) + data.substr(begin, end - begin));
+    }
+    i += 3;
+    begin = i;
+  }
+  if (begin != std::string::npos && begin < data.size()) {
+    nals.push_back(std::string("\x00\x00\x00\x01", 4) + data.substr(begin));
+  }
+  return nals;
+}
+
+static bool VideoNalSlice(int codec, int type) {
+  return codec == VIDEO_CODEC_H265 ? type < 32 : type >= 1 && type <= 5;
+}
+
+// access units as the flv ingest gives them, the samples have one slice per frame
+static std::vector<std::string> JoinNal(int codec, const std::vector<std::string>& nals) {
+  std::vector<std::string> units;
+  std::string unit;
+  for (auto& nal : nals) {
+    unit += nal;
+    if (VideoNalSlice(codec, VideoNalType(codec, nal.data()))) {
+      units.push_back(unit);
+      unit.clear();
+    }
+  }
+  return units;
+}
+
+static int ReadSample(const std::string& path, std::string* data) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file) {
+    return -1;
+  }
+  std::stringstream ss;
+  ss << file.rdbuf();
+  *data = ss.str();
+  return data->empty() ? -1 : 0;
+}
+
+// the key types of the specs, h264 table 7-1 and h265 table 7-1
+static int CheckKeyTypes(void) {
+  static const int h264_keys[] = {5, 7, 8};
+  static const int h265_keys[] = {16, 17, 18, 19, 20, 21, 32, 33, 34};
+  int failed = 0;
+  for (int type = 0; type < 32; type ++) {
+    bool key = std::find(std::begin(h264_keys), std::end(h264_keys), type) != std::end(h264_keys);
+    if (VideoNalKey(VIDEO_CODEC_H264, type) != key) {
+      printf("h264: nal type %d, key %d, %d expected\n", type, !key, key);
+      failed ++;
+    }
+  }
+  for (int type = 0; type < 64; type ++) {
+    bool key = std::find(std::begin(h265_keys), std::end(h265_keys), type) != std::end(h265_keys);
+    if (VideoNalKey(VIDEO_CODEC_H265, type) != key) {
+      printf("h265: nal type %d, key %d, %d expected\n", type, !key, key);
+      failed ++;
+    }
+    // leading and trailing pictures refer to others, irap does not
+    bool delta = type <= 9;
+    if (VideoNalDelta(VIDEO_CODEC_H265, type) != delta) {
+      printf("h265: nal type %d, delta %d, %d expected\n", type, !delta, delta);
+      failed ++;
+    }
+  }
+  printf("key types: %s\n", failed ? "FAILED" : "ok");
+  return failed ? 1 : 0;
+}
+
+// the samples repeat parameter sets at every key frame, h265 has cra of open gop
+static int CheckSampleKeys(const char* name, int codec, const std::vector<std::string>& nals) {
+  int count[64] = {0};
+  int keys = 0;
+  for (auto& nal : nals) {
+    int type = VideoNalType(codec, nal.data());
+    count[type] ++;
+    keys += VideoNalKey(codec, type);
+  }
+  int failed = 0;
+  if (codec == VIDEO_CODEC_H265) {
+    int params = std::min(count[32], std::min(count[33], count[34]));
+    if (params < 2 || count[19] + count[20] < 1 || count[21] < 1) {
+      printf("%s: vps %d, sps %d, pps %d, idr %d, cra %d\n", name, count[32], count[33], count[34],
+             count[19] + count[20], count[21]);
+      failed ++;
+    }
+  } else if (std::min(count[7], count[8]) < 2 || count[5] < 2) {
+    printf("%s: sps %d, pps %d, idr %d\n", name, count[7], count[8], count[5]);
+    failed ++;
+  }
+  printf("%s: %zu nal, %d key, %s\n", name, nals.size(), keys, failed ? "FAILED" : "ok");
+  return failed ? 1 : 0;
+}
+
+class TestPlugin {
+ public:
+  TestPlugin(void) : lib(NULL), init(NULL), start(NULL), process(NULL), stop(NULL), release(NULL) {
+  }
+  int Load(const char* path) {
+    lib = dlopen(path, RTLD_LAZY);
+    if (lib == NULL) {
+      printf("dlopen %s failed, %s\n", path, dlerror());
+      return -1;
+    }
+    DLReg reg = (DLReg)dlsym(lib, "DylibRegister");
+    DLRegister* r = NULL;
+    int size = 0;
+    if (reg == NULL || reg(&r, size) != 0 || r == NULL) {
+      printf("%s is not a plugin\n", path);
+      return -1;
+    }
+    init = (DLInit)dlsym(lib, r->init);
+    start = (DLStart)dlsym(lib, r->start);
+    process = (DLProcess)dlsym(lib, r->process);
+    stop = (DLStop)dlsym(lib, r->stop);
+    release = (DLRelease)dlsym(lib, r->release);
+    free(r);
+    if (init == NULL || start == NULL || process == NULL || stop == NULL || release == NULL) {
+      printf("%s, symbols not found\n", path);
+      return -1;
+    }
+    data.config = JsonDoc::Parse("{\"video\":{\"rgb_queue_len\":10}}");
+    return init(&data, NULL);
+  }
+  // the plugins keep references to the data, the library is not closed
+  void* lib;
+  DLInit init;
+  DLStart start;
+  DLProcess process;
+  DLStop stop;
+  DLRelease release;
+  ElementData data;
+};
+
+static bool Varies(const char* buf, size_t size) {
+  for (size_t i = 1; i < size; i ++) {
+    if (buf[i] != buf[0]) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// feed the packets to a started decoder, returns the frames output at the size
+static int Decode(TestPlugin* plugin, IHandle handle, bool rgb, int codec,
+                  const std::vector<std::string>& packets, int width, int height, int* frame_id) {
+  int frames = 0;
+  for (auto& data : packets) {
+    // flags of the ingest
+    HeadParams params = {0};
+    int type = VideoNalType(codec, data.data());
+    params.codec = codec;
+    params.type = !VideoNalDelta(codec, type);
+    params.key_frame = VideoNalKey(codec, type);
+    params.frame_id = ++(*frame_id);
+    std::unique_ptr<Packet> pkt(new Packet((void* )data.data(), data.size(), &params));
+    TensorData tensor;
+    tensor.tensor_buf.input_num = 1;
+    tensor.tensor_buf.output_num = 1;
+    tensor.tensor_buf.input[0] = pkt.get();
+    if (plugin->process(handle, &tensor) != 0) {
+      printf("process failed, frame %d\n", params.frame_id);
+      continue;
+    }
+    std::unique_ptr<Packet> out(tensor.tensor_buf.output);
+    if (out == nullptr) {
+      continue;
+    }
+    // rgb in data, planar yuv420p in params.ptr
+    const char* pixels = rgb ? out->_data : out->_params.ptr;
+    size_t size = rgb ? out->_size : (size_t)out->_params.ptr_size;
+    size_t expected = rgb ? width * height * 3 : width * height * 3 / 2;
+    if (out->_params.width != width || out->_params.height != height || size != expected ||
+        pixels == nullptr || !Varies(pixels, width * height)) {
+      printf("frame %d, %dx%d, size %zu, %dx%d expected\n", params.frame_id,
+             out->_params.width, out->_params.height, size, width, height);
+      continue;
+    }
+    frames ++;
+  }
+  return frames;
+}
+
+typedef struct {
+  const char* name;
+  int codec;
+  std::vector<std::string> nals;
+  int width;
+  int height;
+} TestSample;
+
+static int RunDecoder(const char* name, const char* path, bool rgb, TestSample* h264, TestSample* h265) {
+  TestPlugin plugin;
+  if (plugin.Load(path) != 0) {
+    printf("%s: FAILED\n", name);
+    return 1;
+  }
+  IHandle handle = plugin.start(1, NULL);
+  if (handle == NULL) {
+    printf("%s: start failed\n", name);
+    return 1;
+  }
+  // nal units of rtsp, then access units of flv, the codec switches between
+  // them and the decoder is rebuilt at the first key frame of the new one
+  struct {
+    TestSample* sample;
+    bool unit;
+  } steps[] = {{h264, false}, {h265, true}, {h265, false}, {h264, true}};
+  int frame_id = 0;
+  int failed = 0;
+  for (auto& step : steps) {
+    TestSample* sample = step.sample;
+    auto packets = step.unit ? JoinNal(sample->codec, sample->nals) : sample->nals;
+    int slices = 0;
+    for (auto& nal : sample->nals) {
+      slices += VideoNalSlice(sample->codec, VideoNalType(sample->codec, nal.data()));
+    }
+    int frames = Decode(&plugin, handle, rgb, sample->codec, packets,
+                        sample->width, sample->height, &frame_id);
+    // the frames before the first key frame and the ones left in the
+    // decoder are not output
+    bool ok = frames >= slices / 2;
+    printf("%s: %s of %s, %d frames of %d\n", name, sample->name, step.unit ? "flv" : "rtsp",
+           frames, slices);
+    failed += ok ? 0 : 1;
+  }
+  plugin.stop(handle);
+  plugin.release();
+  printf("%s: %s\n", name, failed ? "FAILED" : "ok");
+  return failed ? 1 : 0;
+}
+
+int main(int argc, char** argv) {
+  int arg = 1;
+  if (argc > 1 && !strcmp(argv[1], "-v")) {
+    verbose = 1;
+    arg ++;
+  }
+  if (argc - arg < 3) {
+    printf("usage: %s [-v] libcpurgbdec.so libcpuyuvdec.so sample_dir\n", argv[0]);
+    return 1;
+  }
+  std::string dir = argv[arg + 2];
+  TestSample h264 = {"h264", VIDEO_CODEC_H264, {}, H264_WIDTH, H264_HEIGHT};
+  TestSample h265 = {"h265", VIDEO_CODEC_H265, {}, H265_WIDTH, H265_HEIGHT};
+  std::string data;
+  if (ReadSample(dir + "/test.264", &data) != 0) {
+    printf("%s/test.264 not found, made by codec_samples.sh with ffmpeg\n", dir.c_str());
+    return TEST_SKIPPED;
+  }
+  h264.nals = SplitNal(data);
+  if (ReadSample(dir + "/test.265", &data) != 0) {
+    printf("%s/test.265 not found, made by codec_samples.sh with ffmpeg\n", dir.c_str());
+    return TEST_SKIPPED;
+  }
+  h265.nals = SplitNal(data);
+  BufferPoolInit(64 << 20);
+  int failed = 0;
+  failed += CheckKeyTypes();
+  failed += CheckSampleKeys(h264.name, h264.codec, h264.nals);
+  failed += CheckSampleKeys(h265.name, h265.codec, h265.nals);
+  failed += RunDecoder("rgb decoder", argv[arg], true, &h264, &h265);
+  failed += RunDecoder("yuv decoder", argv[arg + 1], false, &h264, &h265);
+  return failed ? 1 : 0;
+}
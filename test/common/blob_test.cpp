@@ -0,0 +1,127 @@
+/****************************************************************************************
+ * Copyright (C) 2021 aistream <aistream@yeah.net>
+ *
+ * Licensed under the BSD 3-Clause License (the "License"); you may not use this
+ * file except in compliance with the License. You may obtain a copy of the License at
+ *
+ * https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Unless required by applicable law or agreed to in writing, software distributed
+ * under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+ * CONDITIONS OF ANY KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations under the License.
+ *
+ ***************************************************************************************/
+
+// Test of ConvertYUV2Blob: the blob of yuv420p and nv12 frames is compared
+// with cv::resize INTER_AREA of the rgb frame, in scales of whole boxes,
+// fractional boxes and no resize, with letterbox padding and normalization
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <vector>
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+extern "C" {
+#include <libavutil/pixfmt.h>
+}
+#include "tensor.h"
+#include "common.h"
+
+// pixel values, rounding of the sums may differ from opencv
+#define BLOB_TOLERANCE 1.0f
+
+typedef struct {
+  int width;
+  int height;
+  int resize_w;
+  int resize_h;
+  int blob_w;
+  int blob_h;
+  bool nv12;
+} BlobCase;
+
+// smooth gradient with noise, so every box averages different pixels
+static void MakeFrame(std::vector<unsigned char>& yuv, int w, int h) {
+  yuv.resize((size_t)w*h*3/2);
+  srand(w*h);
+  for (int y = 0; y < h; y ++) {
+    for (int x = 0; x < w; x ++) {
+      yuv[(size_t)y*w + x] = (x*7 + y*3 + rand()%40) & 0xff;
+    }
+  }
+  for (size_t i = (size_t)w*h; i < yuv.size(); i ++) {
+    yuv[i] = 64 + rand()%128;
+  }
+}
+
+static int RunCase(const BlobCase& t) {
+  int w = t.width;
+  int h = t.height;
+  std::vector<unsigned char> yuv;
+  MakeFrame(yuv, w, h);
+  unsigned char* y = yuv.data();
+  unsigned char* u = y + w*h;
+  unsigned char* v = t.nv12 ? NULL : u + w*h/4;
+  int format = t.nv12 ? AV_PIX_FMT_NV12 : AV_PIX_FMT_YUV420P;
+  cv::Mat rgb(h, w, CV_8UC3);
+  ConvertYUV2RGB(y, u, v, rgb.data, w, h, format);
+  cv::Mat resized;
+  cv::resize(rgb, resized, cv::Size(t.resize_w, t.resize_h), 0, 0, cv::INTER_AREA);
+
+  BlobParams bp;
+  bp.width = t.blob_w;
+  bp.height = t.blob_h;
+  bp.resize_w = t.resize_w;
+  bp.resize_h = t.resize_h;
+  float mean[3] = {104, 117, 123};
+  for (int c = 0; c < 3; c ++) {
+    bp.mean[c] = mean[c];
+    bp.scale[c] = 1/58.0f;
+  }
+  bp.bgr = true;
+  std::vector<float> blob((size_t)3*t.blob_w*t.blob_h);
+  if (ConvertYUV2Blob(y, u, v, w, h, format, &bp, blob.data()) != 0) {
+    printf("%dx%d -> %dx%d: convert failed\n", w, h, t.resize_w, t.resize_h);
+    return 1;
+  }
+  size_t plane = (size_t)t.blob_w*t.blob_h;
+  float worst = 0;
+  for (int c = 0; c < 3; c ++) {
+    // blob is b,g,r
+    float* p = blob.data() + (2 - c)*plane;
+    for (int j = 0; j < t.blob_h; j ++) {
+      for (int i = 0; i < t.blob_w; i ++) {
+        float want = 0;
+        if (i < t.resize_w && j < t.resize_h) {
+          want = resized.at<cv::Vec3b>(j, i)[c];
+        }
+        float got = p[(size_t)j*t.blob_w + i]/bp.scale[c] + bp.mean[c];
+        worst = std::max(worst, fabsf(got - want));
+      }
+    }
+  }
+  bool ok = worst <= BLOB_TOLERANCE + 1e-3f;
+  printf("%dx%d %s -> %dx%d in %dx%d: max diff %.3f, %s\n", w, h, t.nv12 ? "nv12" : "yuv420p",
+         t.resize_w, t.resize_h, t.blob_w, t.blob_h, worst, ok ? "ok" : "FAILED");
+  return ok ? 0 : 1;
+}
+
+int main(int argc, char** argv) {
+  RGBInit();
+  BlobCase cases[] = {
+    {640, 480, 320, 240, 320, 320, false},
+    {1920, 1080, 640, 360, 640, 640, true},
+    {640, 480, 300, 225, 320, 320, true},
+    {352, 288, 160, 131, 160, 160, false},
+    {100, 60, 37, 23, 40, 40, false},
+    {320, 240, 320, 240, 320, 320, true},
+  };
+  int failed = 0;
+  for (size_t i = 0; i < sizeof(cases)/sizeof(cases[0]); i ++) {
+    failed += RunCase(cases[i]);
+  }
+  return failed ? 1 : 0;
+}
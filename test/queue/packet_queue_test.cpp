@@ -0,0 +1,205 @@
+/****************************************************************************************
+ * Copyright (C) 2021 aistream <aistream@yeah.net>
+ *
+ * Licensed under the BSD 3-Clause License (the "License"); you may not use this
+ * file except in compliance with the License. You may obtain a copy of the License at
+ *
+ * https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Unless required by applicable law or agreed to in writing, software distributed
+ * under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+ * CONDITIONS OF ANY KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations under the License.
+ *
+ ***************************************************************************************/
+
+// Test of PacketQueue between elements: a producer run by executor parked
+// on a full QUEUE_BLOCK edge across several timeouts, and a consumer primed
+// by the gop cache when it subscribes during the start of a shared stage,
+// and queue_len raised in place up to the slots reserved
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <memory>
+#include <vector>
+#include "tensor.h"
+#include "log.h"
+
+static int verbose = 0;
+
+void LogWrite(LogSite* site, int level, const char* file, int line,
+              const char* func, const char* format, ...) {
+  if (!verbose) {
+    return;
+  }
+  va_list args;
+  va_start(args, format);
+  fprintf(stderr, "[%s:%d] ", file, line);
+  vfprintf(stderr, format, args);
+  fprintf(stderr, "\n");
+  va_end(args);
+}
+
+class Unit : public QueueListener {
+ public:
+  Unit(void) : woken(0) {}
+  void OnPush(void) {
+    woken ++;
+  }
+  int woken;
+};
+
+static int failed = 0;
+
+#define CHECK(name, cond) do { \
+    if (!(cond)) { \
+      printf("%s: %s failed at line %d\n", name, #cond, __LINE__); \
+      failed ++; \
+    } \
+  } while (0)
+
+static std::shared_ptr<Packet> NewPacket(int frame_id, bool key_frame) {
+  HeadParams params = {0};
+  params.frame_id = frame_id;
+  params.key_frame = key_frame;
+  char data[16] = {0};
+  return std::make_shared<Packet>(data, sizeof(data), &params);
+}
+
+static std::shared_ptr<PacketQueue> BlockQueue(int timeout_ms) {
+  auto queue = std::make_shared<PacketQueue>();
+  queue->policy = QUEUE_BLOCK;
+  queue->timeout_ms = timeout_ms;
+  return queue;
+}
+
+// the edge stays full, every held packet waits timeout_ms of its own
+static void TestParkTimeouts(void) {
+  const char* name = "park_timeouts";
+  int before = failed;
+  using ms = std::chrono::milliseconds;
+  const size_t limit = 2;
+  auto queue = BlockQueue(50);
+  std::vector<std::shared_ptr<PacketQueue>> outputs = {queue};
+  auto unit = std::make_shared<Unit>();
+  std::chrono::steady_clock::time_point start, wake;
+  auto t0 = std::chrono::steady_clock::now();
+  int id = 0;
+  for (size_t i = 0; i < limit; i ++) {
+    CHECK(name, queue->Send(NewPacket(id ++, false), limit, false));
+  }
+  // the first packet
+  CHECK(name, ParkOutputs(outputs, limit, unit, t0, &start, &wake));
+  CHECK(name, start == t0 && wake == t0 + ms(50));
+  CHECK(name, ParkOutputs(outputs, limit, unit, t0 + ms(20), &start, &wake));
+  CHECK(name, start == t0 && wake == t0 + ms(50));
+  CHECK(name, !ParkOutputs(outputs, limit, unit, t0 + ms(55), &start, &wake));
+  CHECK(name, start == std::chrono::steady_clock::time_point());
+  CHECK(name, !queue->Send(NewPacket(id ++, false), limit, false));
+  // the second one is not dropped at once by the deadline of the first
+  CHECK(name, ParkOutputs(outputs, limit, unit, t0 + ms(56), &start, &wake));
+  CHECK(name, start == t0 + ms(56) && wake == t0 + ms(106));
+  CHECK(name, ParkOutputs(outputs, limit, unit, t0 + ms(100), &start, &wake));
+  CHECK(name, !ParkOutputs(outputs, limit, unit, t0 + ms(110), &start, &wake));
+  CHECK(name, !queue->Send(NewPacket(id ++, false), limit, false));
+  CHECK(name, queue->dropped == 2 && queue->Size() == limit);
+  // the third one is taken by a pop before its timeout
+  CHECK(name, ParkOutputs(outputs, limit, unit, t0 + ms(111), &start, &wake));
+  std::shared_ptr<Packet> pkt;
+  CHECK(name, queue->TryPop(pkt) && pkt->_params.frame_id == 0);
+  CHECK(name, unit->woken == 1);
+  CHECK(name, !ParkOutputs(outputs, limit, unit, t0 + ms(112), &start, &wake));
+  CHECK(name, start == std::chrono::steady_clock::time_point());
+  CHECK(name, queue->Send(NewPacket(id ++, false), limit, false));
+  printf("%s: %s\n", name, failed > before ? "FAILED" : "ok");
+}
+
+// two full edges, the unit is woken at the earlier deadline, then waits
+// on the other one with the same start
+static void TestParkTwoEdges(void) {
+  const char* name = "park_two_edges";
+  int before = failed;
+  using ms = std::chrono::milliseconds;
+  const size_t limit = 1;
+  auto fast = BlockQueue(50);
+  auto slow = BlockQueue(200);
+  std::vector<std::shared_ptr<PacketQueue>> outputs = {fast, slow};
+  auto unit = std::make_shared<Unit>();
+  std::chrono::steady_clock::time_point start, wake;
+  auto t0 = std::chrono::steady_clock::now();
+  CHECK(name, fast->Send(NewPacket(0, false), limit, false));
+  CHECK(name, slow->Send(NewPacket(0, false), limit, false));
+  CHECK(name, ParkOutputs(outputs, limit, unit, t0, &start, &wake));
+  CHECK(name, wake == t0 + ms(50));
+  CHECK(name, ParkOutputs(outputs, limit, unit, t0 + ms(60), &start, &wake));
+  CHECK(name, start == t0 && wake == t0 + ms(200));
+  CHECK(name, !ParkOutputs(outputs, limit, unit, t0 + ms(200), &start, &wake));
+  CHECK(name, start == std::chrono::steady_clock::time_point());
+  printf("%s: %s\n", name, failed > before ? "FAILED" : "ok");
+}
+
+// Subscribe primes the new queue before the thread of the stage reaches
+// its prime loop, the cached gop is queued once and not sent again
+static void TestPrimeOnce(void) {
+  const char* name = "prime_once";
+  int before = failed;
+  const size_t limit = 10;
+  int writer = 0;
+  GopCache cache(1 << 20);
+  for (int id = 0; id < 3; id ++) {
+    cache.Put(NewPacket(id, id == 0), &writer);
+  }
+  auto queue = std::make_shared<PacketQueue>();
+  // Subscribe
+  CHECK(name, cache.Prime(queue.get(), limit) == 3);
+  // the prime loop over all outputs at the start of the stage
+  CHECK(name, cache.Prime(queue.get(), limit) == 0);
+  CHECK(name, queue->extra == 3 && queue->primed_first == 0 && queue->primed_last == 2);
+  // the first packets sent by the stage are those in the cache
+  for (int id = 0; id < 5; id ++) {
+    CHECK(name, queue->Send(NewPacket(id, id == 0), limit));
+  }
+  std::shared_ptr<Packet> pkt;
+  for (int id = 0; id < 5; id ++) {
+    CHECK(name, queue->TryPop(pkt) && pkt->_params.frame_id == id);
+  }
+  CHECK(name, !queue->TryPop(pkt));
+  printf("%s: %s\n", name, failed > before ? "FAILED" : "ok");
+}
+
+// the ring is allocated by the first push with the slots reserved by the
+// consumer, a larger queue_len of later pushes is applied up to them
+static void TestReserve(void) {
+  const char* name = "reserve";
+  int before = failed;
+  auto queue = std::make_shared<PacketQueue>();
+  queue->reserve = 200;
+  int id = 0;
+  CHECK(name, queue->Send(NewPacket(id ++, false), 10));
+  CHECK(name, queue->Capacity() >= 200 && queue->Limit() == 10);
+  while (queue->Size() < 10) {
+    queue->Send(NewPacket(id ++, false), 10);
+  }
+  for (int i = 0; i < 190; i ++) {
+    CHECK(name, queue->Send(NewPacket(id ++, false), 200));
+  }
+  CHECK(name, queue->Size() == 200 && queue->dropped == 0);
+  // without reserve the capacity is decided by the first queue_len
+  auto small = std::make_shared<PacketQueue>();
+  CHECK(name, small->Send(NewPacket(0, false), 10));
+  CHECK(name, small->Capacity() < 200);
+  printf("%s: %s\n", name, failed > before ? "FAILED" : "ok");
+}
+
+int main(int argc, char** argv) {
+  verbose = argc > 1 && !strcmp(argv[1], "-v");
+  BufferPoolInit(64 << 20);
+  TestParkTimeouts();
+  TestParkTwoEdges();
+  TestPrimeOnce();
+  TestReserve();
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,570 @@
+/****************************************************************************************
+ * Copyright (C) 2021 aistream <aistream@yeah.net>
+ *
+ * Licensed under the BSD 3-Clause License (the "License"); you may not use this
+ * file except in compliance with the License. You may obtain a copy of the License at
+ *
+ * https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Unless required by applicable law or agreed to in writing, software distributed
+ * under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+ * CONDITIONS OF ANY KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations under the License.
+ *
+ ***************************************************************************************/
+
+// Loopback test of RtspClient, a camera is served by a thread of this process:
+// digest authentication with a stale nonce, DESCRIBE/SETUP/PLAY over tcp
+// interleaved and udp, STAP-A/FU-A of h264 and AP/FU of h265, a fragment lost
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <event2/thread.h>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "rtsp_client.h"
+#include "bufpool.h"
+#include "log.h"
+
+#define TEST_USER "admin"
+#define TEST_PASSWORD "p@ss"
+#define TEST_REALM "cam"
+#define TEST_TIMEOUT_MS 5000
+
+static int verbose = 0;
+
+void LogWrite(LogSite* site, int level, const char* file, int line,
+              const char* func, const char* format, ...) {
+  if (!verbose) {
+    return;
+  }
+  va_list args;
+  va_start(args, format);
+  fprintf(stderr, "[%s:%d] ", file, line);
+  vfprintf(stderr, format, args);
+  fprintf(stderr, "\n");
+  va_end(args);
+}
+
+void LibevntInit(void) {
+  evthread_use_pthreads();
+}
+
+static std::string Md5Hex(const std::string& in) {
+  static const uint32_t k[64] = {
+    0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+    0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be, 0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+    0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+    0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+    0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c, 0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+    0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+    0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+    0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1, 0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391,
+  };
+  static const int r[16] = {7, 12, 17, 22, 5, 9, 14, 20, 4, 11, 16, 23, 6, 10, 15, 21};
+  uint32_t h[4] = {0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476};
+  std::string msg = in;
+  uint64_t bits = (uint64_t)in.size() * 8;
+  msg += (char)0x80;
+  while (msg.size() % 64 != 56) {
+    msg += (char)0;
+  }
+  for (int i = 0; i < 8; i ++) {
+    msg += (char)((bits >> (i * 8)) & 0xff);
+  }
+  for (size_t off = 0; off < msg.size(); off += 64) {
+    const uint8_t* p = (const uint8_t* )msg.data() + off;
+    uint32_t a = h[0], b = h[1], c = h[2], d = h[3];
+    for (int i = 0; i < 64; i ++) {
+      uint32_t f;
+      int g;
+      if (i < 16) {
+        f = (b & c) | (~b & d);
+        g = i;
+      } else if (i < 32) {
+        f = (d & b) | (~d & c);
+        g = (5 * i + 1) % 16;
+      } else if (i < 48) {
+        f = b ^ c ^ d;
+        g = (3 * i + 5) % 16;
+      } else {
+        f = c ^ (b | ~d);
+        g = (7 * i) % 16;
+      }
+      uint32_t w = p[g * 4] | (p[g * 4 + 1] << 8) | (p[g * 4 + 2] << 16) | ((uint32_t)p[g * 4 + 3] << 24);
+      uint32_t x = a + f + k[i] + w;
+      int s = r[(i / 16) * 4 + i % 4];
+      a = d;
+      d = c;
+      c = b;
+      b = b + ((x << s) | (x >> (32 - s)));
+    }
+    h[0] += a;
+    h[1] += b;
+    h[2] += c;
+    h[3] += d;
+  }
+  char out[33];
+  for (int i = 0; i < 16; i ++) {
+    snprintf(out + i * 2, 3, "%02x", (h[i / 4] >> ((i % 4) * 8)) & 0xff);
+  }
+  return std::string(out, 32);
+}
+
+static std::string Base64Encode(const std::string& in) {
+  static const char* table = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  std::string out;
+  for (size_t i = 0; i < in.size(); i += 3) {
+    uint32_t v = (uint8_t)in[i] << 16;
+    v |= i + 1 < in.size() ? (uint8_t)in[i + 1] << 8 : 0;
+    v |= i + 2 < in.size() ? (uint8_t)in[i + 2] : 0;
+    out += table[(v >> 18) & 0x3f];
+    out += table[(v >> 12) & 0x3f];
+    out += i + 1 < in.size() ? table[(v >> 6) & 0x3f] : '=';
+    out += i + 2 < in.size() ? table[v & 0x3f] : '=';
+  }
+  return out;
+}
+
+static std::string HeaderValue(const std::string& head, const char* key) {
+  size_t pos = 0;
+  size_t len = strlen(key);
+  while ((pos = head.find("\r\n", pos)) != std::string::npos) {
+    pos += 2;
+    if (!strncasecmp(head.c_str() + pos, key, len) && head[pos + len] == ':') {
+      size_t begin = head.find_first_not_of(' ', pos + len + 1);
+      return head.substr(begin, head.find("\r\n", begin) - begin);
+    }
+  }
+  return "";
+}
+
+static std::string AuthParam(const std::string& value, const char* key) {
+  std::string pattern = std::string(key) + "=";
+  size_t pos = 0;
+  while ((pos = value.find(pattern, pos)) != std::string::npos) {
+    if (pos == 0 || value[pos - 1] == ' ' || value[pos - 1] == ',') {
+      break;
+    }
+    pos += pattern.size();
+  }
+  if (pos == std::string::npos) {
+    return "";
+  }
+  pos += pattern.size();
+  if (value[pos] == '"') {
+    return value.substr(pos + 1, value.find('"', pos + 1) - pos - 1);
+  }
+  return value.substr(pos, value.find_first_of(", ", pos) - pos);
+}
+
+static std::string Pattern(uint8_t seed, size_t size) {
+  std::string data(size, 0);
+  uint32_t v = seed;
+  for (size_t i = 0; i < size; i ++) {
+    v = v * 1103515245 + 12345;
+    data[i] = (char)(v >> 16);
+  }
+  return data;
+}
+
+// A camera answering a single session, the expected nal units are recorded
+// in the order the client should deliver them
+class TestCamera {
+ public:
+  TestCamera(bool _h265) : h265(_h265), fd(-1), conn(-1), udp_fd(-1), port(0), seq(65530),
+    auth_errors(0) {
+  }
+  ~TestCamera(void) {
+    if (thread.joinable()) {
+      thread.join();
+    }
+    if (fd >= 0) {
+      close(fd);
+    }
+  }
+  int Start(void) {
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+    if (fd < 0 || bind(fd, (struct sockaddr* )&addr, len) != 0 || listen(fd, 1) != 0 ||
+        getsockname(fd, (struct sockaddr* )&addr, &len) != 0) {
+      return -1;
+    }
+    port = ntohs(addr.sin_port);
+    thread = std::thread(&TestCamera::Serve, this);
+    return 0;
+  }
+  std::string Url(void) {
+    return "rtsp://" TEST_USER ":p%40ss@127.0.0.1:" + std::to_string(port) + "/live";
+  }
+  bool h265;
+  int fd;
+  int conn;
+  int udp_fd;
+  int port;
+  uint16_t seq;
+  struct sockaddr_in udp_addr;
+  std::string nonce;
+  int auth_errors;
+  std::vector<std::string> methods;
+  std::vector<std::string> expected;
+  std::thread thread;
+ private:
+  void Serve(void) {
+    struct pollfd pfd = {fd, POLLIN, 0};
+    if (poll(&pfd, 1, TEST_TIMEOUT_MS) != 1 || (conn = accept(fd, NULL, NULL)) < 0) {
+      return;
+    }
+    std::string input;
+    char buf[4096];
+    for (;;) {
+      size_t end = input.find("\r\n\r\n");
+      if (end == std::string::npos) {
+        pfd = {conn, POLLIN, 0};
+        ssize_t n = poll(&pfd, 1, TEST_TIMEOUT_MS) == 1 ? recv(conn, buf, sizeof(buf), 0) : 0;
+        if (n <= 0) {
+          break;
+        }
+        input.append(buf, n);
+        continue;
+      }
+      std::string head = input.substr(0, end + 2);
+      input.erase(0, end + 4);
+      Answer(head);
+    }
+    close(conn);
+    if (udp_fd >= 0) {
+      close(udp_fd);
+    }
+  }
+  void Reply(const std::string& cseq, const char* status, const std::string& headers,
+             const std::string& body = "") {
+    std::string reply = std::string("RTSP/1.0 ") + status + "\r\nCSeq: " + cseq + "\r\n" + headers;
+    if (!body.empty()) {
+      reply += "Content-Length: " + std::to_string(body.size()) + "\r\n";
+    }
+    reply += "\r\n" + body;
+    send(conn, reply.data(), reply.size(), MSG_NOSIGNAL);
+  }
+  std::string Challenge(bool stale) {
+    nonce = Md5Hex(std::to_string(rand())).substr(0, 12);
+    return "WWW-Authenticate: Basic realm=\"" TEST_REALM "\"\r\n"
+           "WWW-Authenticate: Digest realm=\"" TEST_REALM "\", nonce=\"" + nonce +
+           "\", qop=\"auth\", opaque=\"xyz\"" + (stale ? ", stale=TRUE" : "") + "\r\n";
+  }
+  // the first authorized request is answered with a stale nonce
+  bool Authorized(const std::string& method, const std::string& cseq, const std::string& head) {
+    std::string value = HeaderValue(head, "Authorization");
+    if (strncmp(value.c_str(), "Digest ", 7)) {
+      Reply(cseq, "401 Unauthorized", Challenge(false));
+      return false;
+    }
+    std::string ha1 = Md5Hex(TEST_USER ":" TEST_REALM ":" TEST_PASSWORD);
+    std::string ha2 = Md5Hex(method + ":" + AuthParam(value, "uri"));
+    std::string response = Md5Hex(ha1 + ":" + AuthParam(value, "nonce") + ":" + AuthParam(value, "nc") +
+                                  ":" + AuthParam(value, "cnonce") + ":auth:" + ha2);
+    if (AuthParam(value, "username") != TEST_USER || AuthParam(value, "opaque") != "xyz" ||
+        AuthParam(value, "response") != response) {
+      auth_errors ++;
+      Reply(cseq, "403 Forbidden", "");
+      return false;
+    }
+    if (methods.empty()) {
+      methods.push_back("stale");
+      Reply(cseq, "401 Unauthorized", Challenge(true));
+      return false;
+    }
+    if (AuthParam(value, "nonce") != nonce) {
+      auth_errors ++;
+      Reply(cseq, "403 Forbidden", "");
+      return false;
+    }
+    return true;
+  }
+  void Answer(const std::string& head) {
+    std::string method = head.substr(0, head.find(' '));
+    std::string cseq = HeaderValue(head, "CSeq");
+    if (!Authorized(method, cseq, head)) {
+      return;
+    }
+    methods.push_back(method);
+    std::string base = "rtsp://127.0.0.1:" + std::to_string(port) + "/live/";
+    if (method == "DESCRIBE") {
+      Reply(cseq, "200 OK", "Content-Base: " + base + "\r\nContent-Type: application/sdp\r\n", Sdp());
+    } else if (method == "SETUP") {
+      std::string transport = HeaderValue(head, "Transport");
+      size_t pos = transport.find("client_port=");
+      if (pos != std::string::npos) {
+        udp_fd = socket(AF_INET, SOCK_DGRAM, 0);
+        memset(&udp_addr, 0, sizeof(udp_addr));
+        udp_addr.sin_family = AF_INET;
+        udp_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        udp_addr.sin_port = htons(atoi(transport.c_str() + pos + 12));
+      }
+      Reply(cseq, "200 OK", "Session: 12345678;timeout=60\r\nTransport: " + transport + "\r\n");
+    } else if (method == "PLAY") {
+      Reply(cseq, "200 OK", "Session: 12345678\r\n");
+      Stream();
+    } else if (method != "TEARDOWN") {
+      Reply(cseq, "501 Not Implemented", "");
+    }
+  }
+  std::string Sdp(void) {
+    std::string sdp = "v=0\r\no=- 0 0 IN IP4 127.0.0.1\r\ns=test\r\nt=0 0\r\n";
+    if (h265) {
+      // the video is not the first track
+      sdp += "m=audio 0 RTP/AVP 0\r\na=control:trackID=0\r\n"
+             "m=video 0 RTP/AVP 98\r\na=rtpmap:98 H265/90000\r\n"
+             "a=fmtp:98 sprop-vps=" + Base64Encode(Vps()) + "; sprop-sps=" + Base64Encode(Sps()) +
+             "; sprop-pps=" + Base64Encode(Pps()) + "\r\na=control:trackID=1\r\n";
+    } else {
+      sdp += "m=video 0 RTP/AVP 96\r\na=rtpmap:96 H264/90000\r\n"
+             "a=fmtp:96 packetization-mode=1;profile-level-id=42001e;sprop-parameter-sets=" +
+             Base64Encode(Sps()) + "," + Base64Encode(Pps()) + "\r\na=control:trackID=1\r\n";
+    }
+    return sdp;
+  }
+  std::string Vps(void) {
+    return std::string("\x40\x01\x0c\x01\xff", 5);
+  }
+  std::string Sps(void) {
+    return h265 ? std::string("\x42\x01\x01\x01\x60", 5) :
+                  std::string("\x67\x42\x00\x1e\x95\xa8\x28\x0f\x69\xb8\x08\x08\x08\x10", 14);
+  }
+  std::string Pps(void) {
+    return h265 ? std::string("\x44\x01\xc1\x72", 4) : std::string("\x68\xce\x3c\x80", 4);
+  }
+  // nal header of type, with the payload of the pattern
+  std::string Nal(int type, uint8_t seed, size_t size) {
+    std::string header = h265 ? std::string{(char)(type << 1), 1} : std::string(1, (char)(0x60 | type));
+    return header + Pattern(seed, size);
+  }
+  void Rtp(const std::string& payload, uint32_t ts, bool lost = false) {
+    seq ++;
+    if (lost) {
+      return;
+    }
+    std::string pkt(12, 0);
+    pkt[0] = (char)0x80;
+    pkt[1] = (char)(0x80 | (h265 ? 98 : 96));
+    pkt[2] = (char)(seq >> 8);
+    pkt[3] = (char)seq;
+    for (int i = 0; i < 4; i ++) {
+      pkt[4 + i] = (char)(ts >> (24 - i * 8));
+    }
+    pkt[8] = 0x12;
+    pkt[9] = 0x34;
+    pkt += payload;
+    if (udp_fd >= 0) {
+      sendto(udp_fd, pkt.data(), pkt.size(), 0, (struct sockaddr* )&udp_addr, sizeof(udp_addr));
+      // the loopback queue of the client is not overrun
+      usleep(100);
+      return;
+    }
+    std::string frame = std::string("$") + (char)0 + (char)(pkt.size() >> 8) + (char)pkt.size() + pkt;
+    send(conn, frame.data(), frame.size(), MSG_NOSIGNAL);
+  }
+  // STAP-A of h264 or AP of h265
+  void Aggregate(const std::vector<std::string>& nals, uint32_t ts) {
+    std::string payload = h265 ? std::string{(char)(48 << 1), 1} : std::string(1, (char)24);
+    for (auto& nal : nals) {
+      payload += (char)(nal.size() >> 8);
+      payload += (char)nal.size();
+      payload += nal;
+      expected.push_back(nal);
+    }
+    Rtp(payload, ts);
+  }
+  // FU-A of h264 or FU of h265, the second fragment is not sent if lost
+  void Fragment(const std::string& nal, uint32_t ts, bool lost) {
+    size_t header_size = h265 ? 2 : 1;
+    std::string header;
+    int type;
+    if (h265) {
+      header = std::string{(char)((nal[0] & 0x81) | (49 << 1)), nal[1]};
+      type = (nal[0] >> 1) & 0x3f;
+    } else {
+      header = std::string(1, (char)((nal[0] & 0xe0) | 28));
+      type = nal[0] & 0x1f;
+    }
+    const size_t mtu = 1400;
+    for (size_t off = header_size; off < nal.size(); off += mtu) {
+      int flags = (off == header_size ? 0x80 : 0) | (off + mtu >= nal.size() ? 0x40 : 0);
+      Rtp(header + (char)(flags | type) + nal.substr(off, mtu), ts, lost && off == header_size + mtu);
+    }
+    if (!lost) {
+      expected.push_back(nal);
+    }
+  }
+  void Stream(void) {
+    expected.clear();
+    if (h265) {
+      expected.push_back(Vps());
+    }
+    expected.push_back(Sps());
+    expected.push_back(Pps());
+    // the sequence number and the timestamp wrap in the stream
+    uint32_t ts = 0xffffffff - 3000;
+    for (int frame = 0; frame < 3; frame ++) {
+      if (h265) {
+        Aggregate({Nal(1, frame, 100), Nal(1, frame + 10, 50)}, ts);
+        Fragment(Nal(19, frame + 20, 5000), ts + 1000, frame == 1);
+        Fragment(Nal(1, frame + 30, 20000), ts + 2000, false);
+      } else {
+        Aggregate({Nal(6, frame, 20), Nal(1, frame + 10, 30)}, ts);
+        Fragment(Nal(5, frame + 20, 5000), ts + 1000, frame == 1);
+        Fragment(Nal(1, frame + 30, 20000), ts + 2000, false);
+      }
+      std::string single = Nal(1, frame + 40, 200);
+      Rtp(single, ts + 2500);
+      expected.push_back(single);
+      if (udp_fd < 0) {
+        // rtcp on the second channel is skipped
+        send(conn, "$\x01\x00\x04" "abcd", 8, MSG_NOSIGNAL);
+      }
+      ts += 3000;
+    }
+  }
+};
+
+typedef struct {
+  std::mutex mtx;
+  std::condition_variable cond;
+  std::vector<std::string> nals;
+  std::vector<int64_t> pts;
+  int errors;
+} TestSink;
+
+static void OnNal(const RtspNal* nal, void* arg) {
+  TestSink* sink = (TestSink* )arg;
+  const char* data = nal->buf.get();
+  std::lock_guard<std::mutex> lock(sink->mtx);
+  if (nal->size < 5 || memcmp(data, "\x00\x00\x00\x01", 4)) {
+    sink->errors ++;
+  } else {
+    sink->nals.push_back(std::string(data + 4, nal->size - 4));
+    sink->pts.push_back(nal->pts);
+  }
+  sink->cond.notify_all();
+}
+
+static int RunCase(ReactorLoop* loop, bool h265, bool tcp) {
+  const char* name = h265 ? (tcp ? "h265 tcp" : "h265 udp") : (tcp ? "h264 tcp" : "h264 udp");
+  TestCamera camera(h265);
+  if (camera.Start() != 0) {
+    printf("%s: camera start failed\n", name);
+    return 1;
+  }
+  TestSink sink;
+  sink.errors = 0;
+  std::string url = camera.Url();
+  RtspClient client(loop, url.c_str(), tcp, OnNal, &sink);
+  if (client.Start() != 0) {
+    printf("%s: client start failed\n", name);
+    return 1;
+  }
+  {
+    // the expected list is complete once the camera has streamed, before
+    // the last nal is delivered
+    std::unique_lock<std::mutex> lock(sink.mtx);
+    sink.cond.wait_for(lock, std::chrono::milliseconds(TEST_TIMEOUT_MS), [&] {
+      return sink.nals.size() >= 2 + 3 * 5 - 1 + (h265 ? 1 : 0);
+    });
+  }
+  client.Stop();
+  camera.thread.join();
+  int failed = 0;
+  if (camera.auth_errors > 0) {
+    printf("%s: %d requests with bad digest\n", name, camera.auth_errors);
+    failed ++;
+  }
+  std::vector<std::string> methods = {"stale", "DESCRIBE", "SETUP", "PLAY", "TEARDOWN"};
+  if (camera.methods != methods) {
+    std::string seen;
+    for (auto& method : camera.methods) {
+      seen += " " + method;
+    }
+    printf("%s: unexpected requests,%s\n", name, seen.c_str());
+    failed ++;
+  }
+  if (sink.errors > 0) {
+    printf("%s: %d nal without start code\n", name, sink.errors);
+    failed ++;
+  }
+  if (sink.nals.size() != camera.expected.size()) {
+    printf("%s: %zu nal received, %zu expected\n", name, sink.nals.size(), camera.expected.size());
+    failed ++;
+  }
+  for (size_t i = 0; i < sink.nals.size() && i < camera.expected.size(); i ++) {
+    if (sink.nals[i] != camera.expected[i]) {
+      printf("%s: nal %zu differs, size %zu, %zu expected\n", name, i, sink.nals[i].size(),
+             camera.expected[i].size());
+      failed ++;
+      break;
+    }
+  }
+  for (size_t i = 1; i < sink.pts.size(); i ++) {
+    if (sink.pts[i] < sink.pts[i - 1]) {
+      printf("%s: pts %zu goes back across the wrap\n", name, i);
+      failed ++;
+      break;
+    }
+  }
+  printf("%s: %s\n", name, failed ? "FAILED" : "ok");
+  return failed ? 1 : 0;
+}
+
+// Stop right after Start, the connect queued on the loop must not run on
+// the deleted client
+static int RunStopEarly(ReactorLoop* loop) {
+  const char* name = "stop early";
+  TestSink sink;
+  sink.errors = 0;
+  for (int i = 0; i < 100; i ++) {
+    RtspClient* client = new RtspClient(loop, "rtsp://127.0.0.1:1/none", true, OnNal, &sink);
+    if (client->Start() != 0) {
+      printf("%s: client start failed\n", name);
+      delete client;
+      return 1;
+    }
+    client->Stop();
+    delete client;
+  }
+  // the queued connects have run once this does
+  Reactor::Run(loop, [] {}, true);
+  bool failed = sink.errors > 0 || !sink.nals.empty();
+  printf("%s: %s\n", name, failed ? "FAILED" : "ok");
+  return failed ? 1 : 0;
+}
+
+int main(int argc, char** argv) {
+  verbose = argc > 1 && !strcmp(argv[1], "-v");
+  BufferPoolInit(64 << 20);
+  Reactor reactor;
+  if (reactor.Start(1) != 0) {
+    return 1;
+  }
+  int failed = 0;
+  failed += RunCase(reactor.GetLoop(), false, true);
+  failed += RunCase(reactor.GetLoop(), false, false);
+  failed += RunCase(reactor.GetLoop(), true, true);
+  failed += RunCase(reactor.GetLoop(), true, false);
+  failed += RunStopEarly(reactor.GetLoop());
+  reactor.Stop();
+  return failed ? 1 : 0;
+}
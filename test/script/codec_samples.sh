@@ -0,0 +1,28 @@
+#!/bin/sh
+# h264 and h265 samples of ffmpeg lavfi, annex-b with parameter sets at every
+# key frame, h265 of open gop has cra besides idr. used by test/codec and
+# codec_test.sh, nothing is made without ffmpeg of libx264 and libx265
+# usage: codec_samples.sh dir
+
+dir=${1:-samples/codec}
+
+if ! command -v ffmpeg >/dev/null 2>&1; then
+    echo "ffmpeg not found, no samples in $dir"
+    exit 0
+fi
+encoders=$(ffmpeg -hide_banner -encoders 2>/dev/null)
+for enc in libx264 libx265; do
+    if ! echo "$encoders" | grep -q " $enc "; then
+        echo "ffmpeg has no $enc, no samples in $dir"
+        exit 0
+    fi
+done
+mkdir -p $dir
+ffmpeg -y -loglevel error -f lavfi -i testsrc=size=320x240:rate=25 -frames:v 60 \
+    -pix_fmt yuv420p -c:v libx264 -bf 0 \
+    -x264-params keyint=25:min-keyint=25:scenecut=0:repeat-headers=1 \
+    -f h264 $dir/test.264 || exit 1
+ffmpeg -y -loglevel error -f lavfi -i testsrc=size=352x288:rate=25 -frames:v 60 \
+    -pix_fmt yuv420p -c:v libx265 \
+    -x265-params keyint=25:min-keyint=25:scenecut=0:open-gop=1:bframes=0:repeat-headers=1:log-level=error \
+    -f hevc $dir/test.265 || exit 1
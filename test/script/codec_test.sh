@@ -0,0 +1,89 @@
+#!/bin/sh
+# h264 and h265 samples through rtsp and rtmp ingest and both cpu decoders of
+# a running aistream. like test.sh it takes a rtsp server at 8554 and a rtmp
+# server at 1935, e.g. mediamtx, h265 over rtmp needs enhanced flv of ffmpeg
+# 6.1 or later. the codec is switched on the same path to rebuild the
+# decoders, results are read from the log of aistream
+# usage: codec_test.sh [log/aistream.log]
+
+log=${1:-log/aistream.log}
+dir=/tmp/aistream_codec
+api=http://127.0.0.1:15515/api
+failed=0
+pids=""
+
+sh $(dirname $0)/codec_samples.sh $dir || exit 1
+if [ ! -e $dir/test.264 ] || [ ! -e $log ]; then
+    echo "no samples or no log of aistream"
+    exit 1
+fi
+
+# sample, format of it
+publish() {
+    ffmpeg -loglevel error -re -stream_loop -1 -fflags +genpts -f $2 -framerate 25 -i $1 \
+        -c copy -f rtsp -rtsp_transport tcp rtsp://127.0.0.1:8554/codec &
+    pids="$pids $!"
+    ffmpeg -loglevel error -re -stream_loop -1 -fflags +genpts -f $2 -framerate 25 -i $1 \
+        -c copy -f flv rtmp://127.0.0.1:1935/myapp/codec &
+    pids="$pids $!"
+}
+
+unpublish() {
+    kill $pids 2>/dev/null
+    wait $pids 2>/dev/null
+    pids=""
+}
+
+# id, ingest, task, data of the object
+start() {
+    curl -s -d "{\"id\":$1,\"data\":$4}" $api/obj/add/$2
+    curl -s -d "{\"id\":$1,\"data\":{\"task\":\"$3\"}}" $api/task/start
+}
+
+stop() {
+    curl -s -d "{\"id\":$1,\"data\":{\"task\":\"$2\"}}" $api/task/stop
+    curl -s -d "{\"id\":$1}" $api/obj/del
+}
+
+# lines logged since the test started
+expect() {
+    if tail -c +$offset $log | grep -q "$1"; then
+        echo "ok, $1"
+    else
+        echo "FAILED, $1"
+        failed=1
+    fi
+}
+
+offset=$(($(wc -c < $log) + 1))
+trap unpublish EXIT
+publish $dir/test.264 h264
+sleep 2
+# cpurgbdec by face_capture, cpuyuvdec by face_osd
+start 91 rtsp face_capture "{\"tcp_enable\":1,\"url\":\"rtsp://127.0.0.1:8554/codec\"}"
+start 92 rtsp face_osd "{\"tcp_enable\":0,\"url\":\"rtsp://127.0.0.1:8554/codec\"}"
+start 93 rtmp face_capture "{\"url\":\"rtmp://127.0.0.1:1935/myapp/codec\"}"
+start 94 rtmp face_osd "{\"url\":\"rtmp://127.0.0.1:1935/myapp/codec\"}"
+sleep 10
+for id in 91 92 93 94; do
+    expect "find IDR ok, id:$id, 320x240"
+done
+
+# the sessions are broken and retried, the decoders are rebuilt for h265
+unpublish
+publish $dir/test.265 hevc
+sleep 15
+for id in 91 92 93 94; do
+    expect "id:$id, video codec 0 -> 1"
+    expect "find IDR ok, id:$id, 352x288"
+done
+
+stop 91 face_capture
+stop 92 face_osd
+stop 93 face_capture
+stop 94 face_osd
+if [ $failed -ne 0 ]; then
+    echo "codec test FAILED"
+    exit 1
+fi
+echo "codec test ok"